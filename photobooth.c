@@ -18,24 +18,38 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <sys/wait.h>
 #include <gst/video/videooverlay.h>
 #include <gst/video/gstvideosink.h>
 #include <gst/app/app.h>
 #include <curl/curl.h>
 #include <X11/Xlib.h>
-#include <json-glib/json-glib.h>
 
-// #ifdef HAVE_LIBCANBERRA
-#include <canberra-gtk.h>
-// #endif
 #include "photobooth.h"
 #include "photoboothwin.h"
 #include "photoboothled.h"
+#include "photoboothraster.h"
+#include "photoboothsheet.h"
+#include "photoboothlayout.h"
+#include "photoboothwriter.h"
+#include "photoboothindex.h"
+#include "photobooththumbs.h"
+#include "photoboothgallery.h"
+#include "photoboothupload.h"
+#include "photoboothbackend.h"
+#include "photoboothweb.h"
+#include "photoboothbridge.h"
+#include "photoboothfsm.h"
+#include "photoboothtrace.h"
+#include "photoboothmetrics.h"
+#include "photoboothui.h"
+#include "photoboothpreload.h"
+#include "photoboothslideshow.h"
+#include "photoboothcue.h"
 
 #include <gio/gio.h>
 #define G_SETTINGS_ENABLE_BACKEND
@@ -45,24 +59,65 @@
 
 typedef struct _PhotoBoothPrivate PhotoBoothPrivate;
 
+typedef enum { NONE, ACK_SOUND, ERROR_SOUND, SOUND_COUNT } sound_t;
+
+/* the backends a photo is still being uploaded to */
+typedef struct
+{
+	guint              remaining;
+	gboolean           failed;
+	gboolean           posted;                    /* a link went to the twitter bridge */
+} PhotoBoothUploadFanout;
+
+/* a guest's upload, waiting for the web variant and, without the photo
+ * in memory, for the writer to publish the file */
+typedef struct
+{
+	PhotoBooth        *pb;
+	guint              number;
+	gchar             *filename;
+	GBytes            *photo;
+	GBytes            *web_photo;
+	gchar             *web_filename;
+} PhotoBoothUploadRequest;
+
 struct _PhotoBoothPrivate
 {
-	PhotoboothState    state;
+	PhotoboothState    state;                     /* written on the main thread, atomic elsewhere */
 	PhotoBoothWindow  *win;
+	PhotoBoothUi      *ui;
 	GstVideoRectangle  video_size;
 
 	GThread           *capture_thread;
-	gulong             video_block_id, photo_block_id, sink_block_id;
+	gulong             video_block_id, photo_block_id;
+	GstElement        *display_selector;          /* in front of video_sink, between the live and the screensaver input */
+	GstPad            *live_pad, *screensaver_pad;
 	gint               state_change_watchdog_timeout_id;
 
 	guint32            countdown;
 	gint               preview_timeout;
 	gulong             preview_timeout_id;
 	gchar             *overlay_image;
+	GdkPixbuf         *overlay_pixbuf;            /* as decoded, scaled to the preview when it's shown */
+	PhotoBoothPreload *preload;
+
+	gchar             *layout_template;
+	gint               layout_shots, layout_spacing, layout_countdown;
+	PhotoBoothLayout  *layout;
+	guint              layout_shot;
+	PhotoBoothFsm     *fsm;
+	gint               photo_buffers;             /* atomic, counted by the photo probe */
+	gint               photo_branches_done;       /* atomic, PHOTO_BRANCH_* flags */
+	guint64            trace_decode, trace_encode, trace_print;
 
 	gchar             *save_path_template;
 	guint              photos_taken, photos_printed;
 	guint              save_filename_count;
+	gchar             *save_filename;
+	PhotoBoothWriter  *writer;
+	PhotoBoothIndex   *photo_index;
+	PhotoBoothThumbnailer *thumbnailer;
+	gint               gallery_cache_size;
 
 	gchar             *printer_backend;
 	gint               print_copies_min, print_copies_default, print_copies_max, print_copies;
@@ -70,41 +125,83 @@ struct _PhotoBoothPrivate
 	gdouble            print_x_offset, print_y_offset;
 	gchar             *print_icc_profile;
 	gint               prints_remaining;
-	GstBuffer         *print_buffer;
+	GstBuffer         *print_buffer;              /* published once per photo by the print appsink */
 	GtkPrintSettings  *printer_settings;
-	GMutex             processing_mutex;
+	gchar             *print_direct_command;
+	GThread           *print_thread;
+	GError            *print_error;
+	gboolean           print_cut_2up;
+	gint               print_cut_2up_hold;
+	guint              print_flush_timeout_id;
+	PhotoBoothSheetPacker *sheet_packer;
+	GPtrArray         *print_sheets;
+	GPtrArray         *print_sheets_queued;       /* waiting for the job in print_sheets to finish */
+	GMutex             processing_mutex;          /* only around changes of the photo and screensaver graphs */
 
 	gint               preview_fps, preview_width, preview_height;
 	gboolean           cam_reeinit_before_snapshot, cam_reeinit_after_snapshot;
 	gboolean           cam_keep_files;
 	gchar             *cam_icc_profile;
 
-	GstElement        *audio_pipeline;
-	GstElement        *audio_playbin;
+	PhotoBoothCue     *countdown_cue;             /* countdown_audio_uri decoded once */
 
-	GstElement        *screensaver_playbin;
+	GstElement        *screensaver_playbin;       /* its own pipeline, PAUSED while not shown */
+	GstElement        *screensaver_bin;
+	guint              screensaver_bus_watch;
+	gint               screensaver_probe_pending;
+	gint64             screensaver_switch_start;
+	PhotoBoothSlideshow *slideshow;               /* instead of the player with screensaver_slideshow */
+	gboolean           screensaver_slideshow;
+	gint               slideshow_hold, slideshow_fade, slideshow_decode_ahead;
 	gboolean           paused_callback_id;
 
 	gchar             *countdown_audio_uri;
 	gchar             *error_sound;
 	gchar             *ack_sound;
+	PhotoBoothCue     *ack_cue, *error_cue;
+	gint               event_sound_latency;       /* ms from the touch to the sound */
+	gint               event_sound_interval;      /* ms, sounds closer than that are dropped */
+	gint64             event_sound_last[SOUND_COUNT], event_sound_lead[SOUND_COUNT];
+	guint              event_sounds_dropped;
 
 	gchar             *screensaver_uri;
 	gint               screensaver_timeout;
 	guint              screensaver_timeout_id;
-	gint64             last_play_pos;
 
 	gint               upload_timeout;
-	gchar             *facebook_put_uri;
-	gchar             *imgur_album_id;
-	gchar             *imgur_access_token;
-	gchar             *imgur_description;
-	GThread           *upload_thread;
+	GPtrArray         *upload_backends;
+	GHashTable        *upload_fanouts;
+	gint               upload_retry_base, upload_retry_max, upload_max_attempts;
+	gint               upload_concurrency;
+	PhotoBoothUploadQueue *upload_queue;
 	GMutex             upload_mutex;
+	GstBuffer         *upload_photo;
+	guint              upload_photo_number;
+	gint               web_max_edge, web_quality;
+	gboolean           web_progressive;
+	PhotoBoothWebEncoder *web_encoder;
 	gchar             *twitter_bridge_host;
 	guint              twitter_bridge_port;
+	gint               twitter_bridge_queue;
+	gboolean           twitter_bridge_ack;
+	PhotoBoothBridge  *twitter_bridge;
 	gboolean           do_flip;
 
+	PhotoBoothMetrics *metrics;
+	gchar             *metrics_address;
+	gint               metrics_port;
+	PhotoBoothHistogram *countdown_to_exposure, *exposure_to_display, *processing_time, *print_time, *upload_time;
+	PhotoBoothHistogram *command_latency;
+	PhotoBoothHistogram *streaming_callback_time, *processing_lock_time;
+	PhotoBoothHistogram *screensaver_switch_time;
+	PhotoBoothHistogram *countdown_audio_offset;
+	PhotoBoothHistogram *touch_to_sound;
+	gint64             snapshot_due;
+	gint64             trigger_time, exposure_time, display_time, print_start_time;
+	gint               preview_frames;
+	gint               metrics_fps_frames;
+	gint64             metrics_fps_time;
+
 	PhotoBoothLed     *led;
 };
 
@@ -121,17 +218,56 @@ struct _PhotoBoothPrivate
 #define PREVIEW_WIDTH 640
 #define PREVIEW_HEIGHT 424
 #define PT_PER_IN 72
-#define IMGUR_UPLOAD_URI "https://api.imgur.com/3/upload"
+#define PRINT_2UP_PAGE_SIZE "w432h576-div2"
+#define DEFAULT_CUT_2UP_HOLD 60
+#define DEFAULT_LAYOUT_SHOTS 3
+#define DEFAULT_LAYOUT_SPACING 24
+#define DEFAULT_LAYOUT_COUNTDOWN 3
+#define WRITER_MAX_QUEUE 4
+#define WRITER_FSYNC_BATCH 4
+#define PHOTO_BRANCH_DISPLAYED 1
+#define PHOTO_BRANCH_SAVED 2
+#define PHOTO_BRANCH_ALL (PHOTO_BRANCH_DISPLAYED | PHOTO_BRANCH_SAVED)
+#define DEFAULT_GALLERY_CACHE_SIZE 64
+#define DEFAULT_UPLOAD_RETRY_BASE 10
+#define DEFAULT_UPLOAD_RETRY_MAX 600
+#define DEFAULT_UPLOAD_MAX_ATTEMPTS 0
+#define DEFAULT_UPLOAD_CONCURRENCY 2
+#define DEFAULT_WEB_MAX_EDGE 2048
+#define DEFAULT_WEB_QUALITY 85
+#define DEFAULT_WEB_PROGRESSIVE TRUE
 #define DEFAULT_TWITTER_BRIDGE_HOST NULL
 #define DEFAULT_TWITTER_BRIDGE_PORT 0
+#define DEFAULT_TWITTER_BRIDGE_QUEUE 32
+#define DEFAULT_TWITTER_BRIDGE_ACK FALSE
+#define DEFAULT_METRICS_PORT 0
+#define STARTUP_TARGET (2 * G_USEC_PER_SEC)
+#define SCREENSAVER_PRELOAD_BYTES (32 * 1024 * 1024)
+#define SCREENSAVER_CHANNEL "photobooth-screensaver"
+#define SCREENSAVER_SWITCH_TARGET (100 * 1000)
+#define DEFAULT_SLIDESHOW_HOLD 6
+#define DEFAULT_SLIDESHOW_FADE 1000
+#define DEFAULT_SLIDESHOW_DECODE_AHEAD 3
+#define DEFAULT_EVENT_SOUND_LATENCY 40
+#define DEFAULT_EVENT_SOUND_INTERVAL 150
+#define EVENT_SOUND_LATE (10 * 1000)
+
+typedef struct
+{
+	gchar             *label;
+	gint               remaining;
+} PhotoBoothPrinterStatus;
 
-typedef enum { NONE, ACK_SOUND, ERROR_SOUND } sound_t;
+/* the widgets other threads change, through priv->ui */
+typedef enum { UI_STATUS, UI_STATUS_UPLOAD, UI_SPINNER, UI_PREVIEW, UI_N_SLOTS } PhotoBoothUiSlot;
 
 G_DEFINE_TYPE_WITH_PRIVATE (PhotoBooth, photo_booth, GTK_TYPE_APPLICATION)
 
 GST_DEBUG_CATEGORY_STATIC (photo_booth_debug);
 #define GST_CAT_DEFAULT photo_booth_debug
 
+static GQuark photo_number_quark;
+
 /* GObject / GApplication */
 static void photo_booth_activate (GApplication *app);
 static void photo_booth_open (GApplication *app, GFile **files, gint n_files, const gchar *hint);
@@ -145,11 +281,20 @@ void photo_booth_cancel (PhotoBooth *pb);
 
 /* general private functions */
 const gchar* photo_booth_state_get_name (PhotoboothState state);
-static void photo_booth_change_state (PhotoBooth *pb, PhotoboothState state);
+const gchar* photo_booth_event_get_name (PhotoboothEvent event);
+static void photo_booth_change_state (PhotoBooth *pb, PhotoboothEvent event);
+static void photo_booth_state_entered (gint from, gint to, gint event, gpointer user_data);
 static void photo_booth_quit_signal (PhotoBooth *pb);
+static gboolean photo_booth_trace_signal (PhotoBooth *pb);
+static void photo_booth_metrics_collect (GString *out, gpointer user_data);
+static void photo_booth_command_done (const PhotoBoothCommandReply *reply, gpointer user_data);
+static gboolean photo_booth_reinit_camera (PhotoBooth *pb);
 static void photo_booth_window_destroyed_signal (PhotoBoothWindow *win, PhotoBooth *pb);
 static void photo_booth_setup_window (PhotoBooth *pb);
 static gboolean photo_booth_video_widget_ready (PhotoBooth *pb);
+static GstPadProbeReturn photo_booth_first_frame_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean photo_booth_first_frame (PhotoBooth *pb);
+static void photo_booth_preload_assets (PhotoBooth *pb);
 static gboolean photo_booth_preview (PhotoBooth *pb);
 static gboolean photo_booth_preview_ready (PhotoBooth *pb);
 static void photo_booth_snapshot_start (PhotoBooth *pb);
@@ -174,27 +319,79 @@ static void _gphoto_err(GPLogLevel level, const char *domain, const char *str, v
 static GstElement *build_video_bin (PhotoBooth *pb);
 static GstElement *build_photo_bin (PhotoBooth *pb);
 static gboolean photo_booth_setup_gstreamer (PhotoBooth *pb);
+static void photo_booth_setup_photo_bin (PhotoBooth *pb);
 static gboolean photo_booth_bus_callback (GstBus *bus, GstMessage *message, PhotoBooth *pb);
 static GstPadProbeReturn photo_booth_catch_photo_buffer (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
 static gboolean photo_booth_process_photo_plug_elements (PhotoBooth *pb);
 static GstFlowReturn photo_booth_catch_print_buffer (GstElement * appsink, gpointer user_data);
+static GstFlowReturn photo_booth_catch_file_buffer (GstElement * appsink, gpointer user_data);
+static GstFlowReturn photo_booth_catch_web_buffer (GstElement * appsink, gpointer user_data);
+static void photo_booth_plug_web_elements (PhotoBooth *pb, GstElement *tee);
+static void photo_booth_remove_web_elements (PhotoBooth *pb, GstElement *tee);
+static void photo_booth_photo_published (const gchar *filename, guint number, gpointer user_data);
 static gboolean photo_booth_process_photo_remove_elements (PhotoBooth *pb);
+static void photo_booth_photo_branch_done (PhotoBooth *pb, gint branch);
 static void photo_booth_free_print_buffer (PhotoBooth *pb);
-static GstPadProbeReturn photo_booth_screensaver_unplug_continue (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean photo_booth_setup_screensaver (PhotoBooth *pb);
+static GstPadProbeReturn photo_booth_screensaver_shown (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static void photo_booth_link_display (PhotoBooth *pb, GstElement *bin);
+static void photo_booth_unlink_display (PhotoBooth *pb, GstElement *bin);
 
 /* printing functions */
-static gboolean photo_booth_get_printer_status (PhotoBooth *pb);
+static gboolean photo_booth_refresh_printer_status (PhotoBooth *pb);
+static PhotoBoothPrinterStatus *photo_booth_get_printer_status (PhotoBooth *pb);
+static void photo_booth_printer_status_done (PhotoBoothPrinterStatus *status, PhotoBooth *pb);
+static void photo_booth_printer_status_free (PhotoBoothPrinterStatus *status);
 void photo_booth_button_print_clicked (GtkButton *button, PhotoBoothWindow *win);
+void photo_booth_button_gallery_clicked (GtkButton *button, PhotoBoothWindow *win);
 static void photo_booth_print (PhotoBooth *pb);
 static void photo_booth_begin_print (GtkPrintOperation *operation, GtkPrintContext *context, gpointer user_data);
 static void photo_booth_draw_page (GtkPrintOperation *operation, GtkPrintContext *context, int page_nr, gpointer user_data);
 static void photo_booth_print_done (GtkPrintOperation *operation, GtkPrintOperationResult result, gpointer user_data);
 static void photo_booth_printing_error_dialog (PhotoBoothWindow *window, GError *print_error);
+static void photo_booth_print_sheets (PhotoBooth *pb, GPtrArray *sheets);
+static void photo_booth_print_sheets_done (PhotoBooth *pb, gboolean printed);
+static gboolean photo_booth_print_flush_pending (PhotoBooth *pb);
+static void photo_booth_print_finished (PhotoBooth *pb);
+static void photo_booth_paint_print_buffer (PhotoBooth *pb, cairo_t *cr, GstBuffer *buffer);
+static void photo_booth_paint_sheet (PhotoBooth *pb, cairo_t *cr, PhotoBoothSheet *sheet);
+static cairo_surface_t *photo_booth_render_sheet (PhotoBooth *pb, PhotoBoothSheet *sheet);
+static void photo_booth_print_direct_thread_func (PhotoBooth *pb);
+static gboolean photo_booth_print_direct_done (PhotoBooth *pb);
 
 /* upload functions */
 void photo_booth_button_upload_clicked (GtkButton *button, PhotoBoothWindow *win);
-static void photo_booth_post_thread_func (PhotoBooth *pb);
+static GBytes *photo_booth_buffer_to_bytes (GstBuffer *buffer);
+static void photo_booth_load_upload_backends (PhotoBooth *pb, GKeyFile *gkf);
+static gpointer photo_booth_upload_prepare (CURL *curl, const gchar *target, const gchar *filename, guint number, GBytes *photo, gpointer user_data);
+static PhotoBoothUploadResult photo_booth_upload_finish (CURL *curl, const gchar *target, guint number, CURLcode res, gpointer data, gpointer user_data);
+static void photo_booth_upload_web_ready (GBytes *web_photo, const gchar *web_filename, gpointer user_data);
+static void photo_booth_upload_queue_request (gpointer result, gpointer user_data);
+static void photo_booth_upload_request_free (PhotoBoothUploadRequest *request);
+static void photo_booth_upload_attempted (const gchar *target, guint number, PhotoBoothUploadResult result, guint attempts, gpointer user_data);
 static gboolean photo_booth_upload_timedout (PhotoBooth *pb);
+static void photo_booth_update_upload_status (PhotoBooth *pb);
+static void photo_booth_ui_apply (guint slot, const gchar *text, gint value, gpointer user_data);
+
+/* the booth's flow, every state change goes through here. an event that
+ * has no row for the current state is dropped, which makes late timeouts
+ * and probes from an abandoned session harmless */
+static const PhotoBoothFsmTransition photo_booth_transitions[] = {
+	{ PB_FSM_ANY_STATE,          PB_EVENT_CAMERA_LOST,      PB_STATE_NONE },
+	{ PB_STATE_TAKING_PHOTO,     PB_EVENT_CAPTURE_FAILED,   PB_STATE_NONE },
+	{ PB_FSM_ANY_STATE,          PB_EVENT_PREVIEW_STARTED,  PB_STATE_PREVIEW_COOLDOWN },
+	{ PB_STATE_PREVIEW_COOLDOWN, PB_EVENT_PREVIEW_READY,    PB_STATE_PREVIEW },
+	{ PB_STATE_PREVIEW,          PB_EVENT_SCREENSAVER,      PB_STATE_SCREENSAVER },
+	{ PB_STATE_NONE,             PB_EVENT_SCREENSAVER,      PB_STATE_SCREENSAVER },
+	{ PB_STATE_SCREENSAVER,      PB_EVENT_SCREENSAVER_STOP, PB_STATE_NONE },
+	{ PB_STATE_PREVIEW,          PB_EVENT_COUNTDOWN,        PB_STATE_COUNTDOWN },
+	{ PB_STATE_TAKING_PHOTO,     PB_EVENT_COUNTDOWN,        PB_STATE_COUNTDOWN },   /* next shot of a layout */
+	{ PB_STATE_COUNTDOWN,        PB_EVENT_PRETRIGGER,       PB_STATE_TAKING_PHOTO },
+	{ PB_STATE_TAKING_PHOTO,     PB_EVENT_PHOTO_SHOWN,      PB_STATE_PROCESS_PHOTO },
+	{ PB_STATE_PROCESS_PHOTO,    PB_EVENT_PHOTO_PROCESSED,  PB_STATE_ASK_PRINT },
+	{ PB_STATE_ASK_PRINT,        PB_EVENT_PRINT,            PB_STATE_PRINTING },
+	{ PB_STATE_PRINTING,         PB_EVENT_PRINTED,          PB_STATE_ASK_UPLOAD },
+};
 
 static void photo_booth_class_init (PhotoBoothClass *klass)
 {
@@ -204,6 +401,7 @@ static void photo_booth_class_init (PhotoBoothClass *klass)
 	GST_DEBUG_CATEGORY_INIT (photo_booth_debug, "photobooth", GST_DEBUG_BOLD | GST_DEBUG_FG_YELLOW | GST_DEBUG_BG_BLUE, "PhotoBooth");
 	GST_DEBUG ("photo_booth_class_init");
 	gp_log_add_func(GP_LOG_ERROR, _gphoto_err, NULL);
+	photo_number_quark = g_quark_from_static_string ("photobooth-photo-number");
 
 	gobject_class->finalize      = photo_booth_finalize;
 	gobject_class->dispose       = photo_booth_dispose;
@@ -218,24 +416,35 @@ static void photo_booth_init (PhotoBooth *pb)
 
 	GST_DEBUG_OBJECT (pb, "photo_booth_init init object!");
 
-	int control_sock[2];
-	if (socketpair (PF_UNIX, SOCK_STREAM, 0, control_sock) < 0)
+	pb->control = photo_booth_command_channel_new (COMMAND_CHANNEL_CAPACITY);
+	if (!pb->control)
 	{
-		GST_ERROR_OBJECT (pb, "cannot create control sockets: %s (%i)", strerror(errno), errno);
+		GST_ERROR_OBJECT (pb, "cannot create the capture thread's command channel");
 		g_application_quit (G_APPLICATION (pb));
 	}
-	READ_SOCKET (pb) = control_sock[0];
-	WRITE_SOCKET (pb) = control_sock[1];
-	fcntl (READ_SOCKET (pb), F_SETFL, O_NONBLOCK);
-	fcntl (WRITE_SOCKET (pb), F_SETFL, O_NONBLOCK);
+	else
+		photo_booth_command_channel_set_reply_func (pb->control, photo_booth_command_done, pb);
 
 	pb->cam_info = NULL;
 
 	pb->pipeline = NULL;
+	pb->photo_bin = NULL;
+	priv->countdown_cue = NULL;
+	priv->preload = photo_booth_preload_new (PRELOAD_MAX_THREADS);
 	priv->state = PB_STATE_NONE;
+	priv->ui = NULL;
+	priv->fsm = photo_booth_fsm_new (photo_booth_transitions, G_N_ELEMENTS (photo_booth_transitions), PB_STATE_COUNT, PB_STATE_NONE,
+	                                 (PhotoBoothFsmNameFunc) photo_booth_state_get_name, (PhotoBoothFsmNameFunc) photo_booth_event_get_name);
+	photo_booth_fsm_set_enter_func (priv->fsm, photo_booth_state_entered, pb);
+	/* a guest's session runs from the first countdown until the booth is ready for the next one */
+	photo_booth_fsm_set_session (priv->fsm, PB_STATE_COUNTDOWN, PB_STATE_PREVIEW);
+	priv->photo_buffers = 0;
+	priv->photo_branches_done = 0;
+	priv->trace_decode = priv->trace_encode = priv->trace_print = 0;
 	priv->video_block_id = 0;
 	priv->photo_block_id = 0;
-	priv->sink_block_id = 0;
+	priv->display_selector = NULL;
+	priv->live_pad = priv->screensaver_pad = NULL;
 
 	if (mkfifo(MOVIEPIPE, 0666) == -1 && errno != EEXIST)
 	{
@@ -263,33 +472,122 @@ static void photo_booth_init (PhotoBooth *pb)
 	priv->print_width = PRINT_WIDTH;
 	priv->print_height = PRINT_HEIGHT;
 	priv->print_x_offset = priv->print_y_offset = 0;
+	priv->prints_remaining = -1;
 	priv->print_buffer = NULL;
 	priv->print_icc_profile = NULL;
 	priv->cam_icc_profile = NULL;
 	priv->cam_keep_files = FALSE;
 	priv->printer_backend = NULL;
 	priv->printer_settings = NULL;
+	priv->print_direct_command = NULL;
+	priv->print_thread = NULL;
+	priv->print_error = NULL;
+	priv->print_cut_2up = FALSE;
+	priv->print_cut_2up_hold = DEFAULT_CUT_2UP_HOLD;
+	priv->print_flush_timeout_id = 0;
+	priv->sheet_packer = NULL;
+	priv->print_sheets = NULL;
+	priv->print_sheets_queued = NULL;
 	priv->overlay_image = NULL;
+	priv->overlay_pixbuf = NULL;
+	priv->layout_template = NULL;
+	priv->layout_shots = DEFAULT_LAYOUT_SHOTS;
+	priv->layout_spacing = DEFAULT_LAYOUT_SPACING;
+	priv->layout_countdown = DEFAULT_LAYOUT_COUNTDOWN;
+	priv->layout = NULL;
+	priv->layout_shot = 0;
 	priv->countdown_audio_uri = NULL;
 	priv->ack_sound = NULL;
 	priv->error_sound = NULL;
+	priv->ack_cue = priv->error_cue = NULL;
+	priv->event_sound_latency = DEFAULT_EVENT_SOUND_LATENCY;
+	priv->event_sound_interval = DEFAULT_EVENT_SOUND_INTERVAL;
+	memset (priv->event_sound_last, 0, sizeof (priv->event_sound_last));
+	memset (priv->event_sound_lead, 0, sizeof (priv->event_sound_lead));
+	priv->event_sounds_dropped = 0;
 	priv->screensaver_uri = NULL;
 	priv->screensaver_timeout = DEFAULT_SCREENSAVER_TIMEOUT;
 	priv->screensaver_timeout_id = 0;
 	priv->paused_callback_id = 0;
-	priv->last_play_pos = GST_CLOCK_TIME_NONE;
+	priv->screensaver_playbin = priv->screensaver_bin = NULL;
+	priv->screensaver_bus_watch = 0;
+	priv->screensaver_probe_pending = 0;
+	priv->screensaver_switch_start = 0;
+	priv->slideshow = NULL;
+	priv->screensaver_slideshow = FALSE;
+	priv->slideshow_hold = DEFAULT_SLIDESHOW_HOLD;
+	priv->slideshow_fade = DEFAULT_SLIDESHOW_FADE;
+	priv->slideshow_decode_ahead = DEFAULT_SLIDESHOW_DECODE_AHEAD;
 	priv->save_path_template = g_strdup (DEFAULT_SAVE_PATH_TEMPLATE);
 	priv->photos_taken = priv->photos_printed = 0;
 	priv->save_filename_count = 0;
+	priv->save_filename = NULL;
+	priv->writer = NULL;
+	priv->photo_index = NULL;
+	priv->thumbnailer = NULL;
+	priv->gallery_cache_size = DEFAULT_GALLERY_CACHE_SIZE;
 	priv->upload_timeout = 0;
-	priv->facebook_put_uri = NULL;
-	priv->imgur_album_id = NULL;
-	priv->imgur_access_token = NULL;
-	priv->imgur_description = NULL;
-	priv->upload_thread = NULL;
+	priv->upload_backends = g_ptr_array_new_with_free_func ((GDestroyNotify) photo_booth_upload_backend_free);
+	priv->upload_fanouts = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_free);
+	priv->upload_retry_base = DEFAULT_UPLOAD_RETRY_BASE;
+	priv->upload_retry_max = DEFAULT_UPLOAD_RETRY_MAX;
+	priv->upload_max_attempts = DEFAULT_UPLOAD_MAX_ATTEMPTS;
+	priv->upload_concurrency = DEFAULT_UPLOAD_CONCURRENCY;
+	priv->upload_queue = NULL;
+	priv->upload_photo = NULL;
+	priv->upload_photo_number = 0;
+	priv->web_max_edge = DEFAULT_WEB_MAX_EDGE;
+	priv->web_quality = DEFAULT_WEB_QUALITY;
+	priv->web_progressive = DEFAULT_WEB_PROGRESSIVE;
+	priv->web_encoder = NULL;
 	priv->twitter_bridge_host = g_strdup (DEFAULT_TWITTER_BRIDGE_HOST);
 	priv->twitter_bridge_port = DEFAULT_TWITTER_BRIDGE_PORT;
+	priv->twitter_bridge_queue = DEFAULT_TWITTER_BRIDGE_QUEUE;
+	priv->twitter_bridge_ack = DEFAULT_TWITTER_BRIDGE_ACK;
+	priv->twitter_bridge = NULL;
 	priv->do_flip = DEFAULT_FLIP;
+	priv->metrics_address = g_strdup (METRICS_DEFAULT_ADDRESS);
+	priv->metrics_port = DEFAULT_METRICS_PORT;
+	priv->trigger_time = priv->exposure_time = priv->display_time = priv->print_start_time = 0;
+	priv->snapshot_due = 0;
+	priv->preview_frames = priv->metrics_fps_frames = 0;
+	priv->metrics_fps_time = 0;
+	/* in seconds, histograms are always kept and only served if metrics_port is set */
+	{
+		static const gdouble exposure_buckets[] = { 0.1, 0.25, 0.5, 1, 2, 3, 5, 10 };
+		static const gdouble processing_buckets[] = { 0.25, 0.5, 1, 2, 3, 5, 10, 20 };
+		static const gdouble print_buckets[] = { 5, 10, 20, 30, 45, 60, 90, 120, 180, 300 };
+		static const gdouble upload_buckets[] = { 0.5, 1, 2, 5, 10, 20, 30, 60, 120 };
+		static const gdouble command_buckets[] = { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1 };
+		static const gdouble stall_buckets[] = { 0.00001, 0.0001, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5 };
+		static const gdouble switch_buckets[] = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2 };
+		static const gdouble offset_buckets[] = { 0.001, 0.0025, 0.005, 0.01, 0.02, 0.05, 0.1, 0.25 };
+		static const gdouble sound_buckets[] = { 0.01, 0.02, 0.03, 0.04, 0.05, 0.075, 0.1, 0.25, 0.5 };
+		priv->metrics = photo_booth_metrics_new ();
+		photo_booth_metrics_set_collect_func (priv->metrics, photo_booth_metrics_collect, pb);
+		priv->countdown_to_exposure = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_countdown_to_exposure_seconds",
+			"From the end of the countdown until the camera took the photo", exposure_buckets, G_N_ELEMENTS (exposure_buckets));
+		priv->exposure_to_display = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_exposure_to_display_seconds",
+			"From the exposure until the photo is shown", processing_buckets, G_N_ELEMENTS (processing_buckets));
+		priv->processing_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_processing_seconds",
+			"From showing the photo until it's ready to print", processing_buckets, G_N_ELEMENTS (processing_buckets));
+		priv->print_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_print_seconds",
+			"Of a print job, from handing it to the printer until it's done", print_buckets, G_N_ELEMENTS (print_buckets));
+		priv->upload_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_upload_seconds",
+			"Of a single upload attempt", upload_buckets, G_N_ELEMENTS (upload_buckets));
+		priv->command_latency = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_command_latency_seconds",
+			"From sending a command to the capture thread until it acted on it", command_buckets, G_N_ELEMENTS (command_buckets));
+		priv->streaming_callback_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_streaming_callback_seconds",
+			"Time a streaming thread spent in the photo probe or the print appsink", stall_buckets, G_N_ELEMENTS (stall_buckets));
+		priv->processing_lock_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_processing_lock_seconds",
+			"Time the main thread held the processing lock to plug or remove photo elements", stall_buckets, G_N_ELEMENTS (stall_buckets));
+		priv->screensaver_switch_time = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_screensaver_switch_seconds",
+			"From starting the screensaver until its first frame reached the display", switch_buckets, G_N_ELEMENTS (switch_buckets));
+		priv->countdown_audio_offset = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_countdown_audio_offset_seconds",
+			"How far the countdown audio was off the countdown, either way", offset_buckets, G_N_ELEMENTS (offset_buckets));
+		priv->touch_to_sound = photo_booth_metrics_add_histogram (priv->metrics, "photobooth_touch_to_sound_seconds",
+			"From a touch until its event sound was heard", sound_buckets, G_N_ELEMENTS (sound_buckets));
+	}
 	priv->state_change_watchdog_timeout_id = 0;
 
 	priv->led = photo_booth_led_new ();
@@ -302,33 +600,124 @@ static void photo_booth_init (PhotoBooth *pb)
 	g_mutex_init (&priv->upload_mutex);
 }
 
-static void photo_booth_change_state (PhotoBooth *pb, PhotoboothState newstate)
+/* safe from any thread, other threads' events take effect on the main
+ * thread shortly after */
+static void photo_booth_change_state (PhotoBooth *pb, PhotoboothEvent event)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+	photo_booth_fsm_post (priv->fsm, event);
+}
+
+/* runs on the main thread for every transition */
+static void photo_booth_state_entered (gint from, gint to, gint event, gpointer user_data)
 {
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
 	PhotoBoothPrivate *priv;
 	priv = photo_booth_get_instance_private (pb);
-	GST_DEBUG_OBJECT (pb, "change state %s -> %s", photo_booth_state_get_name (priv->state), photo_booth_state_get_name (newstate));
-	gchar *dot_filename = g_strdup_printf ("state_change_%s_to_%s", photo_booth_state_get_name (priv->state), photo_booth_state_get_name (newstate));
+	GST_DEBUG_OBJECT (pb, "change state %s -> %s on %s", photo_booth_state_get_name (from), photo_booth_state_get_name (to), photo_booth_event_get_name (event));
+	gchar *dot_filename = g_strdup_printf ("state_change_%s_to_%s", photo_booth_state_get_name (from), photo_booth_state_get_name (to));
 	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, dot_filename);
 	g_free (dot_filename);
-	priv->state = newstate;
+	g_atomic_int_set (&priv->state, to);
 	if (priv->state_change_watchdog_timeout_id)
 	{
 		GST_LOG_OBJECT (pb, "removed watchdog timeout");
 		g_source_remove (priv->state_change_watchdog_timeout_id);
 		priv->state_change_watchdog_timeout_id = 0;
 	}
+
+	switch (to) {
+		case PB_STATE_PROCESS_PHOTO:
+		{
+			if (priv->print_copies_max)
+				gtk_widget_show (GTK_WIDGET (priv->win->button_print));
+			photo_booth_process_photo_plug_elements (pb);
+			if (priv->preview_timeout > 0)
+				priv->preview_timeout_id = g_timeout_add_seconds (priv->preview_timeout, (GSourceFunc) photo_booth_cancel, pb);
+			gtk_widget_show (GTK_WIDGET (priv->win->button_cancel));
+			photo_booth_window_show_cursor (priv->win);
+			break;
+		}
+		case PB_STATE_NONE:
+		case PB_STATE_PREVIEW_COOLDOWN:
+		{
+			/* cancelled or failed in the middle of a layout, the next
+			 * countdown starts a new one and begin clears the canvas */
+			if (priv->layout_shot)
+			{
+				GST_DEBUG_OBJECT (pb, "abandoned layout after %u shots", priv->layout_shot);
+				priv->layout_shot = 0;
+			}
+			break;
+		}
+		case PB_STATE_ASK_PRINT:
+		{
+			photo_booth_refresh_printer_status (pb);
+			if (priv->print_copies_min != priv->print_copies_max)
+				photo_booth_window_set_copies_show (priv->win, priv->print_copies_min, priv->print_copies_max, priv->print_copies_default);
+			photo_booth_ui_post_value (priv->ui, UI_SPINNER, FALSE);
+			break;
+		}
+		default:
+			break;
+	}
 }
 
 static void photo_booth_setup_window (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv;
+	gchar *save_dir;
 	priv = photo_booth_get_instance_private (pb);
 	priv->win = photo_booth_window_new (pb);
 	gtk_window_present (GTK_WINDOW (priv->win));
+	photo_booth_startup_mark ("window presented");
 	g_signal_connect (G_OBJECT (priv->win), "destroy", G_CALLBACK (photo_booth_window_destroyed_signal), pb);
+	priv->ui = photo_booth_ui_new (UI_N_SLOTS, GTK_WIDGET (priv->win), photo_booth_ui_apply, pb);
+	/* the camera takes longest to come up, it's initialized while the rest is set up */
 	priv->capture_thread = g_thread_try_new ("gphoto-capture", (GThreadFunc) photo_booth_capture_thread_func, pb, NULL);
+	photo_booth_refresh_printer_status (pb);
+	priv->sheet_packer = photo_booth_sheet_packer_new (priv->print_cut_2up ? 2 : 1);
+	priv->writer = photo_booth_writer_new (WRITER_MAX_QUEUE, WRITER_FSYNC_BATCH);
+	save_dir = g_path_get_dirname (priv->save_path_template);
+	priv->thumbnailer = photo_booth_thumbnailer_new (save_dir);
+	if (priv->upload_backends->len)
+	{
+		gchar *queue_dir = g_build_filename (save_dir, UPLOAD_QUEUE_DIRNAME, NULL);
+		priv->upload_queue = photo_booth_upload_queue_new (queue_dir, photo_booth_upload_prepare, photo_booth_upload_finish, pb);
+		if (priv->upload_queue)
+		{
+			photo_booth_upload_queue_set_backoff (priv->upload_queue, priv->upload_retry_base, priv->upload_retry_max, priv->upload_max_attempts);
+			photo_booth_upload_queue_set_concurrency (priv->upload_queue, priv->upload_concurrency);
+			photo_booth_upload_queue_set_attempted_func (priv->upload_queue, photo_booth_upload_attempted, pb);
+			photo_booth_upload_queue_start (priv->upload_queue);
+			/* jobs restored from a previous run are pending right away */
+			photo_booth_update_upload_status (pb);
+			if (priv->web_max_edge > 0)
+				priv->web_encoder = photo_booth_web_encoder_new (save_dir, priv->web_quality, priv->web_progressive);
+			if (priv->twitter_bridge_host && priv->twitter_bridge_port)
+				priv->twitter_bridge = photo_booth_bridge_new (priv->twitter_bridge_host, priv->twitter_bridge_port, priv->twitter_bridge_queue, priv->twitter_bridge_ack);
+		}
+		g_free (queue_dir);
+	}
+	g_free (save_dir);
+	photo_booth_writer_set_published_func (priv->writer, photo_booth_photo_published, pb);
+	if (priv->win->gallery)
+	{
+		photo_booth_gallery_set_thumbnailer (PHOTO_BOOTH_GALLERY (priv->win->gallery), priv->thumbnailer);
+		photo_booth_gallery_set_cache_size (PHOTO_BOOTH_GALLERY (priv->win->gallery), (gsize) priv->gallery_cache_size * 1024 * 1024);
+	}
 	photo_booth_setup_gstreamer (pb);
-	photo_booth_get_printer_status (pb);
+	photo_booth_startup_mark ("preview pipeline built");
+	if (priv->metrics_port > 0)
+	{
+		GError *error = NULL;
+		if (!photo_booth_metrics_listen (priv->metrics, priv->metrics_address, priv->metrics_port, &error))
+		{
+			GST_WARNING_OBJECT (pb, "can't serve metrics on %s:%d: %s", priv->metrics_address, priv->metrics_port, error->message);
+			g_error_free (error);
+		}
+	}
 }
 
 static void photo_booth_activate (GApplication *app)
@@ -352,6 +741,7 @@ static void photo_booth_finalize (GObject *object)
 	SEND_COMMAND (pb, CONTROL_QUIT);
 	photo_booth_flush_pipe (pb->video_fd);
 	g_thread_join (priv->capture_thread);
+	photo_booth_command_channel_free (pb->control);
 	if (pb->cam_info)
 		photo_booth_cam_close (&pb->cam_info);
 	if (pb->video_fd)
@@ -359,18 +749,83 @@ static void photo_booth_finalize (GObject *object)
 		close (pb->video_fd);
 		unlink (MOVIEPIPE);
 	}
-	if (priv->upload_thread)
-		g_thread_join (priv->upload_thread);
+	if (priv->upload_queue)
+		photo_booth_upload_queue_free (priv->upload_queue);
+	if (priv->twitter_bridge)
+	{
+		photo_booth_bridge_close (priv->twitter_bridge);
+		g_object_unref (priv->twitter_bridge);
+	}
+	if (priv->upload_photo)
+		gst_buffer_unref (priv->upload_photo);
+	if (priv->web_encoder)
+		photo_booth_web_encoder_free (priv->web_encoder);
+	if (priv->print_thread)
+		g_thread_join (priv->print_thread);
+	if (priv->ui)
+		photo_booth_ui_free (priv->ui);
+	if (priv->print_sheets)
+		g_ptr_array_unref (priv->print_sheets);
+	if (priv->print_sheets_queued)
+		g_ptr_array_unref (priv->print_sheets_queued);
+	if (priv->sheet_packer)
+		photo_booth_sheet_packer_free (priv->sheet_packer);
+	if (priv->layout)
+		photo_booth_layout_free (priv->layout);
+	if (priv->writer)
+		photo_booth_writer_free (priv->writer);
+	if (priv->thumbnailer)
+		photo_booth_thumbnailer_free (priv->thumbnailer);
+	if (priv->photo_index)
+		photo_booth_index_close (priv->photo_index);
 	g_object_unref (priv->led);
+	photo_booth_fsm_free (priv->fsm);
+	photo_booth_metrics_free (priv->metrics);
 }
 
 static void photo_booth_dispose (GObject *object)
 {
 	PhotoBoothPrivate *priv;
 	priv = photo_booth_get_instance_private (PHOTO_BOOTH (object));
+	/* the preload tasks still running read the settings freed below */
+	if (priv->preload)
+	{
+		photo_booth_preload_free (priv->preload);
+		priv->preload = NULL;
+	}
+	if (priv->countdown_cue)
+	{
+		photo_booth_cue_free (priv->countdown_cue);
+		priv->countdown_cue = NULL;
+	}
+	if (priv->ack_cue)
+	{
+		photo_booth_cue_free (priv->ack_cue);
+		priv->ack_cue = NULL;
+	}
+	if (priv->error_cue)
+	{
+		photo_booth_cue_free (priv->error_cue);
+		priv->error_cue = NULL;
+	}
+	if (priv->screensaver_playbin)
+	{
+		g_source_remove (priv->screensaver_bus_watch);
+		gst_element_set_state (priv->screensaver_playbin, GST_STATE_NULL);
+		gst_object_unref (priv->screensaver_playbin);
+		priv->screensaver_playbin = NULL;
+	}
+	if (priv->slideshow)
+	{
+		photo_booth_slideshow_set_running (priv->slideshow, FALSE);
+		gst_element_set_state (priv->screensaver_bin, GST_STATE_NULL);
+		photo_booth_slideshow_free (priv->slideshow);
+		priv->slideshow = NULL;
+	}
 	g_free (priv->printer_backend);
 	if (priv->printer_settings != NULL)
 		g_object_unref (priv->printer_settings);
+	g_free (priv->print_direct_command);
 	g_free (priv->countdown_audio_uri);
 	g_free (priv->ack_sound);
 	g_free (priv->error_sound);
@@ -378,14 +833,19 @@ static void photo_booth_dispose (GObject *object)
 	g_free (priv->print_icc_profile);
 	g_free (priv->cam_icc_profile);
 	g_free (priv->overlay_image);
+	if (priv->overlay_pixbuf)
+		g_object_unref (priv->overlay_pixbuf);
+	priv->overlay_pixbuf = NULL;
+	g_free (priv->layout_template);
 	g_free (priv->save_path_template);
-	g_free (priv->facebook_put_uri);
-	g_free (priv->imgur_album_id);
-	g_free (priv->imgur_access_token);
-	g_free (priv->imgur_description);
+	g_free (priv->save_filename);
+	g_ptr_array_unref (priv->upload_backends);
+	g_hash_table_destroy (priv->upload_fanouts);
   g_free (priv->twitter_bridge_host);
+	g_free (priv->metrics_address);
 	g_hash_table_destroy (G_strings_table);
 	G_strings_table = NULL;
+	photo_booth_free_print_buffer (PHOTO_BOOTH (object));
 	g_mutex_clear (&priv->processing_mutex);
 	g_mutex_clear (&priv->upload_mutex);
 	G_OBJECT_CLASS (photo_booth_parent_class)->dispose (object);
@@ -437,6 +897,301 @@ static void photo_booth_dispose (GObject *object)
   }                                                                                    \
 }
 
+/* finds the highest photo number in the save directory. slow with many
+ * photos, only used to recover when the photo index is missing or broken */
+static guint photo_booth_scan_save_dir (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	guint highest = 0;
+	gint64 start_time = g_get_monotonic_time ();
+	priv = photo_booth_get_instance_private (pb);
+
+	gchar *save_path_basename = g_path_get_basename (priv->save_path_template);
+	gchar *pos = g_strstr_len ((const gchar*) save_path_basename, strlen (save_path_basename), "%");
+	if (pos)
+	{
+		gchar *filenameprefix = g_strndup (save_path_basename, pos-save_path_basename);
+		GDir *save_dir;
+		GError *error = NULL;
+		gchar *cdir = g_path_get_dirname (priv->save_path_template);
+		save_dir = g_dir_open ((const gchar*)cdir, 0, &error);
+		if (error) {
+			GST_WARNING ("couldn't open save directory '%s': %s", priv->save_path_template, error->message);
+		}
+		else if (save_dir)
+		{
+			const gchar *filename;
+			GMatchInfo *match_info;
+			GRegex *regex;
+			gchar *pattern = g_strdup_printf("(?<filename>%s)(?<number>\\d+)", filenameprefix);
+			GST_TRACE ("save_path_basename regex pattern = '%s'", pattern);
+			regex = g_regex_new (pattern, 0, 0, &error);
+			if (error) {
+				g_critical ("%s\n", error->message);
+			}
+			while ((filename = g_dir_read_name (save_dir)))
+			{
+				if (g_regex_match (regex, filename, 0, &match_info))
+				{
+					gint count = atoi(g_match_info_fetch_named (match_info, "number"));
+					gchar *name = g_match_info_fetch_named (match_info, "filename");
+					if (count > (gint) highest)
+						highest = count;
+					GST_TRACE ("save_path_template found matching file %s (prefix %s, count %d, highest %i)", filename, name, count, highest);
+					g_free (name);
+				}
+				else
+					GST_TRACE ("save_path_template unmatched file %s", filename);
+			}
+			g_dir_close (save_dir);
+		}
+	}
+	g_free (save_path_basename);
+	GST_INFO ("scanned save directory in %" G_GINT64_FORMAT " ms, highest photo number %u", (g_get_monotonic_time () - start_time) / 1000, highest);
+	return highest;
+}
+
+static void photo_booth_open_photo_index (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	GError *error = NULL;
+	gchar *save_dir, *index_filename;
+	priv = photo_booth_get_instance_private (pb);
+
+	save_dir = g_path_get_dirname (priv->save_path_template);
+	index_filename = g_build_filename (save_dir, PHOTO_INDEX_FILENAME, NULL);
+	priv->photo_index = photo_booth_index_open (index_filename, &error);
+	if (priv->photo_index)
+		priv->save_filename_count = photo_booth_index_get_last_number (priv->photo_index);
+	else
+	{
+		GST_WARNING ("%s -> falling back to scanning '%s'", error->message, save_dir);
+		g_clear_error (&error);
+		priv->save_filename_count = photo_booth_scan_save_dir (pb);
+		priv->photo_index = photo_booth_index_create (index_filename, priv->save_filename_count, &error);
+		if (!priv->photo_index)
+		{
+			GST_WARNING ("%s", error->message);
+			g_error_free (error);
+		}
+	}
+	GST_INFO ("next photo number %u", priv->save_filename_count + 1);
+	g_free (index_filename);
+	g_free (save_dir);
+}
+
+static gpointer photo_booth_preload_photo_index (PhotoBooth *pb)
+{
+	photo_booth_open_photo_index (pb);
+	return NULL;
+}
+
+static gpointer photo_booth_preload_overlay (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	GError *error = NULL;
+	GdkPixbuf *pixbuf;
+
+	pixbuf = gdk_pixbuf_new_from_file (priv->overlay_image, &error);
+	if (!pixbuf)
+	{
+		GST_WARNING ("can't load overlay image %s: %s", priv->overlay_image, error->message);
+		g_error_free (error);
+	}
+	return pixbuf;
+}
+
+static void photo_booth_overlay_preloaded (GdkPixbuf *pixbuf, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	priv->overlay_pixbuf = pixbuf;
+}
+
+static gpointer photo_booth_preload_layout (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	return photo_booth_layout_new (priv->layout_template, priv->layout_shots, priv->print_width, priv->print_height, priv->layout_spacing, priv->overlay_image);
+}
+
+static void photo_booth_layout_preloaded (PhotoBoothLayout *layout, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	priv->layout = layout;
+}
+
+/* lcms would only find out about a broken profile with the first photo */
+static gpointer photo_booth_preload_icc_profiles (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	const gchar *profiles[] = { priv->cam_icc_profile, priv->print_icc_profile };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (profiles); i++)
+	{
+		GError *error = NULL;
+		gchar *data;
+		gsize length;
+
+		if (!profiles[i])
+			continue;
+		if (!g_file_get_contents (profiles[i], &data, &length, &error))
+		{
+			GST_WARNING ("can't read ICC profile: %s", error->message);
+			g_error_free (error);
+			continue;
+		}
+		/* the header of every ICC profile has the signature at byte 36 */
+		if (length < 128 || memcmp (data + 36, "acsp", 4) != 0)
+			GST_WARNING ("%s isn't an ICC profile, color correction will fail", profiles[i]);
+		g_free (data);
+	}
+	return NULL;
+}
+
+static PhotoBoothCue *photo_booth_load_cue (const gchar *uri)
+{
+	GError *error = NULL;
+	PhotoBoothCue *cue;
+
+	cue = photo_booth_cue_new (uri, &error);
+	if (!cue)
+	{
+		GST_WARNING ("can't load sound %s: %s", uri, error->message);
+		g_error_free (error);
+	}
+	return cue;
+}
+
+/* event sounds are relative to the working directory */
+static PhotoBoothCue *photo_booth_load_event_sound (const gchar *filename)
+{
+	PhotoBoothCue *cue;
+	gchar *absfilename, *uri, *cwd;
+
+	if (g_path_is_absolute (filename))
+		absfilename = g_strdup (filename);
+	else
+	{
+		cwd = g_get_current_dir ();
+		absfilename = g_build_filename (cwd, filename, NULL);
+		g_free (cwd);
+	}
+	uri = g_filename_to_uri (absfilename, NULL, NULL);
+	cue = uri ? photo_booth_load_cue (uri) : NULL;
+	g_free (uri);
+	g_free (absfilename);
+	return cue;
+}
+
+static gpointer photo_booth_preload_ack_sound (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	return photo_booth_load_event_sound (priv->ack_sound);
+}
+
+static gpointer photo_booth_preload_error_sound (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	return photo_booth_load_event_sound (priv->error_sound);
+}
+
+static void photo_booth_event_sound_offset (PhotoBooth *pb, sound_t sound, gint64 offset)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	gint64 latency = priv->event_sound_lead[sound] + offset;
+
+	photo_booth_histogram_observe (priv->touch_to_sound, (gdouble) MAX (latency, 0) / G_USEC_PER_SEC);
+	if (offset > EVENT_SOUND_LATE)
+		GST_WARNING_OBJECT (pb, "event sound heard %" G_GINT64_FORMAT " ms after the touch, %" G_GINT64_FORMAT " ms later than it was due", latency / 1000, offset / 1000);
+	else
+		GST_DEBUG_OBJECT (pb, "event sound heard %" G_GINT64_FORMAT " ms after the touch", latency / 1000);
+}
+
+static void photo_booth_ack_sound_offset (gint64 offset, PhotoBooth *pb)
+{
+	photo_booth_event_sound_offset (pb, ACK_SOUND, offset);
+}
+
+static void photo_booth_error_sound_offset (gint64 offset, PhotoBooth *pb)
+{
+	photo_booth_event_sound_offset (pb, ERROR_SOUND, offset);
+}
+
+static void photo_booth_ack_sound_preloaded (PhotoBoothCue *cue, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	priv->ack_cue = cue;
+	if (cue)
+		photo_booth_cue_set_offset_func (cue, (PhotoBoothCueOffsetFunc) photo_booth_ack_sound_offset, pb);
+}
+
+static void photo_booth_error_sound_preloaded (PhotoBoothCue *cue, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	priv->error_cue = cue;
+	if (cue)
+		photo_booth_cue_set_offset_func (cue, (PhotoBoothCueOffsetFunc) photo_booth_error_sound_offset, pb);
+}
+
+static gpointer photo_booth_preload_countdown_audio (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	return photo_booth_load_cue (priv->countdown_audio_uri);
+}
+
+static void photo_booth_countdown_audio_offset (gint64 offset, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	photo_booth_histogram_observe (priv->countdown_audio_offset, (gdouble) ABS (offset) / G_USEC_PER_SEC);
+}
+
+static void photo_booth_countdown_audio_preloaded (PhotoBoothCue *cue, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	priv->countdown_cue = cue;
+	if (cue)
+		photo_booth_cue_set_offset_func (cue, (PhotoBoothCueOffsetFunc) photo_booth_countdown_audio_offset, pb);
+}
+
+static gpointer photo_booth_preload_screensaver (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	gchar *filename = g_filename_from_uri (priv->screensaver_uri, NULL, NULL);
+
+	photo_booth_preload_warm_file (filename, SCREENSAVER_PRELOAD_BYTES);
+	g_free (filename);
+	return NULL;
+}
+
+/* nothing of this is needed for the first preview frame, so it's loaded
+ * in the background while the window, the pipeline and the camera come
+ * up. whatever needs one of the results before it's there waits for it */
+static void photo_booth_preload_assets (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+
+	photo_booth_startup_mark ("settings loaded");
+	photo_booth_preload_add (priv->preload, "photo-index", (PhotoBoothPreloadFunc) photo_booth_preload_photo_index, NULL, NULL, pb);
+	if (priv->overlay_image)
+		photo_booth_preload_add (priv->preload, "overlay", (PhotoBoothPreloadFunc) photo_booth_preload_overlay,
+			(PhotoBoothPreloadDoneFunc) photo_booth_overlay_preloaded, g_object_unref, pb);
+	photo_booth_preload_add (priv->preload, "layout", (PhotoBoothPreloadFunc) photo_booth_preload_layout,
+		(PhotoBoothPreloadDoneFunc) photo_booth_layout_preloaded, (GDestroyNotify) photo_booth_layout_free, pb);
+	if (priv->cam_icc_profile || priv->print_icc_profile)
+		photo_booth_preload_add (priv->preload, "icc-profiles", (PhotoBoothPreloadFunc) photo_booth_preload_icc_profiles, NULL, NULL, pb);
+	if (priv->countdown_audio_uri)
+		photo_booth_preload_add (priv->preload, "countdown-audio", (PhotoBoothPreloadFunc) photo_booth_preload_countdown_audio,
+			(PhotoBoothPreloadDoneFunc) photo_booth_countdown_audio_preloaded, (GDestroyNotify) photo_booth_cue_free, pb);
+	if (priv->ack_sound)
+		photo_booth_preload_add (priv->preload, "ack-sound", (PhotoBoothPreloadFunc) photo_booth_preload_ack_sound,
+			(PhotoBoothPreloadDoneFunc) photo_booth_ack_sound_preloaded, (GDestroyNotify) photo_booth_cue_free, pb);
+	if (priv->error_sound)
+		photo_booth_preload_add (priv->preload, "error-sound", (PhotoBoothPreloadFunc) photo_booth_preload_error_sound,
+			(PhotoBoothPreloadDoneFunc) photo_booth_error_sound_preloaded, (GDestroyNotify) photo_booth_cue_free, pb);
+	if (priv->screensaver_uri && !priv->screensaver_slideshow)
+		photo_booth_preload_add (priv->preload, "screensaver", (PhotoBoothPreloadFunc) photo_booth_preload_screensaver, NULL, NULL, pb);
+}
+
 void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 {
 	GKeyFile* gkf;
@@ -475,13 +1230,32 @@ void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 		}
 		if (g_key_file_has_group (gkf, "general"))
 		{
-			gchar *screensaverfile = NULL, *save_path_template = NULL;
+			gchar *screensaverfile = NULL, *save_path_template = NULL, *trace_dir = NULL, *metrics_address = NULL;
+			gboolean trace = FALSE;
+			gint trace_spans = 0;
 			READ_STR_INI_KEY (G_template_filename, gkf, "general", "template");
 			READ_STR_INI_KEY (G_stylesheet_filename, gkf, "general", "stylesheet");
 			READ_INT_INI_KEY (priv->countdown, gkf, "general", "countdown");
 			READ_INT_INI_KEY (priv->preview_timeout, gkf, "general", "preview_timeout");
 			READ_STR_INI_KEY (priv->overlay_image, gkf, "general", "overlay_image");
 			READ_INT_INI_KEY (priv->screensaver_timeout, gkf, "general", "screensaver_timeout");
+			READ_INT_INI_KEY (priv->gallery_cache_size, gkf, "general", "gallery_cache_size");
+			READ_BOOL_INI_KEY (priv->screensaver_slideshow, gkf, "general", "screensaver_slideshow");
+			READ_INT_INI_KEY (priv->slideshow_hold, gkf, "general", "slideshow_hold");
+			READ_INT_INI_KEY (priv->slideshow_fade, gkf, "general", "slideshow_fade");
+			READ_INT_INI_KEY (priv->slideshow_decode_ahead, gkf, "general", "slideshow_decode_ahead");
+			READ_BOOL_INI_KEY (trace, gkf, "general", "trace");
+			READ_INT_INI_KEY (trace_spans, gkf, "general", "trace_spans");
+			READ_STR_INI_KEY (trace_dir, gkf, "general", "trace_dir");
+			READ_INT_INI_KEY (priv->metrics_port, gkf, "general", "metrics_port");
+			READ_STR_INI_KEY (metrics_address, gkf, "general", "metrics_address");
+			if (metrics_address)
+			{
+				g_free (priv->metrics_address);
+				priv->metrics_address = metrics_address;
+			}
+			photo_booth_trace_init (trace, MAX (trace_spans, 0), trace_dir);
+			g_free (trace_dir);
 			READ_STR_INI_KEY (screensaverfile, gkf, "general", "screensaver_file");
 			if (screensaverfile)
 			{
@@ -516,6 +1290,13 @@ void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 				g_free (save_path_template);
 			}
 		}
+		if (g_key_file_has_group (gkf, "layout"))
+		{
+			READ_STR_INI_KEY (priv->layout_template, gkf, "layout", "template");
+			READ_INT_INI_KEY (priv->layout_shots, gkf, "layout", "shots");
+			READ_INT_INI_KEY (priv->layout_spacing, gkf, "layout", "spacing");
+			READ_INT_INI_KEY (priv->layout_countdown, gkf, "layout", "countdown");
+		}
 		if (g_key_file_has_group (gkf, "sounds"))
 		{
 			gchar *countdownaudiofile = NULL;
@@ -537,6 +1318,8 @@ void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 			}
 			READ_STR_INI_KEY (priv->ack_sound, gkf, "sounds", "ack_sound");
 			READ_STR_INI_KEY (priv->error_sound, gkf, "sounds", "error_sound");
+			READ_INT_INI_KEY (priv->event_sound_latency, gkf, "sounds", "event_sound_latency");
+			READ_INT_INI_KEY (priv->event_sound_interval, gkf, "sounds", "event_sound_interval");
 		}
 		if (g_key_file_has_group (gkf, "printer"))
 		{
@@ -550,6 +1333,9 @@ void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 			READ_STR_INI_KEY (priv->print_icc_profile, gkf, "printer", "icc_profile");
 			READ_DBL_INI_KEY (priv->print_x_offset, gkf, "printer", "offset_x");
 			READ_DBL_INI_KEY (priv->print_y_offset, gkf, "printer", "offset_y");
+			READ_STR_INI_KEY (priv->print_direct_command, gkf, "printer", "direct_print_command");
+			READ_BOOL_INI_KEY (priv->print_cut_2up, gkf, "printer", "cut_2up");
+			READ_INT_INI_KEY (priv->print_cut_2up_hold, gkf, "printer", "cut_2up_hold");
 		}
 		if (g_key_file_has_group (gkf, "camera"))
 		{
@@ -562,60 +1348,26 @@ void photo_booth_load_settings (PhotoBooth *pb, const gchar *filename)
 		}
 		if (g_key_file_has_group (gkf, "upload"))
 		{
-			READ_STR_INI_KEY (priv->facebook_put_uri, gkf, "upload", "facebook_put_uri");
-			READ_STR_INI_KEY (priv->imgur_album_id, gkf, "upload", "imgur_album_id");
-			READ_STR_INI_KEY (priv->imgur_access_token, gkf, "upload", "imgur_access_token");
-			READ_STR_INI_KEY (priv->imgur_description, gkf, "upload", "imgur_description");
 			READ_INT_INI_KEY (priv->upload_timeout, gkf, "upload", "upload_timeout");
+			READ_INT_INI_KEY (priv->upload_retry_base, gkf, "upload", "retry_base");
+			READ_INT_INI_KEY (priv->upload_retry_max, gkf, "upload", "retry_max");
+			READ_INT_INI_KEY (priv->upload_max_attempts, gkf, "upload", "max_attempts");
+			READ_INT_INI_KEY (priv->upload_concurrency, gkf, "upload", "concurrency");
+			READ_INT_INI_KEY (priv->web_max_edge, gkf, "upload", "web_max_edge");
+			READ_INT_INI_KEY (priv->web_quality, gkf, "upload", "web_quality");
+			READ_BOOL_INI_KEY (priv->web_progressive, gkf, "upload", "web_progressive");
 			READ_STR_INI_KEY (priv->twitter_bridge_host, gkf, "upload", "twitter_bridge_host");
 			READ_INT_INI_KEY (priv->twitter_bridge_port, gkf, "upload", "twitter_bridge_port");
+			READ_INT_INI_KEY (priv->twitter_bridge_queue, gkf, "upload", "twitter_bridge_queue");
+			READ_BOOL_INI_KEY (priv->twitter_bridge_ack, gkf, "upload", "twitter_bridge_ack");
+			photo_booth_load_upload_backends (pb, gkf);
 		}
 	}
 
-	gchar *save_path_basename = g_path_get_basename (priv->save_path_template);
-	gchar *pos = g_strstr_len ((const gchar*) save_path_basename, strlen (save_path_basename), "%");
-	if (pos)
-	{
-		gchar *filenameprefix = g_strndup (save_path_basename, pos-save_path_basename);
-		GDir *save_dir;
-		GError *error = NULL;
-		gchar *cdir = g_path_get_dirname (priv->save_path_template);
-		save_dir = g_dir_open ((const gchar*)cdir, 0, &error);
-		if (error) {
-			GST_WARNING ("couldn't open save directory '%s': %s", priv->save_path_template, error->message);
-		}
-		else if (save_dir)
-		{
-			const gchar *filename;
-			GMatchInfo *match_info;
-			GRegex *regex;
-			gchar *pattern = g_strdup_printf("(?<filename>%s)(?<number>\\d+)", filenameprefix);
-			GST_TRACE ("save_path_basename regex pattern = '%s'", pattern);
-			regex = g_regex_new (pattern, 0, 0, &error);
-			if (error) {
-				g_critical ("%s\n", error->message);
-			}
-			while ((filename = g_dir_read_name (save_dir)))
-			{
-				if (g_regex_match (regex, filename, 0, &match_info))
-				{
-					gint count = atoi(g_match_info_fetch_named (match_info, "number"));
-					gchar *name = g_match_info_fetch_named (match_info, "filename");
-					if (count > priv->save_filename_count)
-						priv->save_filename_count = count;
-					GST_TRACE ("save_path_template found matching file %s (prefix %s, count %d, highest %i)", filename, name, count, priv->save_filename_count);
-					g_free (name);
-				}
-				else
-					GST_TRACE ("save_path_template unmatched file %s", filename);
-			}
-			g_dir_close (save_dir);
-		}
-	}
-	g_free (save_path_basename);
-
-	g_key_file_free (gkf);
-	if (error)
+	photo_booth_preload_assets (pb);
+
+	g_key_file_free (gkf);
+	if (error)
 	{
 		GST_INFO ( "can't open settings file %s: %s", filename, error->message);
 		g_error_free (error);
@@ -639,21 +1391,68 @@ static GstPadProbeReturn _gst_video_probecb (GstPad * pad, GstPadProbeInfo * inf
 	return GST_PAD_PROBE_DROP;
 }
 
-void _play_event_sound (PhotoBoothPrivate *priv, sound_t sound)
+typedef struct
+{
+	PhotoBoothPrivate *priv;
+	sound_t            sound;
+	gint64             requested;
+} PhotoBoothEventSound;
+
+/* main thread. the sound is due event_sound_latency after it was asked
+ * for, the sink puts it there if it can. a sound right after the last
+ * one of its kind is dropped, one that's still playing starts over. an
+ * error right after an ack is still heard */
+static void _play_event_sound_at (PhotoBoothPrivate *priv, sound_t sound, gint64 requested)
 {
-	gchar *soundfile = NULL;
+	PhotoBoothCue *cue = NULL;
+	gint64 at;
+
 	switch (sound) {
 		case ACK_SOUND:
-			soundfile = priv->ack_sound;
+			cue = priv->ack_cue;
 			break;
 		case ERROR_SOUND:
-			soundfile = priv->error_sound;
+			cue = priv->error_cue;
 			break;
 		default:
 			break;
 	}
-	if (soundfile)
-		ca_context_play (ca_gtk_context_get(), 0, CA_PROP_MEDIA_FILENAME, soundfile, NULL);
+	if (!cue)
+		return;
+	if (priv->event_sound_last[sound] && requested - priv->event_sound_last[sound] < priv->event_sound_interval * (gint64) 1000)
+	{
+		priv->event_sounds_dropped++;
+		GST_DEBUG ("dropped event sound %d %" G_GINT64_FORMAT " ms after the last one, %u dropped so far", sound, (requested - priv->event_sound_last[sound]) / 1000, priv->event_sounds_dropped);
+		return;
+	}
+	priv->event_sound_last[sound] = requested;
+	at = MAX (requested, g_get_monotonic_time ()) + priv->event_sound_latency * (gint64) 1000;
+	priv->event_sound_lead[sound] = at - requested;
+	photo_booth_cue_play (cue, at);
+}
+
+static gboolean _play_event_sound_idle (PhotoBoothEventSound *event)
+{
+	_play_event_sound_at (event->priv, event->sound, event->requested);
+	g_free (event);
+	return G_SOURCE_REMOVE;
+}
+
+/* thread safe */
+void _play_event_sound (PhotoBoothPrivate *priv, sound_t sound)
+{
+	PhotoBoothEventSound *event;
+
+	if (g_main_context_is_owner (g_main_context_default ()))
+	{
+		_play_event_sound_at (priv, sound, g_get_monotonic_time ());
+		return;
+	}
+	event = g_new0 (PhotoBoothEventSound, 1);
+	event->priv = priv;
+	event->sound = sound;
+	event->requested = g_get_monotonic_time ();
+	g_idle_add_full (G_PRIORITY_HIGH, (GSourceFunc) _play_event_sound_idle, event, NULL);
 }
 
 static gboolean photo_booth_cam_init (CameraInfo **cam_info)
@@ -796,6 +1595,15 @@ static void photo_booth_quit_signal (PhotoBooth *pb)
 	g_application_quit (G_APPLICATION (pb));
 }
 
+static gboolean photo_booth_trace_signal (PhotoBooth *pb)
+{
+	gchar *filename = photo_booth_trace_dump ("signal", FALSE);
+	if (!filename)
+		GST_WARNING_OBJECT (pb, "caught SIGUSR1 but tracing is disabled");
+	g_free (filename);
+	return G_SOURCE_CONTINUE;
+}
+
 static void photo_booth_window_destroyed_signal (PhotoBoothWindow *win, PhotoBooth *pb)
 {
 	GST_INFO_OBJECT (pb, "main window closed! exit...");
@@ -808,6 +1616,8 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
 	CameraFile *gp_file = NULL;
 	int gpret, captured_frames = 0;
+	PhotoBoothCommand pending;
+	gboolean has_pending = FALSE;
 
 	GST_DEBUG_OBJECT (pb, "enter capture thread fd = %d", pb->video_fd);
 
@@ -823,7 +1633,7 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 
 		struct pollfd rfd[2];
 		int timeout = 0;
-		rfd[0].fd = READ_SOCKET (pb);
+		rfd[0].fd = photo_booth_command_channel_get_fd (pb->control);
 		rfd[0].events = POLLIN | POLLERR | POLLHUP | POLLPRI;
 
 		if (state == CAPTURE_INIT || (state == CAPTURE_FAILED && !pb->cam_info))
@@ -834,6 +1644,7 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 				{
 					static volatile gsize cam_configured = 0;
 					GST_INFO_OBJECT (pb, "photo_booth_cam_inited @ %p", (void *)pb->cam_info);
+					photo_booth_startup_mark ("camera initialized");
 					if (g_once_init_enter (&cam_configured))
 					{
 						photo_booth_cam_config (pb);
@@ -841,11 +1652,11 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 					}
 					if (state == CAPTURE_FAILED)
 					{
-						photo_booth_window_set_spinner (priv->win, FALSE);
+						photo_booth_ui_post_value (priv->ui, UI_SPINNER, FALSE);
 					}
 				}
 				else {
-					gtk_label_set_text (priv->win->status, _("No camera connected!"));
+					photo_booth_ui_post_text (priv->ui, UI_STATUS, _("No camera connected!"));
 					GST_INFO_OBJECT (pb, "no camera info.");
 				}
 			}
@@ -860,6 +1671,9 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 			timeout = 1000;
 		else
 			timeout = 1000 / priv->preview_fps;
+		/* act on a pretrigger or photo command right away */
+		if (has_pending)
+			timeout = 0;
 
 		int ret = poll(rfd, 1, timeout);
 
@@ -883,7 +1697,7 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 					if (gpret == -7)
 					{
 						state = CAPTURE_FAILED;
-						photo_booth_change_state (pb, PB_STATE_NONE);
+						photo_booth_change_state (pb, PB_EVENT_CAMERA_LOST);
 						photo_booth_cam_close (&pb->cam_info);
 					}
 					continue;
@@ -895,13 +1709,15 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 						continue;
 					}
 					captured_frames++;
+					g_atomic_int_inc (&priv->preview_frames);
 					GST_LOG_OBJECT (pb, "captured frame (%d frames total)", captured_frames);
 				}
 			}
 		}
 		else if (ret == 0 && state == CAPTURE_PRETRIGGER)
 		{
-			gtk_label_set_text (priv->win->status, _("Focussing..."));
+			gint64 acted = g_get_monotonic_time ();
+			photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Focussing..."));
 			if (0)
 				photo_booth_focus (pb->cam_info);
 			if (priv->cam_reeinit_before_snapshot)
@@ -909,69 +1725,103 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 				photo_booth_cam_close (&pb->cam_info);
 				photo_booth_cam_init (&pb->cam_info);
 			}
+			if (has_pending)
+			{
+				photo_booth_command_complete (pb->control, &pending, acted, pb->cam_info ? GP_OK : GP_ERROR_MODEL_NOT_FOUND);
+				has_pending = FALSE;
+			}
 		}
 		else if (ret == 0 && state == CAPTURE_PHOTO)
 		{
+			gint64 acted = g_get_monotonic_time ();
 			if (pb->cam_info)
 			{
-				gtk_label_set_text (priv->win->status, _("Taking photo..."));
+				photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Taking photo..."));
 				photo_booth_led_flash (priv->led);
 				ret = photo_booth_take_photo (pb);
 				photo_booth_led_black (priv->led);
+				if (has_pending)
+				{
+					photo_booth_command_complete (pb->control, &pending, acted, ret && pb->cam_info->size ? GP_OK : GP_ERROR);
+					has_pending = FALSE;
+				}
 				if (ret && pb->cam_info->size)
 				{
 					g_main_context_invoke (NULL, (GSourceFunc) photo_booth_snapshot_taken, pb);
 					state = CAPTURE_PAUSED;
 				}
 				else {
-					gtk_label_set_text (priv->win->status, _("Taking photo failed!"));
+					photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Taking photo failed!"));
 					_play_event_sound (priv, ERROR_SOUND);
 					GST_ERROR_OBJECT (pb, "Taking photo failed!");
+					g_free (photo_booth_trace_dump ("capture", TRUE));
 					photo_booth_cam_close (&pb->cam_info);
-					photo_booth_change_state (pb, PB_STATE_NONE);
-					gtk_widget_show (GTK_WIDGET (priv->win->gtkgstwidget));
+					photo_booth_change_state (pb, PB_EVENT_CAPTURE_FAILED);
+					photo_booth_ui_post_value (priv->ui, UI_PREVIEW, TRUE);
 					state = CAPTURE_FAILED;
 				}
 			}
+			else
+			{
+				/* the camera went away since the countdown started, don't
+				 * leave the command waiting and poll() spinning on it */
+				if (has_pending)
+				{
+					photo_booth_command_complete (pb->control, &pending, acted, GP_ERROR_MODEL_NOT_FOUND);
+					has_pending = FALSE;
+				}
+				photo_booth_ui_post_text (priv->ui, UI_STATUS, _("No camera connected!"));
+				_play_event_sound (priv, ERROR_SOUND);
+				GST_ERROR_OBJECT (pb, "can't take photo without a camera!");
+				photo_booth_change_state (pb, PB_EVENT_CAPTURE_FAILED);
+				photo_booth_ui_post_value (priv->ui, UI_PREVIEW, TRUE);
+				state = CAPTURE_FAILED;
+			}
 		}
 		else if (rfd[0].revents)
 		{
-			char command;
-			READ_COMMAND (pb, command, ret);
-			switch (command) {
-				case CONTROL_PAUSE:
-					GST_DEBUG_OBJECT (pb, "CONTROL_PAUSE!");
-					state = CAPTURE_PAUSED;
-					break;
-				case CONTROL_UNPAUSE:
-					GST_DEBUG_OBJECT (pb, "CONTROL_UNPAUSE!");
-					state = CAPTURE_INIT;
-					break;
-				case CONTROL_VIDEO:
-					GST_DEBUG_OBJECT (pb, "CONTROL_VIDEO");
-					state = CAPTURE_VIDEO;
-					break;
-				case CONTROL_PRETRIGGER:
-					GST_DEBUG_OBJECT (pb, "CONTROL_PRETRIGGER");
-					state = CAPTURE_PRETRIGGER;
-					break;
-				case CONTROL_PHOTO:
-					GST_DEBUG_OBJECT (pb, "CONTROL_PHOTO");
-					state = CAPTURE_PHOTO;
-					break;
-				case CONTROL_QUIT:
-					GST_DEBUG_OBJECT (pb, "CONTROL_QUIT!");
-					state = CAPTURE_QUIT;
-					break;
-				case CONTROL_REINIT:
+			PhotoBoothCommand command;
+			while (photo_booth_command_receive (pb->control, &command))
+			{
+				GST_DEBUG_OBJECT (pb, "%s #%u received after %" G_GINT64_FORMAT " us", photo_booth_command_get_name (command.type), command.seq, command.received - command.sent);
+				/* a pretrigger or photo that wasn't acted on yet is overtaken */
+				if (has_pending)
 				{
-					GST_DEBUG_OBJECT (pb, "CONTROL_REINIT!");
-					photo_booth_cam_close (&pb->cam_info);
-					photo_booth_cam_init (&pb->cam_info);
-					break;
+					photo_booth_command_complete (pb->control, &pending, 0, GP_ERROR_CANCEL);
+					has_pending = FALSE;
 				}
-				default:
-					GST_ERROR_OBJECT (pb, "illegal control socket command %c received!", command);
+				switch (command.type) {
+					case CONTROL_PAUSE:
+						state = CAPTURE_PAUSED;
+						break;
+					case CONTROL_UNPAUSE:
+						state = CAPTURE_INIT;
+						break;
+					case CONTROL_VIDEO:
+						state = CAPTURE_VIDEO;
+						break;
+					case CONTROL_PRETRIGGER:
+						state = CAPTURE_PRETRIGGER;
+						break;
+					case CONTROL_PHOTO:
+						GST_DEBUG_OBJECT (pb, "shot %u of %u", command.shot + 1, command.shots);
+						state = CAPTURE_PHOTO;
+						break;
+					case CONTROL_QUIT:
+						state = CAPTURE_QUIT;
+						break;
+					case CONTROL_REINIT:
+						photo_booth_cam_close (&pb->cam_info);
+						photo_booth_cam_init (&pb->cam_info);
+						break;
+				}
+				if (command.type == CONTROL_PRETRIGGER || command.type == CONTROL_PHOTO)
+				{
+					pending = command;
+					has_pending = TRUE;
+				}
+				else
+					photo_booth_command_complete (pb->control, &command, command.received, GP_OK);
 			}
 			continue;
 		}
@@ -979,12 +1829,12 @@ static void photo_booth_capture_thread_func (PhotoBooth *pb)
 		{
 			if (pb->cam_info)
 			{
-				GST_LOG_OBJECT (pb, "captured thread paused... close camera! %s", photo_booth_state_get_name (priv->state));
+				GST_LOG_OBJECT (pb, "captured thread paused... close camera! %s", photo_booth_state_get_name (g_atomic_int_get (&priv->state)));
 				photo_booth_cam_close (&pb->cam_info);
 // 				photo_booth_flush_pipe (pb->video_fd);
 			}
 			else
-				GST_LOG_OBJECT (pb, "captured thread paused... timeout. %s", photo_booth_state_get_name (priv->state));
+				GST_LOG_OBJECT (pb, "captured thread paused... timeout. %s", photo_booth_state_get_name (g_atomic_int_get (&priv->state)));
 			if (priv->paused_callback_id)
 			{
 				priv->paused_callback_id = 0;
@@ -1082,7 +1932,8 @@ static GstElement *build_photo_bin (PhotoBooth *pb)
 	gst_caps_unref (caps);
 
 	photo_overlay = gst_element_factory_make ("gdkpixbufoverlay", "photo-overlay");
-	if (priv->overlay_image)
+	/* layouts apply the overlay to each of their cells instead */
+	if (priv->overlay_image && !priv->layout)
 		g_object_set (photo_overlay, "location", priv->overlay_image, NULL);
 	g_object_set (photo_overlay, "overlay-width", priv->print_width, NULL);
 	g_object_set (photo_overlay, "overlay-height", priv->print_height, NULL);
@@ -1119,11 +1970,12 @@ static gboolean photo_booth_setup_gstreamer (PhotoBooth *pb)
 	PhotoBoothPrivate *priv;
 	GstBus *bus;
 	GtkWidget *gtkgstwidget;
+	GstPad *pad;
 
 	priv = photo_booth_get_instance_private (pb);
 
+	/* only what the live preview needs, the photo bin is built once it runs */
 	pb->video_bin  = build_video_bin (pb);
-	pb->photo_bin  = build_photo_bin (pb);
 
 	pb->pipeline = gst_pipeline_new ("photobooth-pipeline");
 
@@ -1140,23 +1992,91 @@ static gboolean photo_booth_setup_gstreamer (PhotoBooth *pb)
 	photo_booth_window_add_gtkgstwidget (priv->win, gtkgstwidget);
 	g_object_unref (gtkgstwidget);
 
+	/* the sink stays in the pipeline for good. the preview and photo bins
+	 * take turns on the selector's live input, the screensaver has its own */
+	priv->display_selector = gst_element_factory_make ("input-selector", "display-selector");
+	if (!priv->display_selector)
+	{
+		GST_ERROR_OBJECT (pb, "Failed to create input-selector");
+		return FALSE;
+	}
+	g_object_set (priv->display_selector, "sync-streams", FALSE, NULL);
+
 	gst_element_set_state (pb->pipeline, GST_STATE_PLAYING);
 	gst_element_set_state (pb->video_sink, GST_STATE_PLAYING);
-
-	gst_bin_add_many (GST_BIN (pb->pipeline), pb->video_bin, pb->photo_bin, pb->video_sink, NULL);
+	gst_element_set_state (priv->display_selector, GST_STATE_PLAYING);
+
+	gst_bin_add_many (GST_BIN (pb->pipeline), pb->video_bin, priv->display_selector, pb->video_sink, NULL);
+	gst_element_link (priv->display_selector, pb->video_sink);
+	priv->live_pad = gst_element_get_request_pad (priv->display_selector, "sink_%u");
+	g_object_set (priv->display_selector, "active-pad", priv->live_pad, NULL);
+	pad = gst_element_get_static_pad (pb->video_sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, photo_booth_first_frame_probe, pb, NULL);
+	gst_object_unref (pad);
 
 	/* add watch for messages */
 	bus = gst_pipeline_get_bus (GST_PIPELINE (pb->pipeline));
 	gst_bus_add_watch (bus, (GstBusFunc) photo_booth_bus_callback, pb);
 	gst_object_unref (GST_OBJECT (bus));
 
-	priv->audio_pipeline = gst_pipeline_new ("audio-pipeline");
-	priv->audio_playbin = gst_element_factory_make ("playbin", "audio-playbin");
-	gst_bin_add (GST_BIN (priv->audio_pipeline), priv->audio_playbin);
-
 	return TRUE;
 }
 
+static void photo_booth_link_display (PhotoBooth *pb, GstElement *bin)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	GstPad *pad = gst_element_get_static_pad (bin, "src");
+	GstPadLinkReturn ret = gst_pad_link (pad, priv->live_pad);
+	GST_LOG_OBJECT (pb, "linked %s to the display ret=%i", GST_ELEMENT_NAME (bin), ret);
+	gst_object_unref (pad);
+}
+
+/* releasing the selector's request pad, as gst_element_unlink would, isn't wanted here */
+static void photo_booth_unlink_display (PhotoBooth *pb, GstElement *bin)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	GstPad *pad = gst_element_get_static_pad (bin, "src");
+	gst_pad_unlink (pad, priv->live_pad);
+	gst_object_unref (pad);
+}
+
+static void photo_booth_setup_photo_bin (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	GstPad *pad;
+
+	priv = photo_booth_get_instance_private (pb);
+	if (pb->photo_bin)
+		return;
+	/* the overlay goes into the photo bin only without a layout */
+	photo_booth_preload_wait (priv->preload, "layout");
+	pb->photo_bin = build_photo_bin (pb);
+	if (!pb->photo_bin)
+		return;
+	gst_bin_add (GST_BIN (pb->pipeline), pb->photo_bin);
+	gst_element_set_state (pb->photo_bin, GST_STATE_READY);
+	pad = gst_element_get_static_pad (pb->photo_bin, "src");
+	GST_DEBUG_OBJECT (pad, "built photo_bin, halt it until the first photo");
+	priv->photo_block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, _gst_photo_probecb, pb, NULL);
+	gst_object_unref (pad);
+	photo_booth_startup_mark ("photo bin built");
+}
+
+static GstPadProbeReturn photo_booth_first_frame_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	g_idle_add ((GSourceFunc) photo_booth_first_frame, user_data);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+static gboolean photo_booth_first_frame (PhotoBooth *pb)
+{
+	photo_booth_startup_finish ("first preview frame", STARTUP_TARGET);
+	photo_booth_setup_photo_bin (pb);
+	/* prerolled now, the first screensaver starts as fast as any later one */
+	photo_booth_setup_screensaver (pb);
+	return FALSE;
+}
+
 static gboolean photo_booth_bus_callback (GstBus *bus, GstMessage *message, PhotoBooth *pb)
 {
 	GstObject *src = GST_MESSAGE_SRC (message);
@@ -1184,6 +2104,7 @@ static gboolean photo_booth_bus_callback (GstBus *bus, GstMessage *message, Phot
 			GST_ERROR ("Error: %s : %s", err->message, debug);
 			g_error_free (err);
 			g_free (debug);
+			g_free (photo_booth_trace_dump ("error", TRUE));
 
 			gtk_main_quit ();
 			break;
@@ -1212,14 +2133,10 @@ static gboolean photo_booth_bus_callback (GstBus *bus, GstMessage *message, Phot
 				GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_video_start");
 				GST_DEBUG ("video_sink GST_STATE_CHANGE_PAUSED_TO_PLAYING -> hide spinner!");
 				photo_booth_window_hide_cursor (priv->win);
-				photo_booth_window_set_spinner (priv->win, FALSE);
+				photo_booth_ui_post_value (priv->ui, UI_SPINNER, FALSE);
 			}
 			if (src == GST_OBJECT (priv->screensaver_playbin) && transition == GST_STATE_CHANGE_READY_TO_PAUSED)
-			{
-				GST_DEBUG ("screensaver_playbin GST_STATE_CHANGE_READY_TO_PAUSED last_play_pos=%" GST_TIME_FORMAT "", GST_TIME_ARGS (priv->last_play_pos));
-				if (priv->last_play_pos != GST_CLOCK_TIME_NONE)
-					gst_element_seek (priv->screensaver_playbin, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, GST_SEEK_TYPE_SET, priv->last_play_pos, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
-			}
+				GST_DEBUG ("screensaver_playbin prerolled");
 			break;
 		}
 		case GST_MESSAGE_STREAM_START:
@@ -1248,7 +2165,6 @@ static gboolean photo_booth_video_widget_ready (PhotoBooth *pb)
 	GstElement *element;
 	GstCaps *caps;
 	GdkPixbuf *overlay_pixbuf;
-	GError *error = NULL;
 
 	priv = photo_booth_get_instance_private (pb);
 	gtk_widget_get_preferred_size (priv->win->gtkgstwidget, NULL, &size);
@@ -1270,20 +2186,17 @@ static gboolean photo_booth_video_widget_ready (PhotoBooth *pb)
 	GST_DEBUG_OBJECT (pb, "gtksink widget is ready. output dimensions: %dx%d", rect.w, rect.h);
 	priv->video_size = rect;
 
-	overlay_pixbuf = gdk_pixbuf_new_from_file_at_size (priv->overlay_image, rect.w, rect.h, &error);
-	if (error) {
-		GST_ERROR_OBJECT (pb, "%s\n", error->message);
+	/* decoded in the background since startup, usually done by now */
+	photo_booth_preload_wait (priv->preload, "overlay");
+	if (!priv->overlay_pixbuf)
 		return FALSE;
-	}
-	if (gdk_pixbuf_get_width (overlay_pixbuf) != rect.w || gdk_pixbuf_get_height (overlay_pixbuf) != rect.h)
-	{
-		GST_DEBUG_OBJECT (pb, "overlay_image original dimensions %dx%d. aspect mismatch -> we need to scale!", gdk_pixbuf_get_width (overlay_pixbuf), gdk_pixbuf_get_height (overlay_pixbuf));
-		overlay_pixbuf = gdk_pixbuf_scale_simple (overlay_pixbuf, rect.w, rect.h, GDK_INTERP_BILINEAR);
-	}
+	GST_DEBUG_OBJECT (pb, "overlay_image original dimensions %dx%d", gdk_pixbuf_get_width (priv->overlay_pixbuf), gdk_pixbuf_get_height (priv->overlay_pixbuf));
+	overlay_pixbuf = gdk_pixbuf_scale_simple (priv->overlay_pixbuf, rect.w, rect.h, GDK_INTERP_BILINEAR);
 	rect.x = (size2.width-gdk_pixbuf_get_width (overlay_pixbuf))/2;
 	rect.y = (size2.height-gdk_pixbuf_get_height (overlay_pixbuf))/2;
 	GST_DEBUG_OBJECT (pb, "overlay_image's pixbuf dimensions %dx%d pos@%d,%d", gdk_pixbuf_get_width (overlay_pixbuf), gdk_pixbuf_get_height (overlay_pixbuf), rect.x, rect.y);
 	gtk_image_set_from_pixbuf (priv->win->image, overlay_pixbuf);
+	g_object_unref (overlay_pixbuf);
 	gtk_fixed_move (GTK_FIXED (gtk_widget_get_parent (GTK_WIDGET (priv->win->image))), GTK_WIDGET (priv->win->image), rect.x, 0);
 
 	return FALSE;
@@ -1293,14 +2206,14 @@ static gboolean photo_booth_preview (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
 	GstPad *pad;
-	if (!priv->photo_block_id)
+	if (pb->photo_bin && !priv->photo_block_id)
 	{
 		gst_element_set_state (pb->photo_bin, GST_STATE_READY);
 		pad = gst_element_get_static_pad (pb->photo_bin, "src");
 		GST_DEBUG_OBJECT (pad, "photo_booth_preview! halt photo_bin...");
 		priv->photo_block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, _gst_photo_probecb, pb, NULL);
 		gst_object_unref (pad);
-		gst_element_unlink (pb->photo_bin, pb->video_sink);
+		photo_booth_unlink_display (pb, pb->photo_bin);
 	}
 	if (priv->video_block_id)
 	{
@@ -1310,32 +2223,19 @@ static gboolean photo_booth_preview (PhotoBooth *pb)
 		priv->video_block_id = 0;
 		gst_object_unref (pad);
 	}
-	if (priv->sink_block_id)
-	{
-		pad = gst_element_get_static_pad (pb->video_sink, "sink");
-		GST_DEBUG_OBJECT (pad, "photo_booth_preview! unblock video_sink pad...");
-		gst_pad_remove_probe (pad, priv->sink_block_id);
-		priv->sink_block_id = 0;
-		gst_object_unref (pad);
-		gst_element_set_state (pb->video_sink, GST_STATE_PLAYING);
-	}
 	if (priv->preview_timeout_id)
 	{
 		g_source_remove (priv->preview_timeout_id);
 		GST_DEBUG_OBJECT (pb, "removing preview_timeout");
 		priv->preview_timeout_id = 0;
 	}
-	int ret = gst_element_link (pb->video_bin, pb->video_sink);
-	GST_LOG_OBJECT (pb, "linked video-bin ! video-sink ret=%i", ret);
+	photo_booth_link_display (pb, pb->video_bin);
 	gst_element_set_state (pb->video_bin, GST_STATE_PLAYING);
 	int cooldown_delay = 2000;
 	if (priv->state == PB_STATE_NONE)
 		cooldown_delay = 10;
-	if (priv->state != PB_STATE_UPLOADING)
-	{
-		photo_booth_change_state (pb, PB_STATE_PREVIEW_COOLDOWN);
-		gtk_label_set_text (priv->win->status, _("Please wait..."));
-	}
+	photo_booth_change_state (pb, PB_EVENT_PREVIEW_STARTED);
+	photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Please wait..."));
 	g_timeout_add (cooldown_delay, (GSourceFunc) photo_booth_preview_ready, pb);
 	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_preview");
 	SEND_COMMAND (pb, CONTROL_VIDEO);
@@ -1345,11 +2245,6 @@ static gboolean photo_booth_preview (PhotoBooth *pb)
 static gboolean photo_booth_preview_ready (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
-	if (priv->state == PB_STATE_UPLOADING)
-	{
-		GST_DEBUG_OBJECT (pb, "still uploading, wait another bit");
-		return TRUE;
-	}
 	if (!pb->cam_info)
 	{
 		GST_DEBUG_OBJECT (pb, "camera not ready, waiting");
@@ -1360,10 +2255,11 @@ static gboolean photo_booth_preview_ready (PhotoBooth *pb)
 		GST_DEBUG_OBJECT (pb, "wrong state");
 		return FALSE;
 	}
-	photo_booth_change_state (pb, PB_STATE_PREVIEW);
-	gtk_label_set_text (priv->win->status, _("Touch screen to take a photo!"));
+	photo_booth_change_state (pb, PB_EVENT_PREVIEW_READY);
+	photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Touch screen to take a photo!"));
 	photo_booth_window_hide_cursor (priv->win);
 	gtk_widget_show (GTK_WIDGET (priv->win->switch_flip));
+	gtk_widget_show (GTK_WIDGET (priv->win->button_gallery));
 
 	if (priv->screensaver_timeout > 0)
 		priv->screensaver_timeout_id = g_timeout_add_seconds (priv->screensaver_timeout, (GSourceFunc) photo_booth_screensaver, pb);
@@ -1378,7 +2274,10 @@ static gboolean photo_booth_screensaver (PhotoBooth *pb)
 		GST_DEBUG_OBJECT (pb, "wrong state %s", photo_booth_state_get_name (priv->state));
 		return FALSE;
 	}
-	photo_booth_change_state (pb, PB_STATE_SCREENSAVER);
+	if (photo_booth_window_get_gallery_shown (priv->win))
+		photo_booth_window_show_gallery (priv->win, FALSE);
+	gtk_widget_hide (GTK_WIDGET (priv->win->button_gallery));
+	photo_booth_change_state (pb, PB_EVENT_SCREENSAVER);
 	SEND_COMMAND (pb, CONTROL_PAUSE);
 
 	priv->screensaver_timeout_id = 0;
@@ -1387,84 +2286,198 @@ static gboolean photo_booth_screensaver (PhotoBooth *pb)
 	return FALSE;
 }
 
+/* the display shows the screensaver's last frame until the camera is back */
 static gboolean photo_booth_screensaver_stop (PhotoBooth *pb)
 {
-	photo_booth_change_state (pb, PB_STATE_NONE);
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
 
-	GstElement *src = gst_bin_get_by_name (GST_BIN (pb->video_bin), "mjpeg-fdsrc");
-	GstPad *pad;
-	pad = gst_element_get_static_pad (src, "src");
-	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_IDLE, photo_booth_screensaver_unplug_continue, pb, NULL);
-	gst_object_unref (pad);
-	gst_object_unref (src);
+	photo_booth_change_state (pb, PB_EVENT_SCREENSAVER_STOP);
+
+	g_object_set (priv->display_selector, "active-pad", priv->live_pad, NULL);
+	if (priv->slideshow)
+	{
+		photo_booth_slideshow_set_running (priv->slideshow, FALSE);
+		gst_element_set_state (priv->screensaver_bin, GST_STATE_PAUSED);
+	}
+	if (priv->screensaver_playbin)
+	{
+		gint64 position = GST_CLOCK_TIME_NONE;
+		gst_element_set_state (priv->screensaver_playbin, GST_STATE_PAUSED);
+		gst_element_set_state (priv->screensaver_bin, GST_STATE_PAUSED);
+		gst_element_query_position (priv->screensaver_playbin, GST_FORMAT_TIME, &position);
+		GST_DEBUG ("paused screensaver @ %" GST_TIME_FORMAT, GST_TIME_ARGS (position));
+	}
+	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_screensaver_stop");
+
+	SEND_COMMAND (pb, CONTROL_UNPAUSE);
 	return FALSE;
 }
 
-static GstPadProbeReturn photo_booth_screensaver_unplug_continue (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+/* source ! videoconvert on the selector's screensaver input, it runs
+ * only while the screensaver is shown */
+static gboolean photo_booth_add_screensaver_bin (PhotoBooth *pb, GstElement *source)
 {
-	PhotoBooth *pb = PHOTO_BOOTH (user_data);
 	PhotoBoothPrivate *priv;
-	priv = photo_booth_get_instance_private (pb);
+	GstElement *bin, *convert;
+	GstPad *pad, *ghost;
 
-	g_mutex_lock (&priv->processing_mutex);
-
-	GstPad *sinkpad;
-	sinkpad = gst_element_get_static_pad (pb->video_sink, "sink");
-	priv->sink_block_id = gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, _gst_video_probecb, pb, NULL);
+	priv = photo_booth_get_instance_private (pb);
+	bin = gst_element_factory_make ("bin", "screensaver-bin");
+	convert = gst_element_factory_make ("videoconvert", "screensaver-convert");
+	if (!(bin && convert))
+	{
+		GST_ERROR_OBJECT (pb, "Failed to make screensaver element(s):%s%s", bin?"":" bin", convert?"":" videoconvert");
+		if (bin)
+			gst_object_unref (bin);
+		if (convert)
+			gst_object_unref (convert);
+		return FALSE;
+	}
 
-	gst_element_query_position (priv->screensaver_playbin, GST_FORMAT_TIME, &priv->last_play_pos);
-	GST_DEBUG ("stop screensaver @ %" GST_TIME_FORMAT " %" GST_PTR_FORMAT " block_id=%lu", GST_TIME_ARGS (priv->last_play_pos), pad, priv->sink_block_id );
+	gst_bin_add_many (GST_BIN (bin), source, convert, NULL);
+	gst_element_link (source, convert);
+	pad = gst_element_get_static_pad (convert, "src");
+	ghost = gst_ghost_pad_new ("src", pad);
+	gst_object_unref (pad);
+	gst_pad_set_active (ghost, TRUE);
+	gst_element_add_pad (bin, ghost);
 
-	gst_element_set_state (priv->screensaver_playbin, GST_STATE_NULL);
-	gst_element_set_state (pb->pipeline, GST_STATE_READY);
+	g_mutex_lock (&priv->processing_mutex);
+	gst_element_set_locked_state (bin, TRUE);
+	gst_bin_add (GST_BIN (pb->pipeline), bin);
+	priv->screensaver_pad = gst_element_get_request_pad (priv->display_selector, "sink_%u");
+	gst_pad_link (ghost, priv->screensaver_pad);
+	g_mutex_unlock (&priv->processing_mutex);
 
-	gst_bin_add (GST_BIN (pb->pipeline), pb->video_sink);
-	gst_object_unref (pb->video_sink);
-	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_screensaver_stop");
+	priv->screensaver_bin = bin;
+	return TRUE;
+}
 
-	SEND_COMMAND (pb, CONTROL_UNPAUSE);
+/* the photos taken so far at the size of the window, the ones saved from
+ * now on join as they're published */
+static gboolean photo_booth_setup_slideshow (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	PhotoBoothSlideshow *slideshow;
+	GstElement *source;
+	gint width, height;
 
-	g_mutex_unlock (&priv->processing_mutex);
-	return GST_PAD_PROBE_REMOVE;
+	priv = photo_booth_get_instance_private (pb);
+	width = gtk_widget_get_allocated_width (GTK_WIDGET (priv->win));
+	height = gtk_widget_get_allocated_height (GTK_WIDGET (priv->win));
+	if (width <= 1 || height <= 1)
+	{
+		width = priv->video_size.w;
+		height = priv->video_size.h;
+	}
+	slideshow = photo_booth_slideshow_new (width, height, MAX (priv->slideshow_decode_ahead, 1), MAX (priv->slideshow_hold, 1) * 1000, MAX (priv->slideshow_fade, 0));
+	source = photo_booth_slideshow_get_source (slideshow);
+	if (!source || !photo_booth_add_screensaver_bin (pb, source))
+	{
+		photo_booth_slideshow_free (slideshow);
+		return FALSE;
+	}
+	photo_booth_preload_wait (priv->preload, "photo-index");
+	photo_booth_slideshow_set_photos (slideshow, priv->save_path_template, priv->save_filename_count);
+	g_atomic_pointer_set (&priv->slideshow, slideshow);
+	GST_DEBUG_OBJECT (pb, "slideshow screensaver set up at %dx%d with %u photos", width, height, priv->save_filename_count);
+	return TRUE;
 }
 
-static gboolean photo_booth_capture_paused_cb (PhotoBooth *pb)
+/* one player for the whole run, it's prerolled once and after that only
+ * ever paused and resumed where it was. its frames reach the display
+ * through an intervideosink and the selector's screensaver input */
+static gboolean photo_booth_setup_screensaver (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv;
+	GstElement *player, *intersink, *intersrc;
+	GstBus *bus;
+
 	priv = photo_booth_get_instance_private (pb);
+	if (priv->screensaver_bin)
+		return TRUE;
+	if (!pb->pipeline)
+		return FALSE;
+	if (priv->screensaver_slideshow)
+		return photo_booth_setup_slideshow (pb);
+	if (!priv->screensaver_uri)
+		return FALSE;
 
-	g_mutex_lock (&priv->processing_mutex);
-	gst_element_unlink (pb->video_bin, pb->video_sink);
-	GST_DEBUG_OBJECT (pb, "continue plugging screensaver pipeline");
+	player = gst_element_factory_make ("playbin", "screensaver-playbin");
+	intersink = gst_element_factory_make ("intervideosink", "screensaver-intersink");
+	intersrc = gst_element_factory_make ("intervideosrc", "screensaver-intersrc");
+	if (!(player && intersink && intersrc))
+	{
+		GST_ERROR_OBJECT (pb, "Failed to make screensaver element(s):%s%s%s", player?"":" playbin", intersink?"":" intervideosink", intersrc?"":" intervideosrc");
+		if (player)
+			gst_object_unref (player);
+		if (intersink)
+			gst_object_unref (intersink);
+		if (intersrc)
+			gst_object_unref (intersrc);
+		return FALSE;
+	}
 
-	if (priv->sink_block_id)
+	g_object_set (intersink, "channel", SCREENSAVER_CHANNEL, NULL);
+	g_object_set (intersrc, "channel", SCREENSAVER_CHANNEL, NULL);
+	g_object_set (player, "uri", priv->screensaver_uri, "video-sink", intersink, NULL);
+	if (!photo_booth_add_screensaver_bin (pb, intersrc))
 	{
-		GstPad *sinkpad;
-		sinkpad = gst_element_get_static_pad (pb->video_sink, "sink");
-		GST_DEBUG_OBJECT (sinkpad, "showing screensaver! unblock video_sink...");
-		gst_pad_remove_probe (sinkpad, priv->sink_block_id);
-		priv->sink_block_id = 0;
-		gst_object_unref (sinkpad);
-		gst_element_set_state (pb->video_sink, GST_STATE_PLAYING);
+		gst_object_unref (intersrc);
+		gst_object_unref (player);
+		return FALSE;
 	}
 
-	priv->screensaver_playbin = gst_element_factory_make ("playbin", "screensaver-playbin");
-	gst_object_ref (pb->video_sink);
-	gst_bin_remove (GST_BIN (pb->pipeline), pb->video_sink);
-	g_object_set (priv->screensaver_playbin, "video-sink", pb->video_sink, NULL);
+	bus = gst_pipeline_get_bus (GST_PIPELINE (player));
+	priv->screensaver_bus_watch = gst_bus_add_watch (bus, (GstBusFunc) photo_booth_bus_callback, pb);
+	gst_object_unref (GST_OBJECT (bus));
+
+	priv->screensaver_playbin = player;
+	gst_element_set_state (player, GST_STATE_PAUSED);
+	GST_DEBUG_OBJECT (pb, "screensaver player set up for %s", priv->screensaver_uri);
+	return TRUE;
+}
 
-	if (priv->screensaver_uri)
-		g_object_set (priv->screensaver_playbin, "uri", priv->screensaver_uri, NULL);
-	gst_element_set_state (priv->screensaver_playbin, GST_STATE_PLAYING);
+static GstPadProbeReturn photo_booth_screensaver_shown (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv;
+	gint64 elapsed;
+	priv = photo_booth_get_instance_private (pb);
 
-	GstBus *bus;
-	bus = gst_pipeline_get_bus (GST_PIPELINE (priv->screensaver_playbin));
-	gst_bus_add_watch (bus, (GstBusFunc) photo_booth_bus_callback, pb);
-	gst_object_unref (GST_OBJECT (bus));
+	elapsed = g_get_monotonic_time () - priv->screensaver_switch_start;
+	photo_booth_histogram_observe (priv->screensaver_switch_time, (gdouble) elapsed / G_USEC_PER_SEC);
+	if (elapsed > SCREENSAVER_SWITCH_TARGET)
+		GST_WARNING_OBJECT (pb, "screensaver took %" G_GINT64_FORMAT " ms to show", elapsed / 1000);
+	else
+		GST_DEBUG_OBJECT (pb, "screensaver shown after %" G_GINT64_FORMAT " ms", elapsed / 1000);
+	g_atomic_int_set (&priv->screensaver_probe_pending, 0);
+	return GST_PAD_PROBE_REMOVE;
+}
 
-	gtk_label_set_text (priv->win->status, _("Touch screen to take a photo!"));
+static gboolean photo_booth_capture_paused_cb (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
 
-	g_mutex_unlock (&priv->processing_mutex);
+	if (photo_booth_setup_screensaver (pb))
+	{
+		GST_DEBUG_OBJECT (pb, "resume screensaver");
+		priv->screensaver_switch_start = g_get_monotonic_time ();
+		if (g_atomic_int_compare_and_exchange (&priv->screensaver_probe_pending, 0, 1))
+			gst_pad_add_probe (priv->screensaver_pad, GST_PAD_PROBE_TYPE_BUFFER, photo_booth_screensaver_shown, pb, NULL);
+		if (priv->slideshow)
+			photo_booth_slideshow_set_running (priv->slideshow, TRUE);
+		gst_element_set_state (priv->screensaver_bin, GST_STATE_PLAYING);
+		if (priv->screensaver_playbin)
+			gst_element_set_state (priv->screensaver_playbin, GST_STATE_PLAYING);
+		g_object_set (priv->display_selector, "active-pad", priv->screensaver_pad, NULL);
+	}
+	else
+		GST_WARNING_OBJECT (pb, "no screensaver to show");
+
+	photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Touch screen to take a photo!"));
 	return FALSE;
 }
 
@@ -1475,6 +2488,12 @@ void photo_booth_background_clicked (GtkWidget *widget, GdkEventButton *event, P
 	priv = photo_booth_get_instance_private (pb);
 	GST_INFO_OBJECT (pb, "background clicked in state %s", photo_booth_state_get_name (priv->state));
 
+	/* the gallery lies in the overlay too, its taps are for browsing */
+	if (photo_booth_window_get_gallery_shown (win))
+	{
+		GST_DEBUG_OBJECT (pb, "gallery shown, ignore");
+		return;
+	}
 	if (priv->screensaver_timeout_id)
 	{
 		g_source_remove (priv->screensaver_timeout_id);
@@ -1502,7 +2521,7 @@ void photo_booth_background_clicked (GtkWidget *widget, GdkEventButton *event, P
 			break;
 		}
 		case PB_STATE_ASK_PRINT:
-			g_timeout_add_seconds (15, (GSourceFunc) photo_booth_get_printer_status, pb);
+			g_timeout_add_seconds (15, (GSourceFunc) photo_booth_refresh_printer_status, pb);
 		case PB_STATE_ASK_UPLOAD:
 		{
 // 			photo_booth_button_cancel_clicked (pb);
@@ -1527,7 +2546,7 @@ void photo_booth_background_clicked (GtkWidget *widget, GdkEventButton *event, P
 	}
 
 // 	if (priv->prints_remaining < 1)
-// 		photo_booth_get_printer_status (pb);
+// 		photo_booth_refresh_printer_status (pb);
 }
 
 void photo_booth_flip_switched (GtkSwitch *widget, gboolean state, PhotoBoothWindow *win)
@@ -1543,9 +2562,20 @@ void photo_booth_flip_switched (GtkSwitch *widget, gboolean state, PhotoBoothWin
 }
 
 
-static gboolean photo_booth_get_printer_status (PhotoBooth *pb)
+/* the backend can take seconds to query the printer, so it's asked on a
+ * preload thread and the label is updated once it answered */
+static gboolean photo_booth_refresh_printer_status (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	photo_booth_preload_add (priv->preload, "printer-status", (PhotoBoothPreloadFunc) photo_booth_get_printer_status,
+		(PhotoBoothPreloadDoneFunc) photo_booth_printer_status_done, (GDestroyNotify) photo_booth_printer_status_free, pb);
+	return FALSE;
+}
+
+static PhotoBoothPrinterStatus *photo_booth_get_printer_status (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	PhotoBoothPrinterStatus *status;
 	gchar *label_string;
 	gchar *backend_environment = g_strdup_printf ("BACKEND=%s", priv->printer_backend);
 	gchar *argv[] = { "/usr/lib/cups/backend/gutenprint52+usb", "-m", NULL };
@@ -1568,7 +2598,10 @@ static gboolean photo_booth_get_printer_status (PhotoBooth *pb)
 			regex = g_regex_new ("INFO: Media type\\s.*?: (?<code>\\d+) \\((?<size>.*?)\\)\nINFO: Media remaining\\s.*?: (?<remain>\\d{3})/(?<total>\\d{3})\n", G_REGEX_MULTILINE|G_REGEX_DOTALL, 0, &error);
 			if (error) {
 				g_critical ("%s\n", error->message);
-				return FALSE;
+				g_error_free (error);
+				g_free (output);
+				g_free (backend_environment);
+				return NULL;
 			}
 			if (g_regex_match (regex, output, 0, &match_info))
 			{
@@ -1606,11 +2639,27 @@ static gboolean photo_booth_get_printer_status (PhotoBooth *pb)
 		GST_ERROR_OBJECT (pb, "%s  %s %s (%s)", label_string, argv[1], envp[0], error->message);
 		g_error_free (error);
 	}
-	priv->prints_remaining = remain;
-	gtk_label_set_text (priv->win->status_printer, label_string);
-	g_free (label_string);
+	status = g_new0 (PhotoBoothPrinterStatus, 1);
+	status->label = label_string;
+	status->remaining = remain;
 	g_free (backend_environment);
-	return FALSE;
+	return status;
+}
+
+static void photo_booth_printer_status_done (PhotoBoothPrinterStatus *status, PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	if (!status)
+		return;
+	priv->prints_remaining = status->remaining;
+	gtk_label_set_text (priv->win->status_printer, status->label);
+	photo_booth_printer_status_free (status);
+}
+
+static void photo_booth_printer_status_free (PhotoBoothPrinterStatus *status)
+{
+	g_free (status->label);
+	g_free (status);
 }
 
 static void photo_booth_snapshot_start (PhotoBooth *pb)
@@ -1618,27 +2667,40 @@ static void photo_booth_snapshot_start (PhotoBooth *pb)
 	PhotoBoothPrivate *priv;
 	guint pretrigger_delay = 1;
 	guint snapshot_delay   = 2;
+	guint32 countdown;
+	gint64 start;
 
 	priv = photo_booth_get_instance_private (pb);
-	photo_booth_change_state (pb, PB_STATE_COUNTDOWN);
-	photo_booth_window_start_countdown (priv->win, priv->countdown);
+	/* normally all there since the first preview frame */
+	photo_booth_preload_wait (priv->preload, "photo-index");
+	photo_booth_setup_photo_bin (pb);
+	countdown = priv->layout_shot ? priv->layout_countdown : priv->countdown;
+	if (priv->layout && priv->layout_shot == 0)
+		photo_booth_layout_begin (priv->layout);
+	/* normally decoded long before the first countdown */
+	photo_booth_preload_wait (priv->preload, "countdown-audio");
+	photo_booth_change_state (pb, PB_EVENT_COUNTDOWN);
+	start = g_get_monotonic_time ();
+	photo_booth_window_start_countdown (priv->win, countdown);
 	gtk_widget_hide (GTK_WIDGET (priv->win->switch_flip));
+	gtk_widget_hide (GTK_WIDGET (priv->win->button_gallery));
+	if (photo_booth_window_get_gallery_shown (priv->win))
+		photo_booth_window_show_gallery (priv->win, FALSE);
 
-	if (priv->countdown > 1)
+	if (countdown > 1)
 	{
-		pretrigger_delay = (priv->countdown*1000)-1000;
-		snapshot_delay = (priv->countdown*1000)-5;
+		pretrigger_delay = (countdown*1000)-1000;
+		snapshot_delay = (countdown*1000)-5;
 	}
-	GST_DEBUG_OBJECT (pb, "started countdown of %d seconds, pretrigger in %d ms, snapshot in %d ms", priv->countdown, pretrigger_delay, snapshot_delay);
+	GST_DEBUG_OBJECT (pb, "started countdown of %d seconds, pretrigger in %d ms, snapshot in %d ms", countdown, pretrigger_delay, snapshot_delay);
+	priv->snapshot_due = start + snapshot_delay * (gint64) 1000;
 	g_timeout_add (pretrigger_delay, (GSourceFunc) photo_booth_snapshot_prepare, pb);
 	g_timeout_add (snapshot_delay,   (GSourceFunc) photo_booth_snapshot_trigger, pb);
 
-	if (priv->countdown_audio_uri)
-	{
-		g_object_set (priv->audio_playbin, "uri", priv->countdown_audio_uri, NULL);
-		gst_element_set_state (priv->audio_pipeline, GST_STATE_PLAYING);
-	}
-	photo_booth_led_countdown (priv->led, priv->countdown);
+	/* on the clock the digits and the trigger count on */
+	if (priv->countdown_cue)
+		photo_booth_cue_play (priv->countdown_cue, start);
+	photo_booth_led_countdown (priv->led, countdown);
 }
 
 static gboolean photo_booth_snapshot_prepare (PhotoBooth *pb)
@@ -1648,12 +2710,17 @@ static gboolean photo_booth_snapshot_prepare (PhotoBooth *pb)
 	GST_DEBUG_OBJECT (pb, "photo_booth_snapshot_prepare!");
 	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_pre_snapshot");
 
-	photo_booth_change_state (pb, PB_STATE_TAKING_PHOTO);
+	photo_booth_change_state (pb, PB_EVENT_PRETRIGGER);
 
 	priv = photo_booth_get_instance_private (pb);
-	photo_booth_window_set_spinner (priv->win, TRUE);
+	photo_booth_ui_post_value (priv->ui, UI_SPINNER, TRUE);
 
-	SEND_COMMAND (pb, CONTROL_PRETRIGGER);
+	{
+		PhotoBoothCommand command = { 0, };
+		command.type = CONTROL_PRETRIGGER;
+		command.deadline = priv->snapshot_due;
+		photo_booth_command_send (pb->control, &command);
+	}
 
 	return FALSE;
 }
@@ -1667,11 +2734,19 @@ static gboolean photo_booth_snapshot_trigger (PhotoBooth *pb)
 
 	priv = photo_booth_get_instance_private (pb);
 
-	gst_element_set_state ((priv->audio_pipeline), GST_STATE_READY);
+	if (priv->countdown_cue)
+		photo_booth_cue_stop (priv->countdown_cue);
 
-	gtk_widget_hide (GTK_WIDGET (priv->win->gtkgstwidget));
+	photo_booth_ui_post_value (priv->ui, UI_PREVIEW, FALSE);
 
-	SEND_COMMAND (pb, CONTROL_PHOTO);
+	priv->trigger_time = g_get_monotonic_time ();
+	{
+		PhotoBoothCommand command = { 0, };
+		command.type = CONTROL_PHOTO;
+		command.shot = priv->layout_shot;
+		command.shots = priv->layout ? photo_booth_layout_get_shots (priv->layout) : 1;
+		photo_booth_command_send (pb->control, &command);
+	}
 
 	GST_DEBUG_OBJECT (pb, "preparing for snapshot...");
 
@@ -1724,17 +2799,24 @@ static gboolean photo_booth_take_photo (PhotoBooth *pb)
 	CameraFile *file;
 	CameraFilePath camera_file_path;
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	guint64 trace_start;
 
 	g_mutex_lock (&pb->cam_info->mutex);
+	trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
 	gpret = gp_camera_capture (pb->cam_info->camera, GP_CAPTURE_IMAGE, &camera_file_path, pb->cam_info->context);
+	PHOTO_BOOTH_TRACE_END (trace_start, "capture", priv->save_filename_count + 1);
 	GST_DEBUG_OBJECT (pb, "gp_camera_capture gpret=%i Pathname on the camera: %s/%s", gpret, camera_file_path.folder, camera_file_path.name);
 	if (gpret < 0)
 		goto fail;
+	priv->exposure_time = g_get_monotonic_time ();
+	photo_booth_histogram_observe (priv->countdown_to_exposure, (gdouble) (priv->exposure_time - priv->trigger_time) / G_USEC_PER_SEC);
 
 	gpret = gp_file_new (&file);
 	GST_DEBUG_OBJECT (pb, "gp_file_new gpret=%i", gpret);
 
+	trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
 	gpret = gp_camera_file_get (pb->cam_info->camera, camera_file_path.folder, camera_file_path.name, GP_FILE_TYPE_NORMAL, file, pb->cam_info->context);
+	PHOTO_BOOTH_TRACE_END (trace_start, "download", priv->save_filename_count + 1);
 	GST_DEBUG_OBJECT (pb, "gp_camera_file_get gpret=%i", gpret);
 	if (gpret < 0)
 		goto fail;
@@ -1766,12 +2848,50 @@ static gboolean photo_booth_snapshot_taken (PhotoBooth *pb)
 	GstBuffer *buffer;
 	GstFlowReturn flowret;
 	GstPad *pad;
+	GError *error = NULL;
+	gchar *data = pb->cam_info->data;
+	gsize size = pb->cam_info->size;
+	guint64 trace_start;
+
+	if (priv->layout)
+	{
+		/* the layout keeps its own copy of the shot */
+		photo_booth_layout_add_shot (priv->layout, priv->layout_shot++, pb->cam_info->data, pb->cam_info->size);
+		if (priv->layout_shot < photo_booth_layout_get_shots (priv->layout))
+		{
+			g_free (pb->cam_info->data);
+			pb->cam_info->data = NULL;
+			pb->cam_info->size = 0;
+			GST_DEBUG_OBJECT (pb, "took shot %u of %u, back to live preview for the next one", priv->layout_shot, photo_booth_layout_get_shots (priv->layout));
+			SEND_COMMAND (pb, CONTROL_VIDEO);
+			photo_booth_ui_post_value (priv->ui, UI_SPINNER, FALSE);
+			photo_booth_ui_post_value (priv->ui, UI_PREVIEW, TRUE);
+			photo_booth_snapshot_start (pb);
+			return FALSE;
+		}
+		priv->layout_shot = 0;
+		trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+		if (!photo_booth_layout_finish (priv->layout, &data, &size, &error))
+		{
+			GST_ERROR_OBJECT (pb, "couldn't compose layout: %s", error->message);
+			g_error_free (error);
+			data = pb->cam_info->data;
+			size = pb->cam_info->size;
+		}
+		else
+		{
+			g_free (pb->cam_info->data);
+			pb->cam_info->data = NULL;
+			pb->cam_info->size = 0;
+		}
+		PHOTO_BOOTH_TRACE_END (trace_start, "composite", priv->save_filename_count + 1);
+	}
 
 	gst_element_set_state (pb->video_bin, GST_STATE_READY);
 	pad = gst_element_get_static_pad (pb->video_bin, "src");
 	priv->video_block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, _gst_video_probecb, pb, NULL);
 	gst_object_unref (pad);
-	gst_element_unlink (pb->video_bin, pb->video_sink);
+	photo_booth_unlink_display (pb, pb->video_bin);
 
 	if (priv->photo_block_id)
 	{
@@ -1781,15 +2901,16 @@ static gboolean photo_booth_snapshot_taken (PhotoBooth *pb)
 		gst_object_unref (pad);
 	}
 
-	gst_element_link (pb->photo_bin, pb->video_sink);
+	photo_booth_link_display (pb, pb->photo_bin);
 	gst_element_set_state (pb->photo_bin, GST_STATE_PLAYING);
 
 	priv->photos_taken++;
-	GST_DEBUG_OBJECT (pb, "photo_booth_snapshot_taken size=%lu photos_taken=%i", pb->cam_info->size, priv->photos_taken);
-	gtk_label_set_text (priv->win->status, _("Processing photo..."));
+	GST_DEBUG_OBJECT (pb, "photo_booth_snapshot_taken size=%" G_GSIZE_FORMAT " photos_taken=%i", size, priv->photos_taken);
+	photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Processing photo..."));
 
 	appsrc = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-appsrc");
-	buffer = gst_buffer_new_wrapped (pb->cam_info->data, pb->cam_info->size);
+	buffer = gst_buffer_new_wrapped (data, size);
+	priv->trace_decode = PHOTO_BOOTH_TRACE_BEGIN ();
 	g_signal_emit_by_name (appsrc, "push-buffer", buffer, &flowret);
 
 	if (flowret != GST_FLOW_OK)
@@ -1798,6 +2919,8 @@ static gboolean photo_booth_snapshot_taken (PhotoBooth *pb)
 
 	gst_element_set_state (pb->photo_bin, GST_STATE_PLAYING);
 	pad = gst_element_get_static_pad (pb->photo_bin, "src");
+	g_atomic_int_set (&priv->photo_buffers, 0);
+	g_atomic_int_set (&priv->photo_branches_done, 0);
 	priv->photo_block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, photo_booth_catch_photo_buffer, pb, NULL);
 
 	return FALSE;
@@ -1808,77 +2931,84 @@ static GstPadProbeReturn photo_booth_catch_photo_buffer (GstPad * pad, GstPadPro
 	PhotoBooth *pb = PHOTO_BOOTH (user_data);
 	PhotoBoothPrivate *priv;
 	GstPadProbeReturn ret = GST_PAD_PROBE_PASS;
+	gint64 start = g_get_monotonic_time ();
 	priv = photo_booth_get_instance_private (pb);
 
-	GST_LOG_OBJECT (pb, "probe function in state %s... locking", photo_booth_state_get_name (priv->state));
-	g_mutex_lock (&priv->processing_mutex);
-	switch (priv->state) {
-		case PB_STATE_TAKING_PHOTO:
+	GST_LOG_OBJECT (pb, "probe function in state %s", photo_booth_state_get_name (g_atomic_int_get (&priv->state)));
+	/* counts buffers rather than looking at the state, which only changes
+	 * once the main thread got to the event. the probe never touches the
+	 * graph, so it doesn't wait for the main thread plugging elements */
+	switch (g_atomic_int_add (&priv->photo_buffers, 1)) {
+		case 0:
 		{
+			PHOTO_BOOTH_TRACE_END (priv->trace_decode, "decode", priv->save_filename_count + 1);
+			priv->display_time = g_get_monotonic_time ();
+			photo_booth_histogram_observe (priv->exposure_to_display, (gdouble) (priv->display_time - priv->exposure_time) / G_USEC_PER_SEC);
+			/* only the main thread may send commands */
 			if (priv->cam_reeinit_after_snapshot)
-				SEND_COMMAND (pb, CONTROL_REINIT);
-			photo_booth_change_state (pb, PB_STATE_PROCESS_PHOTO);
+				g_main_context_invoke (NULL, (GSourceFunc) photo_booth_reinit_camera, pb);
 			GST_DEBUG_OBJECT (pb, "first buffer caught -> display in sink, invoke processing");
-			if (priv->print_copies_max)
-			{
-				gtk_widget_show (GTK_WIDGET (priv->win->button_print));
-			}
-			g_main_context_invoke (NULL, (GSourceFunc) photo_booth_process_photo_plug_elements, pb);
-			if (priv->preview_timeout > 0)
-				priv->preview_timeout_id = g_timeout_add_seconds (priv->preview_timeout, (GSourceFunc) photo_booth_cancel, pb);
-			gtk_widget_show (GTK_WIDGET (priv->win->button_cancel));
-			photo_booth_window_show_cursor (priv->win);
+			photo_booth_change_state (pb, PB_EVENT_PHOTO_SHOWN);
 			break;
 		}
-		case PB_STATE_PROCESS_PHOTO:
+		case 1:
 		{
-			photo_booth_change_state (pb, PB_STATE_ASK_PRINT);
 			GST_DEBUG_OBJECT (pb, "second buffer caught -> will be caught for printing. waiting for answer, hide spinner");
-			if (priv->print_copies_min != priv->print_copies_max)
-				photo_booth_window_set_copies_show (priv->win, priv->print_copies_min, priv->print_copies_max, priv->print_copies_default);
-			photo_booth_window_set_spinner (priv->win, FALSE);
+			photo_booth_histogram_observe (priv->processing_time, (gdouble) (g_get_monotonic_time () - priv->display_time) / G_USEC_PER_SEC);
+			photo_booth_change_state (pb, PB_EVENT_PHOTO_PROCESSED);
 			break;
 		}
-		case PB_STATE_ASK_PRINT:
+		default:
 		{
-			GST_DEBUG_OBJECT (pb, "third buffer caught -> okay this is enough, remove processing elements and probe");
-			g_main_context_invoke (NULL, (GSourceFunc) photo_booth_process_photo_remove_elements, pb);
+			GST_DEBUG_OBJECT (pb, "third buffer caught -> okay this is enough, remove processing elements and probe once the file is saved");
+			photo_booth_photo_branch_done (pb, PHOTO_BRANCH_DISPLAYED);
 			ret = GST_PAD_PROBE_REMOVE;
 			break;
 		}
-		default:
-			break;
 	}
-	g_mutex_unlock (&priv->processing_mutex);
-	GST_LOG_OBJECT (pb, "probe function in state %s... unlocked", photo_booth_state_get_name (priv->state));
+	photo_booth_histogram_observe (priv->streaming_callback_time, (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC);
 	return ret;
 }
 
 static gboolean photo_booth_process_photo_plug_elements (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv;
-	GstElement *tee, *encoder, *filesink, *lcms, *appsink;
+	GstElement *tee, *filequeue, *encoder, *fileappsink, *lcms, *appsink;
+	gint64 locked;
 	priv = photo_booth_get_instance_private (pb);
 
 	GST_DEBUG_OBJECT (pb, "plugging photo processing elements. locking...");
+	photo_booth_free_print_buffer (pb);
 	g_mutex_lock (&priv->processing_mutex);
+	locked = g_get_monotonic_time ();
 	encoder = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-encoder");
 	tee = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-tee");
 
+	/* the queue gives the file branch its own streaming thread, so
+	 * encoding and a backed up writer never hold up display or print */
+	filequeue = gst_element_factory_make ("queue", "photo-file-queue");
 	encoder = gst_element_factory_make ("jpegenc", "photo-encoder");
-	filesink = gst_element_factory_make ("filesink", "photo-filesink");
-	if (!encoder || !filesink)
+	fileappsink = gst_element_factory_make ("appsink", "photo-file-appsink");
+	if (!filequeue || !encoder || !fileappsink)
 		GST_ERROR_OBJECT (pb->photo_bin, "Failed to make photo encoder");
 	priv->save_filename_count++;
-	gchar *filename = g_strdup_printf (priv->save_path_template, priv->save_filename_count);
-	GST_INFO_OBJECT (pb->photo_bin, "saving photo to '%s'", filename);
-	g_object_set (filesink, "location", filename, NULL);
-	g_free (filename);
-
-	gst_bin_add_many (GST_BIN (pb->photo_bin), encoder, filesink, NULL);
+	g_free (priv->save_filename);
+	priv->save_filename = g_strdup_printf (priv->save_path_template, priv->save_filename_count);
+	GST_INFO_OBJECT (pb->photo_bin, "saving photo to '%s'", priv->save_filename);
+	if (priv->photo_index)
+		photo_booth_index_add (priv->photo_index, priv->save_filename_count, priv->save_filename);
+	g_object_set_data_full (G_OBJECT (fileappsink), "filename", g_strdup (priv->save_filename), g_free);
+	g_object_set_data (G_OBJECT (fileappsink), "number", GUINT_TO_POINTER (priv->save_filename_count));
+	g_object_set (G_OBJECT (fileappsink), "emit-signals", TRUE, "enable-last-sample", FALSE, "sync", FALSE, NULL);
+	g_signal_connect (fileappsink, "new-sample", G_CALLBACK (photo_booth_catch_file_buffer), pb);
+	priv->trace_encode = PHOTO_BOOTH_TRACE_BEGIN ();
+
+	gst_bin_add_many (GST_BIN (pb->photo_bin), filequeue, encoder, fileappsink, NULL);
 	tee = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-tee");
-	if (!gst_element_link_many (tee, encoder, filesink, NULL))
+	if (!gst_element_link_many (tee, filequeue, encoder, fileappsink, NULL))
 		GST_ERROR_OBJECT (pb->photo_bin, "couldn't link photobin filewrite elements!");
+	if (priv->web_encoder)
+		photo_booth_plug_web_elements (pb, tee);
 
 	lcms = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "print-lcms");
 	if (!lcms)
@@ -1923,7 +3053,8 @@ static gboolean photo_booth_process_photo_plug_elements (PhotoBooth *pb)
 	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_process_photo_plug_elements");
 
 	g_mutex_unlock (&priv->processing_mutex);
-	GST_DEBUG_OBJECT (pb, "plugged photo processing elements and unlocked.");
+	photo_booth_histogram_observe (priv->processing_lock_time, (gdouble) (g_get_monotonic_time () - locked) / G_USEC_PER_SEC);
+	GST_DEBUG_OBJECT (pb, "plugged photo processing elements and unlocked after %" G_GINT64_FORMAT " us.", g_get_monotonic_time () - locked);
 	return FALSE;
 }
 
@@ -1932,37 +3063,193 @@ static GstFlowReturn photo_booth_catch_print_buffer (GstElement * appsink, gpoin
 	PhotoBooth *pb;
 	PhotoBoothPrivate *priv;
 	GstSample *sample;
-	GstPad *pad;
+	GstBuffer *buffer;
+	gint64 start = g_get_monotonic_time ();
 
 	pb = PHOTO_BOOTH (user_data);
 	priv = photo_booth_get_instance_private (pb);
-	g_mutex_lock (&priv->processing_mutex);
 	sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
-	priv->print_buffer = gst_buffer_ref( gst_sample_get_buffer (sample));
+	if (!sample)
+		return GST_FLOW_OK;
+	/* imagefreeze repeats the frame, only the first one is published. the
+	 * main thread empties the slot before the next photo */
+	buffer = gst_buffer_ref (gst_sample_get_buffer (sample));
+	if (g_atomic_pointer_compare_and_exchange (&priv->print_buffer, NULL, buffer))
+		GST_DEBUG_OBJECT (pb, "got photo for printer: %" GST_PTR_FORMAT ". caps = %" GST_PTR_FORMAT "", buffer, gst_sample_get_caps (sample));
+	else
+		gst_buffer_unref (buffer);
+	gst_sample_unref (sample);
+	photo_booth_histogram_observe (priv->streaming_callback_time, (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC);
+	return GST_FLOW_OK;
+}
 
-	pad = gst_element_get_static_pad (appsink, "sink");
-	GstCaps *caps = gst_pad_get_current_caps (pad);
-	GST_DEBUG_OBJECT (pb, "got photo for printer: %" GST_PTR_FORMAT ". caps = %" GST_PTR_FORMAT "", priv->print_buffer, caps);
+/* hands the encoded photo to the writer thread. imagefreeze repeats the
+ * frame until the processing elements are removed, only the first is saved */
+static GstFlowReturn photo_booth_catch_file_buffer (GstElement * appsink, gpointer user_data)
+{
+	PhotoBooth *pb;
+	PhotoBoothPrivate *priv;
+	GstSample *sample;
+
+	pb = PHOTO_BOOTH (user_data);
+	priv = photo_booth_get_instance_private (pb);
+	sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
+	if (!sample)
+		return GST_FLOW_OK;
+	if (!g_object_get_data (G_OBJECT (appsink), "written"))
+	{
+		guint number = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (appsink), "number"));
+		GError *error = NULL;
+		gboolean queued;
+		PHOTO_BOOTH_TRACE_END (priv->trace_encode, "encode", number);
+		queued = photo_booth_writer_push (priv->writer, gst_sample_get_buffer (sample), g_object_get_data (G_OBJECT (appsink), "filename"), number, &error);
+		if (!queued)
+		{
+			GST_ERROR_OBJECT (pb, "photo %u not saved: %s", number, error->message);
+			photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Saving photo failed!"));
+			g_error_free (error);
+		}
+		g_object_set_data (G_OBJECT (appsink), "written", GINT_TO_POINTER (TRUE));
+		photo_booth_photo_branch_done (pb, PHOTO_BRANCH_SAVED);
+		/* kept for uploading it straight from memory, the file may not
+		 * even be published yet when the guest asks for it */
+		if (queued && priv->upload_queue)
+		{
+			g_mutex_lock (&priv->upload_mutex);
+			gst_buffer_replace (&priv->upload_photo, gst_sample_get_buffer (sample));
+			priv->upload_photo_number = number;
+			g_mutex_unlock (&priv->upload_mutex);
+		}
+	}
+	gst_sample_unref (sample);
+	return GST_FLOW_OK;
+}
+
+/* the web variant branch scales and converts on its own streaming thread
+ * and hands the first frame to the web encoder. it's leaky, so it can
+ * never back up the tee */
+static void photo_booth_plug_web_elements (PhotoBooth *pb, GstElement *tee)
+{
+	PhotoBoothPrivate *priv;
+	GstElement *webqueue, *webscale, *webconvert, *webfilter, *webappsink;
+	GstCaps *caps;
+	gint width, height;
+	priv = photo_booth_get_instance_private (pb);
+
+	webqueue = gst_element_factory_make ("queue", "photo-web-queue");
+	webscale = gst_element_factory_make ("videoscale", "photo-web-scale");
+	webconvert = gst_element_factory_make ("videoconvert", "photo-web-convert");
+	webfilter = gst_element_factory_make ("capsfilter", "photo-web-capsfilter");
+	webappsink = gst_element_factory_make ("appsink", "photo-web-appsink");
+	if (!webqueue || !webscale || !webconvert || !webfilter || !webappsink)
+	{
+		GST_ERROR_OBJECT (pb->photo_bin, "Failed to make web variant elements");
+		return;
+	}
+	g_object_set (G_OBJECT (webqueue), "leaky", 2, "max-size-buffers", 1, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+	photo_booth_web_encoder_get_size (priv->web_max_edge, priv->print_width, priv->print_height, &width, &height);
+	caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "RGB", "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+	g_object_set (G_OBJECT (webfilter), "caps", caps, NULL);
 	gst_caps_unref (caps);
+	g_object_set_data_full (G_OBJECT (webappsink), "filename", g_strdup (priv->save_filename), g_free);
+	g_object_set_data (G_OBJECT (webappsink), "number", GUINT_TO_POINTER (priv->save_filename_count));
+	g_object_set (G_OBJECT (webappsink), "emit-signals", TRUE, "enable-last-sample", FALSE, "sync", FALSE, "max-buffers", 1, "drop", TRUE, NULL);
+	g_signal_connect (webappsink, "new-sample", G_CALLBACK (photo_booth_catch_web_buffer), pb);
+
+	gst_bin_add_many (GST_BIN (pb->photo_bin), webqueue, webscale, webconvert, webfilter, webappsink, NULL);
+	if (!gst_element_link_many (tee, webqueue, webscale, webconvert, webfilter, webappsink, NULL))
+		GST_ERROR_OBJECT (pb->photo_bin, "couldn't link photobin web variant elements!");
+}
+
+static void photo_booth_remove_web_elements (PhotoBooth *pb, GstElement *tee)
+{
+	const gchar *names[] = { "photo-web-queue", "photo-web-scale", "photo-web-convert", "photo-web-capsfilter", "photo-web-appsink" };
+	GstElement *elements[G_N_ELEMENTS (names)];
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (names); i++)
+	{
+		elements[i] = gst_bin_get_by_name (GST_BIN (pb->photo_bin), names[i]);
+		if (!elements[i])
+		{
+			while (i--)
+				gst_object_unref (elements[i]);
+			return;
+		}
+	}
+	gst_element_unlink (tee, elements[0]);
+	for (i = 0; i < G_N_ELEMENTS (names); i++)
+	{
+		if (i + 1 < G_N_ELEMENTS (names))
+			gst_element_unlink (elements[i], elements[i + 1]);
+		gst_bin_remove (GST_BIN (pb->photo_bin), elements[i]);
+		gst_element_set_state (elements[i], GST_STATE_NULL);
+		gst_object_unref (elements[i]);
+	}
+}
+
+/* only the first frame is encoded, on the web encoder's thread */
+static GstFlowReturn photo_booth_catch_web_buffer (GstElement * appsink, gpointer user_data)
+{
+	PhotoBoothPrivate *priv;
+	GstSample *sample;
+
+	priv = photo_booth_get_instance_private (PHOTO_BOOTH (user_data));
+	sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
+	if (!sample)
+		return GST_FLOW_OK;
+	if (!g_object_get_data (G_OBJECT (appsink), "written"))
+	{
+		photo_booth_web_encoder_push (priv->web_encoder, sample, g_object_get_data (G_OBJECT (appsink), "filename"),
+		                              GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (appsink), "number")));
+		g_object_set_data (G_OBJECT (appsink), "written", GINT_TO_POINTER (TRUE));
+	}
 	gst_sample_unref (sample);
-	g_mutex_unlock (&priv->processing_mutex);
 	return GST_FLOW_OK;
 }
 
+/* runs on the writer thread */
+static void photo_booth_photo_published (const gchar *filename, guint number, gpointer user_data)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (PHOTO_BOOTH (user_data));
+	PhotoBoothSlideshow *slideshow;
+	photo_booth_thumbnailer_queue (priv->thumbnailer, number, filename);
+	slideshow = g_atomic_pointer_get (&priv->slideshow);
+	if (slideshow)
+		photo_booth_slideshow_add_photo (slideshow, number);
+}
+
+/* any thread. the processing elements go away once the photo was shown
+ * long enough and the file branch handed the encoded photo to the writer,
+ * whichever is last. taking the bin to READY earlier flushes the encoder */
+static void photo_booth_photo_branch_done (PhotoBooth *pb, gint branch)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	gint done = g_atomic_int_or (&priv->photo_branches_done, branch);
+	if ((done | branch) == PHOTO_BRANCH_ALL && done != PHOTO_BRANCH_ALL)
+		g_main_context_invoke (NULL, (GSourceFunc) photo_booth_process_photo_remove_elements, pb);
+}
+
 static gboolean photo_booth_process_photo_remove_elements (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv;
-	GstElement *tee, *encoder, *filesink, *appsink, *lcms;
+	GstElement *tee, *filequeue, *encoder, *fileappsink, *appsink, *lcms;
+	PhotoBoothWriterStats stats;
+	gint64 locked;
 	priv = photo_booth_get_instance_private (pb);
 
 	GST_DEBUG_OBJECT (pb, "remove output file encoder and writer elements and pause. locking...");
 	g_mutex_lock (&priv->processing_mutex);
+	locked = g_get_monotonic_time ();
 
 	gst_element_set_state (pb->photo_bin, GST_STATE_READY);
 	tee = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-tee");
+	filequeue = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-file-queue");
 	encoder = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-encoder");
-	filesink = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-filesink");
-	gst_element_unlink_many (tee, encoder, filesink, NULL);
+	fileappsink = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "photo-file-appsink");
+	gst_element_unlink_many (tee, filequeue, encoder, fileappsink, NULL);
+	if (priv->web_encoder)
+		photo_booth_remove_web_elements (pb, tee);
 
 	appsink = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "print-appsink");
 	lcms = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "print-lcms");
@@ -1974,33 +3261,63 @@ static gboolean photo_booth_process_photo_remove_elements (PhotoBooth *pb)
 	else
 		gst_element_unlink (tee, appsink);
 
-	gst_bin_remove_many (GST_BIN (pb->photo_bin), encoder, filesink, appsink, NULL);
-	gst_element_set_state (filesink, GST_STATE_NULL);
+	gst_bin_remove_many (GST_BIN (pb->photo_bin), filequeue, encoder, fileappsink, appsink, NULL);
+	gst_element_set_state (fileappsink, GST_STATE_NULL);
 	gst_element_set_state (encoder, GST_STATE_NULL);
+	gst_element_set_state (filequeue, GST_STATE_NULL);
 	gst_element_set_state (appsink, GST_STATE_NULL);
 	gst_object_unref (tee);
+	gst_object_unref (filequeue);
 	gst_object_unref (encoder);
-	gst_object_unref (filesink);
+	gst_object_unref (fileappsink);
 	priv->photo_block_id = 0;
 
 	g_mutex_unlock (&priv->processing_mutex);
+	photo_booth_histogram_observe (priv->processing_lock_time, (gdouble) (g_get_monotonic_time () - locked) / G_USEC_PER_SEC);
+	photo_booth_writer_get_stats (priv->writer, &stats);
+	GST_INFO_OBJECT (pb, "writer stats: %u written, %u failed, %u refused, queue depth %u (max %u), latency last %" G_GINT64_FORMAT " ms avg %" G_GINT64_FORMAT " ms max %" G_GINT64_FORMAT " ms",
+		stats.written, stats.failed, stats.refused, stats.queue_depth, stats.max_queue_depth, stats.last_latency / 1000, stats.avg_latency / 1000, stats.max_latency / 1000);
 	gtk_widget_hide (GTK_WIDGET (priv->win->image));
-	gtk_widget_show (GTK_WIDGET (priv->win->gtkgstwidget));
+	photo_booth_ui_post_value (priv->ui, UI_PREVIEW, TRUE);
 	GST_DEBUG_OBJECT (pb, "removed output file encoder and writer elements and paused and unlocked.");
 	return FALSE;
 }
 
+/* main thread. the appsink only ever fills an empty slot, so the one
+ * found here is still there to be taken out */
 static void photo_booth_free_print_buffer (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv;
-	GstElement *appsink;
+	GstBuffer *buffer;
 	priv = photo_booth_get_instance_private (pb);
-	GST_DEBUG_OBJECT (pb, "freeing buffer");
-	if (GST_IS_BUFFER (priv->print_buffer))
-		gst_buffer_unref (priv->print_buffer);
-	appsink = gst_bin_get_by_name (GST_BIN (pb->photo_bin), "print-appsink");
-	if (GST_IS_ELEMENT (appsink))
-		gst_object_unref (appsink);
+	buffer = g_atomic_pointer_get (&priv->print_buffer);
+	if (buffer && g_atomic_pointer_compare_and_exchange (&priv->print_buffer, buffer, NULL))
+	{
+		GST_DEBUG_OBJECT (pb, "freeing buffer %" GST_PTR_FORMAT, buffer);
+		gst_buffer_unref (buffer);
+	}
+}
+
+void photo_booth_button_gallery_clicked (GtkButton *button, PhotoBoothWindow *win)
+{
+	PhotoBooth *pb = PHOTO_BOOTH_FROM_WINDOW (win);
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+	GST_DEBUG_OBJECT (pb, "photo_booth_button_gallery_clicked in state %s", photo_booth_state_get_name (priv->state));
+	if (photo_booth_window_get_gallery_shown (win))
+		photo_booth_window_show_gallery (win, FALSE);
+	else if (priv->state == PB_STATE_PREVIEW)
+	{
+		/* an abandoned gallery is closed by the screensaver, give it the full timeout */
+		if (priv->screensaver_timeout_id)
+		{
+			g_source_remove (priv->screensaver_timeout_id);
+			priv->screensaver_timeout_id = g_timeout_add_seconds (priv->screensaver_timeout, (GSourceFunc) photo_booth_screensaver, pb);
+		}
+		photo_booth_preload_wait (priv->preload, "photo-index");
+		photo_booth_gallery_set_photos (PHOTO_BOOTH_GALLERY (win->gallery), priv->save_path_template, priv->save_filename_count);
+		photo_booth_window_show_gallery (win, TRUE);
+	}
 }
 
 void photo_booth_button_print_clicked (GtkButton *button, PhotoBoothWindow *win)
@@ -2020,18 +3337,98 @@ void photo_booth_button_upload_clicked (GtkButton *button, PhotoBoothWindow *win
 {
 	PhotoBooth *pb = PHOTO_BOOTH_FROM_WINDOW (win);
 	PhotoBoothPrivate *priv;
+	PhotoBoothUploadRequest *request;
+	PhotoBoothUploadFanout *fanout;
 	priv = photo_booth_get_instance_private (pb);
 	GST_DEBUG_OBJECT (pb, "photo_booth_button_upload_clicked");
 	if (priv->state == PB_STATE_ASK_UPLOAD)
 	{
 		_play_event_sound (priv, ACK_SOUND);
-		photo_booth_window_set_spinner (priv->win, TRUE);
-		gtk_label_set_text (priv->win->status, _("Uploading..."));
-		priv->upload_thread = g_thread_try_new ("upload", (GThreadFunc) photo_booth_post_thread_func, pb, NULL);
 		photo_booth_cancel (pb);
+		if (!priv->upload_queue)
+			return;
+		/* the booth is free for the next guest right away, the upload's
+		 * progress only shows in the status bar */
+		if (priv->photo_index)
+			photo_booth_index_set_upload_status (priv->photo_index, priv->save_filename_count, INDEX_UPLOAD_PENDING);
+		request = g_new0 (PhotoBoothUploadRequest, 1);
+		request->pb = pb;
+		request->number = priv->save_filename_count;
+		request->filename = g_strdup (priv->save_filename);
+		g_mutex_lock (&priv->upload_mutex);
+		if (priv->upload_photo && priv->upload_photo_number == priv->save_filename_count)
+			request->photo = photo_booth_buffer_to_bytes (priv->upload_photo);
+		fanout = g_new0 (PhotoBoothUploadFanout, 1);
+		fanout->remaining = priv->upload_backends->len;
+		g_hash_table_replace (priv->upload_fanouts, GUINT_TO_POINTER (priv->save_filename_count), fanout);
+		g_mutex_unlock (&priv->upload_mutex);
+		/* the web variant is normally long done while the guest was asked
+		 * to print, if not the jobs are queued once it is */
+		if (priv->web_encoder)
+			photo_booth_web_encoder_get_async (priv->web_encoder, request->number, photo_booth_upload_web_ready, request);
+		else
+			photo_booth_upload_web_ready (NULL, NULL, request);
 	}
 }
 
+static void photo_booth_upload_request_free (PhotoBoothUploadRequest *request)
+{
+	if (request->photo)
+		g_bytes_unref (request->photo);
+	if (request->web_photo)
+		g_bytes_unref (request->web_photo);
+	g_free (request->web_filename);
+	g_free (request->filename);
+	g_free (request);
+}
+
+/* on a preload thread, the upload queue's thread mustn't stall on it */
+static gpointer photo_booth_upload_wait_published (PhotoBoothUploadRequest *request)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (request->pb);
+	photo_booth_writer_flush (priv->writer);
+	return request;
+}
+
+/* on the main thread */
+static void photo_booth_upload_web_ready (GBytes *web_photo, const gchar *web_filename, gpointer user_data)
+{
+	PhotoBoothUploadRequest *request = user_data;
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (request->pb);
+
+	if (web_photo)
+	{
+		request->web_photo = g_bytes_ref (web_photo);
+		request->web_filename = g_strdup (web_filename);
+	}
+	/* jobs read the photo back from its file, which the writer may not
+	 * have published yet */
+	if (!request->photo)
+		photo_booth_preload_add (priv->preload, "upload-photo", (PhotoBoothPreloadFunc) photo_booth_upload_wait_published,
+			photo_booth_upload_queue_request, (GDestroyNotify) photo_booth_upload_request_free, request);
+	else
+		photo_booth_upload_queue_request (request, request);
+}
+
+/* on the main thread, queues one job per backend, each retried on its own */
+static void photo_booth_upload_queue_request (gpointer result, gpointer user_data)
+{
+	PhotoBoothUploadRequest *request = result;
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (request->pb);
+	guint i;
+
+	for (i = 0; i < priv->upload_backends->len; i++)
+	{
+		PhotoBoothUploadBackend *backend = g_ptr_array_index (priv->upload_backends, i);
+		if (request->web_photo && photo_booth_upload_backend_wants_web_variant (backend))
+			photo_booth_upload_queue_push (priv->upload_queue, photo_booth_upload_backend_get_name (backend), request->web_filename, request->number, request->web_photo);
+		else
+			photo_booth_upload_queue_push (priv->upload_queue, photo_booth_upload_backend_get_name (backend), request->filename, request->number, request->photo);
+	}
+	photo_booth_update_upload_status (request->pb);
+	photo_booth_upload_request_free (request);
+}
+
 void photo_booth_button_cancel_clicked (GtkButton *button, PhotoBoothWindow *win)
 {
 	PhotoBooth *pb = PHOTO_BOOTH_FROM_WINDOW (win);
@@ -2047,7 +3444,7 @@ void photo_booth_cancel (PhotoBooth *pb)
 	GST_INFO_OBJECT (pb, "cancelled in state %s", photo_booth_state_get_name (priv->state));
 	switch (priv->state) {
 		case PB_STATE_PROCESS_PHOTO:
-			photo_booth_process_photo_remove_elements (pb);
+			photo_booth_photo_branch_done (pb, PHOTO_BRANCH_DISPLAYED);
 		case PB_STATE_TAKING_PHOTO:
 		case PB_STATE_PRINTING:
 			break;
@@ -2083,7 +3480,8 @@ static void photo_booth_print (PhotoBooth *pb)
 	PhotoBoothPrivate *priv;
 	priv = photo_booth_get_instance_private (pb);
 	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_photo_print");
-	photo_booth_get_printer_status (pb);
+	/* the count was refreshed in the background when the guest was asked,
+	 * querying the printer here would block the UI */
 	GST_INFO_OBJECT (pb, "PRINT! prints_remaining=%i", priv->prints_remaining);
 	priv->print_copies = photo_booth_window_get_copies_hide (priv->win);
 	gtk_widget_hide (GTK_WIDGET (priv->win->button_print));
@@ -2094,66 +3492,134 @@ static void photo_booth_print (PhotoBooth *pb)
 	if (priv->prints_remaining > priv->print_copies)
 #endif
 	{
-		gtk_label_set_text (priv->win->status, _("Printing..."));
-		photo_booth_change_state (pb, PB_STATE_PRINTING);
-		PhotoBoothPrivate *priv;
-		GtkPrintOperation *printop;
-		GtkPrintOperationResult res;
-		GtkPageSetup *page_setup;
-		GtkPaperSize *paper_size;
-		GError *print_error;
-		GtkPrintOperationAction action;
-
-		priv = photo_booth_get_instance_private (pb);
-		printop = gtk_print_operation_new ();
-
-		if (priv->printer_settings != NULL)
-			action = GTK_PRINT_OPERATION_ACTION_PRINT;
+		/* check the slot before leaving ASK_PRINT, an empty one means the
+		 * print branch never delivered this photo */
+		GstBuffer *print_buffer = g_atomic_pointer_get (&priv->print_buffer);
+		if (!print_buffer)
+		{
+			GST_ERROR_OBJECT (pb, "the print appsink hasn't published photo %u", priv->save_filename_count);
+			_play_event_sound (priv, ERROR_SOUND);
+			photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Can't print this photo!"));
+			photo_booth_cancel (pb);
+			return;
+		}
+		photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Printing..."));
+		photo_booth_change_state (pb, PB_EVENT_PRINT);
+		if (priv->print_flush_timeout_id)
+		{
+			g_source_remove (priv->print_flush_timeout_id);
+			priv->print_flush_timeout_id = 0;
+		}
+		/* remember which photo the buffer is, for the index once it's printed */
+		gst_mini_object_set_qdata (GST_MINI_OBJECT (print_buffer), photo_number_quark, GUINT_TO_POINTER (priv->save_filename_count), NULL);
+		photo_booth_print_sheets (pb, photo_booth_sheet_packer_add (priv->sheet_packer, print_buffer, priv->print_copies));
+	}
+	else if (priv->prints_remaining == -1) {
+		photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Can't print, no printer connected!"));
+	}
+	else
+		photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Can't print, out of paper!"));
+}
+
+/* takes ownership of sheets and prints them through the direct raster path or the GTK print dialog */
+static void photo_booth_print_sheets (PhotoBooth *pb, GPtrArray *sheets)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+
+	/* a flush of held back prints may still be running, the sheets go
+	 * out once it's done rather than replacing it */
+	if (priv->print_sheets)
+	{
+		GST_INFO_OBJECT (pb, "printer busy, queueing %u sheets", sheets->len);
+		if (priv->print_sheets_queued)
+			g_ptr_array_extend_and_steal (priv->print_sheets_queued, sheets);
 		else
+			priv->print_sheets_queued = sheets;
+		return;
+	}
+
+	priv->print_sheets = sheets;
+	priv->trace_print = PHOTO_BOOTH_TRACE_BEGIN ();
+	priv->print_start_time = g_get_monotonic_time ();
+	GST_INFO_OBJECT (pb, "printing %u sheets with %u slots each, %u prints held back", sheets->len, photo_booth_sheet_packer_get_slots (priv->sheet_packer), photo_booth_sheet_packer_get_pending (priv->sheet_packer));
+	if (sheets->len == 0)
+	{
+		photo_booth_print_sheets_done (pb, FALSE);
+		return;
+	}
+	if (priv->print_direct_command)
+	{
+		GError *thread_error = NULL;
+		GST_INFO_OBJECT (pb, "direct printing through '%s'", priv->print_direct_command);
+		priv->print_thread = g_thread_try_new ("direct-print", (GThreadFunc) photo_booth_print_direct_thread_func, pb, &thread_error);
+		if (!priv->print_thread)
 		{
-			priv->printer_settings = gtk_print_settings_new ();
-			action = GTK_PRINT_OPERATION_ACTION_PRINT_DIALOG;
+			photo_booth_printing_error_dialog (priv->win, thread_error);
+			g_error_free (thread_error);
+			photo_booth_print_sheets_done (pb, FALSE);
 		}
+		return;
+	}
+
+	GtkPrintOperation *printop;
+	GtkPrintOperationResult res;
+	GtkPageSetup *page_setup;
+	GtkPaperSize *paper_size;
+	GError *print_error;
+	GtkPrintOperationAction action;
+
+	printop = gtk_print_operation_new ();
+
+	if (priv->printer_settings != NULL)
+		action = GTK_PRINT_OPERATION_ACTION_PRINT;
+	else
+	{
+		priv->printer_settings = gtk_print_settings_new ();
+		action = GTK_PRINT_OPERATION_ACTION_PRINT_DIALOG;
+	}
 
-		gtk_print_operation_set_print_settings (printop, priv->printer_settings);
-		g_signal_connect (printop, "begin_print", G_CALLBACK (photo_booth_begin_print), pb);
-		g_signal_connect (printop, "draw_page", G_CALLBACK (photo_booth_draw_page), pb);
-		g_signal_connect (printop, "done", G_CALLBACK (photo_booth_print_done), pb);
+	gtk_print_operation_set_print_settings (printop, priv->printer_settings);
+	g_signal_connect (printop, "begin_print", G_CALLBACK (photo_booth_begin_print), pb);
+	g_signal_connect (printop, "draw_page", G_CALLBACK (photo_booth_draw_page), pb);
+	g_signal_connect (printop, "done", G_CALLBACK (photo_booth_print_done), pb);
 
-		page_setup = gtk_page_setup_new();
+	page_setup = gtk_page_setup_new();
+	if (priv->print_cut_2up)
+	{
+		paper_size = gtk_paper_size_new_custom(PRINT_2UP_PAGE_SIZE, "6x8 (2x 6x4)", PT_PER_IN*6.0, PT_PER_IN*8.0, GTK_UNIT_POINTS);
+		gtk_page_setup_set_orientation (page_setup, GTK_PAGE_ORIENTATION_PORTRAIT);
+	}
+	else
+	{
 		paper_size = gtk_paper_size_new_custom("custom", "custom", PT_PER_IN*4.0, PT_PER_IN*6.0, GTK_UNIT_POINTS);
 		gtk_page_setup_set_orientation (page_setup, GTK_PAGE_ORIENTATION_LANDSCAPE);
+	}
 
-		gtk_page_setup_set_paper_size (page_setup, paper_size);
-		gtk_print_operation_set_default_page_setup (printop, page_setup);
-		gtk_print_operation_set_use_full_page (printop, TRUE);
-		gtk_print_operation_set_unit (printop, GTK_UNIT_POINTS);
+	gtk_page_setup_set_paper_size (page_setup, paper_size);
+	gtk_print_operation_set_default_page_setup (printop, page_setup);
+	gtk_print_operation_set_use_full_page (printop, TRUE);
+	gtk_print_operation_set_unit (printop, GTK_UNIT_POINTS);
 
-		res = gtk_print_operation_run (printop, action, GTK_WINDOW (priv->win), &print_error);
-		if (res == GTK_PRINT_OPERATION_RESULT_ERROR)
-		{
-			photo_booth_printing_error_dialog (priv->win, print_error);
-			g_error_free (print_error);
-		}
-		else if (res == GTK_PRINT_OPERATION_RESULT_CANCEL)
-		{
-			gtk_label_set_text (priv->win->status, _("Printing cancelled"));
-			g_object_unref (priv->printer_settings);
-			priv->printer_settings = NULL;
-			GST_INFO_OBJECT (pb, "print cancelled");
-		}
-		else if (res == GTK_PRINT_OPERATION_RESULT_APPLY)
-		{
-			g_object_unref (priv->printer_settings);
-			priv->printer_settings = g_object_ref (gtk_print_operation_get_print_settings (printop));
-		}
-		g_object_unref (printop);
+	res = gtk_print_operation_run (printop, action, GTK_WINDOW (priv->win), &print_error);
+	if (res == GTK_PRINT_OPERATION_RESULT_ERROR)
+	{
+		photo_booth_printing_error_dialog (priv->win, print_error);
+		g_error_free (print_error);
 	}
-	else if (priv->prints_remaining == -1) {
-		gtk_label_set_text (priv->win->status, _("Can't print, no printer connected!"));
+	else if (res == GTK_PRINT_OPERATION_RESULT_CANCEL)
+	{
+		photo_booth_ui_post_text (priv->ui, UI_STATUS, _("Printing cancelled"));
+		g_object_unref (priv->printer_settings);
+		priv->printer_settings = NULL;
+		GST_INFO_OBJECT (pb, "print cancelled");
 	}
-	else
-		gtk_label_set_text (priv->win->status, _("Can't print, out of paper!"));
+	else if (res == GTK_PRINT_OPERATION_RESULT_APPLY)
+	{
+		g_object_unref (priv->printer_settings);
+		priv->printer_settings = g_object_ref (gtk_print_operation_get_print_settings (printop));
+	}
+	g_object_unref (printop);
 }
 
 static void photo_booth_begin_print (GtkPrintOperation *operation, GtkPrintContext *context, gpointer user_data)
@@ -2165,41 +3631,159 @@ static void photo_booth_begin_print (GtkPrintOperation *operation, GtkPrintConte
 
 	priv = photo_booth_get_instance_private (pb);
 
-	GST_INFO_OBJECT (pb, "photo_booth_begin_print %i copies", priv->print_copies);
-	gtk_print_operation_set_n_pages (operation, priv->print_copies);
+	GST_INFO_OBJECT (pb, "photo_booth_begin_print %i copies on %u sheets", priv->print_copies, priv->print_sheets->len);
+	gtk_print_operation_set_n_pages (operation, priv->print_sheets->len);
+}
+
+static void photo_booth_paint_print_buffer (PhotoBooth *pb, cairo_t *cr, GstBuffer *buffer)
+{
+	PhotoBoothPrivate *priv;
+	GstMapInfo map;
+
+	priv = photo_booth_get_instance_private (pb);
+
+	gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+	int stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, priv->print_width);
+	cairo_surface_t *cairosurface = cairo_image_surface_create_for_data (map.data, CAIRO_FORMAT_RGB24, priv->print_width, priv->print_height, stride);
+	cairo_set_source_surface (cr, cairosurface, priv->print_x_offset, priv->print_y_offset);
+	cairo_paint (cr);
+	cairo_surface_destroy (cairosurface);
+
+	gst_buffer_unmap (buffer, &map);
+}
+
+/* paints a sheet in printer pixel units. 2-up slots are stacked 4" apart on the 6x8" sheet */
+static void photo_booth_paint_sheet (PhotoBooth *pb, cairo_t *cr, PhotoBoothSheet *sheet)
+{
+	PhotoBoothPrivate *priv;
+	guint i;
+
+	priv = photo_booth_get_instance_private (pb);
+	for (i = 0; i < sheet->n_slots; i++)
+	{
+		cairo_save (cr);
+		cairo_translate (cr, 0, i * 4 * priv->print_dpi);
+		photo_booth_paint_print_buffer (pb, cr, sheet->slot[i]);
+		cairo_restore (cr);
+	}
 }
 
 static void photo_booth_draw_page (GtkPrintOperation *operation, GtkPrintContext *context, int page_nr, gpointer user_data)
 {
 	PhotoBooth *pb;
 	PhotoBoothPrivate *priv;
-	GstMapInfo map;
+	PhotoBoothSheet *sheet;
 
 	pb = PHOTO_BOOTH (user_data);
 	priv = photo_booth_get_instance_private (pb);
 
-	if (!GST_IS_BUFFER (priv->print_buffer))
+	if (!priv->print_sheets || page_nr >= priv->print_sheets->len)
 	{
-		GST_ERROR_OBJECT (context, "can't draw because we have no photo buffer!");
+		GST_ERROR_OBJECT (context, "can't draw because we have no sheet for page %i!", page_nr);
 		return;
 	}
-	GST_DEBUG_OBJECT (context, "draw_page no. %i . %" GST_PTR_FORMAT " size %dx%d, %i dpi, offsets (%.2f, %.2f)", page_nr, priv->print_buffer, priv->print_width, priv->print_height, priv->print_dpi, priv->print_x_offset, priv->print_y_offset);
-
-	gst_buffer_map(priv->print_buffer, &map, GST_MAP_READ);
+	sheet = g_ptr_array_index (priv->print_sheets, page_nr);
+	GST_DEBUG_OBJECT (context, "draw_page no. %i with %u slots. size %dx%d, %i dpi, offsets (%.2f, %.2f)", page_nr, sheet->n_slots, priv->print_width, priv->print_height, priv->print_dpi, priv->print_x_offset, priv->print_y_offset);
 
-	int stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, priv->print_width);
-	cairo_surface_t *cairosurface = cairo_image_surface_create_for_data (map.data, CAIRO_FORMAT_RGB24, priv->print_width, priv->print_height, stride);
 	cairo_t *cr = gtk_print_context_get_cairo_context (context);
 	cairo_matrix_t m;
 	cairo_get_matrix(cr, &m);
 
 	float scale = (float) PT_PER_IN / (float) priv->print_dpi;
 	cairo_scale(cr, scale, scale);
-	cairo_set_source_surface(cr, cairosurface, priv->print_x_offset, priv->print_y_offset);
-	cairo_paint(cr);
+	photo_booth_paint_sheet (pb, cr, sheet);
 	cairo_set_matrix(cr, &m);
+}
 
-	gst_buffer_unmap (priv->print_buffer, &map);
+/* renders a sheet at printer resolution. a single landscape photo goes onto a
+ * portrait 4x6" page, the same way CUPS would rotate the landscape page setup
+ * of the dialog path. 2-up sheets are portrait 6x8" with the photos stacked */
+static cairo_surface_t *photo_booth_render_sheet (PhotoBooth *pb, PhotoBoothSheet *sheet)
+{
+	PhotoBoothPrivate *priv;
+	cairo_surface_t *page;
+	cairo_t *cr;
+	gint page_width, page_height;
+
+	priv = photo_booth_get_instance_private (pb);
+	page_width = (priv->print_cut_2up ? 6 : 4) * priv->print_dpi;
+	page_height = (priv->print_cut_2up ? 8 : 6) * priv->print_dpi;
+
+	page = cairo_image_surface_create (CAIRO_FORMAT_RGB24, page_width, page_height);
+	cr = cairo_create (page);
+	cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
+	cairo_paint (cr);
+	if (!priv->print_cut_2up)
+	{
+		cairo_translate (cr, page_width, 0);
+		cairo_rotate (cr, G_PI / 2);
+	}
+	photo_booth_paint_sheet (pb, cr, sheet);
+	cairo_destroy (cr);
+	return page;
+}
+
+static void photo_booth_print_direct_thread_func (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	gchar *argv[] = { "/bin/sh", "-c", NULL, NULL };
+	gchar **envp;
+	GError *error = NULL;
+	GPid pid;
+	gint stdin_fd, status;
+	guint i, run;
+
+	priv = photo_booth_get_instance_private (pb);
+	argv[2] = priv->print_direct_command;
+
+	envp = g_get_environ ();
+	if (priv->printer_backend)
+		envp = g_environ_setenv (envp, "BACKEND", priv->printer_backend, TRUE);
+
+	if (g_spawn_async_with_pipes (NULL, argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &stdin_fd, NULL, NULL, &error))
+	{
+		photo_booth_raster_begin (stdin_fd, &error);
+		/* identical consecutive sheets are rendered once and written as copies */
+		for (i = 0; i < priv->print_sheets->len && !error; i += run)
+		{
+			PhotoBoothSheet *sheet = g_ptr_array_index (priv->print_sheets, i);
+			cairo_surface_t *page;
+			for (run = 1; i + run < priv->print_sheets->len; run++)
+				if (!photo_booth_sheet_equal (sheet, g_ptr_array_index (priv->print_sheets, i + run)))
+					break;
+			page = photo_booth_render_sheet (pb, sheet);
+			photo_booth_raster_write_page (stdin_fd, page, priv->print_dpi, run, priv->print_cut_2up ? PRINT_2UP_PAGE_SIZE : NULL, priv->print_cut_2up, &error);
+			cairo_surface_destroy (page);
+		}
+		close (stdin_fd);
+		if (waitpid (pid, &status, 0) == pid && !error)
+			g_spawn_check_exit_status (status, &error);
+		g_spawn_close_pid (pid);
+	}
+	g_strfreev (envp);
+
+	priv->print_error = error;
+	g_main_context_invoke (NULL, (GSourceFunc) photo_booth_print_direct_done, pb);
+}
+
+static gboolean photo_booth_print_direct_done (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+
+	g_thread_join (priv->print_thread);
+	priv->print_thread = NULL;
+
+	if (priv->print_error)
+	{
+		photo_booth_printing_error_dialog (priv->win, priv->print_error);
+		g_clear_error (&priv->print_error);
+		photo_booth_print_sheets_done (pb, FALSE);
+	}
+	else
+		photo_booth_print_sheets_done (pb, TRUE);
+	return FALSE;
 }
 
 static void photo_booth_printing_error_dialog (PhotoBoothWindow *window, GError *print_error)
@@ -2229,23 +3813,91 @@ static void photo_booth_print_done (GtkPrintOperation *operation, GtkPrintOperat
 		photo_booth_printing_error_dialog (priv->win, print_error);
 		g_error_free (print_error);
 	}
-	else if (result == GTK_PRINT_OPERATION_RESULT_APPLY)
+	else if (result != GTK_PRINT_OPERATION_RESULT_APPLY)
+		GST_INFO_OBJECT (user_data, "print_done photos_printed unhandled result %i", result);
+
+	photo_booth_print_sheets_done (pb, result == GTK_PRINT_OPERATION_RESULT_APPLY);
+}
+
+static void photo_booth_print_sheets_done (PhotoBooth *pb, gboolean printed)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+
+	if (printed)
+	{
+		guint prints = photo_booth_sheet_packer_printed (priv->sheet_packer, priv->print_sheets);
+		guint i, j;
+		priv->photos_printed += prints;
+		for (i = 0; priv->photo_index && i < priv->print_sheets->len; i++)
+		{
+			PhotoBoothSheet *sheet = g_ptr_array_index (priv->print_sheets, i);
+			for (j = 0; j < sheet->n_slots; j++)
+			{
+				guint number = GPOINTER_TO_UINT (gst_mini_object_get_qdata (GST_MINI_OBJECT (sheet->slot[j]), photo_number_quark));
+				if (number)
+					photo_booth_index_add_prints (priv->photo_index, number, 1);
+			}
+		}
+		GST_INFO_OBJECT (pb, "print_done photos_printed copies=%u total=%i", prints, priv->photos_printed);
+		photo_booth_histogram_observe (priv->print_time, (gdouble) (g_get_monotonic_time () - priv->print_start_time) / G_USEC_PER_SEC);
+		photo_booth_led_printer (priv->led, prints);
+	}
+	g_ptr_array_unref (priv->print_sheets);
+	priv->print_sheets = NULL;
+	PHOTO_BOOTH_TRACE_END (priv->trace_print, "print", 0);
+
+	GST_INFO_OBJECT (pb, "print statistics: %u prints on %u sheets, %u sheets saved, %.1f prints per hour",
+		photo_booth_sheet_packer_get_prints (priv->sheet_packer), photo_booth_sheet_packer_get_sheets (priv->sheet_packer),
+		photo_booth_sheet_packer_get_saved (priv->sheet_packer), photo_booth_sheet_packer_get_per_hour (priv->sheet_packer));
+
+	if (photo_booth_sheet_packer_get_pending (priv->sheet_packer) && !priv->print_flush_timeout_id)
 	{
-		gint copies = gtk_print_operation_get_n_pages_to_print (operation);
-		priv->photos_printed += copies;
-		GST_INFO_OBJECT (user_data, "print_done photos_printed copies=%i total=%i", copies, priv->photos_printed);
-		photo_booth_led_printer (priv->led, copies);
+		GST_DEBUG_OBJECT (pb, "holding back %u prints for %i seconds to pair them up", photo_booth_sheet_packer_get_pending (priv->sheet_packer), priv->print_cut_2up_hold);
+		priv->print_flush_timeout_id = g_timeout_add_seconds (priv->print_cut_2up_hold, (GSourceFunc) photo_booth_print_flush_pending, pb);
 	}
-	else
-		GST_INFO_OBJECT (user_data, "print_done photos_printed unhandled result %i", result);
 
-	g_timeout_add_seconds (15, (GSourceFunc) photo_booth_get_printer_status, pb);
+	/* the guest's job was waiting behind a flush, it finishes PRINTING */
+	if (priv->print_sheets_queued)
+	{
+		GPtrArray *sheets = priv->print_sheets_queued;
+		priv->print_sheets_queued = NULL;
+		photo_booth_print_sheets (pb, sheets);
+		return;
+	}
+
+	if (priv->state == PB_STATE_PRINTING)
+		photo_booth_print_finished (pb);
+}
+
+/* nobody printed an odd copy to pair with the held back one in time, print it alone */
+static gboolean photo_booth_print_flush_pending (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+
+	if (priv->print_sheets || priv->state == PB_STATE_PRINTING)
+	{
+		GST_DEBUG_OBJECT (pb, "printer busy, flush held back prints later");
+		return TRUE;
+	}
+	priv->print_flush_timeout_id = 0;
+	photo_booth_print_sheets (pb, photo_booth_sheet_packer_flush (priv->sheet_packer));
+	return FALSE;
+}
+
+static void photo_booth_print_finished (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
 
-	if ((priv->imgur_album_id && priv->imgur_access_token) || priv->facebook_put_uri)
+	g_timeout_add_seconds (15, (GSourceFunc) photo_booth_refresh_printer_status, pb);
+
+	if (priv->upload_queue)
 	{
 		gtk_widget_show (GTK_WIDGET (priv->win->button_upload));
 		g_timeout_add_seconds (priv->upload_timeout, (GSourceFunc) photo_booth_upload_timedout, pb);
-		photo_booth_change_state (pb, PB_STATE_ASK_UPLOAD);
+		photo_booth_change_state (pb, PB_EVENT_PRINTED);
 	}
 	else
 		photo_booth_cancel (pb);
@@ -2253,128 +3905,345 @@ static void photo_booth_print_done (GtkPrintOperation *operation, GtkPrintOperat
 	return;
 }
 
-size_t _curl_write_func (void *ptr, size_t size, size_t nmemb, void *buf)
+/* runs on the upload queue thread, the bridge client takes it from there */
+static void photo_booth_twitter_post (PhotoBooth *pb, const gchar *target, const gchar *link)
+{
+	PhotoBoothPrivate *priv;
+	priv = photo_booth_get_instance_private (pb);
+	GST_INFO ("%s uploaded photo url: %s", target, link);
+	photo_booth_bridge_send (priv->twitter_bridge, link);
+}
+
+typedef struct
+{
+	GstBuffer  *buffer;
+	GstMapInfo  map;
+} PhotoBoothMappedBuffer;
+
+static void photo_booth_mapped_buffer_free (PhotoBoothMappedBuffer *mapped)
+{
+	gst_buffer_unmap (mapped->buffer, &mapped->map);
+	gst_buffer_unref (mapped->buffer);
+	g_slice_free (PhotoBoothMappedBuffer, mapped);
+}
+
+/* wraps the buffer's memory without copying it, the buffer is kept mapped
+ * and referenced as long as the bytes are alive */
+static GBytes *photo_booth_buffer_to_bytes (GstBuffer *buffer)
 {
-	int i;
-	for (i = 0; i < size*nmemb; i++)
-		g_string_append_c((GString *)buf, ((gchar *)ptr)[i]);
-	return i;
+	PhotoBoothMappedBuffer *mapped = g_slice_new0 (PhotoBoothMappedBuffer);
+	mapped->buffer = gst_buffer_ref (buffer);
+	if (!gst_buffer_map (mapped->buffer, &mapped->map, GST_MAP_READ))
+	{
+		gst_buffer_unref (mapped->buffer);
+		g_slice_free (PhotoBoothMappedBuffer, mapped);
+		return NULL;
+	}
+	return g_bytes_new_with_free_func (mapped->map.data, mapped->map.size, (GDestroyNotify) photo_booth_mapped_buffer_free, mapped);
 }
 
-void photo_booth_post_thread_func (PhotoBooth* pb)
+/* [upload] backends lists the enabled ones, each configured in its own
+ * [upload-<name>] group. without it the imgur and facebook keys of old
+ * configs still work */
+static void photo_booth_load_upload_backends (PhotoBooth *pb, GKeyFile *gkf)
 {
 	PhotoBoothPrivate *priv;
-	CURLcode res;
-	CURL *curl;
+	gchar **names;
+	gsize i, len = 0;
 	priv = photo_booth_get_instance_private (pb);
-	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pb->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "photo_booth_facebook_post");
-	g_mutex_lock (&priv->upload_mutex);
-	curl = curl_easy_init();
-	if (curl)
-	{
-		photo_booth_change_state (pb, PB_STATE_UPLOADING);
-		struct curl_httppost* post = NULL;
-		struct curl_httppost* last = NULL;
-		GString *buf = g_string_new("");
-		gchar *filename = g_strdup_printf (priv->save_path_template, priv->save_filename_count);
-		curl_formadd (&post, &last, CURLFORM_COPYNAME, "image", CURLFORM_FILE, filename, CURLFORM_CONTENTTYPE, "image/jpeg", CURLFORM_END);
-		curl_easy_setopt (curl, CURLOPT_USERAGENT, "Schaffenburg Photobooth");
-		if (priv->imgur_access_token && priv->imgur_album_id)
-		{
-			gchar *auth_header;
-			struct curl_slist *headerlist = NULL;
-			auth_header = g_strdup_printf ("Authorization: Bearer %s", priv->imgur_access_token);
-			headerlist = curl_slist_append (headerlist, auth_header);
-			curl_formadd (&post, &last, CURLFORM_COPYNAME, "album", CURLFORM_COPYCONTENTS, priv->imgur_album_id, CURLFORM_END);
-			if (priv->imgur_description)
-				curl_formadd (&post, &last, CURLFORM_COPYNAME, "description", CURLFORM_COPYCONTENTS, priv->imgur_description, CURLFORM_END);
-			curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headerlist);
-			curl_easy_setopt (curl, CURLOPT_URL, IMGUR_UPLOAD_URI);
-			GST_INFO_OBJECT (pb, "imgur posting '%s' to album http://imgur.com/a/%s'...", filename, priv->imgur_album_id);
-			g_free (auth_header);
-		}
-		else if (priv->facebook_put_uri)
-		{
-			curl_easy_setopt (curl, CURLOPT_URL, priv->facebook_put_uri);
-			GST_INFO_OBJECT (pb, "facebook posting '%s' to '%s'...", filename, priv->facebook_put_uri);
-		}
-		curl_easy_setopt (curl, CURLOPT_POST, 1L);
-		curl_easy_setopt (curl, CURLOPT_HTTPPOST, post);
-		curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, _curl_write_func);
-		curl_easy_setopt (curl, CURLOPT_WRITEDATA, buf);
-		res = curl_easy_perform (curl);
-		if (res != CURLE_OK)
+
+	g_ptr_array_set_size (priv->upload_backends, 0);
+	names = g_key_file_get_string_list (gkf, "upload", "backends", &len, NULL);
+	if (!names)
+	{
+		GPtrArray *legacy = g_ptr_array_new ();
+		if (g_key_file_has_key (gkf, "upload", "imgur_album_id", NULL))
+			g_ptr_array_add (legacy, g_strdup ("imgur"));
+		if (g_key_file_has_key (gkf, "upload", "facebook_put_uri", NULL))
+			g_ptr_array_add (legacy, g_strdup ("webhook"));
+		len = legacy->len;
+		g_ptr_array_add (legacy, NULL);
+		names = (gchar **) g_ptr_array_free (legacy, FALSE);
+	}
+	for (i = 0; i < len; i++)
+	{
+		PhotoBoothUploadBackend *backend;
+		g_strstrip (names[i]);
+		if (!*names[i])
+			continue;
+		backend = photo_booth_upload_backend_new (gkf, names[i]);
+		if (backend)
+			g_ptr_array_add (priv->upload_backends, backend);
+	}
+	g_strfreev (names);
+}
+
+/* a queued job's backend. jobs from before there were several go to the
+ * first one */
+static PhotoBoothUploadBackend *photo_booth_get_upload_backend (PhotoBooth *pb, const gchar *target)
+{
+	PhotoBoothPrivate *priv;
+	guint i;
+	priv = photo_booth_get_instance_private (pb);
+
+	if (!*target && priv->upload_backends->len)
+		return g_ptr_array_index (priv->upload_backends, 0);
+	for (i = 0; i < priv->upload_backends->len; i++)
+	{
+		PhotoBoothUploadBackend *backend = g_ptr_array_index (priv->upload_backends, i);
+		if (!g_strcmp0 (photo_booth_upload_backend_get_name (backend), target))
+			return backend;
+	}
+	return NULL;
+}
+
+/* runs on the upload queue thread, sets up one attempt */
+static gpointer photo_booth_upload_prepare (CURL *curl, const gchar *target, const gchar *filename, guint number, GBytes *photo, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothUploadBackend *backend;
+
+	backend = photo_booth_get_upload_backend (pb, target);
+	if (!backend)
+	{
+		GST_WARNING ("upload backend '%s' of photo %u is no longer configured", target, number);
+		return NULL;
+	}
+	/* a job reading its file is only queued once the writer published
+	 * it, restored ones are from an earlier run */
+	if (!photo)
+	{
+		if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
 		{
-			GST_WARNING ("curl_easy_perform() failed %s", curl_easy_strerror(res));
+			GST_WARNING ("photo %u '%s' is gone, can't upload it", number, filename);
+			return NULL;
 		}
-		curl_easy_cleanup (curl);
-		curl_formfree (post);
-		g_free (filename);
-		GST_DEBUG ("curl_easy_perform() finished. response='%s'", buf->str);
+	}
+	else
+		GST_DEBUG_OBJECT (pb, "uploading photo %u to %s from memory (%" G_GSIZE_FORMAT " bytes)", number, target, g_bytes_get_size (photo));
+	return photo_booth_upload_backend_prepare (backend, curl, filename, number, photo);
+}
 
-		if (priv->twitter_bridge_host && priv->twitter_bridge_port)
-		{
-			JsonParser *parser;
-			JsonNode *root;
-			JsonReader *reader;
-			GError *error;
-			const char *link_url;
-			GSocketConnection *connection = NULL;
-			GSocketClient *client;
-
-			parser = json_parser_new ();
-
-			error = NULL;
-			json_parser_load_from_data (parser, buf->str, buf->len, &error);
-			if (error)
-			{
-				GST_WARNING ("Unable to parse '%s': %s", buf->str, error->message);
-				g_error_free (error);
-				g_object_unref (parser);
-				return;
-			}
+/* a photo is posted once, with the first link any of its backends got.
+ * jobs restored after a restart don't know their siblings, only the
+ * first backend's link is posted for them */
+static gboolean photo_booth_upload_claim_post (PhotoBooth *pb, const gchar *target, guint number)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	PhotoBoothUploadFanout *fanout;
+	gboolean claimed;
+
+	g_mutex_lock (&priv->upload_mutex);
+	fanout = g_hash_table_lookup (priv->upload_fanouts, GUINT_TO_POINTER (number));
+	if (fanout)
+	{
+		claimed = !fanout->posted;
+		fanout->posted = TRUE;
+	}
+	else
+		claimed = priv->upload_backends->len && photo_booth_get_upload_backend (pb, target) == g_ptr_array_index (priv->upload_backends, 0);
+	g_mutex_unlock (&priv->upload_mutex);
+	if (!claimed)
+		GST_DEBUG_OBJECT (pb, "photo %u was already posted, not posting the %s link", number, target);
+	return claimed;
+}
 
-			root = json_parser_get_root (parser);
-			reader = json_reader_new (root);
-			gboolean ret = json_reader_read_member (reader, "data");
-			GST_INFO ("imgur read data member ret=%i", ret);
+/* runs on the upload queue thread once the attempt's transfer is over */
+static PhotoBoothUploadResult photo_booth_upload_finish (CURL *curl, const gchar *target, guint number, CURLcode res, gpointer data, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv;
+	PhotoBoothUploadResult result;
+	gchar *link = NULL;
+	curl_off_t total = 0;
+	priv = photo_booth_get_instance_private (pb);
 
-			json_reader_read_member (reader, "link");
-			link_url = json_reader_get_string_value (reader);
-			GST_INFO ("imgur uploaded photo url: %s", link_url);
+	if (res != CURLE_ABORTED_BY_CALLBACK && curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME_T, &total) == CURLE_OK)
+		photo_booth_histogram_observe (priv->upload_time, (gdouble) total / G_USEC_PER_SEC);
+	/* backends are only loaded once, the prepared one is still there */
+	result = photo_booth_upload_backend_finish (photo_booth_get_upload_backend (pb, target), curl, res, data, &link);
+	if (link && priv->twitter_bridge && photo_booth_upload_claim_post (pb, target, number))
+		photo_booth_twitter_post (pb, target, link);
+	g_free (link);
+	return result;
+}
 
-			client = g_socket_client_new();
+/* the upload queue's progress in the status bar, from any thread */
+static void photo_booth_update_upload_status (PhotoBooth *pb)
+{
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	PhotoBoothUploadQueueStats stats;
+	gchar *label_string;
 
-			connection = g_socket_client_connect_to_host (client,
-																										priv->twitter_bridge_host,
-																										priv->twitter_bridge_port,
-																										NULL,
-																										&error);
+	if (!priv->upload_queue)
+		return;
+	photo_booth_upload_queue_get_stats (priv->upload_queue, &stats);
+	if (!stats.depth)
+		label_string = g_strdup ("");
+	else if (stats.active)
+		label_string = g_strdup_printf (_("Uploading... %u pending"), stats.depth);
+	else
+		label_string = g_strdup_printf (_("%u uploads pending"), stats.depth);
+	photo_booth_ui_post_text (priv->ui, UI_STATUS_UPLOAD, label_string);
+	g_free (label_string);
+}
 
-			if (error != NULL) {
-						GST_WARNING ("Unable to connect to twitter bridge: %s", error->message);
-						g_error_free (error);
-			}
+/* on the main thread, with the latest state posted for a widget */
+static void photo_booth_ui_apply (guint slot, const gchar *text, gint value, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
 
-			GOutputStream *ostream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+	switch (slot) {
+		case UI_STATUS:
+			gtk_label_set_text (priv->win->status, text);
+			break;
+		case UI_STATUS_UPLOAD:
+			gtk_label_set_text (priv->win->status_upload, text);
+			break;
+		case UI_SPINNER:
+			photo_booth_window_set_spinner (priv->win, value);
+			break;
+		case UI_PREVIEW:
+			gtk_widget_set_visible (GTK_WIDGET (priv->win->gtkgstwidget), value);
+			break;
+	}
+}
 
-			g_output_stream_write  (ostream, link_url, strlen(link_url), NULL, NULL);
-			g_output_stream_write  (ostream, "\n", 1, NULL, &error);
-			if (error != NULL) {
-					GST_WARNING ("Unable to connect to send to twitter bridge: %s", error->message);
-					g_error_free (error);
-			}
+static gboolean photo_booth_reinit_camera (PhotoBooth *pb)
+{
+	SEND_COMMAND (pb, CONTROL_REINIT);
+	return FALSE;
+}
+
+/* the capture thread is done with a command */
+static void photo_booth_command_done (const PhotoBoothCommandReply *reply, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	const PhotoBoothCommand *command = &reply->command;
+
+	if (!reply->acted)
+	{
+		GST_DEBUG_OBJECT (pb, "%s #%u was overtaken before it was acted on", photo_booth_command_get_name (command->type), command->seq);
+		return;
+	}
+	photo_booth_histogram_observe (priv->command_latency, (gdouble) (reply->acted - command->sent) / G_USEC_PER_SEC);
+	GST_DEBUG_OBJECT (pb, "%s #%u: received after %" G_GINT64_FORMAT " us, acted on after %" G_GINT64_FORMAT " us, done after %" G_GINT64_FORMAT " ms, result %d",
+		photo_booth_command_get_name (command->type), command->seq, command->received - command->sent, reply->acted - command->sent,
+		(reply->completed - command->sent) / 1000, reply->result);
+	if (command->deadline && reply->completed > command->deadline)
+		GST_WARNING_OBJECT (pb, "%s #%u finished %" G_GINT64_FORMAT " ms after its deadline", photo_booth_command_get_name (command->type), command->seq,
+			(reply->completed - command->deadline) / 1000);
+}
 
-			g_object_unref (reader);
-			g_object_unref (parser);
-			GST_INFO ("Successfully twittered");
+/* a scrape of the metrics endpoint, on the main thread */
+static void photo_booth_metrics_collect (GString *out, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	PhotoBoothWriterStats writer_stats;
+	gint frames = g_atomic_int_get (&priv->preview_frames);
+	gint64 now = g_get_monotonic_time ();
+	gchar *statm = NULL;
+
+	photo_booth_metrics_append_counter (out, "photobooth_photos_taken_total", "Photos taken since start", priv->photos_taken);
+	photo_booth_metrics_append_counter (out, "photobooth_photos_printed_total", "Prints made since start", priv->photos_printed);
+	photo_booth_metrics_append_gauge (out, "photobooth_prints_remaining", "Prints left in the printer, -1 if unknown", priv->prints_remaining);
+	photo_booth_metrics_append_gauge (out, "photobooth_state", "The booth's current state", g_atomic_int_get (&priv->state));
+
+	/* fps averaged over the time since the previous scrape */
+	photo_booth_metrics_append_counter (out, "photobooth_preview_frames_total", "Live preview frames from the camera", frames);
+	if (priv->metrics_fps_time && now > priv->metrics_fps_time)
+		photo_booth_metrics_append_gauge (out, "photobooth_preview_fps", "Live preview frame rate since the previous scrape",
+			(gdouble) (frames - priv->metrics_fps_frames) * G_USEC_PER_SEC / (now - priv->metrics_fps_time));
+	priv->metrics_fps_frames = frames;
+	priv->metrics_fps_time = now;
+	if (pb->video_sink)
+	{
+		GstStructure *stats = NULL;
+		guint64 rendered = 0, dropped = 0;
+		g_object_get (pb->video_sink, "stats", &stats, NULL);
+		if (stats)
+		{
+			gst_structure_get_uint64 (stats, "rendered", &rendered);
+			gst_structure_get_uint64 (stats, "dropped", &dropped);
+			gst_structure_free (stats);
+			photo_booth_metrics_append_counter (out, "photobooth_rendered_frames_total", "Frames shown by the video sink", rendered);
+			photo_booth_metrics_append_counter (out, "photobooth_dropped_frames_total", "Frames the video sink dropped for being late", dropped);
 		}
-		g_string_free (buf, TRUE);
 	}
-	g_mutex_unlock (&priv->upload_mutex);
-	photo_booth_change_state (pb, PB_STATE_PREVIEW_COOLDOWN);
-	photo_booth_window_set_spinner (priv->win, FALSE);
-	return;
+
+	if (priv->writer)
+	{
+		photo_booth_writer_get_stats (priv->writer, &writer_stats);
+		photo_booth_metrics_append_gauge (out, "photobooth_writer_queue_depth", "Photos waiting to be written", writer_stats.queue_depth);
+		photo_booth_metrics_append_counter (out, "photobooth_writer_failures_total", "Photos that couldn't be written", writer_stats.failed);
+		photo_booth_metrics_append_counter (out, "photobooth_writer_refused_total", "Photos refused while the writer queue was full", writer_stats.refused);
+	}
+	if (priv->upload_queue)
+	{
+		PhotoBoothUploadQueueStats upload_stats;
+		photo_booth_upload_queue_get_stats (priv->upload_queue, &upload_stats);
+		photo_booth_metrics_append_gauge (out, "photobooth_upload_queue_depth", "Uploads waiting or in progress", upload_stats.depth);
+		photo_booth_metrics_append_gauge (out, "photobooth_upload_active", "Uploads in progress", upload_stats.active);
+		photo_booth_metrics_append_gauge (out, "photobooth_upload_oldest_age_seconds", "Age of the oldest queued upload", upload_stats.oldest_age);
+		photo_booth_metrics_append_counter (out, "photobooth_uploads_total", "Uploads completed", upload_stats.uploaded);
+		photo_booth_metrics_append_counter (out, "photobooth_upload_failures_total", "Uploads given up on", upload_stats.failed);
+		photo_booth_metrics_append_counter (out, "photobooth_upload_retries_total", "Upload attempts to be retried", upload_stats.retries);
+	}
+
+	/* the second field is the resident set in pages */
+	if (g_file_get_contents ("/proc/self/statm", &statm, NULL, NULL))
+	{
+		gchar **fields = g_strsplit (statm, " ", 3);
+		if (fields[0] && fields[1])
+			photo_booth_metrics_append_gauge (out, "process_resident_memory_bytes", "Resident memory size",
+				(gdouble) g_ascii_strtoull (fields[1], NULL, 10) * sysconf (_SC_PAGESIZE));
+		g_strfreev (fields);
+		g_free (statm);
+	}
+}
+
+/* runs on the upload queue thread. a photo counts as uploaded once all
+ * its backends have it, and as failed as soon as any of them gave up */
+static void photo_booth_upload_attempted (const gchar *target, guint number, PhotoBoothUploadResult result, guint attempts, gpointer user_data)
+{
+	PhotoBooth *pb = PHOTO_BOOTH (user_data);
+	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
+	PhotoBoothUploadFanout *fanout;
+	gboolean settled = TRUE, failed = result == UPLOAD_RESULT_FAILED, prune = FALSE;
+
+	if (result != UPLOAD_RESULT_RETRY)
+	{
+		g_mutex_lock (&priv->upload_mutex);
+		/* jobs restored after a restart settle one by one */
+		fanout = g_hash_table_lookup (priv->upload_fanouts, GUINT_TO_POINTER (number));
+		if (fanout)
+		{
+			fanout->failed |= failed;
+			failed = fanout->failed;
+			settled = --fanout->remaining == 0;
+			if (settled)
+			{
+				g_hash_table_remove (priv->upload_fanouts, GUINT_TO_POINTER (number));
+				prune = TRUE;
+			}
+		}
+		g_mutex_unlock (&priv->upload_mutex);
+		/* no job of this photo is left to read its web variant. jobs
+		 * restored after a restart don't know their siblings, theirs stays */
+		if (prune && priv->web_encoder)
+		{
+			gchar *filename = g_strdup_printf (priv->save_path_template, number);
+			photo_booth_web_encoder_remove (priv->web_encoder, filename);
+			g_free (filename);
+		}
+		if (priv->photo_index && (settled || failed))
+			photo_booth_index_set_upload_status (priv->photo_index, number, failed ? INDEX_UPLOAD_FAILED : INDEX_UPLOAD_DONE);
+	}
+	/* a burst of finished uploads only updates the label once */
+	photo_booth_update_upload_status (pb);
 }
 
 static gboolean photo_booth_upload_timedout (PhotoBooth *pb)
@@ -2392,6 +4261,7 @@ static gboolean photo_booth_watchdog_timedout (PhotoBooth *pb)
 {
 	PhotoBoothPrivate *priv = photo_booth_get_instance_private (pb);
 	GST_ERROR_OBJECT (pb, "watchdog timed out in state %s", photo_booth_state_get_name(priv->state));
+	g_free (photo_booth_trace_dump ("watchdog", TRUE));
 	photo_booth_cancel (pb);
 	return FALSE;
 }
@@ -2408,13 +4278,32 @@ const gchar* photo_booth_state_get_name (PhotoboothState state)
 		case PB_STATE_ASK_PRINT: return "PB_STATE_ASK_PRINT";
 		case PB_STATE_PRINTING: return "PB_STATE_PRINTING";
 		case PB_STATE_ASK_UPLOAD: return "PB_STATE_ASK_UPLOAD";
-		case PB_STATE_UPLOADING: return "PB_STATE_UPLOADING";
 		case PB_STATE_SCREENSAVER: return "PB_STATE_SCREENSAVER";
 		default: break;
 	}
 	return "STATE UNKOWN!";
 }
 
+const gchar* photo_booth_event_get_name (PhotoboothEvent event)
+{
+	switch (event) {
+		case PB_EVENT_CAMERA_LOST: return "PB_EVENT_CAMERA_LOST";
+		case PB_EVENT_CAPTURE_FAILED: return "PB_EVENT_CAPTURE_FAILED";
+		case PB_EVENT_PREVIEW_STARTED: return "PB_EVENT_PREVIEW_STARTED";
+		case PB_EVENT_PREVIEW_READY: return "PB_EVENT_PREVIEW_READY";
+		case PB_EVENT_SCREENSAVER: return "PB_EVENT_SCREENSAVER";
+		case PB_EVENT_SCREENSAVER_STOP: return "PB_EVENT_SCREENSAVER_STOP";
+		case PB_EVENT_COUNTDOWN: return "PB_EVENT_COUNTDOWN";
+		case PB_EVENT_PRETRIGGER: return "PB_EVENT_PRETRIGGER";
+		case PB_EVENT_PHOTO_SHOWN: return "PB_EVENT_PHOTO_SHOWN";
+		case PB_EVENT_PHOTO_PROCESSED: return "PB_EVENT_PHOTO_PROCESSED";
+		case PB_EVENT_PRINT: return "PB_EVENT_PRINT";
+		case PB_EVENT_PRINTED: return "PB_EVENT_PRINTED";
+		default: break;
+	}
+	return "EVENT UNKOWN!";
+}
+
 PhotoBooth *photo_booth_new (void)
 {
 	return g_object_new (PHOTO_BOOTH_TYPE,
@@ -2428,8 +4317,11 @@ int main (int argc, char *argv[])
 	PhotoBooth *pb;
 	int ret;
 
+	photo_booth_startup_mark ("launched");
 	XInitThreads();
 	gst_init (0, NULL);
+	photo_booth_startup_mark ("gstreamer initialized");
+	curl_global_init (CURL_GLOBAL_DEFAULT);
 
 	pb = photo_booth_new ();
 
@@ -2438,9 +4330,13 @@ int main (int argc, char *argv[])
 	else
 		photo_booth_load_settings (pb, DEFAULT_CONFIG);
 
+	/* a print backend or upload peer going away must not kill the booth */
+	signal (SIGPIPE, SIG_IGN);
 	g_unix_signal_add (SIGINT, (GSourceFunc) photo_booth_quit_signal, pb);
+	g_unix_signal_add (SIGUSR1, (GSourceFunc) photo_booth_trace_signal, pb);
 	ret = g_application_run (G_APPLICATION (pb), argc, argv);
 
 	g_object_unref (pb);
+	curl_global_cleanup ();
 	return ret;
 }
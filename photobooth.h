@@ -22,34 +22,10 @@
 #include <gst/gst.h>
 #include <gphoto2/gphoto2.h>
 #include <gphoto2/gphoto2-camera.h>
+#include "photoboothcommand.h"
 
-#define CONTROL_VIDEO          '1'     /* start movie capture */
-#define CONTROL_PRETRIGGER     '2'     /* pretrigger */
-#define CONTROL_PHOTO          '3'     /* photo capture */
-#define CONTROL_PAUSE          '4'     /* pause capture */
-#define CONTROL_UNPAUSE        '5'     /* unpause capture */
-#define CONTROL_REINIT         '6'     /* reinitializes camera */
-#define CONTROL_QUIT           '0'     /* quit capture thread */
-#define CONTROL_SOCKETS(src)   src->control_sock
-#define WRITE_SOCKET(src)      src->control_sock[1]
-#define READ_SOCKET(src)       src->control_sock[0]
-
-#define CLEAR_COMMAND(src)                  \
-G_STMT_START {                              \
-  char c;                                   \
-  read(READ_SOCKET(src), &c, 1);            \
-} G_STMT_END
-
-#define SEND_COMMAND(src, command)          \
-G_STMT_START {                              \
-  int G_GNUC_UNUSED _res; unsigned char c; c = command;   \
-  _res = write (WRITE_SOCKET(src), &c, 1);  \
-} G_STMT_END
-
-#define READ_COMMAND(src, command, res)        \
-G_STMT_START {                                 \
-  res = read(READ_SOCKET(src), &command, 1);   \
-} G_STMT_END
+/* only ever sent from the main thread */
+#define SEND_COMMAND(src, command)   photo_booth_command_send_type ((src)->control, command)
 
 G_BEGIN_DECLS
 
@@ -84,10 +60,27 @@ typedef enum
 	PB_STATE_ASK_PRINT,
 	PB_STATE_PRINTING,
 	PB_STATE_ASK_UPLOAD,
-	PB_STATE_UPLOADING,
 	PB_STATE_SCREENSAVER
 } PhotoboothState;
 
+#define PB_STATE_COUNT (PB_STATE_SCREENSAVER + 1)
+
+typedef enum
+{
+	PB_EVENT_CAMERA_LOST = 0,
+	PB_EVENT_CAPTURE_FAILED,
+	PB_EVENT_PREVIEW_STARTED,
+	PB_EVENT_PREVIEW_READY,
+	PB_EVENT_SCREENSAVER,
+	PB_EVENT_SCREENSAVER_STOP,
+	PB_EVENT_COUNTDOWN,
+	PB_EVENT_PRETRIGGER,
+	PB_EVENT_PHOTO_SHOWN,
+	PB_EVENT_PHOTO_PROCESSED,
+	PB_EVENT_PRINT,
+	PB_EVENT_PRINTED
+} PhotoboothEvent;
+
 gchar *G_template_filename;
 gchar *G_stylesheet_filename;
 GHashTable *G_strings_table;
@@ -118,7 +111,7 @@ struct _PhotoBooth
 	gint timeout_id;
 	CameraInfo *cam_info;
 
-	int control_sock[2];
+	PhotoBoothCommandChannel *control;
 };
 
 struct _PhotoBoothClass
@@ -0,0 +1,503 @@
+/*
+ * photoboothbackend.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include "photobooth.h"
+#include "photoboothbackend.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_backend_debug);
+#define GST_CAT_DEFAULT photo_booth_backend_debug
+
+#define IMGUR_UPLOAD_URI          "https://api.imgur.com/3/upload"
+#define UPLOAD_USER_AGENT         "Schaffenburg Photobooth"
+#define DEFAULT_WEBHOOK_FIELD     "image"
+#define DEFAULT_S3_REGION         "us-east-1"
+
+typedef struct
+{
+	guint                 number;
+	struct curl_httppost *post;
+	struct curl_slist    *headerlist;
+	GString              *response;
+	GBytes               *photo;       /* body of PUT uploads */
+	gsize                 offset;
+	FILE                 *file;
+	gchar                *part_filename, *final_filename;
+	gchar                *link;
+} PhotoBoothBackendRequest;
+
+typedef struct
+{
+	const gchar *type;
+	gboolean     web_variant;          /* default of the backend's web_variant key */
+	gboolean   (*configure) (PhotoBoothUploadBackend *backend, GKeyFile *gkf, const gchar *group);
+	gboolean   (*prepare)   (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo);
+	/* only called after a successful transfer */
+	gboolean   (*finish)    (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request);
+} PhotoBoothUploadBackendType;
+
+/* a backend only sets up its request on the easy handle it's given, the
+ * upload queue runs the transfers of all of them concurrently and keeps
+ * retrying each photo per backend independently */
+struct _PhotoBoothUploadBackend
+{
+	gchar       *name;
+	const PhotoBoothUploadBackendType *type;
+	gboolean     web_variant;
+	gchar       *uri;
+	gchar       *field;
+	gchar       *header;
+	gchar       *album, *description;
+	gchar       *bucket, *region, *access_key, *secret_key, *prefix, *public_url;
+};
+
+/* a key of the backend's group, or of the [upload] group under its name
+ * from before there were backends */
+static gchar *_backend_get_string (GKeyFile *gkf, const gchar *group, const gchar *key, const gchar *legacy_key)
+{
+	gchar *value = g_key_file_get_string (gkf, group, key, NULL);
+	if (!value && legacy_key)
+		value = g_key_file_get_string (gkf, "upload", legacy_key, NULL);
+	if (value && !*value)
+		g_clear_pointer (&value, g_free);
+	return value;
+}
+
+static size_t _backend_write_func (void *ptr, size_t size, size_t nmemb, GString *buf)
+{
+	g_string_append_len (buf, ptr, size * nmemb);
+	return size * nmemb;
+}
+
+static size_t _backend_read_func (char *ptr, size_t size, size_t nmemb, PhotoBoothBackendRequest *request)
+{
+	gsize len;
+	const guint8 *data;
+
+	if (request->file)
+		return fread (ptr, size, nmemb, request->file);
+	data = g_bytes_get_data (request->photo, &len);
+	len = MIN (len - request->offset, size * nmemb);
+	memcpy (ptr, data + request->offset, len);
+	request->offset += len;
+	return len;
+}
+
+/* the photo as multipart form field, straight from memory if it's there */
+static void _backend_add_image (PhotoBoothBackendRequest *request, struct curl_httppost **last, const gchar *field, const gchar *filename, GBytes *photo)
+{
+	if (photo)
+	{
+		gchar *basename = g_path_get_basename (filename);
+		gsize size;
+		gconstpointer data = g_bytes_get_data (photo, &size);
+		/* curl only references the data, the queue keeps it alive */
+		curl_formadd (&request->post, last, CURLFORM_COPYNAME, field, CURLFORM_BUFFER, basename, CURLFORM_BUFFERPTR, data,
+		              CURLFORM_BUFFERLENGTH, (long) size, CURLFORM_CONTENTTYPE, "image/jpeg", CURLFORM_END);
+		g_free (basename);
+	}
+	else
+		curl_formadd (&request->post, last, CURLFORM_COPYNAME, field, CURLFORM_FILE, filename, CURLFORM_CONTENTTYPE, "image/jpeg", CURLFORM_END);
+}
+
+/* the photo as request body of an upload */
+static gboolean _backend_set_body (PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo)
+{
+	curl_off_t size;
+
+	if (photo)
+	{
+		request->photo = g_bytes_ref (photo);
+		size = g_bytes_get_size (photo);
+	}
+	else
+	{
+		struct stat st;
+		request->file = g_fopen (filename, "rb");
+		if (!request->file || fstat (fileno (request->file), &st) < 0)
+		{
+			GST_WARNING ("can't open '%s': %s", filename, g_strerror (errno));
+			return FALSE;
+		}
+		size = st.st_size;
+	}
+	curl_easy_setopt (curl, CURLOPT_UPLOAD, 1L);
+	curl_easy_setopt (curl, CURLOPT_READFUNCTION, _backend_read_func);
+	curl_easy_setopt (curl, CURLOPT_READDATA, request);
+	curl_easy_setopt (curl, CURLOPT_INFILESIZE_LARGE, size);
+	return TRUE;
+}
+
+/* data.link as imgur answers, or a top level link */
+static gchar *_backend_parse_link (const GString *response)
+{
+	JsonParser *parser = json_parser_new ();
+	JsonReader *reader;
+	gchar *link = NULL;
+
+	if (json_parser_load_from_data (parser, response->str, response->len, NULL) && json_parser_get_root (parser))
+	{
+		reader = json_reader_new (json_parser_get_root (parser));
+		if (json_reader_read_member (reader, "data") && json_reader_read_member (reader, "link"))
+			link = g_strdup (json_reader_get_string_value (reader));
+		else
+		{
+			json_reader_end_member (reader);
+			json_reader_end_member (reader);
+			if (json_reader_read_member (reader, "link"))
+				link = g_strdup (json_reader_get_string_value (reader));
+		}
+		g_object_unref (reader);
+	}
+	g_object_unref (parser);
+	return link;
+}
+
+/* imgur: multipart post into an album */
+
+static gboolean _imgur_configure (PhotoBoothUploadBackend *backend, GKeyFile *gkf, const gchar *group)
+{
+	gchar *token;
+
+	backend->uri = _backend_get_string (gkf, group, "uri", NULL);
+	if (!backend->uri)
+		backend->uri = g_strdup (IMGUR_UPLOAD_URI);
+	backend->album = _backend_get_string (gkf, group, "album_id", "imgur_album_id");
+	backend->description = _backend_get_string (gkf, group, "description", "imgur_description");
+	token = _backend_get_string (gkf, group, "access_token", "imgur_access_token");
+	if (token)
+		backend->header = g_strdup_printf ("Authorization: Bearer %s", token);
+	g_free (token);
+	return backend->album && backend->header;
+}
+
+static gboolean _imgur_prepare (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo)
+{
+	struct curl_httppost *last = NULL;
+
+	_backend_add_image (request, &last, "image", filename, photo);
+	curl_formadd (&request->post, &last, CURLFORM_COPYNAME, "album", CURLFORM_COPYCONTENTS, backend->album, CURLFORM_END);
+	if (backend->description)
+		curl_formadd (&request->post, &last, CURLFORM_COPYNAME, "description", CURLFORM_COPYCONTENTS, backend->description, CURLFORM_END);
+	request->headerlist = curl_slist_append (request->headerlist, backend->header);
+	curl_easy_setopt (curl, CURLOPT_URL, backend->uri);
+	curl_easy_setopt (curl, CURLOPT_HTTPPOST, request->post);
+	GST_INFO ("%s: imgur posting '%s' to album http://imgur.com/a/%s", backend->name, filename, backend->album);
+	return TRUE;
+}
+
+static gboolean _response_finish (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request)
+{
+	request->link = _backend_parse_link (request->response);
+	return TRUE;
+}
+
+/* webhook: multipart post of the photo and its number to any url */
+
+static gboolean _webhook_configure (PhotoBoothUploadBackend *backend, GKeyFile *gkf, const gchar *group)
+{
+	backend->uri = _backend_get_string (gkf, group, "uri", "facebook_put_uri");
+	backend->field = _backend_get_string (gkf, group, "field", NULL);
+	if (!backend->field)
+		backend->field = g_strdup (DEFAULT_WEBHOOK_FIELD);
+	backend->header = _backend_get_string (gkf, group, "header", NULL);
+	return backend->uri != NULL;
+}
+
+static gboolean _webhook_prepare (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo)
+{
+	struct curl_httppost *last = NULL;
+	gchar *number = g_strdup_printf ("%u", request->number);
+
+	_backend_add_image (request, &last, backend->field, filename, photo);
+	curl_formadd (&request->post, &last, CURLFORM_COPYNAME, "number", CURLFORM_COPYCONTENTS, number, CURLFORM_END);
+	if (backend->header)
+		request->headerlist = curl_slist_append (request->headerlist, backend->header);
+	curl_easy_setopt (curl, CURLOPT_URL, backend->uri);
+	curl_easy_setopt (curl, CURLOPT_HTTPPOST, request->post);
+	GST_INFO ("%s: posting '%s' to '%s'", backend->name, filename, backend->uri);
+	g_free (number);
+	return TRUE;
+}
+
+/* folder: copy to a local or mounted network directory, through curl's
+ * file:// protocol so it runs like any other transfer. it's written under
+ * a temporary name and only renamed into place once complete */
+
+static gboolean _folder_configure (PhotoBoothUploadBackend *backend, GKeyFile *gkf, const gchar *group)
+{
+	gchar *path = _backend_get_string (gkf, group, "path", NULL);
+
+	if (path && !g_path_is_absolute (path))
+	{
+		gchar *cwd = g_get_current_dir ();
+		backend->uri = g_build_filename (cwd, path, NULL);
+		g_free (cwd);
+		g_free (path);
+	}
+	else
+		backend->uri = path;
+	return backend->uri != NULL;
+}
+
+static gboolean _folder_prepare (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo)
+{
+	gchar *basename, *part_basename, *uri;
+
+	if (g_mkdir_with_parents (backend->uri, 0755) < 0)
+	{
+		/* the share may just not be mounted (yet) */
+		GST_WARNING ("%s: can't create '%s': %s", backend->name, backend->uri, g_strerror (errno));
+	}
+	basename = g_path_get_basename (filename);
+	part_basename = g_strdup_printf (".%s.part", basename);
+	request->final_filename = g_build_filename (backend->uri, basename, NULL);
+	request->part_filename = g_build_filename (backend->uri, part_basename, NULL);
+	uri = g_filename_to_uri (request->part_filename, NULL, NULL);
+	g_free (part_basename);
+	g_free (basename);
+	if (!uri || !_backend_set_body (request, curl, filename, photo))
+	{
+		g_free (uri);
+		return FALSE;
+	}
+	curl_easy_setopt (curl, CURLOPT_URL, uri);
+	GST_INFO ("%s: copying '%s' to '%s'", backend->name, filename, request->final_filename);
+	g_free (uri);
+	return TRUE;
+}
+
+static gboolean _folder_finish (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request)
+{
+	if (g_rename (request->part_filename, request->final_filename) < 0)
+	{
+		GST_WARNING ("%s: can't rename to '%s': %s", backend->name, request->final_filename, g_strerror (errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* s3: a signed PUT to an S3 compatible object store (path style, so it
+ * works with minio and friends), signed by curl's AWS SigV4 support */
+
+static gboolean _s3_configure (PhotoBoothUploadBackend *backend, GKeyFile *gkf, const gchar *group)
+{
+	backend->uri = _backend_get_string (gkf, group, "endpoint", NULL);
+	backend->bucket = _backend_get_string (gkf, group, "bucket", NULL);
+	backend->region = _backend_get_string (gkf, group, "region", NULL);
+	if (!backend->region)
+		backend->region = g_strdup (DEFAULT_S3_REGION);
+	backend->access_key = _backend_get_string (gkf, group, "access_key", NULL);
+	backend->secret_key = _backend_get_string (gkf, group, "secret_key", NULL);
+	backend->prefix = _backend_get_string (gkf, group, "prefix", NULL);
+	backend->public_url = _backend_get_string (gkf, group, "public_url", NULL);
+	return backend->uri && backend->bucket && backend->access_key && backend->secret_key;
+}
+
+static gboolean _s3_prepare (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request, CURL *curl, const gchar *filename, GBytes *photo)
+{
+	gchar *basename, *key, *url, *sigv4, *userpwd;
+
+	if (!_backend_set_body (request, curl, filename, photo))
+		return FALSE;
+	basename = g_path_get_basename (filename);
+	key = g_strdup_printf ("%s%s", backend->prefix ? backend->prefix : "", basename);
+	url = g_strdup_printf ("%s/%s/%s", backend->uri, backend->bucket, key);
+	sigv4 = g_strdup_printf ("aws:amz:%s:s3", backend->region);
+	userpwd = g_strdup_printf ("%s:%s", backend->access_key, backend->secret_key);
+	curl_easy_setopt (curl, CURLOPT_URL, url);
+	curl_easy_setopt (curl, CURLOPT_AWS_SIGV4, sigv4);
+	curl_easy_setopt (curl, CURLOPT_USERPWD, userpwd);
+	/* streamed bodies aren't hashed for the signature */
+	request->headerlist = curl_slist_append (request->headerlist, "x-amz-content-sha256: UNSIGNED-PAYLOAD");
+	request->headerlist = curl_slist_append (request->headerlist, "Content-Type: image/jpeg");
+	if (backend->public_url)
+		request->link = g_strdup_printf ("%s/%s", backend->public_url, key);
+	GST_INFO ("%s: putting '%s' to '%s'", backend->name, filename, url);
+	g_free (userpwd);
+	g_free (sigv4);
+	g_free (url);
+	g_free (key);
+	g_free (basename);
+	return TRUE;
+}
+
+static gboolean _s3_finish (PhotoBoothUploadBackend *backend, PhotoBoothBackendRequest *request)
+{
+	return TRUE;
+}
+
+static const PhotoBoothUploadBackendType backend_types[] = {
+	{ "imgur",   TRUE,  _imgur_configure,   _imgur_prepare,   _response_finish },
+	{ "webhook", TRUE,  _webhook_configure, _webhook_prepare, _response_finish },
+	{ "folder",  FALSE, _folder_configure,  _folder_prepare,  _folder_finish },
+	{ "s3",      FALSE, _s3_configure,      _s3_prepare,      _s3_finish },
+};
+
+PhotoBoothUploadBackend *photo_booth_upload_backend_new (GKeyFile *gkf, const gchar *name)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothUploadBackend *backend;
+	gchar *group, *type;
+	GError *error = NULL;
+	guint i;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_backend_debug, "photoboothbackend", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_CYAN, "PhotoBoothBackend");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	group = g_strdup_printf ("upload-%s", name);
+	type = _backend_get_string (gkf, group, "type", NULL);
+	backend = g_new0 (PhotoBoothUploadBackend, 1);
+	backend->name = g_strdup (name);
+	for (i = 0; i < G_N_ELEMENTS (backend_types); i++)
+		if (!g_strcmp0 (type ? type : name, backend_types[i].type))
+			backend->type = &backend_types[i];
+	if (!backend->type)
+		GST_ERROR ("upload backend '%s' has unknown type '%s'", name, type ? type : name);
+	else if (!backend->type->configure (backend, gkf, group))
+	{
+		GST_ERROR ("upload backend '%s' is missing settings in [%s]", name, group);
+		backend->type = NULL;
+	}
+	if (!backend->type)
+	{
+		photo_booth_upload_backend_free (backend);
+		backend = NULL;
+	}
+	else
+	{
+		backend->web_variant = g_key_file_get_boolean (gkf, group, "web_variant", &error);
+		if (error)
+		{
+			backend->web_variant = backend->type->web_variant;
+			g_error_free (error);
+		}
+		GST_INFO ("upload backend '%s' (%s) to '%s'%s", name, backend->type->type, backend->uri, backend->web_variant ? ", web variant" : "");
+	}
+	g_free (type);
+	g_free (group);
+	return backend;
+}
+
+void photo_booth_upload_backend_free (PhotoBoothUploadBackend *backend)
+{
+	g_free (backend->name);
+	g_free (backend->uri);
+	g_free (backend->field);
+	g_free (backend->header);
+	g_free (backend->album);
+	g_free (backend->description);
+	g_free (backend->bucket);
+	g_free (backend->region);
+	g_free (backend->access_key);
+	g_free (backend->secret_key);
+	g_free (backend->prefix);
+	g_free (backend->public_url);
+	g_free (backend);
+}
+
+const gchar *photo_booth_upload_backend_get_name (PhotoBoothUploadBackend *backend)
+{
+	return backend->name;
+}
+
+/* whether it gets the web variant rather than the archival photo */
+gboolean photo_booth_upload_backend_wants_web_variant (PhotoBoothUploadBackend *backend)
+{
+	return backend->web_variant;
+}
+
+static void _backend_request_free (PhotoBoothBackendRequest *request)
+{
+	if (request->post)
+		curl_formfree (request->post);
+	curl_slist_free_all (request->headerlist);
+	g_string_free (request->response, TRUE);
+	if (request->photo)
+		g_bytes_unref (request->photo);
+	if (request->file)
+		fclose (request->file);
+	g_free (request->part_filename);
+	g_free (request->final_filename);
+	g_free (request->link);
+	g_slice_free (PhotoBoothBackendRequest, request);
+}
+
+/* sets up one attempt on the upload queue's thread. NULL if the photo
+ * can't be uploaded at all */
+gpointer photo_booth_upload_backend_prepare (PhotoBoothUploadBackend *backend, CURL *curl, const gchar *filename, guint number, GBytes *photo)
+{
+	PhotoBoothBackendRequest *request = g_slice_new0 (PhotoBoothBackendRequest);
+
+	request->number = number;
+	request->response = g_string_new (NULL);
+	if (!backend->type->prepare (backend, request, curl, filename, photo))
+	{
+		_backend_request_free (request);
+		return NULL;
+	}
+	curl_easy_setopt (curl, CURLOPT_USERAGENT, UPLOAD_USER_AGENT);
+	if (request->headerlist)
+		curl_easy_setopt (curl, CURLOPT_HTTPHEADER, request->headerlist);
+	curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, _backend_write_func);
+	curl_easy_setopt (curl, CURLOPT_WRITEDATA, request->response);
+	return request;
+}
+
+/* classifies the transfer's outcome and frees the request. link is set
+ * to the photo's public url if the backend knows it */
+PhotoBoothUploadResult photo_booth_upload_backend_finish (PhotoBoothUploadBackend *backend, CURL *curl, CURLcode res, gpointer data, gchar **link)
+{
+	PhotoBoothBackendRequest *request = data;
+	PhotoBoothUploadResult result;
+	long http_code = 0;
+
+	curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+	if (res != CURLE_OK)
+	{
+		GST_WARNING ("%s: upload of photo %u failed: %s", backend->name, request->number, curl_easy_strerror (res));
+		result = UPLOAD_RESULT_RETRY;
+	}
+	else if (http_code == 408 || http_code == 429 || http_code >= 500)
+	{
+		GST_WARNING ("%s: upload refused with HTTP %ld, will retry", backend->name, http_code);
+		result = UPLOAD_RESULT_RETRY;
+	}
+	else if (http_code && (http_code < 200 || http_code >= 300))
+	{
+		GST_WARNING ("%s: upload rejected with HTTP %ld: '%s'", backend->name, http_code, request->response->str);
+		result = UPLOAD_RESULT_FAILED;
+	}
+	else
+		/* file:// transfers have no response code */
+		result = backend->type->finish (backend, request) ? UPLOAD_RESULT_OK : UPLOAD_RESULT_RETRY;
+	GST_DEBUG ("%s: upload of photo %u finished. response='%s'", backend->name, request->number, request->response->str);
+
+	if (result == UPLOAD_RESULT_OK && link)
+	{
+		*link = request->link;
+		request->link = NULL;
+	}
+	_backend_request_free (request);
+	return result;
+}
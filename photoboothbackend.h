@@ -0,0 +1,38 @@
+/*
+ * GStreamer photoboothbackend.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_BACKEND_H__
+#define __PHOTO_BOOTH_BACKEND_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "photoboothupload.h"
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothUploadBackend PhotoBoothUploadBackend;
+
+/* an upload target configured in the [upload-<name>] ini group. type is
+ * one of imgur, webhook, folder or s3 and defaults to the name */
+PhotoBoothUploadBackend *photo_booth_upload_backend_new         (GKeyFile *gkf, const gchar *name);
+void                     photo_booth_upload_backend_free        (PhotoBoothUploadBackend *backend);
+const gchar             *photo_booth_upload_backend_get_name    (PhotoBoothUploadBackend *backend);
+gboolean                 photo_booth_upload_backend_wants_web_variant (PhotoBoothUploadBackend *backend);
+gpointer                 photo_booth_upload_backend_prepare     (PhotoBoothUploadBackend *backend, CURL *curl, const gchar *filename, guint number, GBytes *photo);
+PhotoBoothUploadResult   photo_booth_upload_backend_finish      (PhotoBoothUploadBackend *backend, CURL *curl, CURLcode res, gpointer request, gchar **link);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_BACKEND_H__ */
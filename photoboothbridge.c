@@ -0,0 +1,399 @@
+/*
+ * photoboothbridge.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include "photobooth.h"
+#include "photoboothbridge.h"
+
+G_DEFINE_TYPE (PhotoBoothBridge, photo_booth_bridge, G_TYPE_OBJECT);
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_bridge_debug);
+#define GST_CAT_DEFAULT photo_booth_bridge_debug
+
+#define BRIDGE_CONNECT_TIMEOUT    10
+#define BRIDGE_RECONNECT_MIN      1
+#define BRIDGE_RECONNECT_MAX      30
+
+/* one line per message, "link\n". with ack set the bridge answers every
+ * line it has dealt with with a line of its own, otherwise a message
+ * counts as delivered once it's written to the socket. */
+typedef struct
+{
+	gchar     *data;
+	gsize      len;
+	gint64     queue_time;
+	gboolean   acked;           /* before its write was even finished */
+} PhotoBoothBridgeMessage;
+
+static void photo_booth_bridge_finalize (GObject *object);
+static void _bridge_connect (PhotoBoothBridge *bridge);
+static void _bridge_flush (PhotoBoothBridge *bridge);
+
+static void photo_booth_bridge_class_init (PhotoBoothBridgeClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+	GST_DEBUG_CATEGORY_INIT (photo_booth_bridge_debug, "photoboothbridge", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothBridge");
+
+	gobject_class->finalize = photo_booth_bridge_finalize;
+}
+
+static void photo_booth_bridge_init (PhotoBoothBridge *bridge)
+{
+	g_mutex_init (&bridge->mutex);
+	g_queue_init (&bridge->queue);
+	g_queue_init (&bridge->in_flight);
+	bridge->cancellable = g_cancellable_new ();
+	bridge->client = g_socket_client_new ();
+	g_socket_client_set_timeout (bridge->client, BRIDGE_CONNECT_TIMEOUT);
+	bridge->reconnect_delay = BRIDGE_RECONNECT_MIN;
+}
+
+static void _bridge_message_free (PhotoBoothBridgeMessage *message)
+{
+	g_free (message->data);
+	g_slice_free (PhotoBoothBridgeMessage, message);
+}
+
+static void photo_booth_bridge_finalize (GObject *object)
+{
+	PhotoBoothBridge *bridge = PHOTO_BOOTH_BRIDGE (object);
+
+	g_queue_foreach (&bridge->queue, (GFunc) _bridge_message_free, NULL);
+	g_queue_clear (&bridge->queue);
+	g_queue_foreach (&bridge->in_flight, (GFunc) _bridge_message_free, NULL);
+	g_queue_clear (&bridge->in_flight);
+	if (bridge->writing_message)
+		_bridge_message_free (bridge->writing_message);
+	g_clear_object (&bridge->input);
+	g_clear_object (&bridge->connection);
+	g_object_unref (bridge->client);
+	g_object_unref (bridge->cancellable);
+	if (bridge->context)
+		g_main_context_unref (bridge->context);
+	g_mutex_clear (&bridge->mutex);
+	g_free (bridge->host);
+	G_OBJECT_CLASS (photo_booth_bridge_parent_class)->finalize (object);
+}
+
+static gboolean _bridge_reconnect_timeout (PhotoBoothBridge *bridge)
+{
+	bridge->reconnect_id = 0;
+	_bridge_connect (bridge);
+	return FALSE;
+}
+
+static void _bridge_schedule_reconnect (PhotoBoothBridge *bridge)
+{
+	GSource *source;
+
+	if (bridge->closed || bridge->reconnect_id)
+		return;
+	GST_DEBUG_OBJECT (bridge, "reconnecting in %u s", bridge->reconnect_delay);
+	source = g_timeout_source_new_seconds (bridge->reconnect_delay);
+	g_source_set_callback (source, (GSourceFunc) _bridge_reconnect_timeout, g_object_ref (bridge), g_object_unref);
+	bridge->reconnect_id = g_source_attach (source, bridge->context);
+	g_source_unref (source);
+	bridge->reconnect_delay = MIN (bridge->reconnect_delay * 2, BRIDGE_RECONNECT_MAX);
+}
+
+/* unacknowledged messages go back to the front of the queue, the bridge
+ * may see a link twice but never misses one */
+static void _bridge_disconnect (PhotoBoothBridge *bridge, const gchar *reason)
+{
+	PhotoBoothBridgeMessage *message;
+
+	if (!bridge->connection || bridge->closed)
+		return;
+	GST_WARNING_OBJECT (bridge, "lost connection to %s:%u: %s", bridge->host, bridge->port, reason);
+	g_io_stream_close (G_IO_STREAM (bridge->connection), NULL, NULL);
+	g_clear_object (&bridge->input);
+	g_clear_object (&bridge->connection);
+	g_mutex_lock (&bridge->mutex);
+	/* the message being written is the newest, it goes behind the others */
+	if (bridge->writing_message)
+	{
+		message = bridge->writing_message;
+		bridge->writing_message = NULL;
+		message->acked = FALSE;
+		g_queue_push_head (&bridge->queue, message);
+		bridge->stats.resent++;
+	}
+	while ((message = g_queue_pop_tail (&bridge->in_flight)))
+	{
+		g_queue_push_head (&bridge->queue, message);
+		bridge->stats.resent++;
+	}
+	bridge->stats.connected = FALSE;
+	bridge->stats.disconnects++;
+	g_mutex_unlock (&bridge->mutex);
+	_bridge_schedule_reconnect (bridge);
+}
+
+static void _bridge_delivered (PhotoBoothBridge *bridge, PhotoBoothBridgeMessage *message)
+{
+	gint64 latency = g_get_monotonic_time () - message->queue_time;
+
+	g_mutex_lock (&bridge->mutex);
+	bridge->stats.delivered++;
+	bridge->stats.last_latency = latency;
+	bridge->stats.max_latency = MAX (bridge->stats.max_latency, latency);
+	GST_INFO_OBJECT (bridge, "delivered after %" G_GINT64_FORMAT " ms: %.*s. %u delivered, %u queued, %u dropped, %u resent, %u connects",
+		latency / 1000, (gint) message->len - 1, message->data, bridge->stats.delivered, g_queue_get_length (&bridge->queue),
+		bridge->stats.dropped, bridge->stats.resent, bridge->stats.connects);
+	g_mutex_unlock (&bridge->mutex);
+	_bridge_message_free (message);
+}
+
+static void _bridge_read_line (PhotoBoothBridge *bridge);
+
+static void _bridge_line_read (GDataInputStream *input, GAsyncResult *res, PhotoBoothBridge *bridge)
+{
+	GError *error = NULL;
+	gchar *line;
+
+	line = g_data_input_stream_read_line_finish (input, res, NULL, &error);
+	if (input != bridge->input)
+	{
+		/* a stale read of a connection that's already gone */
+	}
+	else if (error || !line)
+		_bridge_disconnect (bridge, error ? error->message : "closed by peer");
+	else
+	{
+		if (bridge->ack)
+		{
+			PhotoBoothBridgeMessage *message, *writing = NULL;
+			g_mutex_lock (&bridge->mutex);
+			message = g_queue_pop_head (&bridge->in_flight);
+			/* the bridge may answer before our write callback ran, the
+			 * message is delivered once that's done */
+			if (!message && bridge->writing_message && !((PhotoBoothBridgeMessage *) bridge->writing_message)->acked)
+			{
+				writing = bridge->writing_message;
+				writing->acked = TRUE;
+			}
+			g_mutex_unlock (&bridge->mutex);
+			if (message)
+				_bridge_delivered (bridge, message);
+			else if (!writing)
+				GST_WARNING_OBJECT (bridge, "unexpected ack '%s'", line);
+		}
+		else
+			GST_DEBUG_OBJECT (bridge, "bridge said '%s'", line);
+		_bridge_read_line (bridge);
+	}
+	g_clear_error (&error);
+	g_free (line);
+	g_object_unref (bridge);
+}
+
+static void _bridge_read_line (PhotoBoothBridge *bridge)
+{
+	g_data_input_stream_read_line_async (bridge->input, G_PRIORITY_DEFAULT, bridge->cancellable,
+		(GAsyncReadyCallback) _bridge_line_read, g_object_ref (bridge));
+}
+
+static void _bridge_connected (GSocketClient *client, GAsyncResult *res, PhotoBoothBridge *bridge)
+{
+	GError *error = NULL;
+	GSocketConnection *connection;
+
+	bridge->connecting = FALSE;
+	connection = g_socket_client_connect_to_host_finish (client, res, &error);
+	if (!connection)
+	{
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			GST_WARNING_OBJECT (bridge, "can't connect to %s:%u: %s", bridge->host, bridge->port, error->message);
+			_bridge_schedule_reconnect (bridge);
+		}
+		g_error_free (error);
+		g_object_unref (bridge);
+		return;
+	}
+	if (bridge->closed)
+	{
+		g_object_unref (connection);
+		g_object_unref (bridge);
+		return;
+	}
+
+	g_socket_set_keepalive (g_socket_connection_get_socket (connection), TRUE);
+	bridge->connection = connection;
+	bridge->input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	bridge->reconnect_delay = BRIDGE_RECONNECT_MIN;
+	g_mutex_lock (&bridge->mutex);
+	bridge->stats.connected = TRUE;
+	bridge->stats.connects++;
+	GST_INFO_OBJECT (bridge, "connected to %s:%u, %u messages waiting", bridge->host, bridge->port, g_queue_get_length (&bridge->queue));
+	g_mutex_unlock (&bridge->mutex);
+	/* the read side notices a dead connection even while nothing is sent */
+	_bridge_read_line (bridge);
+	_bridge_flush (bridge);
+	g_object_unref (bridge);
+}
+
+static void _bridge_connect (PhotoBoothBridge *bridge)
+{
+	if (bridge->closed || bridge->connecting || bridge->connection)
+		return;
+	bridge->connecting = TRUE;
+	g_socket_client_connect_to_host_async (bridge->client, bridge->host, bridge->port, bridge->cancellable,
+		(GAsyncReadyCallback) _bridge_connected, g_object_ref (bridge));
+}
+
+static void _bridge_written (GOutputStream *output, GAsyncResult *res, PhotoBoothBridge *bridge)
+{
+	GError *error = NULL;
+	PhotoBoothBridgeMessage *message;
+	gboolean written;
+
+	written = g_output_stream_write_all_finish (output, res, NULL, &error);
+	if (!bridge->connection || output != g_io_stream_get_output_stream (G_IO_STREAM (bridge->connection)))
+	{
+		/* of a connection that's already gone, its message was requeued */
+		g_clear_error (&error);
+		g_object_unref (bridge);
+		return;
+	}
+	if (!written)
+	{
+		/* requeues the message being written along with in_flight */
+		_bridge_disconnect (bridge, error->message);
+		g_error_free (error);
+		g_object_unref (bridge);
+		return;
+	}
+	g_mutex_lock (&bridge->mutex);
+	message = bridge->writing_message;
+	bridge->writing_message = NULL;
+	g_mutex_unlock (&bridge->mutex);
+	if (bridge->ack && !message->acked)
+	{
+		g_mutex_lock (&bridge->mutex);
+		g_queue_push_tail (&bridge->in_flight, message);
+		g_mutex_unlock (&bridge->mutex);
+		_bridge_flush (bridge);
+	}
+	else
+	{
+		_bridge_delivered (bridge, message);
+		_bridge_flush (bridge);
+	}
+	g_object_unref (bridge);
+}
+
+/* writes the next message, one at a time. the message being written is
+ * kept on its own until the write finished, a lost connection requeues it
+ * in front of the queue */
+static void _bridge_flush (PhotoBoothBridge *bridge)
+{
+	PhotoBoothBridgeMessage *message;
+
+	if (!bridge->connection)
+	{
+		_bridge_connect (bridge);
+		return;
+	}
+	g_mutex_lock (&bridge->mutex);
+	if (bridge->writing_message)
+	{
+		g_mutex_unlock (&bridge->mutex);
+		return;
+	}
+	message = g_queue_pop_head (&bridge->queue);
+	bridge->writing_message = message;
+	g_mutex_unlock (&bridge->mutex);
+	if (!message)
+		return;
+	g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (bridge->connection)), message->data, message->len,
+		G_PRIORITY_DEFAULT, bridge->cancellable, (GAsyncReadyCallback) _bridge_written, g_object_ref (bridge));
+}
+
+static gboolean _bridge_flush_idle (PhotoBoothBridge *bridge)
+{
+	if (!bridge->closed)
+		_bridge_flush (bridge);
+	return FALSE;
+}
+
+/* the connection lives on the calling thread's default main context, it
+ * is established right away and kept open */
+PhotoBoothBridge *photo_booth_bridge_new (const gchar *host, guint16 port, guint max_queue, gboolean ack)
+{
+	PhotoBoothBridge *bridge = g_object_new (PHOTO_BOOTH_BRIDGE_TYPE, NULL);
+
+	bridge->host = g_strdup (host);
+	bridge->port = port;
+	bridge->max_queue = MAX (max_queue, 1);
+	bridge->ack = ack;
+	bridge->context = g_main_context_ref_thread_default ();
+	_bridge_connect (bridge);
+	return bridge;
+}
+
+/* may be called from any thread. when max_queue messages are waiting the
+ * oldest is dropped, a stale link is the least valuable */
+void photo_booth_bridge_send (PhotoBoothBridge *bridge, const gchar *message)
+{
+	PhotoBoothBridgeMessage *msg = g_slice_new0 (PhotoBoothBridgeMessage);
+
+	msg->data = g_strdup_printf ("%s\n", message);
+	msg->len = strlen (msg->data);
+	msg->queue_time = g_get_monotonic_time ();
+	g_mutex_lock (&bridge->mutex);
+	if (g_queue_get_length (&bridge->queue) >= bridge->max_queue)
+	{
+		PhotoBoothBridgeMessage *dropped = g_queue_pop_head (&bridge->queue);
+		GST_WARNING_OBJECT (bridge, "queue full, dropping %.*s", (gint) dropped->len - 1, dropped->data);
+		_bridge_message_free (dropped);
+		bridge->stats.dropped++;
+	}
+	g_queue_push_tail (&bridge->queue, msg);
+	bridge->stats.queued++;
+	g_mutex_unlock (&bridge->mutex);
+	g_main_context_invoke_full (bridge->context, G_PRIORITY_DEFAULT, (GSourceFunc) _bridge_flush_idle, g_object_ref (bridge), g_object_unref);
+}
+
+/* must be called on the bridge's context before dropping the last
+ * reference, pending operations hold references of their own */
+void photo_booth_bridge_close (PhotoBoothBridge *bridge)
+{
+	bridge->closed = TRUE;
+	g_cancellable_cancel (bridge->cancellable);
+	if (bridge->reconnect_id)
+	{
+		GSource *source = g_main_context_find_source_by_id (bridge->context, bridge->reconnect_id);
+		if (source)
+			g_source_destroy (source);
+		bridge->reconnect_id = 0;
+	}
+	if (bridge->connection)
+		g_io_stream_close (G_IO_STREAM (bridge->connection), NULL, NULL);
+	g_mutex_lock (&bridge->mutex);
+	if (bridge->queue.length || bridge->in_flight.length || bridge->writing_message)
+		GST_WARNING_OBJECT (bridge, "closing with %u messages undelivered", bridge->queue.length + bridge->in_flight.length + (bridge->writing_message ? 1 : 0));
+	g_mutex_unlock (&bridge->mutex);
+}
+
+void photo_booth_bridge_get_stats (PhotoBoothBridge *bridge, PhotoBoothBridgeStats *stats)
+{
+	g_mutex_lock (&bridge->mutex);
+	*stats = bridge->stats;
+	stats->queue_depth = g_queue_get_length (&bridge->queue);
+	stats->in_flight = g_queue_get_length (&bridge->in_flight) + (bridge->writing_message ? 1 : 0);
+	g_mutex_unlock (&bridge->mutex);
+}
@@ -0,0 +1,77 @@
+/*
+ * GStreamer photoboothbridge.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_BRIDGE_H__
+#define __PHOTO_BOOTH_BRIDGE_H__
+
+#include <glib-object.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define PHOTO_BOOTH_BRIDGE_TYPE                (photo_booth_bridge_get_type ())
+#define PHOTO_BOOTH_BRIDGE(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj),PHOTO_BOOTH_BRIDGE_TYPE,PhotoBoothBridge))
+#define PHOTO_BOOTH_BRIDGE_CLASS(klass)        (G_TYPE_CHECK_CLASS_CAST ((klass), PHOTO_BOOTH_BRIDGE_TYPE,PhotoBoothBridgeClass))
+#define IS_PHOTO_BOOTH_BRIDGE(obj)             (G_TYPE_CHECK_INSTANCE_TYPE ((obj),PHOTO_BOOTH_BRIDGE_TYPE))
+#define IS_PHOTO_BOOTH_BRIDGE_CLASS(klass)     (G_TYPE_CHECK_CLASS_TYPE ((klass), PHOTO_BOOTH_BRIDGE_TYPE))
+
+typedef struct _PhotoBoothBridge              PhotoBoothBridge;
+typedef struct _PhotoBoothBridgeClass         PhotoBoothBridgeClass;
+typedef struct _PhotoBoothBridgeStats         PhotoBoothBridgeStats;
+
+struct _PhotoBoothBridgeStats
+{
+	guint      queued, delivered, dropped, resent;
+	guint      queue_depth, in_flight;
+	guint      connects, disconnects;
+	gboolean   connected;
+	gint64     last_latency, max_latency;      /* send to delivery, in us */
+};
+
+struct _PhotoBoothBridge
+{
+	GObject parent;
+	gchar             *host;
+	guint16            port;
+	guint              max_queue;
+	gboolean           ack;
+	GMainContext      *context;
+	GSocketClient     *client;
+	GSocketConnection *connection;
+	GDataInputStream  *input;
+	GCancellable      *cancellable;
+	GMutex             mutex;
+	GQueue             queue, in_flight;
+	gpointer           writing_message;           /* out of queue, into in_flight once written */
+	gboolean           connecting, closed;
+	guint              reconnect_delay, reconnect_id;
+	PhotoBoothBridgeStats stats;
+};
+
+struct _PhotoBoothBridgeClass
+{
+	GObjectClass parent_class;
+};
+
+GType              photo_booth_bridge_get_type     (void);
+PhotoBoothBridge  *photo_booth_bridge_new          (const gchar *host, guint16 port, guint max_queue, gboolean ack);
+void               photo_booth_bridge_send         (PhotoBoothBridge *bridge, const gchar *message);
+void               photo_booth_bridge_close        (PhotoBoothBridge *bridge);
+void               photo_booth_bridge_get_stats    (PhotoBoothBridge *bridge, PhotoBoothBridgeStats *stats);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_BRIDGE_H__ */
@@ -0,0 +1,224 @@
+/*
+ * photoboothcommand.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "photobooth.h"
+#include "photoboothcommand.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_command_debug);
+#define GST_CAT_DEFAULT photo_booth_command_debug
+
+/* a single producer single consumer ring. head is only written by the
+ * producer and tail only by the consumer, each publishes its side with
+ * release semantics after the slot is written or read. the producer rings
+ * the doorbell after every push. the consumer only clears it once it finds
+ * the ring empty and then looks again, so no push can go unnoticed */
+typedef struct
+{
+	guint8    *slots;
+	gsize      size;
+	guint      mask;
+	guint      head, tail;
+	gint       doorbell;          /* eventfd, readable while there may be items */
+} CommandRing;
+
+/* commands go from the main thread to the capture thread, replies the
+ * other way round and are dispatched on the main loop */
+struct _PhotoBoothCommandChannel
+{
+	CommandRing commands, replies;
+	guint32    seq;
+	guint      dropped_commands, dropped_replies;
+	guint      reply_source_id;
+	PhotoBoothCommandReplyFunc reply_func;
+	gpointer   reply_data;
+};
+
+static gboolean _ring_init (CommandRing *ring, guint capacity, gsize size)
+{
+	guint n = 1;
+
+	while (n < capacity)
+		n <<= 1;
+	ring->doorbell = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->doorbell < 0)
+		return FALSE;
+	ring->slots = g_malloc0 (n * size);
+	ring->size = size;
+	ring->mask = n - 1;
+	ring->head = ring->tail = 0;
+	return TRUE;
+}
+
+static void _ring_clear (CommandRing *ring)
+{
+	if (ring->doorbell >= 0)
+		close (ring->doorbell);
+	g_free (ring->slots);
+}
+
+static gboolean _ring_push (CommandRing *ring, gconstpointer item)
+{
+	guint head = ring->head;
+
+	if (head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) > ring->mask)
+		return FALSE;
+	memcpy (ring->slots + (head & ring->mask) * ring->size, item, ring->size);
+	__atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+	eventfd_write (ring->doorbell, 1);
+	return TRUE;
+}
+
+static gboolean _ring_pop (CommandRing *ring, gpointer item)
+{
+	guint tail = ring->tail;
+	eventfd_t value;
+
+	if (__atomic_load_n (&ring->head, __ATOMIC_ACQUIRE) == tail)
+	{
+		eventfd_read (ring->doorbell, &value);
+		if (__atomic_load_n (&ring->head, __ATOMIC_ACQUIRE) == tail)
+			return FALSE;
+	}
+	memcpy (item, ring->slots + (tail & ring->mask) * ring->size, ring->size);
+	__atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+static gboolean _command_replies_ready (gint fd, GIOCondition condition, PhotoBoothCommandChannel *channel)
+{
+	PhotoBoothCommandReply reply;
+
+	while (_ring_pop (&channel->replies, &reply))
+	{
+		if (channel->reply_func)
+			channel->reply_func (&reply, channel->reply_data);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+PhotoBoothCommandChannel *photo_booth_command_channel_new (guint capacity)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothCommandChannel *channel;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_command_debug, "photoboothcommand", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_CYAN, "PhotoBoothCommand");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	channel = g_new0 (PhotoBoothCommandChannel, 1);
+	channel->commands.doorbell = channel->replies.doorbell = -1;
+	if (!_ring_init (&channel->commands, capacity, sizeof (PhotoBoothCommand)) ||
+	    !_ring_init (&channel->replies, capacity, sizeof (PhotoBoothCommandReply)))
+	{
+		GST_ERROR ("can't create command channel: %s", g_strerror (errno));
+		photo_booth_command_channel_free (channel);
+		return NULL;
+	}
+	channel->reply_source_id = g_unix_fd_add (channel->replies.doorbell, G_IO_IN, (GUnixFDSourceFunc) _command_replies_ready, channel);
+	return channel;
+}
+
+void photo_booth_command_channel_free (PhotoBoothCommandChannel *channel)
+{
+	if (channel->reply_source_id)
+		g_source_remove (channel->reply_source_id);
+	if (channel->dropped_commands || channel->dropped_replies)
+		GST_WARNING ("%u commands and %u replies were dropped over a full channel", channel->dropped_commands, channel->dropped_replies);
+	_ring_clear (&channel->commands);
+	_ring_clear (&channel->replies);
+	g_free (channel);
+}
+
+void photo_booth_command_channel_set_reply_func (PhotoBoothCommandChannel *channel, PhotoBoothCommandReplyFunc func, gpointer user_data)
+{
+	channel->reply_func = func;
+	channel->reply_data = user_data;
+}
+
+/* the consumer polls this for POLLIN */
+gint photo_booth_command_channel_get_fd (PhotoBoothCommandChannel *channel)
+{
+	return channel->commands.doorbell;
+}
+
+/* main thread only. stamps the command with its sequence number and the
+ * time it was sent */
+gboolean photo_booth_command_send (PhotoBoothCommandChannel *channel, PhotoBoothCommand *command)
+{
+	command->seq = ++channel->seq;
+	command->sent = g_get_monotonic_time ();
+	command->received = 0;
+	if (_ring_push (&channel->commands, command))
+	{
+		GST_LOG ("sent %s #%u", photo_booth_command_get_name (command->type), command->seq);
+		return TRUE;
+	}
+	channel->dropped_commands++;
+	GST_ERROR ("command channel full, dropped %s #%u", photo_booth_command_get_name (command->type), command->seq);
+	return FALSE;
+}
+
+gboolean photo_booth_command_send_type (PhotoBoothCommandChannel *channel, PhotoBoothCommandType type)
+{
+	PhotoBoothCommand command = { 0, };
+
+	command.type = type;
+	return photo_booth_command_send (channel, &command);
+}
+
+/* capture thread only, FALSE once there's nothing left */
+gboolean photo_booth_command_receive (PhotoBoothCommandChannel *channel, PhotoBoothCommand *command)
+{
+	if (!_ring_pop (&channel->commands, command))
+		return FALSE;
+	command->received = g_get_monotonic_time ();
+	return TRUE;
+}
+
+/* capture thread only, hands the outcome back to the main thread */
+void photo_booth_command_complete (PhotoBoothCommandChannel *channel, const PhotoBoothCommand *command, gint64 acted, gint result)
+{
+	PhotoBoothCommandReply reply;
+
+	reply.command = *command;
+	reply.acted = acted;
+	reply.completed = g_get_monotonic_time ();
+	reply.result = result;
+	if (!_ring_push (&channel->replies, &reply))
+	{
+		channel->dropped_replies++;
+		GST_WARNING ("reply channel full, dropped reply to %s #%u", photo_booth_command_get_name (command->type), command->seq);
+	}
+}
+
+const gchar *photo_booth_command_get_name (PhotoBoothCommandType type)
+{
+	switch (type) {
+		case CONTROL_VIDEO: return "CONTROL_VIDEO";
+		case CONTROL_PRETRIGGER: return "CONTROL_PRETRIGGER";
+		case CONTROL_PHOTO: return "CONTROL_PHOTO";
+		case CONTROL_PAUSE: return "CONTROL_PAUSE";
+		case CONTROL_UNPAUSE: return "CONTROL_UNPAUSE";
+		case CONTROL_REINIT: return "CONTROL_REINIT";
+		case CONTROL_QUIT: return "CONTROL_QUIT";
+	}
+	return "CONTROL_INVALID";
+}
@@ -0,0 +1,72 @@
+/*
+ * GStreamer photoboothcommand.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_COMMAND_H__
+#define __PHOTO_BOOTH_COMMAND_H__
+
+#include <glib.h>
+
+#define COMMAND_CHANNEL_CAPACITY   64
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	CONTROL_VIDEO = 1,     /* start movie capture */
+	CONTROL_PRETRIGGER,    /* pretrigger */
+	CONTROL_PHOTO,         /* photo capture */
+	CONTROL_PAUSE,         /* pause capture */
+	CONTROL_UNPAUSE,       /* unpause capture */
+	CONTROL_REINIT,        /* reinitializes camera */
+	CONTROL_QUIT           /* quit capture thread */
+} PhotoBoothCommandType;
+
+typedef struct _PhotoBoothCommandChannel   PhotoBoothCommandChannel;
+
+/* times are monotonic, in us */
+typedef struct
+{
+	PhotoBoothCommandType type;
+	guint32    seq;               /* set by send */
+	gint64     sent;              /* set by send */
+	gint64     received;          /* set by receive */
+	gint64     deadline;          /* when it should have been acted on, 0 for none */
+	guint      shot, shots;       /* of a PHOTO, in a layout of several */
+} PhotoBoothCommand;
+
+typedef struct
+{
+	PhotoBoothCommand command;
+	gint64     acted;             /* when the capture thread started on it */
+	gint64     completed;
+	gint       result;            /* 0 or a gphoto error */
+} PhotoBoothCommandReply;
+
+/* called on the main thread for every completed command */
+typedef void (*PhotoBoothCommandReplyFunc) (const PhotoBoothCommandReply *reply, gpointer user_data);
+
+PhotoBoothCommandChannel *photo_booth_command_channel_new      (guint capacity);
+void                      photo_booth_command_channel_free     (PhotoBoothCommandChannel *channel);
+void                      photo_booth_command_channel_set_reply_func (PhotoBoothCommandChannel *channel, PhotoBoothCommandReplyFunc func, gpointer user_data);
+gint                      photo_booth_command_channel_get_fd   (PhotoBoothCommandChannel *channel);
+gboolean                  photo_booth_command_send             (PhotoBoothCommandChannel *channel, PhotoBoothCommand *command);
+gboolean                  photo_booth_command_send_type        (PhotoBoothCommandChannel *channel, PhotoBoothCommandType type);
+gboolean                  photo_booth_command_receive          (PhotoBoothCommandChannel *channel, PhotoBoothCommand *command);
+void                      photo_booth_command_complete         (PhotoBoothCommandChannel *channel, const PhotoBoothCommand *command, gint64 acted, gint result);
+const gchar              *photo_booth_command_get_name         (PhotoBoothCommandType type);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_COMMAND_H__ */
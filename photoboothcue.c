@@ -0,0 +1,347 @@
+/*
+ * photoboothcue.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <gst/app/app.h>
+#include "photobooth.h"
+#include "photoboothcue.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_cue_debug);
+#define GST_CAT_DEFAULT photo_booth_cue_debug
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define CUE_FORMAT "S16LE"
+#else
+#define CUE_FORMAT "S16BE"
+#endif
+#define CUE_SAMPLE_BYTES      2
+#define CUE_MAX_BYTES         (16 * 1024 * 1024)
+#define CUE_POLL_INTERVAL     (100 * GST_MSECOND)
+#define CUE_BUFFER_TIME       40000          /* us, of the audio sink's ring buffer */
+#define CUE_LATENCY_TIME      10000
+#define CUE_MEASURE_DELAY     500            /* ms after the start, or halfway through */
+
+/* a short sound decoded to pcm once and played from memory. the player is
+ * prerolled with all of it between plays, so starting it is only a state
+ * change. it runs on the system clock, which is the monotonic clock, with
+ * its base time set to when the first sample is due, so the sink puts it
+ * exactly there no matter how long the state change took. a start that's
+ * already due skips what would have been played by now. a while after the
+ * start the position the sink reports is compared to the clock. once it
+ * played to the end it's prerolled again right away */
+struct _PhotoBoothCue
+{
+	gchar                   *uri;
+	GstBuffer               *pcm;
+	GstClockTime             duration;
+	GstElement              *pipeline, *appsrc;
+	guint                    bus_watch;
+	gint64                   start;
+	guint                    measure_id;
+	PhotoBoothCueOffsetFunc  offset_func;
+	gpointer                 offset_data;
+};
+
+static void _cue_pad_added (GstElement *decoder, GstPad *pad, GstElement *convert)
+{
+	GstPad *sinkpad = gst_element_get_static_pad (convert, "sink");
+	GstCaps *caps = gst_pad_query_caps (pad, NULL);
+
+	if (!gst_pad_is_linked (sinkpad) && g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "audio/"))
+		gst_pad_link (pad, sinkpad);
+	gst_caps_unref (caps);
+	gst_object_unref (sinkpad);
+}
+
+/* uri ! audioconvert ! appsink, pulled until eos into one buffer */
+static GstBuffer *_cue_decode (const gchar *uri, GstCaps **caps, GError **error)
+{
+	GstElement *pipeline, *decoder, *convert, *sink;
+	GstCaps *filter;
+	GstBus *bus;
+	GByteArray *pcm;
+	GstSample *sample;
+	GstMessage *message;
+	GstBuffer *buffer = NULL;
+
+	pipeline = gst_pipeline_new ("cue-decode");
+	decoder = gst_element_factory_make ("uridecodebin", NULL);
+	convert = gst_element_factory_make ("audioconvert", NULL);
+	sink = gst_element_factory_make ("appsink", NULL);
+	if (!(decoder && convert && sink))
+	{
+		g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Failed to make element(s):%s%s%s", decoder?"":" uridecodebin", convert?"":" audioconvert", sink?"":" appsink");
+		if (decoder)
+			gst_object_unref (decoder);
+		if (convert)
+			gst_object_unref (convert);
+		if (sink)
+			gst_object_unref (sink);
+		gst_object_unref (pipeline);
+		return NULL;
+	}
+	filter = gst_caps_new_simple ("audio/x-raw", "format", G_TYPE_STRING, CUE_FORMAT, "layout", G_TYPE_STRING, "interleaved", NULL);
+	g_object_set (decoder, "uri", uri, NULL);
+	g_object_set (sink, "caps", filter, "sync", FALSE, NULL);
+	gst_caps_unref (filter);
+	gst_bin_add_many (GST_BIN (pipeline), decoder, convert, sink, NULL);
+	gst_element_link (convert, sink);
+	g_signal_connect (decoder, "pad-added", G_CALLBACK (_cue_pad_added), convert);
+
+	pcm = g_byte_array_new ();
+	bus = gst_element_get_bus (pipeline);
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	while (TRUE)
+	{
+		sample = gst_app_sink_try_pull_sample (GST_APP_SINK (sink), CUE_POLL_INTERVAL);
+		if (sample)
+		{
+			GstMapInfo map;
+			if (!*caps)
+				*caps = gst_caps_ref (gst_sample_get_caps (sample));
+			if (gst_buffer_map (gst_sample_get_buffer (sample), &map, GST_MAP_READ))
+			{
+				g_byte_array_append (pcm, map.data, map.size);
+				gst_buffer_unmap (gst_sample_get_buffer (sample), &map);
+			}
+			gst_sample_unref (sample);
+			if (pcm->len > CUE_MAX_BYTES)
+			{
+				g_set_error (error, GST_STREAM_ERROR, GST_STREAM_ERROR_FAILED, "%s is longer than %u bytes of pcm", uri, CUE_MAX_BYTES);
+				break;
+			}
+			continue;
+		}
+		if (gst_app_sink_is_eos (GST_APP_SINK (sink)))
+		{
+			gsize size = pcm->len;
+			if (size)
+				buffer = gst_buffer_new_wrapped (g_byte_array_free (pcm, FALSE), size);
+			else
+				g_set_error (error, GST_STREAM_ERROR, GST_STREAM_ERROR_DECODE, "%s has no audio", uri);
+			break;
+		}
+		message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+		if (message)
+		{
+			gst_message_parse_error (message, error, NULL);
+			gst_message_unref (message);
+			break;
+		}
+	}
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (bus);
+	gst_object_unref (pipeline);
+	if (!buffer)
+	{
+		g_byte_array_free (pcm, TRUE);
+		if (*caps)
+			gst_caps_unref (*caps);
+		*caps = NULL;
+	}
+	return buffer;
+}
+
+/* small ring buffer on whatever sink autoaudiosink picks */
+static void _cue_element_added (GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+	if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK) && g_object_class_find_property (G_OBJECT_GET_CLASS (element), "buffer-time"))
+	{
+		g_object_set (element, "buffer-time", (gint64) CUE_BUFFER_TIME, "latency-time", (gint64) CUE_LATENCY_TIME, NULL);
+		GST_DEBUG ("%s with %d us buffer", GST_ELEMENT_NAME (element), CUE_BUFFER_TIME);
+	}
+}
+
+static gboolean _cue_bus_callback (GstBus *bus, GstMessage *message, PhotoBoothCue *cue)
+{
+	GError *error = NULL;
+
+	switch (GST_MESSAGE_TYPE (message))
+	{
+		case GST_MESSAGE_ERROR:
+			gst_message_parse_error (message, &error, NULL);
+			GST_WARNING ("playing %s failed: %s", cue->uri, error->message);
+			g_error_free (error);
+			break;
+		case GST_MESSAGE_EOS:
+			if (GST_MESSAGE_SRC (message) == GST_OBJECT (cue->pipeline) && cue->start)
+			{
+				GST_LOG ("%s played", cue->uri);
+				photo_booth_cue_stop (cue);
+			}
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+/* everything is queued right away, the sink holds on to the first buffer */
+static void _cue_preroll (PhotoBoothCue *cue)
+{
+	gst_element_set_state (cue->pipeline, GST_STATE_PAUSED);
+	gst_app_src_push_buffer (GST_APP_SRC (cue->appsrc), gst_buffer_ref (cue->pcm));
+	gst_app_src_end_of_stream (GST_APP_SRC (cue->appsrc));
+}
+
+/* decodes uri, may take a while and is best called off the main thread */
+PhotoBoothCue *photo_booth_cue_new (const gchar *uri, GError **error)
+{
+	static volatile gsize debug_initialized = 0;
+	GstElement *convert, *resample, *sink;
+	GstStructure *structure;
+	GstCaps *caps = NULL;
+	GstClock *clock;
+	GstBuffer *pcm;
+	PhotoBoothCue *cue;
+	gint rate = 0, channels = 0;
+	GstBus *bus;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_cue_debug, "photoboothcue", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothCue");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	pcm = _cue_decode (uri, &caps, error);
+	if (!pcm)
+		return NULL;
+	structure = gst_caps_get_structure (caps, 0);
+	if (!gst_structure_get_int (structure, "rate", &rate) || !gst_structure_get_int (structure, "channels", &channels) || rate <= 0 || channels <= 0)
+	{
+		g_set_error (error, GST_STREAM_ERROR, GST_STREAM_ERROR_FORMAT, "%s decoded to unexpected caps", uri);
+		gst_buffer_unref (pcm);
+		gst_caps_unref (caps);
+		return NULL;
+	}
+
+	cue = g_new0 (PhotoBoothCue, 1);
+	cue->uri = g_strdup (uri);
+	cue->pcm = pcm;
+	cue->duration = gst_util_uint64_scale (gst_buffer_get_size (pcm) / (CUE_SAMPLE_BYTES * channels), GST_SECOND, rate);
+	GST_BUFFER_PTS (pcm) = 0;
+	GST_BUFFER_DURATION (pcm) = cue->duration;
+
+	cue->pipeline = gst_pipeline_new ("cue-pipeline");
+	cue->appsrc = gst_element_factory_make ("appsrc", NULL);
+	convert = gst_element_factory_make ("audioconvert", NULL);
+	resample = gst_element_factory_make ("audioresample", NULL);
+	sink = gst_element_factory_make ("autoaudiosink", NULL);
+	if (!(cue->appsrc && convert && resample && sink))
+	{
+		g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "Failed to make element(s):%s%s%s%s", cue->appsrc?"":" appsrc", convert?"":" audioconvert", resample?"":" audioresample", sink?"":" autoaudiosink");
+		if (cue->appsrc)
+			gst_object_unref (cue->appsrc);
+		if (convert)
+			gst_object_unref (convert);
+		if (resample)
+			gst_object_unref (resample);
+		if (sink)
+			gst_object_unref (sink);
+		gst_object_unref (cue->pipeline);
+		gst_caps_unref (caps);
+		gst_buffer_unref (pcm);
+		g_free (cue->uri);
+		g_free (cue);
+		return NULL;
+	}
+	g_object_set (cue->appsrc, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+	gst_caps_unref (caps);
+	g_signal_connect (cue->pipeline, "deep-element-added", G_CALLBACK (_cue_element_added), NULL);
+	gst_bin_add_many (GST_BIN (cue->pipeline), cue->appsrc, convert, resample, sink, NULL);
+	gst_element_link_many (cue->appsrc, convert, resample, sink, NULL);
+
+	/* the system clock reads CLOCK_MONOTONIC like g_get_monotonic_time.
+	 * the base time is set on every start, never by the pipeline */
+	clock = gst_system_clock_obtain ();
+	gst_pipeline_use_clock (GST_PIPELINE (cue->pipeline), clock);
+	gst_object_unref (clock);
+	gst_element_set_start_time (cue->pipeline, GST_CLOCK_TIME_NONE);
+
+	bus = gst_element_get_bus (cue->pipeline);
+	cue->bus_watch = gst_bus_add_watch (bus, (GstBusFunc) _cue_bus_callback, cue);
+	gst_object_unref (bus);
+
+	_cue_preroll (cue);
+	GST_INFO ("decoded %s: %" GST_TIME_FORMAT ", %d Hz, %d channels, %" G_GSIZE_FORMAT " bytes", uri, GST_TIME_ARGS (cue->duration), rate, channels, gst_buffer_get_size (pcm));
+	return cue;
+}
+
+void photo_booth_cue_free (PhotoBoothCue *cue)
+{
+	if (cue->measure_id)
+		g_source_remove (cue->measure_id);
+	g_source_remove (cue->bus_watch);
+	gst_element_set_state (cue->pipeline, GST_STATE_NULL);
+	gst_object_unref (cue->pipeline);
+	gst_buffer_unref (cue->pcm);
+	g_free (cue->uri);
+	g_free (cue);
+}
+
+void photo_booth_cue_set_offset_func (PhotoBoothCue *cue, PhotoBoothCueOffsetFunc func, gpointer user_data)
+{
+	cue->offset_func = func;
+	cue->offset_data = user_data;
+}
+
+static gboolean _cue_measure (PhotoBoothCue *cue)
+{
+	gint64 position = -1, expected, offset;
+
+	cue->measure_id = 0;
+	expected = (g_get_monotonic_time () - cue->start) * 1000;
+	if (!gst_element_query_position (cue->pipeline, GST_FORMAT_TIME, &position) || position < 0)
+	{
+		GST_DEBUG ("no position to measure the offset of %s", cue->uri);
+		return G_SOURCE_REMOVE;
+	}
+	if ((GstClockTime) position >= cue->duration)
+		return G_SOURCE_REMOVE;
+	offset = (expected - position) / 1000;
+	GST_INFO ("%s is %" G_GINT64_FORMAT " us behind the clock", cue->uri, offset);
+	if (cue->offset_func)
+		cue->offset_func (offset, cue->offset_data);
+	return G_SOURCE_REMOVE;
+}
+
+/* main thread. the first sample is heard at the monotonic time at */
+void photo_booth_cue_play (PhotoBoothCue *cue, gint64 at)
+{
+	gint64 now = g_get_monotonic_time ();
+
+	if (cue->start)
+		photo_booth_cue_stop (cue);
+	gst_element_set_base_time (cue->pipeline, at * 1000);
+	gst_element_set_state (cue->pipeline, GST_STATE_PLAYING);
+	cue->start = at;
+	if (now > at)
+		GST_DEBUG ("started %" G_GINT64_FORMAT " us late, the beginning is skipped", now - at);
+	cue->measure_id = g_timeout_add (MAX (at - now, 0) / 1000 + MIN (CUE_MEASURE_DELAY, GST_TIME_AS_MSECONDS (cue->duration) / 2), (GSourceFunc) _cue_measure, cue);
+}
+
+/* main thread. cuts it off and prerolls it again for the next play */
+void photo_booth_cue_stop (PhotoBoothCue *cue)
+{
+	if (cue->measure_id)
+	{
+		g_source_remove (cue->measure_id);
+		cue->measure_id = 0;
+	}
+	if (!cue->start)
+		return;
+	cue->start = 0;
+	gst_element_set_state (cue->pipeline, GST_STATE_READY);
+	_cue_preroll (cue);
+}
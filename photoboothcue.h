@@ -0,0 +1,37 @@
+/*
+ * GStreamer photoboothcue.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_CUE_H__
+#define __PHOTO_BOOTH_CUE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothCue PhotoBoothCue;
+
+/* on the main thread, offset in microseconds the audio is behind the
+ * monotonic clock it was started on, negative if it's ahead */
+typedef void (*PhotoBoothCueOffsetFunc) (gint64 offset, gpointer user_data);
+
+PhotoBoothCue   *photo_booth_cue_new                 (const gchar *uri, GError **error);
+void             photo_booth_cue_free                (PhotoBoothCue *cue);
+void             photo_booth_cue_set_offset_func     (PhotoBoothCue *cue, PhotoBoothCueOffsetFunc func, gpointer user_data);
+void             photo_booth_cue_play                (PhotoBoothCue *cue, gint64 at);
+void             photo_booth_cue_stop                (PhotoBoothCue *cue);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_CUE_H__ */
@@ -0,0 +1,220 @@
+/*
+ * photoboothfsm.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include "photobooth.h"
+#include "photoboothfsm.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_fsm_debug);
+#define GST_CAT_DEFAULT photo_booth_fsm_debug
+
+#define SESSION_RATE_WINDOW   (3600 * G_USEC_PER_SEC)
+#define SESSION_RATE_MIN_SPAN (60 * G_USEC_PER_SEC)
+
+/* events may be posted from any thread but are only ever consumed on the
+ * main thread, one at a time and in order. one posted on the main thread
+ * outside of a transition is handled right away, so the caller sees the
+ * new state when post returns. events posted while a transition is being
+ * entered run once it is complete.
+ *
+ * the time spent in each state is summed up per session, from entering
+ * start_state until end_state is reached again, and logged when it ends */
+struct _PhotoBoothFsm
+{
+	const PhotoBoothFsmTransition *table;
+	guint                  n_transitions, n_states;
+	gint                   state;
+	PhotoBoothFsmNameFunc  state_name, event_name;
+	PhotoBoothFsmEnterFunc enter_func;
+	gpointer               enter_data;
+	GAsyncQueue           *events;
+	gboolean               dispatching;
+	GMutex                 dispatch_mutex;
+	guint                  dispatch_source;         /* idle source scheduled by another thread */
+	gint64                 entered;                 /* monotonic time the state was entered */
+	gint                   session_start_state, session_end_state;
+	gint64                 session_start;
+	gint64                *session_times;          /* per state, of the current session */
+	gint64                *total_times;            /* per state, of all sessions */
+	guint                  sessions;
+	gint64                 first_session_start;
+	GQueue                 session_ends;
+};
+
+static const PhotoBoothFsmTransition *_fsm_lookup (PhotoBoothFsm *fsm, gint event)
+{
+	guint i;
+
+	for (i = 0; i < fsm->n_transitions; i++)
+	{
+		const PhotoBoothFsmTransition *t = &fsm->table[i];
+		if (t->event == event && (t->from == fsm->state || t->from == PB_FSM_ANY_STATE))
+			return t;
+	}
+	return NULL;
+}
+
+static void _fsm_session_done (PhotoBoothFsm *fsm, gint64 now)
+{
+	GString *breakdown = g_string_new (NULL);
+	gint64 duration = now - fsm->session_start, *end;
+	guint i;
+
+	if (!fsm->first_session_start)
+		fsm->first_session_start = fsm->session_start;
+	fsm->sessions++;
+	end = g_new (gint64, 1);
+	*end = now;
+	g_queue_push_tail (&fsm->session_ends, end);
+	while (*(gint64 *) g_queue_peek_head (&fsm->session_ends) < now - SESSION_RATE_WINDOW)
+		g_free (g_queue_pop_head (&fsm->session_ends));
+
+	for (i = 0; i < fsm->n_states; i++)
+	{
+		if (!fsm->session_times[i])
+			continue;
+		fsm->total_times[i] += fsm->session_times[i];
+		g_string_append_printf (breakdown, " %s %.1f s (avg %.1f s)", fsm->state_name (i),
+			(gdouble) fsm->session_times[i] / G_USEC_PER_SEC, (gdouble) fsm->total_times[i] / fsm->sessions / G_USEC_PER_SEC);
+	}
+	GST_INFO ("session %u took %.1f s:%s", fsm->sessions, (gdouble) duration / G_USEC_PER_SEC, breakdown->str);
+	GST_INFO ("%u sessions in the past hour, %.1f per hour since the first", g_queue_get_length (&fsm->session_ends),
+		fsm->sessions * (gdouble) SESSION_RATE_WINDOW / MAX (now - fsm->first_session_start, SESSION_RATE_MIN_SPAN));
+	g_string_free (breakdown, TRUE);
+	memset (fsm->session_times, 0, fsm->n_states * sizeof (gint64));
+	fsm->session_start = 0;
+}
+
+static void _fsm_handle (PhotoBoothFsm *fsm, gint event)
+{
+	const PhotoBoothFsmTransition *t = _fsm_lookup (fsm, event);
+	gint64 now = g_get_monotonic_time ();
+	gint from = fsm->state;
+
+	if (!t)
+	{
+		GST_DEBUG ("ignoring %s in %s", fsm->event_name (event), fsm->state_name (fsm->state));
+		return;
+	}
+
+	if (fsm->session_start)
+		fsm->session_times[from] += now - fsm->entered;
+	GST_DEBUG ("%s: %s -> %s after %" G_GINT64_FORMAT " ms, %" G_GINT64_FORMAT " ms into the session", fsm->event_name (event),
+		fsm->state_name (from), fsm->state_name (t->to), (now - fsm->entered) / 1000, fsm->session_start ? (now - fsm->session_start) / 1000 : 0);
+	g_atomic_int_set (&fsm->state, t->to);
+	fsm->entered = now;
+
+	if (t->to == fsm->session_start_state && !fsm->session_start)
+		fsm->session_start = now;
+	else if (t->to == fsm->session_end_state && fsm->session_start)
+		_fsm_session_done (fsm, now);
+
+	if (fsm->enter_func)
+		fsm->enter_func (from, t->to, event, fsm->enter_data);
+}
+
+static gboolean _fsm_dispatch (PhotoBoothFsm *fsm)
+{
+	gpointer event;
+
+	g_mutex_lock (&fsm->dispatch_mutex);
+	fsm->dispatch_source = 0;
+	g_mutex_unlock (&fsm->dispatch_mutex);
+	fsm->dispatching = TRUE;
+	while ((event = g_async_queue_try_pop (fsm->events)))
+		_fsm_handle (fsm, GPOINTER_TO_INT (event) - 1);
+	fsm->dispatching = FALSE;
+	return FALSE;
+}
+
+PhotoBoothFsm *photo_booth_fsm_new (const PhotoBoothFsmTransition *table, guint n_transitions, guint n_states, gint initial, PhotoBoothFsmNameFunc state_name, PhotoBoothFsmNameFunc event_name)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothFsm *fsm;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_fsm_debug, "photoboothfsm", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothFsm");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	fsm = g_new0 (PhotoBoothFsm, 1);
+	fsm->table = table;
+	fsm->n_transitions = n_transitions;
+	fsm->n_states = n_states;
+	fsm->state = initial;
+	fsm->state_name = state_name;
+	fsm->event_name = event_name;
+	fsm->events = g_async_queue_new ();
+	g_mutex_init (&fsm->dispatch_mutex);
+	fsm->entered = g_get_monotonic_time ();
+	fsm->session_start_state = fsm->session_end_state = PB_FSM_ANY_STATE;
+	fsm->session_times = g_new0 (gint64, n_states);
+	fsm->total_times = g_new0 (gint64, n_states);
+	g_queue_init (&fsm->session_ends);
+	return fsm;
+}
+
+void photo_booth_fsm_free (PhotoBoothFsm *fsm)
+{
+	g_mutex_lock (&fsm->dispatch_mutex);
+	if (fsm->dispatch_source)
+		g_source_remove (fsm->dispatch_source);
+	g_mutex_unlock (&fsm->dispatch_mutex);
+	g_mutex_clear (&fsm->dispatch_mutex);
+	g_async_queue_unref (fsm->events);
+	g_queue_clear_full (&fsm->session_ends, g_free);
+	g_free (fsm->session_times);
+	g_free (fsm->total_times);
+	g_free (fsm);
+}
+
+void photo_booth_fsm_set_enter_func (PhotoBoothFsm *fsm, PhotoBoothFsmEnterFunc func, gpointer user_data)
+{
+	fsm->enter_func = func;
+	fsm->enter_data = user_data;
+}
+
+void photo_booth_fsm_set_session (PhotoBoothFsm *fsm, gint start_state, gint end_state)
+{
+	fsm->session_start_state = start_state;
+	fsm->session_end_state = end_state;
+}
+
+/* thread safe */
+void photo_booth_fsm_post (PhotoBoothFsm *fsm, gint event)
+{
+	g_async_queue_push (fsm->events, GINT_TO_POINTER (event + 1));
+	if (g_main_context_is_owner (g_main_context_default ()))
+	{
+		if (!fsm->dispatching)
+			_fsm_dispatch (fsm);
+	}
+	else
+	{
+		/* the source id is stored before the dispatch can clear it */
+		g_mutex_lock (&fsm->dispatch_mutex);
+		if (!fsm->dispatch_source)
+			fsm->dispatch_source = g_idle_add_full (G_PRIORITY_HIGH, (GSourceFunc) _fsm_dispatch, fsm, NULL);
+		g_mutex_unlock (&fsm->dispatch_mutex);
+	}
+}
+
+/* thread safe, from other threads it may not yet reflect their own
+ * events still queued */
+gint photo_booth_fsm_get_state (PhotoBoothFsm *fsm)
+{
+	return g_atomic_int_get (&fsm->state);
+}
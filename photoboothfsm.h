@@ -0,0 +1,49 @@
+/*
+ * GStreamer photoboothfsm.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_FSM_H__
+#define __PHOTO_BOOTH_FSM_H__
+
+#include <glib.h>
+
+#define PB_FSM_ANY_STATE       (-1)
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothFsm PhotoBoothFsm;
+
+/* one row of the transition table, an event not listed for the current
+ * state is ignored */
+typedef struct
+{
+	gint       from;           /* or PB_FSM_ANY_STATE */
+	gint       event;
+	gint       to;
+} PhotoBoothFsmTransition;
+
+typedef const gchar *(*PhotoBoothFsmNameFunc) (gint value);
+/* called on the main thread after the state changed */
+typedef void (*PhotoBoothFsmEnterFunc) (gint from, gint to, gint event, gpointer user_data);
+
+PhotoBoothFsm   *photo_booth_fsm_new             (const PhotoBoothFsmTransition *table, guint n_transitions, guint n_states, gint initial, PhotoBoothFsmNameFunc state_name, PhotoBoothFsmNameFunc event_name);
+void             photo_booth_fsm_free            (PhotoBoothFsm *fsm);
+void             photo_booth_fsm_set_enter_func  (PhotoBoothFsm *fsm, PhotoBoothFsmEnterFunc func, gpointer user_data);
+void             photo_booth_fsm_set_session     (PhotoBoothFsm *fsm, gint start_state, gint end_state);
+void             photo_booth_fsm_post            (PhotoBoothFsm *fsm, gint event);
+gint             photo_booth_fsm_get_state       (PhotoBoothFsm *fsm);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_FSM_H__ */
@@ -0,0 +1,522 @@
+/*
+ * photoboothgallery.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "photobooth.h"
+#include "photoboothgallery.h"
+
+#define GALLERY_TILE_WIDTH      THUMBNAIL_SIZE_MEDIUM
+#define GALLERY_TILE_HEIGHT     (THUMBNAIL_SIZE_MEDIUM * 2 / 3)
+#define GALLERY_SPACING         16
+#define GALLERY_PREFETCH_ROWS   3
+#define GALLERY_DECODE_THREADS  2
+#define GALLERY_DECODE_NICE     10
+#define DEFAULT_GALLERY_CACHE   (64 * 1024 * 1024)
+
+/* shows the saved photos newest first in a grid that only ever draws
+ * the visible rows. tiles come from the decoded pixbuf cache, misses are
+ * decoded from the thumbnail cache on a low priority worker pool, nearest
+ * to the view first, and rows ahead in the scroll direction are prefetched.
+ * the gallery is its own GtkScrollable, so its size doesn't grow with the
+ * number of photos. */
+typedef struct _PhotoBoothGalleryPrivate PhotoBoothGalleryPrivate;
+
+struct _PhotoBoothGalleryPrivate
+{
+	GtkAdjustment         *hadjustment, *vadjustment;
+	guint                  hscroll_policy, vscroll_policy;
+	gdouble                last_scroll;
+	gint                   scroll_direction;
+
+	gchar                 *path_template;
+	guint                  last_number;
+	gint                   columns;
+
+	PhotoBoothThumbnailer *thumbnailer;
+	GThreadPool           *decode_pool;
+	GHashTable            *pending;
+	gint                   wanted_first, wanted_last, wanted_center;  /* photo numbers, atomic */
+
+	GQueue                 cache_lru;
+	GHashTable            *cache_table;
+	gsize                  cache_bytes, cache_budget;
+	guint                  cache_hits, cache_misses;
+};
+
+/* a photo that couldn't be decoded is cached without pixbuf, so it
+ * isn't decoded again on every draw */
+typedef struct
+{
+	guint                  number;
+	GdkPixbuf             *pixbuf;
+	gsize                  bytes;
+} PhotoBoothGalleryEntry;
+
+typedef struct
+{
+	PhotoBoothGallery     *gallery;
+	guint                  number;
+	gchar                 *filename;
+	GdkPixbuf             *pixbuf;
+	gboolean               failed;
+} PhotoBoothGalleryJob;
+
+enum
+{
+	PROP_0,
+	PROP_HADJUSTMENT,
+	PROP_VADJUSTMENT,
+	PROP_HSCROLL_POLICY,
+	PROP_VSCROLL_POLICY,
+};
+
+G_DEFINE_TYPE_WITH_CODE (PhotoBoothGallery, photo_booth_gallery, GTK_TYPE_DRAWING_AREA,
+                         G_ADD_PRIVATE (PhotoBoothGallery)
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_SCROLLABLE, NULL));
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_gallery_debug);
+#define GST_CAT_DEFAULT photo_booth_gallery_debug
+
+static void photo_booth_gallery_finalize (GObject *object);
+static void photo_booth_gallery_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
+static void photo_booth_gallery_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static gboolean photo_booth_gallery_draw (GtkWidget *widget, cairo_t *cr);
+static void photo_booth_gallery_size_allocate (GtkWidget *widget, GtkAllocation *allocation);
+static void _gallery_decode_func (PhotoBoothGalleryJob *job, PhotoBoothGallery *gallery);
+static gint _gallery_job_compare (PhotoBoothGalleryJob *a, PhotoBoothGalleryJob *b, PhotoBoothGallery *gallery);
+
+static void photo_booth_gallery_class_init (PhotoBoothGalleryClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+	GST_DEBUG_CATEGORY_INIT (photo_booth_gallery_debug, "photoboothgallery", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_BLUE, "PhotoBoothGallery");
+
+	gobject_class->finalize = photo_booth_gallery_finalize;
+	gobject_class->set_property = photo_booth_gallery_set_property;
+	gobject_class->get_property = photo_booth_gallery_get_property;
+	widget_class->draw = photo_booth_gallery_draw;
+	widget_class->size_allocate = photo_booth_gallery_size_allocate;
+
+	g_object_class_override_property (gobject_class, PROP_HADJUSTMENT, "hadjustment");
+	g_object_class_override_property (gobject_class, PROP_VADJUSTMENT, "vadjustment");
+	g_object_class_override_property (gobject_class, PROP_HSCROLL_POLICY, "hscroll-policy");
+	g_object_class_override_property (gobject_class, PROP_VSCROLL_POLICY, "vscroll-policy");
+}
+
+static void photo_booth_gallery_init (PhotoBoothGallery *gallery)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	priv->columns = 1;
+	priv->pending = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_queue_init (&priv->cache_lru);
+	priv->cache_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->cache_budget = DEFAULT_GALLERY_CACHE;
+	priv->decode_pool = g_thread_pool_new ((GFunc) _gallery_decode_func, gallery, GALLERY_DECODE_THREADS, FALSE, NULL);
+	g_thread_pool_set_sort_function (priv->decode_pool, (GCompareDataFunc) _gallery_job_compare, gallery);
+	gtk_widget_add_events (GTK_WIDGET (gallery), GDK_BUTTON_PRESS_MASK);
+}
+
+static void _gallery_cache_entry_free (PhotoBoothGalleryEntry *entry)
+{
+	g_clear_object (&entry->pixbuf);
+	g_slice_free (PhotoBoothGalleryEntry, entry);
+}
+
+static void photo_booth_gallery_finalize (GObject *object)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (PHOTO_BOOTH_GALLERY (object));
+	PhotoBoothGalleryEntry *entry;
+
+	/* jobs hold a reference on the gallery, so the pool is idle by now */
+	g_thread_pool_free (priv->decode_pool, TRUE, TRUE);
+	g_hash_table_destroy (priv->pending);
+	g_hash_table_destroy (priv->cache_table);
+	while ((entry = g_queue_pop_head (&priv->cache_lru)))
+		_gallery_cache_entry_free (entry);
+	g_clear_object (&priv->hadjustment);
+	g_clear_object (&priv->vadjustment);
+	g_free (priv->path_template);
+	G_OBJECT_CLASS (photo_booth_gallery_parent_class)->finalize (object);
+}
+
+static PhotoBoothGalleryEntry *_gallery_cache_lookup (PhotoBoothGalleryPrivate *priv, guint number)
+{
+	GList *link = g_hash_table_lookup (priv->cache_table, GUINT_TO_POINTER (number));
+	if (!link)
+	{
+		priv->cache_misses++;
+		return NULL;
+	}
+	priv->cache_hits++;
+	g_queue_unlink (&priv->cache_lru, link);
+	g_queue_push_head_link (&priv->cache_lru, link);
+	return link->data;
+}
+
+/* pixbuf is NULL for a photo that failed to decode */
+static void _gallery_cache_insert (PhotoBoothGalleryPrivate *priv, guint number, GdkPixbuf *pixbuf)
+{
+	PhotoBoothGalleryEntry *entry = g_slice_new0 (PhotoBoothGalleryEntry);
+	entry->number = number;
+	if (pixbuf)
+	{
+		entry->pixbuf = g_object_ref (pixbuf);
+		entry->bytes = gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+	}
+	else
+		entry->bytes = sizeof (PhotoBoothGalleryEntry);
+	g_queue_push_head (&priv->cache_lru, entry);
+	g_hash_table_insert (priv->cache_table, GUINT_TO_POINTER (number), priv->cache_lru.head);
+	priv->cache_bytes += entry->bytes;
+
+	while (priv->cache_bytes > priv->cache_budget && priv->cache_lru.length > 1)
+	{
+		PhotoBoothGalleryEntry *lru = g_queue_pop_tail (&priv->cache_lru);
+		g_hash_table_remove (priv->cache_table, GUINT_TO_POINTER (lru->number));
+		priv->cache_bytes -= lru->bytes;
+		_gallery_cache_entry_free (lru);
+	}
+}
+
+/* failed photos may have been published since, they're tried again */
+static void _gallery_cache_forget_failures (PhotoBoothGalleryPrivate *priv)
+{
+	GList *link = priv->cache_lru.head;
+
+	while (link)
+	{
+		GList *next = link->next;
+		PhotoBoothGalleryEntry *entry = link->data;
+		if (!entry->pixbuf)
+		{
+			g_queue_delete_link (&priv->cache_lru, link);
+			g_hash_table_remove (priv->cache_table, GUINT_TO_POINTER (entry->number));
+			priv->cache_bytes -= entry->bytes;
+			_gallery_cache_entry_free (entry);
+		}
+		link = next;
+	}
+}
+
+static void _gallery_update_adjustment (PhotoBoothGallery *gallery)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	gint width = gtk_widget_get_allocated_width (GTK_WIDGET (gallery));
+	gint height = gtk_widget_get_allocated_height (GTK_WIDGET (gallery));
+	gint rows;
+
+	priv->columns = MAX (1, (width - GALLERY_SPACING) / (GALLERY_TILE_WIDTH + GALLERY_SPACING));
+	rows = (priv->last_number + priv->columns - 1) / priv->columns;
+	if (priv->vadjustment)
+		gtk_adjustment_configure (priv->vadjustment, MIN (gtk_adjustment_get_value (priv->vadjustment), MAX (0, rows * (GALLERY_TILE_HEIGHT + GALLERY_SPACING) + GALLERY_SPACING - height)),
+		                          0, MAX (height, rows * (GALLERY_TILE_HEIGHT + GALLERY_SPACING) + GALLERY_SPACING),
+		                          GALLERY_TILE_HEIGHT + GALLERY_SPACING, height * 0.9, height);
+	if (priv->hadjustment)
+		gtk_adjustment_configure (priv->hadjustment, 0, 0, width, width * 0.1, width * 0.9, width);
+}
+
+static void photo_booth_gallery_size_allocate (GtkWidget *widget, GtkAllocation *allocation)
+{
+	GTK_WIDGET_CLASS (photo_booth_gallery_parent_class)->size_allocate (widget, allocation);
+	_gallery_update_adjustment (PHOTO_BOOTH_GALLERY (widget));
+}
+
+static void _gallery_vadjustment_changed (GtkAdjustment *adjustment, PhotoBoothGallery *gallery)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	gdouble value = gtk_adjustment_get_value (adjustment);
+	if (value != priv->last_scroll)
+		priv->scroll_direction = value > priv->last_scroll ? 1 : -1;
+	priv->last_scroll = value;
+	gtk_widget_queue_draw (GTK_WIDGET (gallery));
+}
+
+static void _gallery_set_adjustment (PhotoBoothGallery *gallery, GtkAdjustment **slot, GtkAdjustment *adjustment, gboolean vertical)
+{
+	if (*slot)
+	{
+		if (vertical)
+			g_signal_handlers_disconnect_by_func (*slot, _gallery_vadjustment_changed, gallery);
+		g_object_unref (*slot);
+	}
+	if (!adjustment)
+		adjustment = gtk_adjustment_new (0, 0, 0, 0, 0, 0);
+	*slot = g_object_ref_sink (adjustment);
+	if (vertical)
+		g_signal_connect (adjustment, "value-changed", G_CALLBACK (_gallery_vadjustment_changed), gallery);
+	_gallery_update_adjustment (gallery);
+}
+
+static void photo_booth_gallery_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+	PhotoBoothGallery *gallery = PHOTO_BOOTH_GALLERY (object);
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+
+	switch (prop_id)
+	{
+		case PROP_HADJUSTMENT:
+			_gallery_set_adjustment (gallery, &priv->hadjustment, g_value_get_object (value), FALSE);
+			break;
+		case PROP_VADJUSTMENT:
+			_gallery_set_adjustment (gallery, &priv->vadjustment, g_value_get_object (value), TRUE);
+			break;
+		case PROP_HSCROLL_POLICY:
+			priv->hscroll_policy = g_value_get_enum (value);
+			break;
+		case PROP_VSCROLL_POLICY:
+			priv->vscroll_policy = g_value_get_enum (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void photo_booth_gallery_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (PHOTO_BOOTH_GALLERY (object));
+
+	switch (prop_id)
+	{
+		case PROP_HADJUSTMENT:
+			g_value_set_object (value, priv->hadjustment);
+			break;
+		case PROP_VADJUSTMENT:
+			g_value_set_object (value, priv->vadjustment);
+			break;
+		case PROP_HSCROLL_POLICY:
+			g_value_set_enum (value, priv->hscroll_policy);
+			break;
+		case PROP_VSCROLL_POLICY:
+			g_value_set_enum (value, priv->vscroll_policy);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+/* newest photo first */
+static guint _gallery_number_at (PhotoBoothGalleryPrivate *priv, gint index)
+{
+	if (index < 0 || index >= (gint) priv->last_number)
+		return 0;
+	return priv->last_number - index;
+}
+
+static gint _gallery_job_compare (PhotoBoothGalleryJob *a, PhotoBoothGalleryJob *b, PhotoBoothGallery *gallery)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	gint center = g_atomic_int_get (&priv->wanted_center);
+	return ABS ((gint) a->number - center) - ABS ((gint) b->number - center);
+}
+
+static void _gallery_size_prepared (GdkPixbufLoader *loader, gint width, gint height, gpointer user_data)
+{
+	gdouble scale = MIN ((gdouble) GALLERY_TILE_WIDTH / width, (gdouble) GALLERY_TILE_HEIGHT / height);
+	if (scale < 1.0)
+		gdk_pixbuf_loader_set_size (loader, MAX (width * scale, 1), MAX (height * scale, 1));
+}
+
+static gboolean _gallery_decode_done (PhotoBoothGalleryJob *job)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (job->gallery);
+
+	g_hash_table_remove (priv->pending, GUINT_TO_POINTER (job->number));
+	if (job->pixbuf || job->failed)
+	{
+		_gallery_cache_insert (priv, job->number, job->pixbuf);
+		g_clear_object (&job->pixbuf);
+		gtk_widget_queue_draw (GTK_WIDGET (job->gallery));
+	}
+	g_object_unref (job->gallery);
+	g_free (job->filename);
+	g_slice_free (PhotoBoothGalleryJob, job);
+	return FALSE;
+}
+
+static void _gallery_decode_func (PhotoBoothGalleryJob *job, PhotoBoothGallery *gallery)
+{
+	static GPrivate priority_lowered;
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	gint first = g_atomic_int_get (&priv->wanted_first), last = g_atomic_int_get (&priv->wanted_last);
+	GError *error = NULL;
+	gchar *thumbnail = NULL;
+
+	if (!g_private_get (&priority_lowered))
+	{
+		if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), GALLERY_DECODE_NICE) < 0)
+			GST_WARNING ("can't lower gallery decoder priority: %s", g_strerror (errno));
+		g_private_set (&priority_lowered, GINT_TO_POINTER (TRUE));
+	}
+
+	/* scrolled out of reach while waiting */
+	if ((gint) job->number < first || (gint) job->number > last)
+	{
+		GST_LOG ("skip decoding photo %u, wanted are %i..%i", job->number, first, last);
+		goto done;
+	}
+
+	if (priv->thumbnailer)
+		thumbnail = photo_booth_thumbnailer_lookup (priv->thumbnailer, job->number, job->filename, THUMBNAIL_SIZE_MEDIUM);
+	if (thumbnail)
+		job->pixbuf = gdk_pixbuf_new_from_file (thumbnail, &error);
+	else
+	{
+		/* no thumbnail yet, DCT-scaled decode of the photo itself */
+		GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+		GMappedFile *mapped = g_mapped_file_new (job->filename, FALSE, &error);
+		g_signal_connect (loader, "size-prepared", G_CALLBACK (_gallery_size_prepared), NULL);
+		if (mapped && gdk_pixbuf_loader_write (loader, (const guchar *) g_mapped_file_get_contents (mapped), g_mapped_file_get_length (mapped), &error) && gdk_pixbuf_loader_close (loader, &error))
+			job->pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+		else
+			gdk_pixbuf_loader_close (loader, NULL);
+		if (mapped)
+			g_mapped_file_unref (mapped);
+		g_object_unref (loader);
+	}
+	if (error)
+	{
+		GST_DEBUG ("can't load photo %u: %s", job->number, error->message);
+		g_error_free (error);
+	}
+	job->failed = !job->pixbuf;
+	g_free (thumbnail);
+
+done:
+	g_main_context_invoke (NULL, (GSourceFunc) _gallery_decode_done, job);
+}
+
+static void _gallery_request (PhotoBoothGallery *gallery, guint number)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	PhotoBoothGalleryJob *job;
+
+	if (!number || g_hash_table_contains (priv->pending, GUINT_TO_POINTER (number)) || g_hash_table_contains (priv->cache_table, GUINT_TO_POINTER (number)))
+		return;
+	g_hash_table_add (priv->pending, GUINT_TO_POINTER (number));
+
+	job = g_slice_new0 (PhotoBoothGalleryJob);
+	job->gallery = g_object_ref (gallery);
+	job->number = number;
+	job->filename = g_strdup_printf (priv->path_template, number);
+	g_thread_pool_push (priv->decode_pool, job, NULL);
+}
+
+static gboolean photo_booth_gallery_draw (GtkWidget *widget, cairo_t *cr)
+{
+	PhotoBoothGallery *gallery = PHOTO_BOOTH_GALLERY (widget);
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	gint row_height = GALLERY_TILE_HEIGHT + GALLERY_SPACING;
+	gint height = gtk_widget_get_allocated_height (widget);
+	gdouble offset = priv->vadjustment ? gtk_adjustment_get_value (priv->vadjustment) : 0;
+	gint first_row, last_row, row, column, prefetch_first, prefetch_last;
+
+	if (!priv->path_template || !priv->last_number)
+		return FALSE;
+
+	first_row = MAX (0, (gint) (offset / row_height));
+	last_row = (gint) ((offset + height) / row_height);
+
+	for (row = first_row; row <= last_row; row++)
+	{
+		for (column = 0; column < priv->columns; column++)
+		{
+			guint number = _gallery_number_at (priv, row * priv->columns + column);
+			gdouble x = GALLERY_SPACING + column * (GALLERY_TILE_WIDTH + GALLERY_SPACING);
+			gdouble y = GALLERY_SPACING + row * row_height - offset;
+			PhotoBoothGalleryEntry *entry;
+			if (!number)
+				break;
+			entry = _gallery_cache_lookup (priv, number);
+			if (entry && entry->pixbuf)
+			{
+				gdk_cairo_set_source_pixbuf (cr, entry->pixbuf, x + (GALLERY_TILE_WIDTH - gdk_pixbuf_get_width (entry->pixbuf)) / 2, y + (GALLERY_TILE_HEIGHT - gdk_pixbuf_get_height (entry->pixbuf)) / 2);
+				cairo_paint (cr);
+			}
+			else if (entry)
+			{
+				/* crossed out, it couldn't be decoded */
+				cairo_set_source_rgba (cr, 0.15, 0.15, 0.15, 0.8);
+				cairo_rectangle (cr, x, y, GALLERY_TILE_WIDTH, GALLERY_TILE_HEIGHT);
+				cairo_fill (cr);
+				cairo_set_source_rgba (cr, 0.5, 0.5, 0.5, 0.8);
+				cairo_set_line_width (cr, 2);
+				cairo_move_to (cr, x, y);
+				cairo_line_to (cr, x + GALLERY_TILE_WIDTH, y + GALLERY_TILE_HEIGHT);
+				cairo_move_to (cr, x + GALLERY_TILE_WIDTH, y);
+				cairo_line_to (cr, x, y + GALLERY_TILE_HEIGHT);
+				cairo_stroke (cr);
+			}
+			else
+			{
+				cairo_set_source_rgba (cr, 0.3, 0.3, 0.3, 0.8);
+				cairo_rectangle (cr, x, y, GALLERY_TILE_WIDTH, GALLERY_TILE_HEIGHT);
+				cairo_fill (cr);
+				_gallery_request (gallery, number);
+			}
+		}
+	}
+
+	/* prefetch ahead in the scroll direction, keep a little behind */
+	prefetch_first = MAX (0, first_row - (priv->scroll_direction < 0 ? GALLERY_PREFETCH_ROWS : 1));
+	prefetch_last = last_row + (priv->scroll_direction < 0 ? 1 : GALLERY_PREFETCH_ROWS);
+	g_atomic_int_set (&priv->wanted_first, _gallery_number_at (priv, MIN ((prefetch_last + 1) * priv->columns - 1, (gint) priv->last_number - 1)));
+	g_atomic_int_set (&priv->wanted_last, _gallery_number_at (priv, prefetch_first * priv->columns));
+	g_atomic_int_set (&priv->wanted_center, _gallery_number_at (priv, MIN ((first_row + last_row) / 2 * priv->columns, (gint) priv->last_number - 1)));
+	for (row = prefetch_first; row <= prefetch_last; row++)
+		if (row < first_row || row > last_row)
+			for (column = 0; column < priv->columns; column++)
+				_gallery_request (gallery, _gallery_number_at (priv, row * priv->columns + column));
+
+	GST_LOG ("drew rows %i..%i, cache %" G_GSIZE_FORMAT " kB in %u pixbufs, %u hits %u misses, %u decodes pending",
+		first_row, last_row, priv->cache_bytes / 1024, priv->cache_lru.length, priv->cache_hits, priv->cache_misses, g_thread_pool_unprocessed (priv->decode_pool));
+	return FALSE;
+}
+
+void photo_booth_gallery_set_thumbnailer (PhotoBoothGallery *gallery, PhotoBoothThumbnailer *thumbnailer)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	priv->thumbnailer = thumbnailer;
+}
+
+void photo_booth_gallery_set_cache_size (PhotoBoothGallery *gallery, gsize bytes)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+	priv->cache_budget = bytes;
+	GST_DEBUG_OBJECT (gallery, "decoded image cache budget %" G_GSIZE_FORMAT " kB", bytes / 1024);
+}
+
+/* photos are path_template's numbers 1..last_number, missing ones stay blank */
+void photo_booth_gallery_set_photos (PhotoBoothGallery *gallery, const gchar *path_template, guint last_number)
+{
+	PhotoBoothGalleryPrivate *priv = photo_booth_gallery_get_instance_private (gallery);
+
+	g_free (priv->path_template);
+	priv->path_template = g_strdup (path_template);
+	priv->last_number = last_number;
+	_gallery_cache_forget_failures (priv);
+	priv->scroll_direction = 1;
+	priv->last_scroll = 0;
+	if (priv->vadjustment)
+		gtk_adjustment_set_value (priv->vadjustment, 0);
+	_gallery_update_adjustment (gallery);
+	gtk_widget_queue_draw (GTK_WIDGET (gallery));
+	GST_DEBUG_OBJECT (gallery, "showing %u photos of '%s'", last_number, path_template);
+}
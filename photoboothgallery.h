@@ -0,0 +1,50 @@
+/*
+ * GStreamer photoboothgallery.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_GALLERY_H__
+#define __PHOTO_BOOTH_GALLERY_H__
+
+#include <gtk/gtk.h>
+#include "photobooththumbs.h"
+
+G_BEGIN_DECLS
+
+#define PHOTO_BOOTH_GALLERY_TYPE                (photo_booth_gallery_get_type ())
+#define PHOTO_BOOTH_GALLERY(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj), PHOTO_BOOTH_GALLERY_TYPE, PhotoBoothGallery))
+#define PHOTO_BOOTH_GALLERY_CLASS(klass)        (G_TYPE_CHECK_CLASS_CAST ((klass),  PHOTO_BOOTH_GALLERY_TYPE, PhotoBoothGalleryClass))
+#define IS_PHOTO_BOOTH_GALLERY(obj)             (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PHOTO_BOOTH_GALLERY_TYPE))
+#define IS_PHOTO_BOOTH_GALLERY_CLASS(klass)     (G_TYPE_CHECK_CLASS_TYPE ((klass),  PHOTO_BOOTH_GALLERY_TYPE))
+
+typedef struct _PhotoBoothGallery              PhotoBoothGallery;
+typedef struct _PhotoBoothGalleryClass         PhotoBoothGalleryClass;
+
+struct _PhotoBoothGallery
+{
+	GtkDrawingArea parent;
+};
+
+struct _PhotoBoothGalleryClass
+{
+	GtkDrawingAreaClass parent_class;
+};
+
+GType                   photo_booth_gallery_get_type            (void);
+void                    photo_booth_gallery_set_thumbnailer     (PhotoBoothGallery *gallery, PhotoBoothThumbnailer *thumbnailer);
+void                    photo_booth_gallery_set_cache_size      (PhotoBoothGallery *gallery, gsize bytes);
+void                    photo_booth_gallery_set_photos          (PhotoBoothGallery *gallery, const gchar *path_template, guint last_number);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_GALLERY_H__ */
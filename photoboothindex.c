@@ -0,0 +1,324 @@
+/*
+ * photoboothindex.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include "photobooth.h"
+#include "photoboothindex.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_index_debug);
+#define GST_CAT_DEFAULT photo_booth_index_debug
+
+#define INDEX_MAGIC         "PBINDEX"
+#define INDEX_VERSION       1
+#define INDEX_HEADER_SIZE   64
+#define INDEX_RECORD_SIZE   128
+
+/* the file is a fixed size header followed by fixed size records which
+ * are only ever appended. a photo's print count or upload status change
+ * appends an updated copy of its record, the last one wins. the header
+ * carries the highest photo number so startup only has to read it. */
+typedef struct
+{
+	gchar      magic[8];
+	guint32    version;
+	guint32    record_size;
+	guint32    last_number;
+	guint32    records;
+	guint8     reserved[40];
+} PhotoBoothIndexHeader;
+
+typedef struct
+{
+	guint32    number;
+	guint32    prints;
+	gint64     timestamp;
+	guint8     upload_status;
+	guint8     reserved[7];
+	gchar      path[104];
+} PhotoBoothIndexRecord;
+
+G_STATIC_ASSERT (sizeof (PhotoBoothIndexHeader) == INDEX_HEADER_SIZE);
+G_STATIC_ASSERT (sizeof (PhotoBoothIndexRecord) == INDEX_RECORD_SIZE);
+
+struct _PhotoBoothIndex
+{
+	gint                   fd;
+	gchar                 *filename;
+	PhotoBoothIndexHeader  header;
+	GHashTable            *session_records;  /* number -> latest record written or looked up by this process */
+	GMutex                 mutex;
+};
+
+static void _index_init_debug (void)
+{
+	static volatile gsize debug_initialized = 0;
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_index_debug, "photoboothindex", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_CYAN, "PhotoBoothIndex");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+}
+
+static PhotoBoothIndex *_index_new (gint fd, const gchar *filename)
+{
+	PhotoBoothIndex *index = g_new0 (PhotoBoothIndex, 1);
+	index->fd = fd;
+	index->filename = g_strdup (filename);
+	index->session_records = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	g_mutex_init (&index->mutex);
+	return index;
+}
+
+static gboolean _index_pwrite (PhotoBoothIndex *index, const void *data, gsize len, goffset offset)
+{
+	const guint8 *p = data;
+	while (len)
+	{
+		gssize written = pwrite (index->fd, p, len, offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			GST_ERROR ("writing '%s' failed: %s", index->filename, g_strerror (errno));
+			return FALSE;
+		}
+		p += written;
+		offset += written;
+		len -= written;
+	}
+	return TRUE;
+}
+
+/* g_memdup2 would need GLib 2.68 */
+static PhotoBoothIndexRecord *_index_record_dup (const PhotoBoothIndexRecord *record)
+{
+	PhotoBoothIndexRecord *copy = g_new (PhotoBoothIndexRecord, 1);
+	*copy = *record;
+	return copy;
+}
+
+static gboolean _index_append (PhotoBoothIndex *index, PhotoBoothIndexRecord *record)
+{
+	goffset offset = INDEX_HEADER_SIZE + (goffset) index->header.records * INDEX_RECORD_SIZE;
+
+	if (!_index_pwrite (index, record, sizeof (*record), offset))
+		return FALSE;
+	index->header.records++;
+	if (record->number > index->header.last_number)
+		index->header.last_number = record->number;
+	g_hash_table_replace (index->session_records, GUINT_TO_POINTER (record->number), _index_record_dup (record));
+	return _index_pwrite (index, &index->header, sizeof (index->header), 0);
+}
+
+/* records of earlier runs aren't read at startup. they're looked up
+ * from the end of the file, the last one of a number wins, and kept for
+ * the next time. updates mostly concern recent photos near the end */
+static PhotoBoothIndexRecord *_index_lookup (PhotoBoothIndex *index, guint number, PhotoBoothIndexRecord *record)
+{
+	PhotoBoothIndexRecord *known = g_hash_table_lookup (index->session_records, GUINT_TO_POINTER (number));
+	guint i;
+
+	if (known)
+	{
+		*record = *known;
+		return record;
+	}
+	for (i = index->header.records; i > 0; i--)
+	{
+		if (pread (index->fd, record, sizeof (*record), INDEX_HEADER_SIZE + (goffset) (i - 1) * INDEX_RECORD_SIZE) != sizeof (*record))
+		{
+			GST_WARNING ("can't read record %u of '%s'", i - 1, index->filename);
+			break;
+		}
+		if (record->number == number)
+		{
+			g_hash_table_replace (index->session_records, GUINT_TO_POINTER (number), _index_record_dup (record));
+			return record;
+		}
+	}
+	memset (record, 0, sizeof (*record));
+	record->number = number;
+	return record;
+}
+
+/* returns NULL if the index doesn't exist or can't be trusted, in which
+ * case the caller has to recover by scanning the save directory */
+PhotoBoothIndex *photo_booth_index_open (const gchar *filename, GError **error)
+{
+	PhotoBoothIndex *index;
+	PhotoBoothIndexHeader header;
+	struct stat st;
+	goffset expected;
+	gint fd;
+
+	_index_init_debug ();
+
+	fd = g_open (filename, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "can't open photo index '%s': %s", filename, g_strerror (errno));
+		return NULL;
+	}
+	if (pread (fd, &header, sizeof (header), 0) != sizeof (header) || fstat (fd, &st) < 0 ||
+	    memcmp (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) || header.version != INDEX_VERSION || header.record_size != INDEX_RECORD_SIZE)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "photo index '%s' has an invalid header", filename);
+		close (fd);
+		return NULL;
+	}
+
+	expected = INDEX_HEADER_SIZE + (goffset) header.records * INDEX_RECORD_SIZE;
+	if (st.st_size < expected)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "photo index '%s' is truncated (%" G_GOFFSET_FORMAT " < %" G_GOFFSET_FORMAT " bytes)", filename, (goffset) st.st_size, expected);
+		close (fd);
+		return NULL;
+	}
+
+	index = _index_new (fd, filename);
+	index->header = header;
+
+	/* records appended after the header was last written, e.g. on a crash */
+	if (st.st_size > expected)
+	{
+		PhotoBoothIndexRecord record;
+		guint tail = (st.st_size - expected) / INDEX_RECORD_SIZE, i;
+		GST_WARNING ("photo index '%s' has %u records and %" G_GOFFSET_FORMAT " bytes beyond its header, recovering", filename, tail, (goffset) (st.st_size - expected));
+		for (i = 0; i < tail; i++)
+		{
+			if (pread (fd, &record, sizeof (record), expected + (goffset) i * INDEX_RECORD_SIZE) != sizeof (record))
+				break;
+			index->header.last_number = MAX (index->header.last_number, record.number);
+		}
+		index->header.records += i;
+		if (ftruncate (fd, INDEX_HEADER_SIZE + (goffset) index->header.records * INDEX_RECORD_SIZE) < 0 ||
+		    !_index_pwrite (index, &index->header, sizeof (index->header), 0))
+			GST_WARNING ("can't repair photo index '%s'", filename);
+	}
+
+	GST_INFO ("opened photo index '%s' with %u records, last photo number %u", filename, index->header.records, index->header.last_number);
+	return index;
+}
+
+/* starts a new empty index, replacing an existing broken one */
+PhotoBoothIndex *photo_booth_index_create (const gchar *filename, guint last_number, GError **error)
+{
+	PhotoBoothIndex *index;
+	gint fd;
+
+	_index_init_debug ();
+
+	fd = g_open (filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "can't create photo index '%s': %s", filename, g_strerror (errno));
+		return NULL;
+	}
+
+	index = _index_new (fd, filename);
+	memcpy (index->header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+	index->header.version = INDEX_VERSION;
+	index->header.record_size = INDEX_RECORD_SIZE;
+	index->header.last_number = last_number;
+	if (!_index_pwrite (index, &index->header, sizeof (index->header), 0))
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "can't write photo index '%s': %s", filename, g_strerror (errno));
+		photo_booth_index_close (index);
+		return NULL;
+	}
+
+	GST_INFO ("created photo index '%s', last photo number %u", filename, last_number);
+	return index;
+}
+
+void photo_booth_index_close (PhotoBoothIndex *index)
+{
+	close (index->fd);
+	g_hash_table_destroy (index->session_records);
+	g_mutex_clear (&index->mutex);
+	g_free (index->filename);
+	g_free (index);
+}
+
+guint photo_booth_index_get_last_number (PhotoBoothIndex *index)
+{
+	guint last_number;
+	g_mutex_lock (&index->mutex);
+	last_number = index->header.last_number;
+	g_mutex_unlock (&index->mutex);
+	return last_number;
+}
+
+guint photo_booth_index_get_records (PhotoBoothIndex *index)
+{
+	guint records;
+	g_mutex_lock (&index->mutex);
+	records = index->header.records;
+	g_mutex_unlock (&index->mutex);
+	return records;
+}
+
+gboolean photo_booth_index_add (PhotoBoothIndex *index, guint number, const gchar *path)
+{
+	PhotoBoothIndexRecord record;
+	gchar *basename = g_path_get_basename (path);
+	gboolean ret;
+
+	memset (&record, 0, sizeof (record));
+	record.number = number;
+	record.timestamp = g_get_real_time () / G_USEC_PER_SEC;
+	record.upload_status = INDEX_UPLOAD_NONE;
+	g_strlcpy (record.path, basename, sizeof (record.path));
+	g_free (basename);
+
+	g_mutex_lock (&index->mutex);
+	ret = _index_append (index, &record);
+	g_mutex_unlock (&index->mutex);
+	GST_DEBUG ("added photo %u '%s'", number, record.path);
+	return ret;
+}
+
+gboolean photo_booth_index_add_prints (PhotoBoothIndex *index, guint number, guint prints)
+{
+	PhotoBoothIndexRecord record;
+	gboolean ret;
+
+	g_mutex_lock (&index->mutex);
+	_index_lookup (index, number, &record);
+	record.prints += prints;
+	ret = _index_append (index, &record);
+	g_mutex_unlock (&index->mutex);
+	GST_DEBUG ("photo %u printed %u times", number, record.prints);
+	return ret;
+}
+
+gboolean photo_booth_index_set_upload_status (PhotoBoothIndex *index, guint number, PhotoBoothIndexUploadStatus status)
+{
+	PhotoBoothIndexRecord record;
+	gboolean ret;
+
+	g_mutex_lock (&index->mutex);
+	_index_lookup (index, number, &record);
+	record.upload_status = status;
+	ret = _index_append (index, &record);
+	g_mutex_unlock (&index->mutex);
+	GST_DEBUG ("photo %u upload status %i", number, status);
+	return ret;
+}
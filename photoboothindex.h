@@ -0,0 +1,46 @@
+/*
+ * GStreamer photoboothindex.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_INDEX_H__
+#define __PHOTO_BOOTH_INDEX_H__
+
+#include <glib.h>
+
+#define PHOTO_INDEX_FILENAME ".photobooth-index"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	INDEX_UPLOAD_NONE = 0,
+	INDEX_UPLOAD_PENDING,
+	INDEX_UPLOAD_DONE,
+	INDEX_UPLOAD_FAILED,
+} PhotoBoothIndexUploadStatus;
+
+typedef struct _PhotoBoothIndex PhotoBoothIndex;
+
+PhotoBoothIndex    *photo_booth_index_open              (const gchar *filename, GError **error);
+PhotoBoothIndex    *photo_booth_index_create            (const gchar *filename, guint last_number, GError **error);
+void                photo_booth_index_close             (PhotoBoothIndex *index);
+guint               photo_booth_index_get_last_number   (PhotoBoothIndex *index);
+guint               photo_booth_index_get_records       (PhotoBoothIndex *index);
+gboolean            photo_booth_index_add               (PhotoBoothIndex *index, guint number, const gchar *path);
+gboolean            photo_booth_index_add_prints        (PhotoBoothIndex *index, guint number, guint prints);
+gboolean            photo_booth_index_set_upload_status (PhotoBoothIndex *index, guint number, PhotoBoothIndexUploadStatus status);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_INDEX_H__ */
@@ -0,0 +1,290 @@
+/*
+ * photoboothlayout.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "photobooth.h"
+#include "photoboothlayout.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_layout_debug);
+#define GST_CAT_DEFAULT photo_booth_layout_debug
+
+#define LAYOUT_MAX_CELLS     8
+#define LAYOUT_RENDER_THREADS 2
+#define LAYOUT_JPEG_QUALITY  "95"
+
+typedef struct
+{
+	guint      shot;
+	gint       x, y, w, h;
+} PhotoBoothLayoutCell;
+
+typedef struct
+{
+	guint      shot;
+	GBytes    *jpeg;
+	gint64     queued_time;
+} PhotoBoothLayoutJob;
+
+/* composes the shots of one session into a canvas of print size.
+ * every shot is decoded and rendered into its cell(s) on the render pool
+ * as soon as it's added, so finishing only has to wait for the last shot
+ * and encode the canvas. cells never overlap, so the workers write into
+ * the shared canvas without locking. */
+struct _PhotoBoothLayout
+{
+	gchar                *template_name;
+	guint                 shots;
+	PhotoBoothLayoutCell  cells[LAYOUT_MAX_CELLS];
+	guint                 n_cells;
+	GdkPixbuf            *canvas;
+	GdkPixbuf            *cell_overlay;
+	GThreadPool          *render_pool;
+	GMutex                mutex;
+	GCond                 cond;
+	guint                 pending;
+	gint64                session_start_time;
+};
+
+static void _layout_add_cell (PhotoBoothLayout *layout, guint shot, gint x, gint y, gint w, gint h)
+{
+	PhotoBoothLayoutCell *cell = &layout->cells[layout->n_cells++];
+	cell->shot = shot;
+	cell->x = x;
+	cell->y = y;
+	cell->w = w;
+	cell->h = h;
+}
+
+/* strip: the canvas is split into an upper and a lower 2x6" strip which
+ * carry the same shots side by side. grid: 2x2 shots */
+static gboolean _layout_build_cells (PhotoBoothLayout *layout, gint width, gint height, gint spacing)
+{
+	guint i, row, rows, cols, copies;
+
+	if (g_strcmp0 (layout->template_name, LAYOUT_TEMPLATE_STRIP) == 0)
+	{
+		layout->shots = CLAMP (layout->shots, 2, LAYOUT_MAX_CELLS / 2);
+		cols = layout->shots;
+		rows = 2;
+		copies = 2;
+	}
+	else if (g_strcmp0 (layout->template_name, LAYOUT_TEMPLATE_GRID) == 0)
+	{
+		layout->shots = 4;
+		cols = rows = 2;
+		copies = 1;
+	}
+	else
+		return FALSE;
+
+	for (row = 0; row < rows; row++)
+	{
+		for (i = 0; i < cols; i++)
+		{
+			gint cell_w = (width - (cols + 1) * spacing) / cols;
+			gint cell_h = (height - (rows + 1) * spacing) / rows;
+			guint shot = copies > 1 ? i : row * cols + i;
+			_layout_add_cell (layout, shot, spacing + i * (cell_w + spacing), spacing + row * (cell_h + spacing), cell_w, cell_h);
+		}
+	}
+	return TRUE;
+}
+
+static void _layout_size_prepared (GdkPixbufLoader *loader, gint width, gint height, PhotoBoothLayoutCell *cell)
+{
+	gdouble scale = MAX ((gdouble) cell->w / width, (gdouble) cell->h / height);
+	/* let the jpeg loader do the bulk of the downscaling while decoding (DCT scaling) */
+	if (scale < 1.0)
+		gdk_pixbuf_loader_set_size (loader, width * scale + 0.5, height * scale + 0.5);
+}
+
+static void _layout_render_cell (PhotoBoothLayout *layout, PhotoBoothLayoutCell *cell, GdkPixbuf *shot)
+{
+	gint sw = gdk_pixbuf_get_width (shot);
+	gint sh = gdk_pixbuf_get_height (shot);
+	gdouble scale = MAX ((gdouble) cell->w / sw, (gdouble) cell->h / sh);
+
+	/* scale to cover the cell and crop centered */
+	gdk_pixbuf_scale (shot, layout->canvas, cell->x, cell->y, cell->w, cell->h,
+	                  cell->x + (cell->w - sw * scale) / 2, cell->y + (cell->h - sh * scale) / 2,
+	                  scale, scale, GDK_INTERP_BILINEAR);
+	if (layout->cell_overlay)
+		gdk_pixbuf_composite (layout->cell_overlay, layout->canvas, cell->x, cell->y, cell->w, cell->h,
+		                      cell->x, cell->y, 1.0, 1.0, GDK_INTERP_NEAREST, 255);
+}
+
+static void _layout_render_func (PhotoBoothLayoutJob *job, PhotoBoothLayout *layout)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf *shot;
+	PhotoBoothLayoutCell *first = NULL;
+	GError *error = NULL;
+	gint64 start_time = g_get_monotonic_time ();
+	guint i;
+
+	for (i = 0; i < layout->n_cells && !first; i++)
+		if (layout->cells[i].shot == job->shot)
+			first = &layout->cells[i];
+
+	loader = gdk_pixbuf_loader_new_with_type ("jpeg", NULL);
+	g_signal_connect (loader, "size-prepared", G_CALLBACK (_layout_size_prepared), first);
+	if (gdk_pixbuf_loader_write (loader, g_bytes_get_data (job->jpeg, NULL), g_bytes_get_size (job->jpeg), &error) && gdk_pixbuf_loader_close (loader, &error))
+	{
+		shot = gdk_pixbuf_loader_get_pixbuf (loader);
+		GST_DEBUG ("decoded shot %u to %dx%d in %" G_GINT64_FORMAT " ms (queued for %" G_GINT64_FORMAT " ms)", job->shot,
+			gdk_pixbuf_get_width (shot), gdk_pixbuf_get_height (shot), (g_get_monotonic_time () - start_time) / 1000, (start_time - job->queued_time) / 1000);
+		_layout_render_cell (layout, first, shot);
+		/* further cells showing the same shot are copies of the rendered one */
+		for (i = 0; i < layout->n_cells; i++)
+		{
+			PhotoBoothLayoutCell *cell = &layout->cells[i];
+			if (cell != first && cell->shot == job->shot)
+				gdk_pixbuf_copy_area (layout->canvas, first->x, first->y, first->w, first->h, layout->canvas, cell->x, cell->y);
+		}
+	}
+	else
+	{
+		GST_ERROR ("can't decode shot %u: %s", job->shot, error->message);
+		g_error_free (error);
+		gdk_pixbuf_loader_close (loader, NULL);
+	}
+	g_object_unref (loader);
+
+	GST_DEBUG ("rendered shot %u in %" G_GINT64_FORMAT " ms", job->shot, (g_get_monotonic_time () - start_time) / 1000);
+
+	g_mutex_lock (&layout->mutex);
+	layout->pending--;
+	g_cond_signal (&layout->cond);
+	g_mutex_unlock (&layout->mutex);
+
+	g_bytes_unref (job->jpeg);
+	g_slice_free (PhotoBoothLayoutJob, job);
+}
+
+/* returns NULL for the single template (or unknown ones), in which case
+ * the photo bin takes the full frame as before */
+PhotoBoothLayout *photo_booth_layout_new (const gchar *template_name, guint shots, gint width, gint height, gint spacing, const gchar *overlay_image)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothLayout *layout;
+	GError *error = NULL;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_layout_debug, "photoboothlayout", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothLayout");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	if (!template_name || g_strcmp0 (template_name, LAYOUT_TEMPLATE_SINGLE) == 0)
+		return NULL;
+
+	layout = g_new0 (PhotoBoothLayout, 1);
+	layout->template_name = g_strdup (template_name);
+	layout->shots = shots;
+	if (!_layout_build_cells (layout, width, height, spacing))
+	{
+		GST_WARNING ("unknown layout template '%s', falling back to single shots", template_name);
+		g_free (layout->template_name);
+		g_free (layout);
+		return NULL;
+	}
+
+	layout->canvas = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+	if (overlay_image)
+	{
+		layout->cell_overlay = gdk_pixbuf_new_from_file_at_scale (overlay_image, layout->cells[0].w, layout->cells[0].h, FALSE, &error);
+		if (!layout->cell_overlay)
+		{
+			GST_WARNING ("can't load overlay image %s: %s", overlay_image, error->message);
+			g_error_free (error);
+		}
+	}
+
+	g_mutex_init (&layout->mutex);
+	g_cond_init (&layout->cond);
+	layout->render_pool = g_thread_pool_new ((GFunc) _layout_render_func, layout, LAYOUT_RENDER_THREADS, FALSE, NULL);
+
+	GST_INFO ("layout '%s' with %u shots in %u cells of %dx%d on %dx%d canvas", layout->template_name, layout->shots, layout->n_cells, layout->cells[0].w, layout->cells[0].h, width, height);
+	return layout;
+}
+
+void photo_booth_layout_free (PhotoBoothLayout *layout)
+{
+	g_thread_pool_free (layout->render_pool, FALSE, TRUE);
+	g_mutex_clear (&layout->mutex);
+	g_cond_clear (&layout->cond);
+	g_object_unref (layout->canvas);
+	if (layout->cell_overlay)
+		g_object_unref (layout->cell_overlay);
+	g_free (layout->template_name);
+	g_free (layout);
+}
+
+guint photo_booth_layout_get_shots (PhotoBoothLayout *layout)
+{
+	return layout->shots;
+}
+
+void photo_booth_layout_begin (PhotoBoothLayout *layout)
+{
+	g_mutex_lock (&layout->mutex);
+	while (layout->pending)
+		g_cond_wait (&layout->cond, &layout->mutex);
+	g_mutex_unlock (&layout->mutex);
+
+	gdk_pixbuf_fill (layout->canvas, 0xffffffff);
+	layout->session_start_time = g_get_monotonic_time ();
+	GST_DEBUG ("begin layout session");
+}
+
+/* copies the jpeg data and queues its decoding and rendering */
+void photo_booth_layout_add_shot (PhotoBoothLayout *layout, guint shot, const gchar *data, gsize size)
+{
+	PhotoBoothLayoutJob *job;
+
+	g_return_if_fail (shot < layout->shots);
+
+	job = g_slice_new0 (PhotoBoothLayoutJob);
+	job->shot = shot;
+	job->jpeg = g_bytes_new (data, size);
+	job->queued_time = g_get_monotonic_time ();
+
+	g_mutex_lock (&layout->mutex);
+	layout->pending++;
+	g_mutex_unlock (&layout->mutex);
+
+	GST_DEBUG ("queue shot %u/%u (%" G_GSIZE_FORMAT " bytes) for rendering", shot + 1, layout->shots, size);
+	g_thread_pool_push (layout->render_pool, job, NULL);
+}
+
+/* waits for the outstanding cells and encodes the canvas as jpeg,
+ * jpeg_data is to be freed with g_free */
+gboolean photo_booth_layout_finish (PhotoBoothLayout *layout, gchar **jpeg_data, gsize *jpeg_size, GError **error)
+{
+	gint64 wait_time = g_get_monotonic_time (), encode_time;
+	gboolean ret;
+
+	g_mutex_lock (&layout->mutex);
+	while (layout->pending)
+		g_cond_wait (&layout->cond, &layout->mutex);
+	g_mutex_unlock (&layout->mutex);
+
+	encode_time = g_get_monotonic_time ();
+	ret = gdk_pixbuf_save_to_buffer (layout->canvas, jpeg_data, jpeg_size, "jpeg", error, "quality", LAYOUT_JPEG_QUALITY, NULL);
+
+	GST_INFO ("finished layout '%s': waited %" G_GINT64_FORMAT " ms for cells, encoded %" G_GSIZE_FORMAT " bytes in %" G_GINT64_FORMAT " ms, session took %" G_GINT64_FORMAT " ms",
+		layout->template_name, (encode_time - wait_time) / 1000, ret ? *jpeg_size : 0, (g_get_monotonic_time () - encode_time) / 1000, (g_get_monotonic_time () - layout->session_start_time) / 1000);
+	return ret;
+}
@@ -0,0 +1,38 @@
+/*
+ * GStreamer photoboothlayout.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_LAYOUT_H__
+#define __PHOTO_BOOTH_LAYOUT_H__
+
+#include <glib.h>
+
+#define LAYOUT_TEMPLATE_SINGLE "single"
+#define LAYOUT_TEMPLATE_STRIP  "strip"  /* two identical 2x6" strips, cut apart after printing */
+#define LAYOUT_TEMPLATE_GRID   "grid"   /* 2x2 grid of four shots */
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothLayout PhotoBoothLayout;
+
+PhotoBoothLayout   *photo_booth_layout_new          (const gchar *template_name, guint shots, gint width, gint height, gint spacing, const gchar *overlay_image);
+void                photo_booth_layout_free         (PhotoBoothLayout *layout);
+guint               photo_booth_layout_get_shots    (PhotoBoothLayout *layout);
+void                photo_booth_layout_begin        (PhotoBoothLayout *layout);
+void                photo_booth_layout_add_shot     (PhotoBoothLayout *layout, guint shot, const gchar *data, gsize size);
+gboolean            photo_booth_layout_finish       (PhotoBoothLayout *layout, gchar **jpeg_data, gsize *jpeg_size, GError **error);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_LAYOUT_H__ */
@@ -0,0 +1,318 @@
+/*
+ * photoboothmetrics.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include "photobooth.h"
+#include "photoboothmetrics.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_metrics_debug);
+#define GST_CAT_DEFAULT photo_booth_metrics_debug
+
+#define METRICS_REQUEST_MAX    4096
+#define METRICS_CLIENT_TIMEOUT 5           /* seconds a scraper may stall */
+#define METRICS_CONTENT_TYPE   "text/plain; version=0.0.4; charset=utf-8"
+
+/* histograms may be observed from any thread, they keep a count per
+ * bucket and are only made cumulative when scraped */
+struct _PhotoBoothHistogram
+{
+	gchar     *name, *help;
+	gdouble   *bounds;
+	guint      n_bounds;
+	guint64   *counts;             /* n_bounds + 1, the last one is +Inf */
+	guint64    count;
+	gdouble    sum;
+	GMutex     mutex;
+};
+
+/* serves GET /metrics in the prometheus text format on the main loop,
+ * one request per connection. clients share one cancellable, so free
+ * can abort all requests in flight */
+struct _PhotoBoothMetrics
+{
+	GSocketService *service;
+	GCancellable   *cancellable;
+	GList          *clients;
+	GPtrArray      *histograms;
+	PhotoBoothMetricsCollectFunc collect_func;
+	gpointer        collect_data;
+	guint           scrapes;
+};
+
+typedef struct
+{
+	PhotoBoothMetrics *metrics;
+	GSocketConnection *connection;
+	gchar              request[METRICS_REQUEST_MAX];
+	gsize              len;
+	gchar             *response;
+} PhotoBoothMetricsClient;
+
+static void _metrics_read (PhotoBoothMetricsClient *client);
+
+static void _histogram_free (PhotoBoothHistogram *histogram)
+{
+	g_free (histogram->name);
+	g_free (histogram->help);
+	g_free (histogram->bounds);
+	g_free (histogram->counts);
+	g_mutex_clear (&histogram->mutex);
+	g_free (histogram);
+}
+
+static void _histogram_append (PhotoBoothHistogram *histogram, GString *out)
+{
+	gchar value[G_ASCII_DTOSTR_BUF_SIZE];
+	guint64 cumulative = 0;
+	guint i;
+
+	g_string_append_printf (out, "# HELP %s %s\n# TYPE %s histogram\n", histogram->name, histogram->help, histogram->name);
+	g_mutex_lock (&histogram->mutex);
+	for (i = 0; i < histogram->n_bounds; i++)
+	{
+		cumulative += histogram->counts[i];
+		g_string_append_printf (out, "%s_bucket{le=\"%s\"} %" G_GUINT64_FORMAT "\n", histogram->name,
+			g_ascii_dtostr (value, sizeof (value), histogram->bounds[i]), cumulative);
+	}
+	g_string_append_printf (out, "%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n", histogram->name, histogram->count);
+	g_string_append_printf (out, "%s_sum %s\n", histogram->name, g_ascii_dtostr (value, sizeof (value), histogram->sum));
+	g_string_append_printf (out, "%s_count %" G_GUINT64_FORMAT "\n", histogram->name, histogram->count);
+	g_mutex_unlock (&histogram->mutex);
+}
+
+static void _metrics_append (GString *out, const gchar *type, const gchar *name, const gchar *help, gdouble value)
+{
+	gchar str[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n%s %s\n", name, help, name, type, name, g_ascii_dtostr (str, sizeof (str), value));
+}
+
+void photo_booth_metrics_append_counter (GString *out, const gchar *name, const gchar *help, gdouble value)
+{
+	_metrics_append (out, "counter", name, help, value);
+}
+
+void photo_booth_metrics_append_gauge (GString *out, const gchar *name, const gchar *help, gdouble value)
+{
+	_metrics_append (out, "gauge", name, help, value);
+}
+
+static void _metrics_client_free (PhotoBoothMetricsClient *client)
+{
+	if (client->metrics)
+		client->metrics->clients = g_list_remove (client->metrics->clients, client);
+	g_io_stream_close (G_IO_STREAM (client->connection), NULL, NULL);
+	g_object_unref (client->connection);
+	g_free (client->response);
+	g_free (client);
+}
+
+static void _metrics_written (GOutputStream *stream, GAsyncResult *res, PhotoBoothMetricsClient *client)
+{
+	GError *error = NULL;
+
+	if (!g_output_stream_write_all_finish (stream, res, NULL, &error))
+	{
+		GST_DEBUG ("can't send metrics: %s", error->message);
+		g_error_free (error);
+	}
+	_metrics_client_free (client);
+}
+
+static void _metrics_respond (PhotoBoothMetricsClient *client)
+{
+	PhotoBoothMetrics *metrics = client->metrics;
+	GString *body = NULL;
+	const gchar *status = "200 OK";
+	guint i;
+
+	if (g_str_has_prefix (client->request, "GET /metrics ") || g_str_has_prefix (client->request, "GET / "))
+	{
+		body = g_string_new (NULL);
+		metrics->scrapes++;
+		photo_booth_metrics_append_counter (body, "photobooth_metrics_scrapes_total", "Scrapes of this endpoint", metrics->scrapes);
+		if (metrics->collect_func)
+			metrics->collect_func (body, metrics->collect_data);
+		for (i = 0; i < metrics->histograms->len; i++)
+			_histogram_append (g_ptr_array_index (metrics->histograms, i), body);
+	}
+	else if (g_str_has_prefix (client->request, "GET "))
+		status = "404 Not Found";
+	else
+		status = "405 Method Not Allowed";
+	if (!body)
+		body = g_string_new (status + 4);
+
+	client->response = g_strdup_printf ("HTTP/1.0 %s\r\nContent-Type: " METRICS_CONTENT_TYPE "\r\nContent-Length: %" G_GSIZE_FORMAT "\r\nConnection: close\r\n\r\n%s",
+		status, body->len, body->str);
+	g_string_free (body, TRUE);
+	g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (client->connection)), client->response, strlen (client->response),
+		G_PRIORITY_DEFAULT, metrics->cancellable, (GAsyncReadyCallback) _metrics_written, client);
+}
+
+static void _metrics_read_done (GInputStream *stream, GAsyncResult *res, PhotoBoothMetricsClient *client)
+{
+	GError *error = NULL;
+	gssize len = g_input_stream_read_finish (stream, res, &error);
+
+	if (len <= 0)
+	{
+		if (error)
+		{
+			GST_DEBUG ("can't read metrics request: %s", error->message);
+			g_error_free (error);
+		}
+		_metrics_client_free (client);
+		return;
+	}
+	/* metrics went away while reading */
+	if (!client->metrics)
+	{
+		_metrics_client_free (client);
+		return;
+	}
+	client->len += len;
+	client->request[client->len] = '\0';
+	/* only the request line matters, headers are skipped */
+	if (strstr (client->request, "\r\n\r\n") || strstr (client->request, "\n\n") || client->len == sizeof (client->request) - 1)
+		_metrics_respond (client);
+	else
+		_metrics_read (client);
+}
+
+static void _metrics_read (PhotoBoothMetricsClient *client)
+{
+	g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (client->connection)), client->request + client->len,
+		sizeof (client->request) - 1 - client->len, G_PRIORITY_DEFAULT, client->metrics->cancellable, (GAsyncReadyCallback) _metrics_read_done, client);
+}
+
+static gboolean _metrics_incoming (GSocketService *service, GSocketConnection *connection, GObject *source, PhotoBoothMetrics *metrics)
+{
+	PhotoBoothMetricsClient *client = g_new0 (PhotoBoothMetricsClient, 1);
+
+	client->metrics = metrics;
+	client->connection = g_object_ref (connection);
+	/* a scraper that never finishes its request must not hold the socket */
+	g_socket_set_timeout (g_socket_connection_get_socket (connection), METRICS_CLIENT_TIMEOUT);
+	metrics->clients = g_list_prepend (metrics->clients, client);
+	_metrics_read (client);
+	return TRUE;
+}
+
+PhotoBoothMetrics *photo_booth_metrics_new (void)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothMetrics *metrics;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_metrics_debug, "photoboothmetrics", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_MAGENTA, "PhotoBoothMetrics");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	metrics = g_new0 (PhotoBoothMetrics, 1);
+	metrics->cancellable = g_cancellable_new ();
+	metrics->histograms = g_ptr_array_new_with_free_func ((GDestroyNotify) _histogram_free);
+	return metrics;
+}
+
+/* cancels the requests in flight and detaches their clients, each is
+ * freed by its cancelled callback without touching metrics again */
+void photo_booth_metrics_free (PhotoBoothMetrics *metrics)
+{
+	GList *l;
+
+	g_cancellable_cancel (metrics->cancellable);
+	for (l = metrics->clients; l; l = l->next)
+	{
+		PhotoBoothMetricsClient *client = l->data;
+		client->metrics = NULL;
+	}
+	g_list_free (metrics->clients);
+	g_object_unref (metrics->cancellable);
+	if (metrics->service)
+	{
+		g_socket_service_stop (metrics->service);
+		g_socket_listener_close (G_SOCKET_LISTENER (metrics->service));
+		g_object_unref (metrics->service);
+	}
+	g_ptr_array_unref (metrics->histograms);
+	g_free (metrics);
+}
+
+gboolean photo_booth_metrics_listen (PhotoBoothMetrics *metrics, const gchar *address, guint port, GError **error)
+{
+	GInetAddress *inet_address = g_inet_address_new_from_string (address ? address : METRICS_DEFAULT_ADDRESS);
+	GSocketAddress *socket_address;
+	gboolean ret;
+
+	if (!inet_address)
+	{
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid address '%s'", address);
+		return FALSE;
+	}
+	socket_address = g_inet_socket_address_new (inet_address, port);
+	metrics->service = g_socket_service_new ();
+	ret = g_socket_listener_add_address (G_SOCKET_LISTENER (metrics->service), socket_address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, error);
+	g_object_unref (socket_address);
+	g_object_unref (inet_address);
+	if (!ret)
+	{
+		g_clear_object (&metrics->service);
+		return FALSE;
+	}
+	g_signal_connect (metrics->service, "incoming", G_CALLBACK (_metrics_incoming), metrics);
+	g_socket_service_start (metrics->service);
+	GST_INFO ("serving metrics on http://%s:%u/metrics", address ? address : METRICS_DEFAULT_ADDRESS, port);
+	return TRUE;
+}
+
+void photo_booth_metrics_set_collect_func (PhotoBoothMetrics *metrics, PhotoBoothMetricsCollectFunc func, gpointer user_data)
+{
+	metrics->collect_func = func;
+	metrics->collect_data = user_data;
+}
+
+/* bounds are the ascending upper bounds of the buckets, without +Inf */
+PhotoBoothHistogram *photo_booth_metrics_add_histogram (PhotoBoothMetrics *metrics, const gchar *name, const gchar *help, const gdouble *bounds, guint n_bounds)
+{
+	PhotoBoothHistogram *histogram = g_new0 (PhotoBoothHistogram, 1);
+
+	histogram->name = g_strdup (name);
+	histogram->help = g_strdup (help);
+	histogram->bounds = g_new (gdouble, n_bounds);
+	memcpy (histogram->bounds, bounds, n_bounds * sizeof (gdouble));
+	histogram->n_bounds = n_bounds;
+	histogram->counts = g_new0 (guint64, n_bounds + 1);
+	g_mutex_init (&histogram->mutex);
+	g_ptr_array_add (metrics->histograms, histogram);
+	return histogram;
+}
+
+/* thread safe */
+void photo_booth_histogram_observe (PhotoBoothHistogram *histogram, gdouble value)
+{
+	guint i;
+
+	if (!histogram)
+		return;
+	for (i = 0; i < histogram->n_bounds && value > histogram->bounds[i]; i++);
+	g_mutex_lock (&histogram->mutex);
+	histogram->counts[i]++;
+	histogram->count++;
+	histogram->sum += value;
+	g_mutex_unlock (&histogram->mutex);
+}
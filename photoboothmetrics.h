@@ -0,0 +1,43 @@
+/*
+ * GStreamer photoboothmetrics.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_METRICS_H__
+#define __PHOTO_BOOTH_METRICS_H__
+
+#include <glib.h>
+
+#define METRICS_DEFAULT_ADDRESS  "127.0.0.1"
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothMetrics          PhotoBoothMetrics;
+typedef struct _PhotoBoothHistogram        PhotoBoothHistogram;
+
+/* called on the main thread for every scrape, appends the current
+ * counters and gauges with the append functions below */
+typedef void (*PhotoBoothMetricsCollectFunc) (GString *out, gpointer user_data);
+
+PhotoBoothMetrics   *photo_booth_metrics_new              (void);
+void                 photo_booth_metrics_free             (PhotoBoothMetrics *metrics);
+gboolean             photo_booth_metrics_listen           (PhotoBoothMetrics *metrics, const gchar *address, guint port, GError **error);
+void                 photo_booth_metrics_set_collect_func (PhotoBoothMetrics *metrics, PhotoBoothMetricsCollectFunc func, gpointer user_data);
+PhotoBoothHistogram *photo_booth_metrics_add_histogram    (PhotoBoothMetrics *metrics, const gchar *name, const gchar *help, const gdouble *bounds, guint n_bounds);
+void                 photo_booth_histogram_observe        (PhotoBoothHistogram *histogram, gdouble value);
+void                 photo_booth_metrics_append_counter   (GString *out, const gchar *name, const gchar *help, gdouble value);
+void                 photo_booth_metrics_append_gauge     (GString *out, const gchar *name, const gchar *help, gdouble value);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_METRICS_H__ */
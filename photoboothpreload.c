@@ -0,0 +1,314 @@
+/*
+ * photoboothpreload.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "photobooth.h"
+#include "photoboothpreload.h"
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_preload_debug);
+#define GST_CAT_DEFAULT photo_booth_preload_debug
+
+#define WARM_CHUNK_SIZE (64 * 1024)
+
+/* loads what startup doesn't need to wait for on a small thread pool.
+ * every task has a name, its result is handed to the done func on the
+ * main thread as soon as it's there. the main thread may also wait for a
+ * task by name when it needs the result right now, the done func then
+ * runs before wait returns */
+typedef struct
+{
+	const gchar               *name;
+	PhotoBoothPreloadFunc      func;
+	PhotoBoothPreloadDoneFunc  done;
+	GDestroyNotify             result_free;
+	gpointer                   user_data;
+	PhotoBoothPreload         *preload;
+	gpointer                   result;
+	gboolean                   finished, applied;
+	guint                      idle_id;
+	gint64                     queued;
+} PhotoBoothPreloadTask;
+
+struct _PhotoBoothPreload
+{
+	GThreadPool *pool;
+	GMutex       mutex;
+	GCond        cond;
+	GPtrArray   *tasks;
+};
+
+typedef struct
+{
+	gchar       *what;
+	gint64       time;
+} PhotoBoothStartupMark;
+
+/* the startup timeline, from the first mark until it's finished */
+static GMutex  startup_mutex;
+static GArray *startup_marks = NULL;
+static gint64  startup_origin = 0;
+static gboolean startup_finished = FALSE;
+
+static void _preload_debug_init (void)
+{
+	static volatile gsize debug_initialized = 0;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_preload_debug, "photoboothpreload", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothPreload");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+}
+
+static gboolean _preload_idle (PhotoBoothPreloadTask *task)
+{
+	PhotoBoothPreload *preload = task->preload;
+	gboolean apply;
+
+	g_mutex_lock (&preload->mutex);
+	task->idle_id = 0;
+	apply = !task->applied;
+	task->applied = TRUE;
+	g_mutex_unlock (&preload->mutex);
+	if (apply)
+		task->done (task->result, task->user_data);
+	return G_SOURCE_REMOVE;
+}
+
+static void _preload_run (PhotoBoothPreloadTask *task, PhotoBoothPreload *preload)
+{
+	guint64 trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+	gint64 started = g_get_monotonic_time ();
+	gpointer result;
+	gchar *what;
+
+	result = task->func (task->user_data);
+	PHOTO_BOOTH_TRACE_END (trace_start, task->name, 0);
+	GST_INFO ("preloaded %s in %" G_GINT64_FORMAT " ms, %" G_GINT64_FORMAT " ms after it was queued", task->name,
+		(g_get_monotonic_time () - started) / 1000, (g_get_monotonic_time () - task->queued) / 1000);
+	what = g_strdup_printf ("preloaded %s", task->name);
+	photo_booth_startup_mark (what);
+	g_free (what);
+
+	g_mutex_lock (&preload->mutex);
+	task->result = result;
+	task->finished = TRUE;
+	if (task->done)
+		task->idle_id = g_idle_add ((GSourceFunc) _preload_idle, task);
+	else
+	{
+		if (result && task->result_free)
+			task->result_free (result);
+		task->applied = TRUE;
+	}
+	g_cond_broadcast (&preload->cond);
+	g_mutex_unlock (&preload->mutex);
+}
+
+PhotoBoothPreload *photo_booth_preload_new (guint max_threads)
+{
+	PhotoBoothPreload *preload;
+
+	_preload_debug_init ();
+
+	preload = g_new0 (PhotoBoothPreload, 1);
+	g_mutex_init (&preload->mutex);
+	g_cond_init (&preload->cond);
+	preload->tasks = g_ptr_array_new ();
+	preload->pool = g_thread_pool_new ((GFunc) _preload_run, preload, MAX (max_threads, 1), FALSE, NULL);
+	return preload;
+}
+
+/* tasks that haven't started yet are dropped, running ones are waited for */
+void photo_booth_preload_free (PhotoBoothPreload *preload)
+{
+	guint i;
+
+	g_thread_pool_free (preload->pool, TRUE, TRUE);
+	for (i = 0; i < preload->tasks->len; i++)
+	{
+		PhotoBoothPreloadTask *task = g_ptr_array_index (preload->tasks, i);
+		if (task->idle_id)
+			g_source_remove (task->idle_id);
+		if (!task->applied && task->result && task->result_free)
+			task->result_free (task->result);
+		g_free (task);
+	}
+	g_ptr_array_free (preload->tasks, TRUE);
+	g_cond_clear (&preload->cond);
+	g_mutex_clear (&preload->mutex);
+	g_free (preload);
+}
+
+/* main thread. name must be a static string. result_free discards a
+ * result that done never got, done may be NULL if the task is only run
+ * for its side effects. a task may be added again once it's done */
+void photo_booth_preload_add (PhotoBoothPreload *preload, const gchar *name, PhotoBoothPreloadFunc func, PhotoBoothPreloadDoneFunc done, GDestroyNotify result_free, gpointer user_data)
+{
+	PhotoBoothPreloadTask *task = g_new0 (PhotoBoothPreloadTask, 1);
+	guint i;
+
+	task->name = name;
+	task->func = func;
+	task->done = done;
+	task->result_free = result_free;
+	task->user_data = user_data;
+	task->preload = preload;
+	task->queued = g_get_monotonic_time ();
+	g_mutex_lock (&preload->mutex);
+	/* whatever was handed over already isn't waited for anymore */
+	for (i = preload->tasks->len; i > 0; i--)
+	{
+		PhotoBoothPreloadTask *old = g_ptr_array_index (preload->tasks, i - 1);
+		if (old->finished && old->applied && !old->idle_id)
+			g_free (g_ptr_array_remove_index (preload->tasks, i - 1));
+	}
+	g_ptr_array_add (preload->tasks, task);
+	g_mutex_unlock (&preload->mutex);
+	GST_DEBUG ("queued %s", name);
+	g_thread_pool_push (preload->pool, task, NULL);
+}
+
+/* main thread. blocks until the latest task named name finished and its
+ * result was handed to done. FALSE if there's no such task */
+gboolean photo_booth_preload_wait (PhotoBoothPreload *preload, const gchar *name)
+{
+	PhotoBoothPreloadTask *task = NULL;
+	gint64 start = g_get_monotonic_time ();
+	gboolean apply;
+	guint i;
+
+	g_mutex_lock (&preload->mutex);
+	for (i = preload->tasks->len; i > 0 && !task; i--)
+		if (g_strcmp0 (((PhotoBoothPreloadTask *) g_ptr_array_index (preload->tasks, i - 1))->name, name) == 0)
+			task = g_ptr_array_index (preload->tasks, i - 1);
+	if (!task)
+	{
+		g_mutex_unlock (&preload->mutex);
+		return FALSE;
+	}
+	while (!task->finished)
+		g_cond_wait (&preload->cond, &preload->mutex);
+	if (task->idle_id)
+	{
+		g_source_remove (task->idle_id);
+		task->idle_id = 0;
+	}
+	apply = !task->applied;
+	task->applied = TRUE;
+	g_mutex_unlock (&preload->mutex);
+
+	if (g_get_monotonic_time () - start > 1000)
+		GST_INFO ("waited %" G_GINT64_FORMAT " ms for %s", (g_get_monotonic_time () - start) / 1000, name);
+	if (apply)
+		task->done (task->result, task->user_data);
+	return TRUE;
+}
+
+/* reads up to max_bytes of filename, 0 for all of it, so the first read
+ * once it's used comes from the page cache instead of the disk */
+void photo_booth_preload_warm_file (const gchar *filename, goffset max_bytes)
+{
+	gchar *chunk;
+	goffset total = 0;
+	ssize_t n;
+	int fd;
+
+	if (!filename)
+		return;
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		GST_WARNING ("can't preload %s: %s", filename, g_strerror (errno));
+		return;
+	}
+	chunk = g_malloc (WARM_CHUNK_SIZE);
+	while ((!max_bytes || total < max_bytes) && (n = read (fd, chunk, WARM_CHUNK_SIZE)) > 0)
+		total += n;
+	g_free (chunk);
+	close (fd);
+	GST_DEBUG ("warmed %" G_GINT64_FORMAT " bytes of %s", (gint64) total, filename);
+}
+
+/* thread safe. the first mark is the origin of the timeline, marks after
+ * it was finished are only logged */
+void photo_booth_startup_mark (const gchar *what)
+{
+	PhotoBoothStartupMark mark;
+	gint64 since;
+
+	mark.time = g_get_monotonic_time ();
+	g_mutex_lock (&startup_mutex);
+	if (!startup_origin)
+		startup_origin = mark.time;
+	since = mark.time - startup_origin;
+	if (!startup_finished)
+	{
+		if (!startup_marks)
+			startup_marks = g_array_new (FALSE, FALSE, sizeof (PhotoBoothStartupMark));
+		mark.what = g_strdup (what);
+		g_array_append_val (startup_marks, mark);
+	}
+	g_mutex_unlock (&startup_mutex);
+
+	/* the very first mark may come before gst_init */
+	if (gst_is_initialized ())
+	{
+		_preload_debug_init ();
+		GST_DEBUG ("startup +%" G_GINT64_FORMAT " ms: %s", since / 1000, what);
+	}
+}
+
+/* marks what and logs the timeline up to it, once. returns the time from
+ * the first mark in microseconds, or -1 if it was finished before */
+gint64 photo_booth_startup_finish (const gchar *what, gint64 target)
+{
+	GString *timeline;
+	gint64 total;
+	guint i;
+
+	photo_booth_startup_mark (what);
+	_preload_debug_init ();
+
+	g_mutex_lock (&startup_mutex);
+	if (startup_finished)
+	{
+		g_mutex_unlock (&startup_mutex);
+		return -1;
+	}
+	startup_finished = TRUE;
+	timeline = g_string_new (NULL);
+	total = 0;
+	for (i = 0; i < startup_marks->len; i++)
+	{
+		PhotoBoothStartupMark *mark = &g_array_index (startup_marks, PhotoBoothStartupMark, i);
+		g_string_append_printf (timeline, "\n\t+%5" G_GINT64_FORMAT " ms  %s", (mark->time - startup_origin) / 1000, mark->what);
+		total = mark->time - startup_origin;
+		g_free (mark->what);
+	}
+	g_array_free (startup_marks, TRUE);
+	startup_marks = NULL;
+	g_mutex_unlock (&startup_mutex);
+
+	if (total > target)
+		GST_WARNING ("%s after %" G_GINT64_FORMAT " ms, over the %" G_GINT64_FORMAT " ms target:%s", what, total / 1000, target / 1000, timeline->str);
+	else
+		GST_INFO ("%s after %" G_GINT64_FORMAT " ms:%s", what, total / 1000, timeline->str);
+	g_string_free (timeline, TRUE);
+	return total;
+}
@@ -0,0 +1,43 @@
+/*
+ * GStreamer photoboothpreload.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_PRELOAD_H__
+#define __PHOTO_BOOTH_PRELOAD_H__
+
+#include <glib.h>
+
+#define PRELOAD_MAX_THREADS    4
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothPreload PhotoBoothPreload;
+
+/* runs on a pool thread and returns what it loaded */
+typedef gpointer (*PhotoBoothPreloadFunc) (gpointer user_data);
+/* runs on the main thread with the result, which it takes over */
+typedef void (*PhotoBoothPreloadDoneFunc) (gpointer result, gpointer user_data);
+
+PhotoBoothPreload *photo_booth_preload_new       (guint max_threads);
+void             photo_booth_preload_free        (PhotoBoothPreload *preload);
+void             photo_booth_preload_add         (PhotoBoothPreload *preload, const gchar *name, PhotoBoothPreloadFunc func, PhotoBoothPreloadDoneFunc done, GDestroyNotify result_free, gpointer user_data);
+gboolean         photo_booth_preload_wait        (PhotoBoothPreload *preload, const gchar *name);
+void             photo_booth_preload_warm_file   (const gchar *filename, goffset max_bytes);
+
+void             photo_booth_startup_mark        (const gchar *what);
+gint64           photo_booth_startup_finish      (const gchar *what, gint64 target);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_PRELOAD_H__ */
@@ -0,0 +1,164 @@
+/*
+ * photoboothraster.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "photobooth.h"
+#include "photoboothraster.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_raster_debug);
+#define GST_CAT_DEFAULT photo_booth_raster_debug
+
+#define RASTER_SYNC_V3      0x52615333  /* "RaS3", uncompressed, native byte order */
+#define RASTER_CSPACE_RGB   1
+#define RASTER_ORDER_CHUNKY 0
+#define RASTER_CUT_PAGE     4
+#define PT_PER_IN           72
+
+/* cups_page_header2_t as documented in the CUPS raster format spec */
+typedef struct
+{
+	char     MediaClass[64], MediaColor[64], MediaType[64], OutputType[64];
+	guint32  AdvanceDistance, AdvanceMedia, Collate, CutMedia, Duplex;
+	guint32  HWResolution[2];
+	guint32  ImagingBoundingBox[4];
+	guint32  InsertSheet, Jog, LeadingEdge;
+	guint32  Margins[2];
+	guint32  ManualFeed, MediaPosition, MediaWeight, MirrorPrint, NegativePrint, NumCopies;
+	guint32  Orientation, OutputFaceUp;
+	guint32  PageSize[2];
+	guint32  Separations, TraySwitch, Tumble;
+	guint32  cupsWidth, cupsHeight, cupsMediaType, cupsBitsPerColor, cupsBitsPerPixel, cupsBytesPerLine;
+	guint32  cupsColorOrder, cupsColorSpace, cupsCompression, cupsRowCount, cupsRowFeed, cupsRowStep;
+	guint32  cupsNumColors;
+	gfloat   cupsBorderlessScalingFactor;
+	gfloat   cupsPageSize[2];
+	gfloat   cupsImagingBBox[4];
+	guint32  cupsInteger[16];
+	gfloat   cupsReal[16];
+	char     cupsString[16][64];
+	char     cupsMarkerType[64], cupsRenderingIntent[64], cupsPageSizeName[64];
+} PhotoBoothRasterHeader;
+
+G_STATIC_ASSERT (sizeof (PhotoBoothRasterHeader) == 1796);
+
+static gboolean _raster_write_all (gint fd, const void *data, gsize len, GError **error)
+{
+	const guint8 *p = data;
+	while (len)
+	{
+		gssize written = write (fd, p, len);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "raster write failed: %s", g_strerror (errno));
+			return FALSE;
+		}
+		p += written;
+		len -= written;
+	}
+	return TRUE;
+}
+
+gboolean photo_booth_raster_begin (gint fd, GError **error)
+{
+	static volatile gsize debug_initialized = 0;
+	guint32 sync = RASTER_SYNC_V3;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_raster_debug, "photoboothraster", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_BLUE, "PhotoBoothRaster");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	return _raster_write_all (fd, &sync, sizeof (sync), error);
+}
+
+gboolean photo_booth_raster_write_page (gint fd, cairo_surface_t *page, gint dpi, gint copies, const gchar *page_size_name, gboolean cut, GError **error)
+{
+	PhotoBoothRasterHeader header;
+	gint width, height, stride, x, y, copy;
+	const guint8 *pixels;
+	guint8 *rows, *row;
+
+	g_return_val_if_fail (cairo_image_surface_get_format (page) == CAIRO_FORMAT_RGB24, FALSE);
+
+	cairo_surface_flush (page);
+	width = cairo_image_surface_get_width (page);
+	height = cairo_image_surface_get_height (page);
+	stride = cairo_image_surface_get_stride (page);
+	pixels = cairo_image_surface_get_data (page);
+
+	memset (&header, 0, sizeof (header));
+	g_strlcpy (header.MediaType, "Photo", sizeof (header.MediaType));
+	header.HWResolution[0] = header.HWResolution[1] = dpi;
+	header.PageSize[0] = width * PT_PER_IN / dpi;
+	header.PageSize[1] = height * PT_PER_IN / dpi;
+	header.ImagingBoundingBox[2] = header.PageSize[0];
+	header.ImagingBoundingBox[3] = header.PageSize[1];
+	header.NumCopies = 1;
+	header.CutMedia = cut ? RASTER_CUT_PAGE : 0;
+	header.cupsWidth = width;
+	header.cupsHeight = height;
+	header.cupsBitsPerColor = 8;
+	header.cupsBitsPerPixel = 24;
+	header.cupsBytesPerLine = width * 3;
+	header.cupsColorOrder = RASTER_ORDER_CHUNKY;
+	header.cupsColorSpace = RASTER_CSPACE_RGB;
+	header.cupsRowCount = 1;
+	header.cupsRowStep = 1;
+	header.cupsNumColors = 3;
+	header.cupsBorderlessScalingFactor = 1.0;
+	header.cupsPageSize[0] = (gfloat) width * PT_PER_IN / dpi;
+	header.cupsPageSize[1] = (gfloat) height * PT_PER_IN / dpi;
+	header.cupsImagingBBox[2] = header.cupsPageSize[0];
+	header.cupsImagingBBox[3] = header.cupsPageSize[1];
+	if (page_size_name)
+		g_strlcpy (header.cupsPageSizeName, page_size_name, sizeof (header.cupsPageSizeName));
+	else
+		g_snprintf (header.cupsPageSizeName, sizeof (header.cupsPageSizeName), "Custom.%.0fx%.0f", header.cupsPageSize[0], header.cupsPageSize[1]);
+
+	/* convert the xRGB32 surface to packed RGB once, then stream it for each copy */
+	rows = g_malloc (header.cupsBytesPerLine * height);
+	for (y = 0; y < height; y++)
+	{
+		const guint32 *src = (const guint32 *) (pixels + y * stride);
+		row = rows + y * header.cupsBytesPerLine;
+		for (x = 0; x < width; x++)
+		{
+			*row++ = (src[x] >> 16) & 0xff;
+			*row++ = (src[x] >> 8) & 0xff;
+			*row++ = src[x] & 0xff;
+		}
+	}
+
+	GST_DEBUG ("writing %dx%d @ %d dpi raster %s (%u bytes per page) %d times to fd %d", width, height, dpi, header.cupsPageSizeName, header.cupsBytesPerLine * height, copies, fd);
+
+	for (copy = 0; copy < copies; copy++)
+	{
+		if (!_raster_write_all (fd, &header, sizeof (header), error))
+			goto fail;
+		if (!_raster_write_all (fd, rows, header.cupsBytesPerLine * height, error))
+			goto fail;
+	}
+	g_free (rows);
+	return TRUE;
+
+fail:
+	g_free (rows);
+	return FALSE;
+}
@@ -0,0 +1,33 @@
+/*
+ * GStreamer photoboothraster.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_RASTER_H__
+#define __PHOTO_BOOTH_RASTER_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+/* CUPS raster (RaS3, 8 bit chunky RGB) stream writer. begin writes the
+ * sync word, write_page appends the CAIRO_FORMAT_RGB24 image surface page
+ * copies times. page_size_name may be NULL for a custom size, cut requests
+ * a cut after the page (e.g. for the printer's 2-up "-div2" media) */
+gboolean        photo_booth_raster_begin        (gint fd, GError **error);
+gboolean        photo_booth_raster_write_page   (gint fd, cairo_surface_t *page, gint dpi, gint copies, const gchar *page_size_name, gboolean cut, GError **error);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_RASTER_H__ */
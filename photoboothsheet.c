@@ -0,0 +1,142 @@
+/*
+ * photoboothsheet.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include "photoboothsheet.h"
+
+/* packs print copies onto sheets of slots_per_sheet prints each.
+ * copies that don't fill a whole sheet are held back and paired with
+ * the next job's copies, or printed alone when flushed. */
+struct _PhotoBoothSheetPacker
+{
+	guint      slots;
+	GQueue     pending;
+	guint      prints, sheets;
+	gint64     first_print_time;
+};
+
+static void _sheet_free (PhotoBoothSheet *sheet)
+{
+	guint i;
+	for (i = 0; i < sheet->n_slots; i++)
+		gst_buffer_unref (sheet->slot[i]);
+	g_slice_free (PhotoBoothSheet, sheet);
+}
+
+static PhotoBoothSheet *_sheet_from_pending (PhotoBoothSheetPacker *packer, guint n_slots)
+{
+	PhotoBoothSheet *sheet = g_slice_new0 (PhotoBoothSheet);
+	while (sheet->n_slots < n_slots)
+		sheet->slot[sheet->n_slots++] = g_queue_pop_head (&packer->pending);
+	return sheet;
+}
+
+PhotoBoothSheetPacker *photo_booth_sheet_packer_new (guint slots_per_sheet)
+{
+	PhotoBoothSheetPacker *packer = g_new0 (PhotoBoothSheetPacker, 1);
+	packer->slots = CLAMP (slots_per_sheet, 1, SHEET_MAX_SLOTS);
+	g_queue_init (&packer->pending);
+	return packer;
+}
+
+void photo_booth_sheet_packer_free (PhotoBoothSheetPacker *packer)
+{
+	GstBuffer *buffer;
+	while ((buffer = g_queue_pop_head (&packer->pending)))
+		gst_buffer_unref (buffer);
+	g_free (packer);
+}
+
+guint photo_booth_sheet_packer_get_slots (PhotoBoothSheetPacker *packer)
+{
+	return packer->slots;
+}
+
+/* returns the sheets that can be printed right away */
+GPtrArray *photo_booth_sheet_packer_add (PhotoBoothSheetPacker *packer, GstBuffer *buffer, guint copies)
+{
+	GPtrArray *sheets = g_ptr_array_new_with_free_func ((GDestroyNotify) _sheet_free);
+	guint i;
+	for (i = 0; i < copies; i++)
+		g_queue_push_tail (&packer->pending, gst_buffer_ref (buffer));
+	while (g_queue_get_length (&packer->pending) >= packer->slots)
+		g_ptr_array_add (sheets, _sheet_from_pending (packer, packer->slots));
+	return sheets;
+}
+
+/* returns the held back remainder as a partially filled sheet */
+GPtrArray *photo_booth_sheet_packer_flush (PhotoBoothSheetPacker *packer)
+{
+	GPtrArray *sheets = g_ptr_array_new_with_free_func ((GDestroyNotify) _sheet_free);
+	guint remainder = g_queue_get_length (&packer->pending);
+	if (remainder)
+		g_ptr_array_add (sheets, _sheet_from_pending (packer, remainder));
+	return sheets;
+}
+
+guint photo_booth_sheet_packer_get_pending (PhotoBoothSheetPacker *packer)
+{
+	return g_queue_get_length (&packer->pending);
+}
+
+/* accounts successfully printed sheets and returns the number of prints on them */
+guint photo_booth_sheet_packer_printed (PhotoBoothSheetPacker *packer, GPtrArray *sheets)
+{
+	guint i, prints = 0;
+	for (i = 0; i < sheets->len; i++)
+		prints += ((PhotoBoothSheet *) g_ptr_array_index (sheets, i))->n_slots;
+	if (prints && !packer->first_print_time)
+		packer->first_print_time = g_get_monotonic_time ();
+	packer->prints += prints;
+	packer->sheets += sheets->len;
+	return prints;
+}
+
+guint photo_booth_sheet_packer_get_prints (PhotoBoothSheetPacker *packer)
+{
+	return packer->prints;
+}
+
+guint photo_booth_sheet_packer_get_sheets (PhotoBoothSheetPacker *packer)
+{
+	return packer->sheets;
+}
+
+/* sheets saved compared to printing every copy on its own sheet */
+guint photo_booth_sheet_packer_get_saved (PhotoBoothSheetPacker *packer)
+{
+	return packer->prints - packer->sheets;
+}
+
+gdouble photo_booth_sheet_packer_get_per_hour (PhotoBoothSheetPacker *packer)
+{
+	gint64 elapsed;
+	if (!packer->first_print_time)
+		return 0.0;
+	elapsed = g_get_monotonic_time () - packer->first_print_time;
+	if (elapsed < G_USEC_PER_SEC * 60)
+		return 0.0;
+	return (gdouble) packer->prints * 3600.0 * G_USEC_PER_SEC / elapsed;
+}
+
+gboolean photo_booth_sheet_equal (const PhotoBoothSheet *a, const PhotoBoothSheet *b)
+{
+	guint i;
+	if (a->n_slots != b->n_slots)
+		return FALSE;
+	for (i = 0; i < a->n_slots; i++)
+		if (a->slot[i] != b->slot[i])
+			return FALSE;
+	return TRUE;
+}
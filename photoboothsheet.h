@@ -0,0 +1,50 @@
+/*
+ * GStreamer photoboothsheet.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_SHEET_H__
+#define __PHOTO_BOOTH_SHEET_H__
+
+#include <glib.h>
+#include <gst/gst.h>
+
+#define SHEET_MAX_SLOTS 2
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothSheet            PhotoBoothSheet;
+typedef struct _PhotoBoothSheetPacker      PhotoBoothSheetPacker;
+
+struct _PhotoBoothSheet
+{
+	GstBuffer *slot[SHEET_MAX_SLOTS];
+	guint      n_slots;
+};
+
+PhotoBoothSheetPacker  *photo_booth_sheet_packer_new            (guint slots_per_sheet);
+void                    photo_booth_sheet_packer_free           (PhotoBoothSheetPacker *packer);
+guint                   photo_booth_sheet_packer_get_slots      (PhotoBoothSheetPacker *packer);
+GPtrArray              *photo_booth_sheet_packer_add            (PhotoBoothSheetPacker *packer, GstBuffer *buffer, guint copies);
+GPtrArray              *photo_booth_sheet_packer_flush          (PhotoBoothSheetPacker *packer);
+guint                   photo_booth_sheet_packer_get_pending    (PhotoBoothSheetPacker *packer);
+guint                   photo_booth_sheet_packer_printed        (PhotoBoothSheetPacker *packer, GPtrArray *sheets);
+guint                   photo_booth_sheet_packer_get_prints     (PhotoBoothSheetPacker *packer);
+guint                   photo_booth_sheet_packer_get_sheets     (PhotoBoothSheetPacker *packer);
+guint                   photo_booth_sheet_packer_get_saved      (PhotoBoothSheetPacker *packer);
+gdouble                 photo_booth_sheet_packer_get_per_hour   (PhotoBoothSheetPacker *packer);
+gboolean                photo_booth_sheet_equal                 (const PhotoBoothSheet *a, const PhotoBoothSheet *b);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_SHEET_H__ */
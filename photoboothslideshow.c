@@ -0,0 +1,373 @@
+/*
+ * photoboothslideshow.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <gdk/gdk.h>
+#include <gst/app/app.h>
+#include "photobooth.h"
+#include "photoboothslideshow.h"
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_slideshow_debug);
+#define GST_CAT_DEFAULT photo_booth_slideshow_debug
+
+#define SLIDESHOW_FRAME_INTERVAL (G_USEC_PER_SEC / 25)
+#define SLIDESHOW_HOLD_INTERVAL  (G_USEC_PER_SEC / 2)
+#define SLIDESHOW_FRAME_POOL     3
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SLIDESHOW_FORMAT "BGRx"
+#else
+#define SLIDESHOW_FORMAT "xRGB"
+#endif
+
+/* cycles through the saved photos, newest first, and crossfades from one
+ * to the next. a decoder thread keeps the next few scaled to the screen
+ * in a bounded cache, so a fade never waits for a jpeg. a photo that was
+ * just saved is decoded before the rotation goes on and shown next.
+ *
+ * the frames are pushed through an appsrc from its own streaming thread,
+ * paced by the monotonic clock since the display sink doesn't sync. while
+ * a slide is only held a frame now and then is enough */
+struct _PhotoBoothSlideshow
+{
+	gint             width, height;
+	guint            decode_ahead;
+	gint64           hold, fade;              /* us */
+	GMutex           mutex;
+	GCond            cond;                    /* the decoder waits for room, the source for its next frame */
+	gchar           *path_template;
+	guint            last_number;
+	guint            cursor;                  /* next number of the rotation, counting down */
+	guint            misses;                  /* photos in a row that couldn't be decoded */
+	GQueue           fresh;                   /* numbers saved since, decoded before the rotation */
+	GQueue           cache;                   /* decoded slides, the next one first */
+	gboolean         running, quit;
+	gint64           next_frame;
+	GThread         *decoder;
+	GstElement      *appsrc;
+	/* only touched by the appsrc streaming thread */
+	cairo_surface_t *previous, *current, *blank;
+	cairo_surface_t *frames[SLIDESHOW_FRAME_POOL];
+	gint64           slide_start;
+	gboolean         stalled;
+};
+
+static cairo_surface_t *_slideshow_decode (PhotoBoothSlideshow *slideshow, guint number, const gchar *filename)
+{
+	guint64 trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+	GError *error = NULL;
+	cairo_surface_t *surface;
+	GdkPixbuf *pixbuf;
+	cairo_t *cr;
+
+	/* the jpeg loader scales while it decodes, a full size photo takes
+	 * only a fraction of the time it would at its own size */
+	pixbuf = gdk_pixbuf_new_from_file_at_scale (filename, slideshow->width, slideshow->height, TRUE, &error);
+	if (!pixbuf)
+	{
+		if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			GST_DEBUG ("%s is gone, skipped", filename);
+		else
+			GST_WARNING ("can't decode %s: %s", filename, error->message);
+		g_error_free (error);
+		return NULL;
+	}
+	surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, slideshow->width, slideshow->height);
+	cr = cairo_create (surface);
+	cairo_set_source_rgb (cr, 0, 0, 0);
+	cairo_paint (cr);
+	gdk_cairo_set_source_pixbuf (cr, pixbuf, (slideshow->width - gdk_pixbuf_get_width (pixbuf)) / 2, (slideshow->height - gdk_pixbuf_get_height (pixbuf)) / 2);
+	cairo_paint (cr);
+	cairo_destroy (cr);
+	cairo_surface_flush (surface);
+	g_object_unref (pixbuf);
+	PHOTO_BOOTH_TRACE_END (trace_start, "slideshow-decode", number);
+	return surface;
+}
+
+static gpointer _slideshow_decode_thread (PhotoBoothSlideshow *slideshow)
+{
+	g_mutex_lock (&slideshow->mutex);
+	while (!slideshow->quit)
+	{
+		cairo_surface_t *surface;
+		gchar *filename;
+		gboolean fresh;
+		guint number, limit;
+
+		/* with fewer photos than that the same ones would be cached twice */
+		limit = MIN (slideshow->decode_ahead, MAX (slideshow->last_number, 1));
+		if (g_queue_get_length (&slideshow->cache) >= limit || (g_queue_is_empty (&slideshow->fresh) && slideshow->misses >= slideshow->last_number))
+		{
+			g_cond_wait (&slideshow->cond, &slideshow->mutex);
+			continue;
+		}
+		fresh = !g_queue_is_empty (&slideshow->fresh);
+		if (fresh)
+			number = GPOINTER_TO_UINT (g_queue_pop_head (&slideshow->fresh));
+		else
+		{
+			if (slideshow->cursor < 1 || slideshow->cursor > slideshow->last_number)
+				slideshow->cursor = slideshow->last_number;
+			number = slideshow->cursor--;
+		}
+		filename = g_strdup_printf (slideshow->path_template, number);
+		g_mutex_unlock (&slideshow->mutex);
+
+		surface = _slideshow_decode (slideshow, number, filename);
+		g_free (filename);
+
+		g_mutex_lock (&slideshow->mutex);
+		if (!surface)
+		{
+			if (!fresh)
+				slideshow->misses++;
+			continue;
+		}
+		slideshow->misses = 0;
+		if (fresh)
+			g_queue_push_head (&slideshow->cache, surface);
+		else
+			g_queue_push_tail (&slideshow->cache, surface);
+		GST_DEBUG ("decoded photo %u%s, %u slides ahead", number, fresh ? " (new)" : "", g_queue_get_length (&slideshow->cache));
+		g_cond_broadcast (&slideshow->cond);
+	}
+	g_mutex_unlock (&slideshow->mutex);
+	return NULL;
+}
+
+/* the buffer keeps a reference to the surface until the sink is done */
+static GstBuffer *_slideshow_wrap (cairo_surface_t *surface)
+{
+	gsize size = cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+	return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, cairo_image_surface_get_data (surface), size, 0, size, surface, (GDestroyNotify) cairo_surface_destroy);
+}
+
+/* a frame of the pool the sink let go of, or a new one */
+static cairo_surface_t *_slideshow_get_frame (PhotoBoothSlideshow *slideshow)
+{
+	guint i;
+
+	for (i = 0; i < SLIDESHOW_FRAME_POOL; i++)
+	{
+		if (!slideshow->frames[i])
+			slideshow->frames[i] = cairo_image_surface_create (CAIRO_FORMAT_RGB24, slideshow->width, slideshow->height);
+		if (cairo_surface_get_reference_count (slideshow->frames[i]) == 1)
+			return cairo_surface_reference (slideshow->frames[i]);
+	}
+	GST_LOG ("frame pool exhausted");
+	return cairo_image_surface_create (CAIRO_FORMAT_RGB24, slideshow->width, slideshow->height);
+}
+
+static cairo_surface_t *_slideshow_blend (PhotoBoothSlideshow *slideshow, cairo_surface_t *from, cairo_surface_t *to, gdouble alpha)
+{
+	cairo_surface_t *frame = _slideshow_get_frame (slideshow);
+	cairo_t *cr = cairo_create (frame);
+
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface (cr, from, 0, 0);
+	cairo_paint (cr);
+	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_surface (cr, to, 0, 0);
+	cairo_paint_with_alpha (cr, alpha);
+	cairo_destroy (cr);
+	cairo_surface_flush (frame);
+	return frame;
+}
+
+static void _slideshow_need_data (GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+	PhotoBoothSlideshow *slideshow = user_data;
+	cairo_surface_t *next = NULL, *frame;
+	gint64 now, elapsed, next_frame;
+
+	g_mutex_lock (&slideshow->mutex);
+	while (slideshow->running && !slideshow->quit && g_get_monotonic_time () < slideshow->next_frame)
+		g_cond_wait_until (&slideshow->cond, &slideshow->mutex, slideshow->next_frame);
+	if (!slideshow->running || slideshow->quit)
+	{
+		/* asked again once the source is resumed */
+		g_mutex_unlock (&slideshow->mutex);
+		return;
+	}
+	now = g_get_monotonic_time ();
+	if (!slideshow->current || now - slideshow->slide_start >= slideshow->hold + slideshow->fade)
+	{
+		next = g_queue_pop_head (&slideshow->cache);
+		if (next)
+			g_cond_broadcast (&slideshow->cond);
+		else if (slideshow->current && !slideshow->stalled)
+		{
+			GST_INFO ("next slide isn't decoded yet, holding this one");
+			slideshow->stalled = TRUE;
+		}
+	}
+	g_mutex_unlock (&slideshow->mutex);
+
+	if (next)
+	{
+		if (slideshow->previous)
+			cairo_surface_destroy (slideshow->previous);
+		/* the first slide fades in from black */
+		slideshow->previous = slideshow->current ? slideshow->current : cairo_surface_reference (slideshow->blank);
+		slideshow->current = next;
+		slideshow->slide_start = now;
+		slideshow->stalled = FALSE;
+	}
+
+	elapsed = now - slideshow->slide_start;
+	if (slideshow->previous && elapsed < slideshow->fade)
+	{
+		frame = _slideshow_blend (slideshow, slideshow->previous, slideshow->current, (gdouble) elapsed / slideshow->fade);
+		next_frame = now + SLIDESHOW_FRAME_INTERVAL;
+	}
+	else
+	{
+		if (slideshow->previous)
+		{
+			cairo_surface_destroy (slideshow->previous);
+			slideshow->previous = NULL;
+		}
+		frame = cairo_surface_reference (slideshow->current ? slideshow->current : slideshow->blank);
+		next_frame = MAX (MIN (now + SLIDESHOW_HOLD_INTERVAL, slideshow->slide_start + slideshow->hold + slideshow->fade), now + SLIDESHOW_FRAME_INTERVAL);
+	}
+
+	g_mutex_lock (&slideshow->mutex);
+	slideshow->next_frame = next_frame;
+	g_mutex_unlock (&slideshow->mutex);
+	gst_app_src_push_buffer (appsrc, _slideshow_wrap (frame));
+}
+
+PhotoBoothSlideshow *photo_booth_slideshow_new (gint width, gint height, guint decode_ahead, guint hold_ms, guint fade_ms)
+{
+	static volatile gsize debug_initialized = 0;
+	static GstAppSrcCallbacks callbacks = { _slideshow_need_data, NULL, NULL };
+	PhotoBoothSlideshow *slideshow;
+	cairo_t *cr;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_slideshow_debug, "photoboothslideshow", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_GREEN, "PhotoBoothSlideshow");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	slideshow = g_new0 (PhotoBoothSlideshow, 1);
+	slideshow->width = width;
+	slideshow->height = height;
+	slideshow->decode_ahead = MAX (decode_ahead, 1);
+	slideshow->hold = (gint64) hold_ms * 1000;
+	slideshow->fade = (gint64) fade_ms * 1000;
+	g_mutex_init (&slideshow->mutex);
+	g_cond_init (&slideshow->cond);
+	g_queue_init (&slideshow->fresh);
+	g_queue_init (&slideshow->cache);
+
+	slideshow->blank = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+	cr = cairo_create (slideshow->blank);
+	cairo_set_source_rgb (cr, 0, 0, 0);
+	cairo_paint (cr);
+	cairo_destroy (cr);
+	cairo_surface_flush (slideshow->blank);
+
+	slideshow->appsrc = gst_element_factory_make ("appsrc", "slideshow-src");
+	if (slideshow->appsrc)
+	{
+		GstCaps *caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, SLIDESHOW_FORMAT, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+		g_object_set (slideshow->appsrc, "caps", caps, "format", GST_FORMAT_TIME, "is-live", TRUE, "do-timestamp", TRUE, NULL);
+		gst_caps_unref (caps);
+		gst_object_ref_sink (slideshow->appsrc);
+		gst_app_src_set_callbacks (GST_APP_SRC (slideshow->appsrc), &callbacks, slideshow, NULL);
+	}
+	else
+		GST_ERROR ("Failed to make appsrc");
+
+	slideshow->decoder = g_thread_new ("slideshow", (GThreadFunc) _slideshow_decode_thread, slideshow);
+	GST_DEBUG ("slideshow at %dx%d, %u slides ahead, %u ms hold, %u ms fade", width, height, slideshow->decode_ahead, hold_ms, fade_ms);
+	return slideshow;
+}
+
+/* the source must not be streaming anymore */
+void photo_booth_slideshow_free (PhotoBoothSlideshow *slideshow)
+{
+	guint i;
+
+	g_mutex_lock (&slideshow->mutex);
+	slideshow->quit = TRUE;
+	g_cond_broadcast (&slideshow->cond);
+	g_mutex_unlock (&slideshow->mutex);
+	g_thread_join (slideshow->decoder);
+
+	if (slideshow->appsrc)
+		gst_object_unref (slideshow->appsrc);
+	g_queue_clear_full (&slideshow->cache, (GDestroyNotify) cairo_surface_destroy);
+	g_queue_clear (&slideshow->fresh);
+	if (slideshow->previous)
+		cairo_surface_destroy (slideshow->previous);
+	if (slideshow->current)
+		cairo_surface_destroy (slideshow->current);
+	for (i = 0; i < SLIDESHOW_FRAME_POOL; i++)
+		if (slideshow->frames[i])
+			cairo_surface_destroy (slideshow->frames[i]);
+	cairo_surface_destroy (slideshow->blank);
+	g_free (slideshow->path_template);
+	g_cond_clear (&slideshow->cond);
+	g_mutex_clear (&slideshow->mutex);
+	g_free (slideshow);
+}
+
+/* the appsrc to put into the pipeline, NULL if it couldn't be made */
+GstElement *photo_booth_slideshow_get_source (PhotoBoothSlideshow *slideshow)
+{
+	return slideshow->appsrc;
+}
+
+/* the rotation runs from last_number down to 1 */
+void photo_booth_slideshow_set_photos (PhotoBoothSlideshow *slideshow, const gchar *path_template, guint last_number)
+{
+	g_mutex_lock (&slideshow->mutex);
+	g_free (slideshow->path_template);
+	slideshow->path_template = g_strdup (path_template);
+	slideshow->last_number = last_number;
+	slideshow->cursor = last_number;
+	slideshow->misses = 0;
+	g_cond_broadcast (&slideshow->cond);
+	g_mutex_unlock (&slideshow->mutex);
+	GST_DEBUG ("%u photos in the rotation", last_number);
+}
+
+/* thread safe. number was just saved, it's shown next and stays in the
+ * rotation */
+void photo_booth_slideshow_add_photo (PhotoBoothSlideshow *slideshow, guint number)
+{
+	g_mutex_lock (&slideshow->mutex);
+	if (slideshow->path_template)
+	{
+		slideshow->last_number = MAX (slideshow->last_number, number);
+		g_queue_push_tail (&slideshow->fresh, GUINT_TO_POINTER (number));
+		g_cond_broadcast (&slideshow->cond);
+	}
+	g_mutex_unlock (&slideshow->mutex);
+}
+
+/* before the source is paused or resumed, so a frame that's waited for
+ * doesn't hold up the state change */
+void photo_booth_slideshow_set_running (PhotoBoothSlideshow *slideshow, gboolean running)
+{
+	g_mutex_lock (&slideshow->mutex);
+	slideshow->running = running;
+	slideshow->next_frame = 0;
+	g_cond_broadcast (&slideshow->cond);
+	g_mutex_unlock (&slideshow->mutex);
+}
@@ -0,0 +1,34 @@
+/*
+ * GStreamer photoboothslideshow.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_SLIDESHOW_H__
+#define __PHOTO_BOOTH_SLIDESHOW_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothSlideshow PhotoBoothSlideshow;
+
+PhotoBoothSlideshow *photo_booth_slideshow_new         (gint width, gint height, guint decode_ahead, guint hold_ms, guint fade_ms);
+void             photo_booth_slideshow_free            (PhotoBoothSlideshow *slideshow);
+GstElement      *photo_booth_slideshow_get_source      (PhotoBoothSlideshow *slideshow);
+void             photo_booth_slideshow_set_photos      (PhotoBoothSlideshow *slideshow, const gchar *path_template, guint last_number);
+void             photo_booth_slideshow_add_photo       (PhotoBoothSlideshow *slideshow, guint number);
+void             photo_booth_slideshow_set_running     (PhotoBoothSlideshow *slideshow, gboolean running);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_SLIDESHOW_H__ */
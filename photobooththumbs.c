@@ -0,0 +1,263 @@
+/*
+ * photobooththumbs.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "photobooth.h"
+#include "photobooththumbs.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_thumbs_debug);
+#define GST_CAT_DEFAULT photo_booth_thumbs_debug
+
+#define THUMBNAIL_NICE          15
+#define THUMBNAIL_IOPRIO_IDLE   (3 << 13)  /* IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT */
+#define THUMBNAIL_JPEG_QUALITY  "85"
+
+/* largest first, every size is scaled down from the one before */
+static const gint thumbnail_sizes[] = { THUMBNAIL_SIZE_LARGE, THUMBNAIL_SIZE_MEDIUM, THUMBNAIL_SIZE_SMALL };
+
+typedef struct
+{
+	guint      number;
+	gchar     *filename;
+} PhotoBoothThumbsJob;
+
+/* generates the thumbnails of saved photos on a single worker thread
+ * running at low cpu and idle io priority, so it only ever uses what the
+ * capture, display and print paths leave over. thumbnails are cached as
+ * <save_dir>/.thumbnails/<size>/<number>-<mtime>.jpg, a photo replaced
+ * under the same number gets new ones. */
+struct _PhotoBoothThumbnailer
+{
+	gchar       *cache_dir;
+	GThreadPool *pool;
+	GMutex       mutex;
+	GHashTable  *queued;
+	gboolean     priority_lowered;
+	gboolean     quit;
+};
+
+static gchar *_thumbs_path (PhotoBoothThumbnailer *thumbnailer, guint number, gint64 mtime, gint size)
+{
+	gchar *name = g_strdup_printf ("%u-%" G_GINT64_FORMAT ".jpg", number, mtime);
+	gchar *dir = g_strdup_printf ("%i", size);
+	gchar *path = g_build_filename (thumbnailer->cache_dir, dir, name, NULL);
+	g_free (dir);
+	g_free (name);
+	return path;
+}
+
+static void _thumbs_size_prepared (GdkPixbufLoader *loader, gint width, gint height, gpointer user_data)
+{
+	gdouble scale = (gdouble) THUMBNAIL_SIZE_LARGE / MAX (width, height);
+	/* the jpeg loader picks the matching DCT scale factor, so a 20 MP photo
+	 * never gets decoded in full */
+	if (scale < 1.0)
+		gdk_pixbuf_loader_set_size (loader, MAX (width * scale, 1), MAX (height * scale, 1));
+}
+
+static gboolean _thumbs_save (GdkPixbuf *pixbuf, const gchar *path)
+{
+	GError *error = NULL;
+	gchar *dir = g_path_get_dirname (path);
+	gchar *tmpname = g_strdup_printf ("%s.tmp", path);
+	gboolean ret = FALSE;
+
+	if (g_mkdir_with_parents (dir, 0755) < 0)
+		GST_WARNING ("can't create thumbnail directory '%s': %s", dir, g_strerror (errno));
+	else if (!gdk_pixbuf_save (pixbuf, tmpname, "jpeg", &error, "quality", THUMBNAIL_JPEG_QUALITY, NULL))
+	{
+		GST_WARNING ("can't save thumbnail '%s': %s", tmpname, error->message);
+		g_error_free (error);
+		g_unlink (tmpname);
+	}
+	else if (g_rename (tmpname, path) < 0)
+	{
+		GST_WARNING ("can't rename thumbnail to '%s': %s", path, g_strerror (errno));
+		g_unlink (tmpname);
+	}
+	else
+		ret = TRUE;
+
+	g_free (tmpname);
+	g_free (dir);
+	return ret;
+}
+
+static void _thumbs_generate (PhotoBoothThumbnailer *thumbnailer, guint number, const gchar *filename)
+{
+	GdkPixbufLoader *loader;
+	GMappedFile *mapped;
+	GdkPixbuf *pixbuf, *previous = NULL;
+	GError *error = NULL;
+	GStatBuf st;
+	gint64 start_time = g_get_monotonic_time (), decode_time;
+	guint i, missing = 0;
+
+	if (g_stat (filename, &st) < 0)
+	{
+		GST_WARNING ("can't stat '%s': %s", filename, g_strerror (errno));
+		return;
+	}
+	for (i = 0; i < G_N_ELEMENTS (thumbnail_sizes); i++)
+	{
+		gchar *path = _thumbs_path (thumbnailer, number, st.st_mtime, thumbnail_sizes[i]);
+		if (!g_file_test (path, G_FILE_TEST_EXISTS))
+			missing++;
+		g_free (path);
+	}
+	if (!missing)
+		return;
+
+	mapped = g_mapped_file_new (filename, FALSE, &error);
+	if (!mapped)
+	{
+		GST_WARNING ("can't map '%s': %s", filename, error->message);
+		g_error_free (error);
+		return;
+	}
+	loader = gdk_pixbuf_loader_new_with_type ("jpeg", NULL);
+	g_signal_connect (loader, "size-prepared", G_CALLBACK (_thumbs_size_prepared), NULL);
+	if (!gdk_pixbuf_loader_write (loader, (const guchar *) g_mapped_file_get_contents (mapped), g_mapped_file_get_length (mapped), &error) ||
+	    !gdk_pixbuf_loader_close (loader, &error))
+	{
+		GST_WARNING ("can't decode '%s': %s", filename, error->message);
+		g_error_free (error);
+		gdk_pixbuf_loader_close (loader, NULL);
+		g_object_unref (loader);
+		g_mapped_file_unref (mapped);
+		return;
+	}
+	g_mapped_file_unref (mapped);
+	decode_time = g_get_monotonic_time ();
+
+	pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+	g_object_unref (loader);
+	for (i = 0; i < G_N_ELEMENTS (thumbnail_sizes); i++)
+	{
+		gint width = gdk_pixbuf_get_width (pixbuf), height = gdk_pixbuf_get_height (pixbuf);
+		gdouble scale = (gdouble) thumbnail_sizes[i] / MAX (width, height);
+		gchar *path = _thumbs_path (thumbnailer, number, st.st_mtime, thumbnail_sizes[i]);
+		if (scale < 1.0)
+		{
+			previous = pixbuf;
+			pixbuf = gdk_pixbuf_scale_simple (previous, MAX (width * scale, 1), MAX (height * scale, 1), GDK_INTERP_BILINEAR);
+			g_object_unref (previous);
+		}
+		if (!g_file_test (path, G_FILE_TEST_EXISTS))
+			_thumbs_save (pixbuf, path);
+		g_free (path);
+	}
+	g_object_unref (pixbuf);
+
+	GST_DEBUG ("generated %u thumbnails of photo %u in %" G_GINT64_FORMAT " ms (decode %" G_GINT64_FORMAT " ms)", missing, number,
+		(g_get_monotonic_time () - start_time) / 1000, (decode_time - start_time) / 1000);
+}
+
+static void _thumbs_job_func (PhotoBoothThumbsJob *job, PhotoBoothThumbnailer *thumbnailer)
+{
+	if (!thumbnailer->priority_lowered)
+	{
+		pid_t tid = syscall (SYS_gettid);
+		if (setpriority (PRIO_PROCESS, tid, THUMBNAIL_NICE) < 0)
+			GST_WARNING ("can't lower thumbnailer cpu priority: %s", g_strerror (errno));
+		if (syscall (SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, THUMBNAIL_IOPRIO_IDLE) < 0)
+			GST_WARNING ("can't lower thumbnailer io priority: %s", g_strerror (errno));
+		thumbnailer->priority_lowered = TRUE;
+	}
+
+	if (!thumbnailer->quit)
+		_thumbs_generate (thumbnailer, job->number, job->filename);
+
+	g_mutex_lock (&thumbnailer->mutex);
+	g_hash_table_remove (thumbnailer->queued, GUINT_TO_POINTER (job->number));
+	g_mutex_unlock (&thumbnailer->mutex);
+	g_free (job->filename);
+	g_slice_free (PhotoBoothThumbsJob, job);
+}
+
+PhotoBoothThumbnailer *photo_booth_thumbnailer_new (const gchar *save_dir)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothThumbnailer *thumbnailer;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_thumbs_debug, "photobooththumbs", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_YELLOW, "PhotoBoothThumbs");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	thumbnailer = g_new0 (PhotoBoothThumbnailer, 1);
+	thumbnailer->cache_dir = g_build_filename (save_dir, THUMBNAIL_DIRNAME, NULL);
+	g_mutex_init (&thumbnailer->mutex);
+	thumbnailer->queued = g_hash_table_new (g_direct_hash, g_direct_equal);
+	/* one exclusive thread, so the priority set on it sticks */
+	thumbnailer->pool = g_thread_pool_new ((GFunc) _thumbs_job_func, thumbnailer, 1, TRUE, NULL);
+	GST_INFO ("thumbnail cache in '%s'", thumbnailer->cache_dir);
+	return thumbnailer;
+}
+
+/* skips queued but not started jobs, they're redone on demand by lookup */
+void photo_booth_thumbnailer_free (PhotoBoothThumbnailer *thumbnailer)
+{
+	thumbnailer->quit = TRUE;
+	g_thread_pool_free (thumbnailer->pool, FALSE, TRUE);
+	g_hash_table_destroy (thumbnailer->queued);
+	g_mutex_clear (&thumbnailer->mutex);
+	g_free (thumbnailer->cache_dir);
+	g_free (thumbnailer);
+}
+
+void photo_booth_thumbnailer_queue (PhotoBoothThumbnailer *thumbnailer, guint number, const gchar *filename)
+{
+	PhotoBoothThumbsJob *job;
+
+	g_mutex_lock (&thumbnailer->mutex);
+	if (g_hash_table_contains (thumbnailer->queued, GUINT_TO_POINTER (number)))
+	{
+		g_mutex_unlock (&thumbnailer->mutex);
+		return;
+	}
+	g_hash_table_add (thumbnailer->queued, GUINT_TO_POINTER (number));
+	g_mutex_unlock (&thumbnailer->mutex);
+
+	job = g_slice_new0 (PhotoBoothThumbsJob);
+	job->number = number;
+	job->filename = g_strdup (filename);
+	g_thread_pool_push (thumbnailer->pool, job, NULL);
+	GST_DEBUG ("queued thumbnails for photo %u '%s', %u jobs waiting", number, filename, g_thread_pool_unprocessed (thumbnailer->pool));
+}
+
+/* returns the cached thumbnail's path, or NULL after queueing its
+ * generation if it doesn't exist (yet). size is one of THUMBNAIL_SIZE_* */
+gchar *photo_booth_thumbnailer_lookup (PhotoBoothThumbnailer *thumbnailer, guint number, const gchar *filename, gint size)
+{
+	GStatBuf st;
+	gchar *path;
+
+	if (g_stat (filename, &st) < 0)
+		return NULL;
+	path = _thumbs_path (thumbnailer, number, st.st_mtime, size);
+	if (g_file_test (path, G_FILE_TEST_EXISTS))
+		return path;
+	g_free (path);
+	photo_booth_thumbnailer_queue (thumbnailer, number, filename);
+	return NULL;
+}
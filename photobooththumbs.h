@@ -0,0 +1,37 @@
+/*
+ * GStreamer photobooththumbs.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_THUMBS_H__
+#define __PHOTO_BOOTH_THUMBS_H__
+
+#include <glib.h>
+
+#define THUMBNAIL_DIRNAME      ".thumbnails"
+#define THUMBNAIL_SIZE_SMALL   160  /* longest edge in pixels */
+#define THUMBNAIL_SIZE_MEDIUM  320
+#define THUMBNAIL_SIZE_LARGE   640
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothThumbnailer PhotoBoothThumbnailer;
+
+PhotoBoothThumbnailer  *photo_booth_thumbnailer_new     (const gchar *save_dir);
+void                    photo_booth_thumbnailer_free    (PhotoBoothThumbnailer *thumbnailer);
+void                    photo_booth_thumbnailer_queue   (PhotoBoothThumbnailer *thumbnailer, guint number, const gchar *filename);
+gchar                  *photo_booth_thumbnailer_lookup  (PhotoBoothThumbnailer *thumbnailer, guint number, const gchar *filename, gint size);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_THUMBS_H__ */
@@ -0,0 +1,249 @@
+/*
+ * photoboothtrace.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <gst/gst.h>
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_trace_debug);
+#define GST_CAT_DEFAULT photo_booth_trace_debug
+
+#define TRACE_DEFAULT_SPANS   4096
+#define TRACE_MAX_RETIRED     16
+#define TRACE_ERROR_INTERVAL  (60 * G_USEC_PER_SEC)
+#define TRACE_CALIBRATE_SPANS 10000
+
+/* every thread that records a span gets its own ring, so recording takes
+ * no lock: the slot is filled and only then head is advanced with release
+ * semantics. the dumper copies a ring and drops whatever the owner may
+ * have overwritten meanwhile by reading head again afterwards.
+ *
+ * rings are only registered and unregistered under the lock. a ring of
+ * an exited thread is kept for the next dump, up to TRACE_MAX_RETIRED */
+typedef struct
+{
+	const gchar *name;
+	guint64      start, duration;                  /* in ns */
+	guint        number;
+} TraceSpan;
+
+typedef struct
+{
+	TraceSpan   *spans;
+	guint        head;                             /* spans ever recorded */
+	pid_t        tid;
+	gchar        thread_name[17];
+	gboolean     retired;
+} TraceRing;
+
+gboolean photo_booth_trace_enabled = FALSE;
+
+static guint    trace_spans_per_thread = TRACE_DEFAULT_SPANS;
+static gchar   *trace_dump_dir = NULL;
+static GMutex   trace_mutex;
+static GList   *trace_rings = NULL;
+static gint64   trace_last_error_dump = 0;
+
+static void _trace_ring_retire (TraceRing *ring);
+static GPrivate trace_ring_key = G_PRIVATE_INIT ((GDestroyNotify) _trace_ring_retire);
+
+static void _trace_ring_free (TraceRing *ring)
+{
+	g_free (ring->spans);
+	g_free (ring);
+}
+
+static void _trace_ring_retire (TraceRing *ring)
+{
+	GList *l, *oldest = NULL;
+	guint retired = 0;
+
+	g_mutex_lock (&trace_mutex);
+	ring->retired = TRUE;
+	for (l = trace_rings; l; l = l->next)
+	{
+		if (!((TraceRing *) l->data)->retired)
+			continue;
+		if (!oldest)
+			oldest = l;
+		retired++;
+	}
+	if (retired > TRACE_MAX_RETIRED)
+	{
+		_trace_ring_free (oldest->data);
+		trace_rings = g_list_delete_link (trace_rings, oldest);
+	}
+	g_mutex_unlock (&trace_mutex);
+}
+
+static TraceRing *_trace_ring_new (void)
+{
+	TraceRing *ring = g_new0 (TraceRing, 1);
+
+	ring->spans = g_new0 (TraceSpan, trace_spans_per_thread);
+	ring->tid = syscall (SYS_gettid);
+	prctl (PR_GET_NAME, ring->thread_name, 0, 0, 0);
+	g_mutex_lock (&trace_mutex);
+	trace_rings = g_list_append (trace_rings, ring);
+	g_mutex_unlock (&trace_mutex);
+	g_private_set (&trace_ring_key, ring);
+	return ring;
+}
+
+guint64 photo_booth_trace_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+void photo_booth_trace_span (const gchar *name, guint64 start, guint number)
+{
+	TraceRing *ring = g_private_get (&trace_ring_key);
+	TraceSpan *span;
+	guint head;
+
+	if (G_UNLIKELY (!ring))
+		ring = _trace_ring_new ();
+	head = ring->head;
+	span = &ring->spans[head % trace_spans_per_thread];
+	span->name = name;
+	span->start = start;
+	span->duration = photo_booth_trace_now () - start;
+	span->number = number;
+	__atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void photo_booth_trace_init (gboolean enabled, guint spans_per_thread, const gchar *dump_dir)
+{
+	static volatile gsize debug_initialized = 0;
+	TraceRing *ring;
+	guint64 t0;
+	guint i;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_trace_debug, "photoboothtrace", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_BLUE, "PhotoBoothTrace");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	g_free (trace_dump_dir);
+	trace_dump_dir = g_strdup (dump_dir && *dump_dir ? dump_dir : g_get_tmp_dir ());
+	if (!enabled || photo_booth_trace_enabled)
+		return;
+	if (spans_per_thread)
+		trace_spans_per_thread = spans_per_thread;
+
+	/* measure what a span costs on this machine, then forget the samples */
+	t0 = photo_booth_trace_now ();
+	for (i = 0; i < TRACE_CALIBRATE_SPANS; i++)
+		photo_booth_trace_span ("calibrate", photo_booth_trace_now (), 0);
+	t0 = photo_booth_trace_now () - t0;
+	ring = g_private_get (&trace_ring_key);
+	__atomic_store_n (&ring->head, 0, __ATOMIC_RELEASE);
+
+	photo_booth_trace_enabled = TRUE;
+	GST_INFO ("tracing %u spans per thread into %s, %.0f ns per span", trace_spans_per_thread, trace_dump_dir, (gdouble) t0 / TRACE_CALIBRATE_SPANS);
+}
+
+static void _trace_dump_ring (TraceRing *ring, GString *json)
+{
+	TraceSpan *copy;
+	guint head, first, i, n = trace_spans_per_thread;
+	gchar comm[64], *path, *contents = NULL;
+
+	head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+	if (!head)
+		return;
+	copy = g_new (TraceSpan, n);
+	memcpy (copy, ring->spans, n * sizeof (TraceSpan));
+	/* anything the owner got to since, up to one slot ahead, is torn */
+	first = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+	first = first + 1 > n ? first + 1 - n : 0;
+
+	g_strlcpy (comm, ring->thread_name, sizeof (comm));
+	path = g_strdup_printf ("/proc/self/task/%d/comm", ring->tid);
+	if (!ring->retired && g_file_get_contents (path, &contents, NULL, NULL))
+		g_strlcpy (comm, g_strstrip (contents), sizeof (comm));
+	g_free (contents);
+	g_free (path);
+	g_string_append_printf (json, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", getpid (), ring->tid, comm);
+
+	for (i = MAX (first, head > n ? head - n : 0); i < head; i++)
+	{
+		TraceSpan *span = &copy[i % n];
+		g_string_append_printf (json, "{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"photobooth\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"number\":%u}},\n",
+			span->name, getpid (), ring->tid, (gdouble) span->start / 1000, (gdouble) span->duration / 1000, span->number);
+	}
+	g_free (copy);
+}
+
+/* writes everything recorded so far as a chrome trace, which both
+ * chrome://tracing and ui.perfetto.dev open. dumps on errors are limited
+ * to one per TRACE_ERROR_INTERVAL. returns the file name written */
+gchar *photo_booth_trace_dump (const gchar *reason, gboolean on_error)
+{
+	GString *json;
+	GError *error = NULL;
+	GDateTime *now;
+	gchar *filename, *stamp;
+	GList *l;
+
+	if (!photo_booth_trace_enabled)
+		return NULL;
+
+	g_mutex_lock (&trace_mutex);
+	if (on_error)
+	{
+		gint64 t = g_get_monotonic_time ();
+		if (trace_last_error_dump && t - trace_last_error_dump < TRACE_ERROR_INTERVAL)
+		{
+			g_mutex_unlock (&trace_mutex);
+			GST_DEBUG ("not dumping trace on %s, last one was %" G_GINT64_FORMAT " s ago", reason, (t - trace_last_error_dump) / G_USEC_PER_SEC);
+			return NULL;
+		}
+		trace_last_error_dump = t;
+	}
+	json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (l = trace_rings; l; l = l->next)
+		_trace_dump_ring (l->data, json);
+	g_mutex_unlock (&trace_mutex);
+
+	if (json->str[json->len - 2] == ',')
+		g_string_truncate (json, json->len - 2);
+	g_string_append (json, "\n]}\n");
+
+	now = g_date_time_new_now_local ();
+	stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+	filename = g_strdup_printf ("%s/trace-%s-%s.json", trace_dump_dir, stamp, reason);
+	if (g_file_set_contents (filename, json->str, json->len, &error))
+		GST_INFO ("wrote trace on %s to %s", reason, filename);
+	else
+	{
+		GST_WARNING ("can't write trace to %s: %s", filename, error->message);
+		g_error_free (error);
+		g_free (filename);
+		filename = NULL;
+	}
+	g_date_time_unref (now);
+	g_free (stamp);
+	g_string_free (json, TRUE);
+	return filename;
+}
@@ -0,0 +1,40 @@
+/*
+ * GStreamer photoboothtrace.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_TRACE_H__
+#define __PHOTO_BOOTH_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+extern gboolean photo_booth_trace_enabled;
+
+/* a span starts with BEGIN, which is 0 while tracing is disabled, and is
+ * recorded by END on whichever thread it ends. name must be a static
+ * string, number is the photo it belongs to or 0 */
+#define PHOTO_BOOTH_TRACE_BEGIN() \
+	(G_UNLIKELY (photo_booth_trace_enabled) ? photo_booth_trace_now () : 0)
+#define PHOTO_BOOTH_TRACE_END(start, name, number) \
+	G_STMT_START { if (G_UNLIKELY (start)) photo_booth_trace_span (name, start, number); } G_STMT_END
+
+guint64          photo_booth_trace_now           (void);
+void             photo_booth_trace_span          (const gchar *name, guint64 start, guint number);
+void             photo_booth_trace_init          (gboolean enabled, guint spans_per_thread, const gchar *dump_dir);
+gchar           *photo_booth_trace_dump          (const gchar *reason, gboolean on_error);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_TRACE_H__ */
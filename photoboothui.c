@@ -0,0 +1,181 @@
+/*
+ * photoboothui.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include "photobooth.h"
+#include "photoboothui.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_ui_debug);
+#define GST_CAT_DEFAULT photo_booth_ui_debug
+
+/* any thread may post the state it wants a widget in, one slot per
+ * widget. posts from other threads only keep the latest value per slot
+ * and are applied together on the next frame clock tick of widget, so a
+ * burst of them costs one wakeup and one relayout. a post on the main
+ * thread is applied right away and supersedes anything still pending for
+ * its slot, so updates of a slot are applied in the order they were made */
+struct _PhotoBoothUi
+{
+	GMutex     mutex;
+	guint      n_slots;
+	gchar    **text;
+	gint      *value;
+	guint32    dirty;
+	gboolean   scheduled;          /* until the next flush */
+	guint      idle_id, tick_id;
+	GtkWidget *widget;
+	PhotoBoothUiApplyFunc apply_func;
+	gpointer   apply_data;
+	guint      posted, applied, flushes;
+};
+
+static void _ui_flush (PhotoBoothUi *ui)
+{
+	gchar *text[UI_MAX_SLOTS];
+	gint value[UI_MAX_SLOTS];
+	guint32 dirty;
+	guint slot;
+
+	g_mutex_lock (&ui->mutex);
+	dirty = ui->dirty;
+	for (slot = 0; slot < ui->n_slots; slot++)
+	{
+		text[slot] = NULL;
+		if (!(dirty & (1u << slot)))
+			continue;
+		text[slot] = ui->text[slot];
+		ui->text[slot] = NULL;
+		value[slot] = ui->value[slot];
+	}
+	ui->dirty = 0;
+	ui->scheduled = FALSE;
+	ui->flushes++;
+	g_mutex_unlock (&ui->mutex);
+
+	for (slot = 0; slot < ui->n_slots; slot++)
+	{
+		if (!(dirty & (1u << slot)))
+			continue;
+		ui->apply_func (slot, text[slot], value[slot], ui->apply_data);
+		ui->applied++;
+		g_free (text[slot]);
+	}
+}
+
+static gboolean _ui_tick (GtkWidget *widget, GdkFrameClock *frame_clock, PhotoBoothUi *ui)
+{
+	ui->tick_id = 0;
+	_ui_flush (ui);
+	return G_SOURCE_REMOVE;
+}
+
+/* an unmapped widget has no frame clock ticking */
+static gboolean _ui_schedule_tick (PhotoBoothUi *ui)
+{
+	g_mutex_lock (&ui->mutex);
+	ui->idle_id = 0;
+	g_mutex_unlock (&ui->mutex);
+	if (ui->tick_id)
+		return FALSE;
+	if (gtk_widget_get_mapped (ui->widget))
+		ui->tick_id = gtk_widget_add_tick_callback (ui->widget, (GtkTickCallback) _ui_tick, ui, NULL);
+	else
+		_ui_flush (ui);
+	return FALSE;
+}
+
+static void _ui_post (PhotoBoothUi *ui, guint slot, const gchar *text, gint value)
+{
+	g_return_if_fail (slot < ui->n_slots);
+
+	if (g_main_context_is_owner (g_main_context_default ()))
+	{
+		g_mutex_lock (&ui->mutex);
+		ui->dirty &= ~(1u << slot);
+		g_free (ui->text[slot]);
+		ui->text[slot] = NULL;
+		ui->posted++;
+		g_mutex_unlock (&ui->mutex);
+		ui->apply_func (slot, text, value, ui->apply_data);
+		ui->applied++;
+		return;
+	}
+
+	g_mutex_lock (&ui->mutex);
+	g_free (ui->text[slot]);
+	ui->text[slot] = g_strdup (text);
+	ui->value[slot] = value;
+	ui->dirty |= 1u << slot;
+	ui->posted++;
+	if (!ui->scheduled)
+	{
+		ui->scheduled = TRUE;
+		ui->idle_id = g_idle_add_full (G_PRIORITY_DEFAULT, (GSourceFunc) _ui_schedule_tick, ui, NULL);
+	}
+	g_mutex_unlock (&ui->mutex);
+}
+
+PhotoBoothUi *photo_booth_ui_new (guint n_slots, GtkWidget *widget, PhotoBoothUiApplyFunc func, gpointer user_data)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothUi *ui;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_ui_debug, "photoboothui", GST_DEBUG_BOLD | GST_DEBUG_FG_BLACK | GST_DEBUG_BG_YELLOW, "PhotoBoothUi");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	g_return_val_if_fail (n_slots <= UI_MAX_SLOTS, NULL);
+	ui = g_new0 (PhotoBoothUi, 1);
+	g_mutex_init (&ui->mutex);
+	ui->n_slots = n_slots;
+	ui->text = g_new0 (gchar *, n_slots);
+	ui->value = g_new0 (gint, n_slots);
+	ui->widget = g_object_ref (widget);
+	ui->apply_func = func;
+	ui->apply_data = user_data;
+	return ui;
+}
+
+/* main thread only, once no other thread posts anymore */
+void photo_booth_ui_free (PhotoBoothUi *ui)
+{
+	guint slot;
+
+	GST_INFO ("applied %u of %u posted ui updates in %u flushes", ui->applied, ui->posted, ui->flushes);
+	if (ui->idle_id)
+		g_source_remove (ui->idle_id);
+	if (ui->tick_id)
+		gtk_widget_remove_tick_callback (ui->widget, ui->tick_id);
+	for (slot = 0; slot < ui->n_slots; slot++)
+		g_free (ui->text[slot]);
+	g_free (ui->text);
+	g_free (ui->value);
+	g_object_unref (ui->widget);
+	g_mutex_clear (&ui->mutex);
+	g_free (ui);
+}
+
+/* thread safe */
+void photo_booth_ui_post_text (PhotoBoothUi *ui, guint slot, const gchar *text)
+{
+	_ui_post (ui, slot, text, 0);
+}
+
+/* thread safe */
+void photo_booth_ui_post_value (PhotoBoothUi *ui, guint slot, gint value)
+{
+	_ui_post (ui, slot, NULL, value);
+}
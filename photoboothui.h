@@ -0,0 +1,37 @@
+/*
+ * GStreamer photoboothui.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_UI_H__
+#define __PHOTO_BOOTH_UI_H__
+
+#include <gtk/gtk.h>
+
+#define UI_MAX_SLOTS   32
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothUi PhotoBoothUi;
+
+/* called on the main thread with the latest text or value posted to slot */
+typedef void (*PhotoBoothUiApplyFunc) (guint slot, const gchar *text, gint value, gpointer user_data);
+
+PhotoBoothUi    *photo_booth_ui_new              (guint n_slots, GtkWidget *widget, PhotoBoothUiApplyFunc func, gpointer user_data);
+void             photo_booth_ui_free             (PhotoBoothUi *ui);
+void             photo_booth_ui_post_text        (PhotoBoothUi *ui, guint slot, const gchar *text);
+void             photo_booth_ui_post_value       (PhotoBoothUi *ui, guint slot, gint value);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_UI_H__ */
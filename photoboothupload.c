@@ -0,0 +1,586 @@
+/*
+ * photoboothupload.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "photobooth.h"
+#include "photoboothupload.h"
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_upload_debug);
+#define GST_CAT_DEFAULT photo_booth_upload_debug
+
+#define UPLOAD_JOB_GROUP          "job"
+#define UPLOAD_JOB_SUFFIX         ".job"
+#define UPLOAD_JOB_TEMP_SUFFIX    UPLOAD_JOB_SUFFIX "."
+#define UPLOAD_JOB_TEMP_RANDOM    6      /* g_file_set_contents' XXXXXX */
+#define DEFAULT_BACKOFF_BASE      10
+#define DEFAULT_BACKOFF_MAX       600
+#define DEFAULT_MAX_ACTIVE        2
+#define UPLOAD_CONNECT_TIMEOUT    20
+#define UPLOAD_LOW_SPEED_TIME     60
+#define UPLOAD_IDLE_POLL          60000  /* ms, the queue is woken up for anything new */
+
+typedef struct
+{
+	gchar     *path;            /* of the job file */
+	gchar     *target;          /* the backend it goes to */
+	gchar     *filename;        /* of the photo */
+	guint      number;
+	guint      attempts;
+	gint64     created;         /* wall clock, in us */
+	gint64     next_attempt;
+	GBytes    *photo;           /* only until the first attempt, not persisted */
+	gboolean   active;
+	CURL      *curl;
+	gpointer   request;
+	gint64     start_time;
+	guint64    trace_start;
+} PhotoBoothUploadJob;
+
+/* keeps every upload as a small key file in queue_dir until it succeeded
+ * or failed permanently, so nothing is lost over a crash or restart. one
+ * worker thread runs up to max_active due jobs at once on a single curl
+ * multi handle, whose connection cache keeps connections alive and TLS
+ * sessions resumable between uploads, and which multiplexes them over one
+ * HTTP/2 connection where the server allows it. a transient failure
+ * reschedules a job with an exponential backoff with jitter. when the
+ * network comes back all waiting jobs are made due at once. */
+struct _PhotoBoothUploadQueue
+{
+	gchar     *queue_dir;
+	GThread   *thread;
+	GMutex     mutex;
+	CURLM     *multi;
+	GQueue     idle_handles;
+	GList     *jobs;
+	guint      backoff_base, backoff_max, max_attempts, max_active;
+	gboolean   quit;
+	guint64    seq;
+	GNetworkMonitor *monitor;
+	gulong     network_changed_id;
+	gboolean   network_available;
+	PhotoBoothUploadQueueStats stats;
+	PhotoBoothUploadPrepareFunc prepare_func;
+	PhotoBoothUploadFinishFunc finish_func;
+	gpointer   upload_data;
+	PhotoBoothUploadAttemptedFunc attempted_func;
+	gpointer   attempted_data;
+};
+
+static void _upload_job_free (PhotoBoothUploadJob *job)
+{
+	g_free (job->path);
+	g_free (job->target);
+	g_free (job->filename);
+	if (job->photo)
+		g_bytes_unref (job->photo);
+	g_slice_free (PhotoBoothUploadJob, job);
+}
+
+static gint _upload_job_compare (PhotoBoothUploadJob *a, PhotoBoothUploadJob *b)
+{
+	if (a->next_attempt != b->next_attempt)
+		return a->next_attempt < b->next_attempt ? -1 : 1;
+	return a->created < b->created ? -1 : (a->created > b->created);
+}
+
+static gboolean _upload_job_save (PhotoBoothUploadJob *job)
+{
+	GKeyFile *gkf = g_key_file_new ();
+	GError *error = NULL;
+	gboolean ret;
+
+	g_key_file_set_string (gkf, UPLOAD_JOB_GROUP, "target", job->target);
+	g_key_file_set_string (gkf, UPLOAD_JOB_GROUP, "filename", job->filename);
+	g_key_file_set_uint64 (gkf, UPLOAD_JOB_GROUP, "number", job->number);
+	g_key_file_set_uint64 (gkf, UPLOAD_JOB_GROUP, "attempts", job->attempts);
+	g_key_file_set_int64 (gkf, UPLOAD_JOB_GROUP, "created", job->created);
+	g_key_file_set_int64 (gkf, UPLOAD_JOB_GROUP, "next_attempt", job->next_attempt);
+	/* writes a temp file and renames it over the old one */
+	ret = g_key_file_save_to_file (gkf, job->path, &error);
+	if (!ret)
+	{
+		GST_ERROR ("can't save upload job '%s': %s", job->path, error->message);
+		g_error_free (error);
+	}
+	g_key_file_free (gkf);
+	return ret;
+}
+
+static PhotoBoothUploadJob *_upload_job_load (const gchar *path)
+{
+	GKeyFile *gkf = g_key_file_new ();
+	GError *error = NULL;
+	PhotoBoothUploadJob *job = NULL;
+	gchar *filename;
+
+	if (!g_key_file_load_from_file (gkf, path, G_KEY_FILE_NONE, &error) ||
+	    !(filename = g_key_file_get_string (gkf, UPLOAD_JOB_GROUP, "filename", &error)))
+	{
+		GST_WARNING ("dropping unreadable upload job '%s': %s", path, error->message);
+		g_error_free (error);
+		g_unlink (path);
+	}
+	else
+	{
+		job = g_slice_new0 (PhotoBoothUploadJob);
+		job->path = g_strdup (path);
+		job->filename = filename;
+		/* jobs from before there were several backends have none */
+		job->target = g_key_file_get_string (gkf, UPLOAD_JOB_GROUP, "target", NULL);
+		if (!job->target)
+			job->target = g_strdup ("");
+		job->number = g_key_file_get_uint64 (gkf, UPLOAD_JOB_GROUP, "number", NULL);
+		job->attempts = g_key_file_get_uint64 (gkf, UPLOAD_JOB_GROUP, "attempts", NULL);
+		job->created = g_key_file_get_int64 (gkf, UPLOAD_JOB_GROUP, "created", NULL);
+		/* whatever backoff was pending, a restart is a good moment to retry */
+		job->next_attempt = g_get_real_time ();
+	}
+	g_key_file_free (gkf);
+	return job;
+}
+
+/* the temp file g_key_file_save_to_file leaves behind when it's
+ * interrupted, "<job file>.XXXXXX" */
+static gboolean _upload_is_job_temp (const gchar *name)
+{
+	const gchar *suffix = g_strrstr (name, UPLOAD_JOB_TEMP_SUFFIX);
+	return suffix && strlen (suffix) == strlen (UPLOAD_JOB_TEMP_SUFFIX) + UPLOAD_JOB_TEMP_RANDOM;
+}
+
+static void _upload_queue_restore (PhotoBoothUploadQueue *queue)
+{
+	GDir *dir;
+	const gchar *name;
+	GError *error = NULL;
+
+	dir = g_dir_open (queue->queue_dir, 0, &error);
+	if (!dir)
+	{
+		GST_WARNING ("can't open upload queue directory: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+	while ((name = g_dir_read_name (dir)))
+	{
+		gchar *path = g_build_filename (queue->queue_dir, name, NULL);
+		if (g_str_has_suffix (name, UPLOAD_JOB_SUFFIX))
+		{
+			PhotoBoothUploadJob *job = _upload_job_load (path);
+			if (job)
+			{
+				queue->jobs = g_list_prepend (queue->jobs, job);
+				queue->stats.depth++;
+			}
+		}
+		else if (_upload_is_job_temp (name))
+		{
+			GST_DEBUG ("removing '%s' left over by an interrupted save", name);
+			g_unlink (path);
+		}
+		g_free (path);
+	}
+	g_dir_close (dir);
+	queue->jobs = g_list_sort (queue->jobs, (GCompareFunc) _upload_job_compare);
+	queue->stats.max_depth = queue->stats.depth;
+	if (queue->stats.depth)
+		GST_INFO ("restored %u pending uploads from '%s'", queue->stats.depth, queue->queue_dir);
+}
+
+static gint64 _upload_queue_backoff (PhotoBoothUploadQueue *queue, guint attempts)
+{
+	gdouble delay = queue->backoff_base;
+	guint i;
+
+	for (i = 1; i < attempts && delay < queue->backoff_max; i++)
+		delay *= 2;
+	delay = MIN (delay, queue->backoff_max);
+	/* half fixed, half random, so a booth full of failed uploads doesn't
+	 * hammer the server in lockstep once it's back */
+	return (delay / 2 + g_random_double_range (0, delay / 2)) * G_USEC_PER_SEC;
+}
+
+/* called with the lock held */
+static void _upload_queue_update_age (PhotoBoothUploadQueue *queue)
+{
+	GList *l;
+	gint64 oldest = 0;
+
+	for (l = queue->jobs; l; l = l->next)
+	{
+		PhotoBoothUploadJob *job = l->data;
+		if (!oldest || job->created < oldest)
+			oldest = job->created;
+	}
+	queue->stats.oldest_age = oldest ? (g_get_real_time () - oldest) / G_USEC_PER_SEC : 0;
+}
+
+/* reschedules or removes a finished job, called without the lock */
+static void _upload_queue_complete (PhotoBoothUploadQueue *queue, PhotoBoothUploadJob *job, PhotoBoothUploadResult result)
+{
+	gint64 latency = g_get_monotonic_time () - job->start_time;
+	guint attempts;
+
+	g_mutex_lock (&queue->mutex);
+	job->active = FALSE;
+	queue->stats.active--;
+	queue->stats.last_latency = latency;
+	queue->stats.max_latency = MAX (queue->stats.max_latency, latency);
+	if (result == UPLOAD_RESULT_RETRY && queue->max_attempts && job->attempts >= queue->max_attempts)
+	{
+		GST_WARNING ("giving up on photo %u to %s after %u attempts", job->number, job->target, job->attempts);
+		result = UPLOAD_RESULT_FAILED;
+	}
+	queue->jobs = g_list_remove (queue->jobs, job);
+	if (result == UPLOAD_RESULT_RETRY)
+	{
+		/* retries read the saved file, so a long offline spell doesn't
+		 * pile up photos in memory */
+		g_clear_pointer (&job->photo, g_bytes_unref);
+		queue->stats.retries++;
+		job->next_attempt = g_get_real_time () + _upload_queue_backoff (queue, job->attempts);
+		_upload_job_save (job);
+		queue->jobs = g_list_insert_sorted (queue->jobs, job, (GCompareFunc) _upload_job_compare);
+		GST_INFO ("upload of photo %u to %s failed, retrying in %" G_GINT64_FORMAT " s", job->number, job->target, (job->next_attempt - g_get_real_time ()) / G_USEC_PER_SEC);
+	}
+	else
+	{
+		if (result == UPLOAD_RESULT_OK)
+			queue->stats.uploaded++;
+		else
+			queue->stats.failed++;
+		queue->stats.depth--;
+		g_unlink (job->path);
+	}
+	_upload_queue_update_age (queue);
+	GST_INFO ("photo %u %s %s in %" G_GINT64_FORMAT " ms. queue depth %u (max %u), oldest %" G_GINT64_FORMAT " s, %u active, %u uploaded, %u failed, %u retries",
+		job->number, result == UPLOAD_RESULT_OK ? "uploaded to" : "not uploaded to", job->target, latency / 1000, queue->stats.depth, queue->stats.max_depth,
+		queue->stats.oldest_age, queue->stats.active, queue->stats.uploaded, queue->stats.failed, queue->stats.retries);
+	attempts = job->attempts;
+	g_mutex_unlock (&queue->mutex);
+
+	if (queue->attempted_func)
+		queue->attempted_func (job->target, job->number, result, attempts, queue->attempted_data);
+	if (result != UPLOAD_RESULT_RETRY)
+		_upload_job_free (job);
+}
+
+static void _upload_queue_start (PhotoBoothUploadQueue *queue, PhotoBoothUploadJob *job)
+{
+	CURL *curl = g_queue_pop_head (&queue->idle_handles);
+
+	if (!curl)
+		curl = curl_easy_init ();
+	GST_DEBUG ("uploading photo %u '%s' to %s, attempt %u", job->number, job->filename, job->target, job->attempts);
+	job->start_time = g_get_monotonic_time ();
+	job->trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+	curl_easy_setopt (curl, CURLOPT_PRIVATE, job);
+	curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+	/* h2 over TLS if the server offers it, and wait for an existing
+	 * connection to multiplex on rather than opening another one */
+	curl_easy_setopt (curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt (curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt (curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	/* a stalled connection on venue wifi must end in a retry, not hang the queue */
+	curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, (long) UPLOAD_CONNECT_TIMEOUT);
+	curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, (long) UPLOAD_LOW_SPEED_TIME);
+	job->request = queue->prepare_func (curl, job->target, job->filename, job->number, job->photo, queue->upload_data);
+	g_mutex_lock (&queue->mutex);
+	if (job->photo)
+		queue->stats.from_memory++;
+	else
+		queue->stats.from_file++;
+	g_mutex_unlock (&queue->mutex);
+	if (!job->request)
+	{
+		curl_easy_reset (curl);
+		g_queue_push_head (&queue->idle_handles, curl);
+		PHOTO_BOOTH_TRACE_END (job->trace_start, "upload", job->number);
+		_upload_queue_complete (queue, job, UPLOAD_RESULT_FAILED);
+		return;
+	}
+	job->curl = curl;
+	curl_multi_add_handle (queue->multi, curl);
+}
+
+static void _upload_queue_log_timing (PhotoBoothUploadJob *job)
+{
+	curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+	long http_version = 0, connects = 0;
+
+	curl_easy_getinfo (job->curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+	curl_easy_getinfo (job->curl, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo (job->curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+	curl_easy_getinfo (job->curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+	curl_easy_getinfo (job->curl, CURLINFO_TOTAL_TIME_T, &total);
+	curl_easy_getinfo (job->curl, CURLINFO_HTTP_VERSION, &http_version);
+	curl_easy_getinfo (job->curl, CURLINFO_NUM_CONNECTS, &connects);
+	GST_INFO ("photo %u to %s timing: dns %ld connect %ld tls %ld first byte %ld total %ld ms, %s, %s connection",
+		job->number, job->target, (long) dns / 1000, (long) connect / 1000, (long) tls / 1000, (long) ttfb / 1000, (long) total / 1000,
+		http_version == CURL_HTTP_VERSION_2_0 ? "HTTP/2" : "HTTP/1.x", connects ? "new" : "reused");
+}
+
+static void _upload_queue_done (PhotoBoothUploadQueue *queue, CURL *curl, CURLcode res)
+{
+	PhotoBoothUploadJob *job = NULL;
+	PhotoBoothUploadResult result;
+	long connects = 0;
+
+	curl_easy_getinfo (curl, CURLINFO_PRIVATE, (char **) &job);
+	curl_multi_remove_handle (queue->multi, curl);
+	_upload_queue_log_timing (job);
+	curl_easy_getinfo (curl, CURLINFO_NUM_CONNECTS, &connects);
+	result = queue->finish_func (curl, job->target, job->number, res, job->request, queue->upload_data);
+	PHOTO_BOOTH_TRACE_END (job->trace_start, "upload", job->number);
+	job->request = NULL;
+	job->curl = NULL;
+	curl_easy_reset (curl);
+	g_queue_push_head (&queue->idle_handles, curl);
+
+	g_mutex_lock (&queue->mutex);
+	if (connects)
+		queue->stats.connections += connects;
+	else
+		queue->stats.reused++;
+	g_mutex_unlock (&queue->mutex);
+	_upload_queue_complete (queue, job, result);
+}
+
+static gpointer _upload_queue_thread_func (PhotoBoothUploadQueue *queue)
+{
+	CURLMsg *msg;
+	GList *l, *starting;
+	gint running, left;
+
+	g_mutex_lock (&queue->mutex);
+	while (!queue->quit)
+	{
+		gint64 now = g_get_real_time ();
+		gint timeout = UPLOAD_IDLE_POLL;
+
+		/* jobs are only ever removed by this thread, so the picked ones
+		 * stay valid once the lock is dropped */
+		starting = NULL;
+		for (l = queue->jobs; l; l = l->next)
+		{
+			PhotoBoothUploadJob *job = l->data;
+			if (job->active)
+				continue;
+			if (job->next_attempt > now)
+			{
+				timeout = MIN (timeout, (job->next_attempt - now) / 1000 + 1);
+				break;
+			}
+			if (queue->stats.active >= queue->max_active)
+				break;
+			job->active = TRUE;
+			job->attempts++;
+			queue->stats.active++;
+			queue->stats.max_active = MAX (queue->stats.max_active, queue->stats.active);
+			starting = g_list_append (starting, job);
+		}
+		g_mutex_unlock (&queue->mutex);
+
+		for (l = starting; l; l = l->next)
+			_upload_queue_start (queue, l->data);
+		g_list_free (starting);
+
+		curl_multi_perform (queue->multi, &running);
+		while ((msg = curl_multi_info_read (queue->multi, &left)))
+		{
+			if (msg->msg == CURLMSG_DONE)
+				_upload_queue_done (queue, msg->easy_handle, msg->data.result);
+		}
+		/* also returns on curl's own timeouts and on curl_multi_wakeup */
+		curl_multi_poll (queue->multi, NULL, 0, timeout, NULL);
+		g_mutex_lock (&queue->mutex);
+	}
+
+	/* transfers in progress are abandoned, their jobs stay on disk */
+	for (l = queue->jobs; l; l = l->next)
+	{
+		PhotoBoothUploadJob *job = l->data;
+		if (!job->curl)
+			continue;
+		curl_multi_remove_handle (queue->multi, job->curl);
+		queue->finish_func (job->curl, job->target, job->number, CURLE_ABORTED_BY_CALLBACK, job->request, queue->upload_data);
+		curl_easy_cleanup (job->curl);
+		job->curl = NULL;
+		job->request = NULL;
+	}
+	g_mutex_unlock (&queue->mutex);
+	return NULL;
+}
+
+static void _upload_queue_network_changed (GNetworkMonitor *monitor, gboolean available, PhotoBoothUploadQueue *queue)
+{
+	GList *l;
+
+	g_mutex_lock (&queue->mutex);
+	if (available && !queue->network_available && queue->jobs)
+	{
+		gint64 now = g_get_real_time ();
+		GST_INFO ("network is back, draining %u pending uploads", queue->stats.depth);
+		for (l = queue->jobs; l; l = l->next)
+			((PhotoBoothUploadJob *) l->data)->next_attempt = now;
+		queue->jobs = g_list_sort (queue->jobs, (GCompareFunc) _upload_job_compare);
+		curl_multi_wakeup (queue->multi);
+	}
+	else if (available != queue->network_available)
+		GST_INFO ("network %s", available ? "available" : "lost");
+	queue->network_available = available;
+	g_mutex_unlock (&queue->mutex);
+}
+
+PhotoBoothUploadQueue *photo_booth_upload_queue_new (const gchar *queue_dir, PhotoBoothUploadPrepareFunc prepare_func, PhotoBoothUploadFinishFunc finish_func, gpointer user_data)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothUploadQueue *queue;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_upload_debug, "photoboothupload", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_CYAN, "PhotoBoothUpload");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	if (g_mkdir_with_parents (queue_dir, 0755) < 0)
+	{
+		GST_ERROR ("can't create upload queue directory '%s': %s", queue_dir, g_strerror (errno));
+		return NULL;
+	}
+
+	queue = g_new0 (PhotoBoothUploadQueue, 1);
+	queue->queue_dir = g_strdup (queue_dir);
+	g_mutex_init (&queue->mutex);
+	g_queue_init (&queue->idle_handles);
+	queue->backoff_base = DEFAULT_BACKOFF_BASE;
+	queue->backoff_max = DEFAULT_BACKOFF_MAX;
+	queue->prepare_func = prepare_func;
+	queue->finish_func = finish_func;
+	queue->upload_data = user_data;
+	queue->multi = curl_multi_init ();
+	curl_multi_setopt (queue->multi, CURLMOPT_PIPELINING, (long) CURLPIPE_MULTIPLEX);
+	photo_booth_upload_queue_set_concurrency (queue, DEFAULT_MAX_ACTIVE);
+	_upload_queue_restore (queue);
+
+	/* retries don't depend on it, some setups only ever reach a LAN
+	 * server without a default route. it only cuts the backoff short */
+	queue->monitor = g_network_monitor_get_default ();
+	queue->network_available = g_network_monitor_get_network_available (queue->monitor);
+	queue->network_changed_id = g_signal_connect (queue->monitor, "network-changed", G_CALLBACK (_upload_queue_network_changed), queue);
+	return queue;
+}
+
+void photo_booth_upload_queue_start (PhotoBoothUploadQueue *queue)
+{
+	if (!queue->thread)
+		queue->thread = g_thread_new ("upload-queue", (GThreadFunc) _upload_queue_thread_func, queue);
+}
+
+/* transfers in progress are aborted, everything still queued stays on
+ * disk for the next start */
+void photo_booth_upload_queue_free (PhotoBoothUploadQueue *queue)
+{
+	g_signal_handler_disconnect (queue->monitor, queue->network_changed_id);
+	g_mutex_lock (&queue->mutex);
+	queue->quit = TRUE;
+	curl_multi_wakeup (queue->multi);
+	g_mutex_unlock (&queue->mutex);
+	if (queue->thread)
+		g_thread_join (queue->thread);
+	if (queue->stats.depth)
+		GST_INFO ("%u uploads left pending in '%s'", queue->stats.depth, queue->queue_dir);
+	g_list_free_full (queue->jobs, (GDestroyNotify) _upload_job_free);
+	g_queue_free_full (&queue->idle_handles, (GDestroyNotify) curl_easy_cleanup);
+	curl_multi_cleanup (queue->multi);
+	g_mutex_clear (&queue->mutex);
+	g_free (queue->queue_dir);
+	g_free (queue);
+}
+
+void photo_booth_upload_queue_set_attempted_func (PhotoBoothUploadQueue *queue, PhotoBoothUploadAttemptedFunc func, gpointer user_data)
+{
+	g_mutex_lock (&queue->mutex);
+	queue->attempted_func = func;
+	queue->attempted_data = user_data;
+	g_mutex_unlock (&queue->mutex);
+}
+
+/* base and max in seconds, max_attempts 0 retries forever */
+void photo_booth_upload_queue_set_backoff (PhotoBoothUploadQueue *queue, guint base, guint max, guint max_attempts)
+{
+	g_mutex_lock (&queue->mutex);
+	queue->backoff_base = MAX (base, 1);
+	queue->backoff_max = MAX (max, queue->backoff_base);
+	queue->max_attempts = max_attempts;
+	g_mutex_unlock (&queue->mutex);
+}
+
+/* number of uploads run at once, more are only worth it with a slow
+ * per-request latency, the bandwidth is shared anyway */
+void photo_booth_upload_queue_set_concurrency (PhotoBoothUploadQueue *queue, guint max_active)
+{
+	g_mutex_lock (&queue->mutex);
+	queue->max_active = MAX (max_active, 1);
+	/* one connection is multiplexed over HTTP/2, more are needed for HTTP/1.1 */
+	curl_multi_setopt (queue->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) queue->max_active);
+	curl_multi_setopt (queue->multi, CURLMOPT_MAXCONNECTS, (long) queue->max_active * 2);
+	curl_multi_wakeup (queue->multi);
+	g_mutex_unlock (&queue->mutex);
+}
+
+/* queues the upload of a photo to one target, a photo going to several
+ * gets a job for each of them so they're retried independently. photo, if
+ * given, is uploaded instead of reading back filename on the first
+ * attempt. filename must still be written, it's used for retries and
+ * after a restart */
+void photo_booth_upload_queue_push (PhotoBoothUploadQueue *queue, const gchar *target, const gchar *filename, guint number, GBytes *photo)
+{
+	PhotoBoothUploadJob *job;
+	gchar *name;
+
+	job = g_slice_new0 (PhotoBoothUploadJob);
+	job->target = g_strdup (target);
+	job->filename = g_strdup (filename);
+	job->number = number;
+	job->photo = photo ? g_bytes_ref (photo) : NULL;
+	job->created = job->next_attempt = g_get_real_time ();
+
+	g_mutex_lock (&queue->mutex);
+	name = g_strdup_printf ("%" G_GINT64_FORMAT "-%" G_GUINT64_FORMAT "-%u-%s" UPLOAD_JOB_SUFFIX, job->created, queue->seq++, number, target);
+	job->path = g_build_filename (queue->queue_dir, name, NULL);
+	g_free (name);
+	/* still attempted if it can't be persisted, it's just not crash safe */
+	_upload_job_save (job);
+	queue->jobs = g_list_insert_sorted (queue->jobs, job, (GCompareFunc) _upload_job_compare);
+	queue->stats.enqueued++;
+	queue->stats.depth++;
+	queue->stats.max_depth = MAX (queue->stats.max_depth, queue->stats.depth);
+	GST_DEBUG ("queued upload of photo %u '%s' to %s, depth %u", number, filename, target, queue->stats.depth);
+	curl_multi_wakeup (queue->multi);
+	g_mutex_unlock (&queue->mutex);
+}
+
+void photo_booth_upload_queue_get_stats (PhotoBoothUploadQueue *queue, PhotoBoothUploadQueueStats *stats)
+{
+	g_mutex_lock (&queue->mutex);
+	_upload_queue_update_age (queue);
+	*stats = queue->stats;
+	g_mutex_unlock (&queue->mutex);
+}
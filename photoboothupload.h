@@ -0,0 +1,70 @@
+/*
+ * GStreamer photoboothupload.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_UPLOAD_H__
+#define __PHOTO_BOOTH_UPLOAD_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+
+#define UPLOAD_QUEUE_DIRNAME   ".upload-queue"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	UPLOAD_RESULT_OK,
+	UPLOAD_RESULT_RETRY,     /* transient, try again after a backoff */
+	UPLOAD_RESULT_FAILED     /* permanent, drop the job */
+} PhotoBoothUploadResult;
+
+typedef struct _PhotoBoothUploadQueue          PhotoBoothUploadQueue;
+typedef struct _PhotoBoothUploadQueueStats     PhotoBoothUploadQueueStats;
+
+/* all called on the queue's worker thread. the prepare func sets up the
+ * request to target on an easy handle (the queue owns it and has set the
+ * transport options) and returns its request data, or NULL if the photo
+ * can't be uploaded at all. photo is the encoded photo if it was pushed
+ * from memory and stays valid until the finish func returns, NULL means
+ * reading filename. the finish func classifies the transfer's outcome and
+ * frees the request data. the attempted func reports the outcome after the
+ * job has been rescheduled or removed (attempts counts this one) */
+typedef gpointer (*PhotoBoothUploadPrepareFunc) (CURL *curl, const gchar *target, const gchar *filename, guint number, GBytes *photo, gpointer user_data);
+typedef PhotoBoothUploadResult (*PhotoBoothUploadFinishFunc) (CURL *curl, const gchar *target, guint number, CURLcode res, gpointer request, gpointer user_data);
+typedef void (*PhotoBoothUploadAttemptedFunc) (const gchar *target, guint number, PhotoBoothUploadResult result, guint attempts, gpointer user_data);
+
+struct _PhotoBoothUploadQueueStats
+{
+	guint      depth, max_depth;
+	gint64     oldest_age;                     /* of the oldest queued job, in s */
+	guint      enqueued, uploaded, failed, retries;
+	gint64     last_latency, max_latency;      /* of a single attempt, in us */
+	guint      active, max_active;             /* concurrent transfers */
+	guint      connections, reused;            /* opened and reused by attempts */
+	guint      from_memory, from_file;         /* where attempts took the photo from */
+};
+
+PhotoBoothUploadQueue  *photo_booth_upload_queue_new            (const gchar *queue_dir, PhotoBoothUploadPrepareFunc prepare_func, PhotoBoothUploadFinishFunc finish_func, gpointer user_data);
+void                    photo_booth_upload_queue_free           (PhotoBoothUploadQueue *queue);
+void                    photo_booth_upload_queue_set_attempted_func (PhotoBoothUploadQueue *queue, PhotoBoothUploadAttemptedFunc func, gpointer user_data);
+void                    photo_booth_upload_queue_set_backoff    (PhotoBoothUploadQueue *queue, guint base, guint max, guint max_attempts);
+void                    photo_booth_upload_queue_set_concurrency (PhotoBoothUploadQueue *queue, guint max_active);
+void                    photo_booth_upload_queue_start          (PhotoBoothUploadQueue *queue);
+void                    photo_booth_upload_queue_push           (PhotoBoothUploadQueue *queue, const gchar *target, const gchar *filename, guint number, GBytes *photo);
+void                    photo_booth_upload_queue_get_stats      (PhotoBoothUploadQueue *queue, PhotoBoothUploadQueueStats *stats);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_UPLOAD_H__ */
@@ -0,0 +1,302 @@
+/*
+ * photoboothweb.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <jpeglib.h>
+#include <glib/gstdio.h>
+#include <gst/video/video.h>
+#include "photobooth.h"
+#include "photoboothweb.h"
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_web_debug);
+#define GST_CAT_DEFAULT photo_booth_web_debug
+
+typedef struct
+{
+	GstSample *sample;                /* NULL for a get_async request */
+	gchar     *filename;
+	guint      number;
+	gint64     push_time;
+	PhotoBoothWebReadyFunc ready_func;
+	gpointer   ready_data;
+} PhotoBoothWebJob;
+
+typedef struct
+{
+	GBytes    *jpeg;
+	gchar     *web_filename;
+	PhotoBoothWebReadyFunc func;
+	gpointer   user_data;
+} PhotoBoothWebReady;
+
+/* encodes the web variant of a photo on its own thread from the already
+ * composited and downscaled RGB frame, while the archival jpeg is encoded
+ * on the file branch. libjpeg is used directly since jpegenc can do
+ * neither progressive scans nor optimised huffman tables. no markers but
+ * JFIF are written, so the variant carries no metadata. only the latest
+ * photo's variant is kept, older ones only live on as files until all
+ * their uploads are settled. */
+struct _PhotoBoothWebEncoder
+{
+	gchar       *web_dir;
+	gint         quality;
+	gboolean     progressive;
+	GThreadPool *pool;
+	GMutex       mutex;
+	guint        number;
+	GBytes      *jpeg;
+	gchar       *web_filename;
+};
+
+typedef struct
+{
+	struct jpeg_error_mgr pub;
+	jmp_buf               setjmp_buffer;
+} PhotoBoothWebErrorMgr;
+
+static void _web_error_exit (j_common_ptr cinfo)
+{
+	PhotoBoothWebErrorMgr *err = (PhotoBoothWebErrorMgr *) cinfo->err;
+	gchar message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message) (cinfo, message);
+	GST_ERROR ("libjpeg: %s", message);
+	longjmp (err->setjmp_buffer, 1);
+}
+
+static GBytes *_web_encode (PhotoBoothWebEncoder *encoder, GstVideoFrame *frame)
+{
+	struct jpeg_compress_struct cinfo;
+	PhotoBoothWebErrorMgr jerr;
+	unsigned char *volatile out = NULL;
+	unsigned long out_size = 0;
+	guint8 *pixels = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+	gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0);
+
+	cinfo.err = jpeg_std_error (&jerr.pub);
+	jerr.pub.error_exit = _web_error_exit;
+	if (setjmp (jerr.setjmp_buffer))
+	{
+		jpeg_destroy_compress (&cinfo);
+		free (out);
+		return NULL;
+	}
+	jpeg_create_compress (&cinfo);
+	jpeg_mem_dest (&cinfo, (unsigned char **) &out, &out_size);
+	cinfo.image_width = GST_VIDEO_FRAME_WIDTH (frame);
+	cinfo.image_height = GST_VIDEO_FRAME_HEIGHT (frame);
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults (&cinfo);
+	jpeg_set_quality (&cinfo, encoder->quality, TRUE);
+	cinfo.optimize_coding = TRUE;
+	if (encoder->progressive)
+		jpeg_simple_progression (&cinfo);
+	jpeg_start_compress (&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height)
+	{
+		JSAMPROW row = pixels + cinfo.next_scanline * stride;
+		jpeg_write_scanlines (&cinfo, &row, 1);
+	}
+	jpeg_finish_compress (&cinfo);
+	jpeg_destroy_compress (&cinfo);
+	return g_bytes_new_with_free_func (out, out_size, free, out);
+}
+
+static gboolean _web_ready_dispatch (PhotoBoothWebReady *ready)
+{
+	ready->func (ready->jpeg, ready->web_filename, ready->user_data);
+	return G_SOURCE_REMOVE;
+}
+
+static void _web_ready_free (PhotoBoothWebReady *ready)
+{
+	if (ready->jpeg)
+		g_bytes_unref (ready->jpeg);
+	g_free (ready->web_filename);
+	g_slice_free (PhotoBoothWebReady, ready);
+}
+
+/* the pool runs its jobs one at a time in order, so by the time a
+ * request runs every encode pushed before it is done */
+static void _web_ready_job_func (PhotoBoothWebJob *job, PhotoBoothWebEncoder *encoder)
+{
+	PhotoBoothWebReady *ready = g_slice_new0 (PhotoBoothWebReady);
+
+	g_mutex_lock (&encoder->mutex);
+	if (encoder->number == job->number && encoder->jpeg)
+	{
+		ready->jpeg = g_bytes_ref (encoder->jpeg);
+		ready->web_filename = g_strdup (encoder->web_filename);
+	}
+	g_mutex_unlock (&encoder->mutex);
+	GST_DEBUG ("web variant of photo %u %s, requested %" G_GINT64_FORMAT " ms ago", job->number,
+		ready->jpeg ? "ready" : "missing", (g_get_monotonic_time () - job->push_time) / 1000);
+
+	ready->func = job->ready_func;
+	ready->user_data = job->ready_data;
+	g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, (GSourceFunc) _web_ready_dispatch, ready, (GDestroyNotify) _web_ready_free);
+	g_slice_free (PhotoBoothWebJob, job);
+}
+
+static void _web_job_func (PhotoBoothWebJob *job, PhotoBoothWebEncoder *encoder)
+{
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	GBytes *jpeg = NULL;
+	GError *error = NULL;
+	gchar *basename, *web_filename = NULL;
+	gint64 start_time = g_get_monotonic_time ();
+	guint64 trace_start;
+
+	if (!job->sample)
+	{
+		_web_ready_job_func (job, encoder);
+		return;
+	}
+
+	if (!gst_video_info_from_caps (&info, gst_sample_get_caps (job->sample)) || GST_VIDEO_INFO_FORMAT (&info) != GST_VIDEO_FORMAT_RGB)
+		GST_ERROR ("unexpected web variant caps %" GST_PTR_FORMAT, gst_sample_get_caps (job->sample));
+	else if (!gst_video_frame_map (&frame, &info, gst_sample_get_buffer (job->sample), GST_MAP_READ))
+		GST_ERROR ("can't map photo %u", job->number);
+	else
+	{
+		trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+		jpeg = _web_encode (encoder, &frame);
+		PHOTO_BOOTH_TRACE_END (trace_start, "encode-web", job->number);
+		gst_video_frame_unmap (&frame);
+	}
+
+	if (jpeg)
+	{
+		/* persisted for upload retries after the variant was replaced by
+		 * the next photo's or the booth restarted */
+		basename = g_path_get_basename (job->filename);
+		web_filename = g_build_filename (encoder->web_dir, basename, NULL);
+		g_free (basename);
+		if (g_mkdir_with_parents (encoder->web_dir, 0755) < 0 ||
+		    !g_file_set_contents (web_filename, g_bytes_get_data (jpeg, NULL), g_bytes_get_size (jpeg), &error))
+		{
+			GST_WARNING ("can't save web variant '%s': %s", web_filename, error ? error->message : g_strerror (errno));
+			g_clear_error (&error);
+			g_clear_pointer (&jpeg, g_bytes_unref);
+			g_clear_pointer (&web_filename, g_free);
+		}
+		else
+			GST_INFO ("web variant of photo %u: %ix%i, %" G_GSIZE_FORMAT " bytes, encoded in %" G_GINT64_FORMAT " ms, ready %" G_GINT64_FORMAT " ms after capture",
+				job->number, GST_VIDEO_INFO_WIDTH (&info), GST_VIDEO_INFO_HEIGHT (&info), g_bytes_get_size (jpeg),
+				(g_get_monotonic_time () - start_time) / 1000, (g_get_monotonic_time () - job->push_time) / 1000);
+	}
+
+	g_mutex_lock (&encoder->mutex);
+	if (encoder->jpeg)
+		g_bytes_unref (encoder->jpeg);
+	g_free (encoder->web_filename);
+	encoder->jpeg = jpeg;
+	encoder->web_filename = web_filename;
+	encoder->number = job->number;
+	g_mutex_unlock (&encoder->mutex);
+
+	gst_sample_unref (job->sample);
+	g_free (job->filename);
+	g_slice_free (PhotoBoothWebJob, job);
+}
+
+PhotoBoothWebEncoder *photo_booth_web_encoder_new (const gchar *save_dir, gint quality, gboolean progressive)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothWebEncoder *encoder;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_web_debug, "photoboothweb", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_MAGENTA, "PhotoBoothWeb");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	encoder = g_new0 (PhotoBoothWebEncoder, 1);
+	encoder->web_dir = g_build_filename (save_dir, WEB_VARIANT_DIRNAME, NULL);
+	encoder->quality = CLAMP (quality, 1, 100);
+	encoder->progressive = progressive;
+	g_mutex_init (&encoder->mutex);
+	encoder->pool = g_thread_pool_new ((GFunc) _web_job_func, encoder, 1, FALSE, NULL);
+	return encoder;
+}
+
+void photo_booth_web_encoder_free (PhotoBoothWebEncoder *encoder)
+{
+	g_thread_pool_free (encoder->pool, FALSE, TRUE);
+	if (encoder->jpeg)
+		g_bytes_unref (encoder->jpeg);
+	g_free (encoder->web_filename);
+	g_mutex_clear (&encoder->mutex);
+	g_free (encoder->web_dir);
+	g_free (encoder);
+}
+
+/* the variant's dimensions for a width x height photo, aspect kept and
+ * never upscaled. max_edge 0 keeps the full size */
+void photo_booth_web_encoder_get_size (gint max_edge, gint width, gint height, gint *web_width, gint *web_height)
+{
+	gdouble scale = 1.0;
+
+	if (max_edge > 0 && MAX (width, height) > max_edge)
+		scale = (gdouble) max_edge / MAX (width, height);
+	*web_width = MAX ((gint) (width * scale + 0.5), 1);
+	*web_height = MAX ((gint) (height * scale + 0.5), 1);
+}
+
+/* sample must be RGB at the variant's size, it is encoded asynchronously */
+void photo_booth_web_encoder_push (PhotoBoothWebEncoder *encoder, GstSample *sample, const gchar *filename, guint number)
+{
+	PhotoBoothWebJob *job = g_slice_new0 (PhotoBoothWebJob);
+
+	job->sample = gst_sample_ref (sample);
+	job->filename = g_strdup (filename);
+	job->number = number;
+	job->push_time = g_get_monotonic_time ();
+	g_thread_pool_push (encoder->pool, job, NULL);
+}
+
+/* calls func with photo number's variant and its file once an encode in
+ * progress is done, without blocking. without a variant the caller
+ * uploads the archival photo */
+void photo_booth_web_encoder_get_async (PhotoBoothWebEncoder *encoder, guint number, PhotoBoothWebReadyFunc func, gpointer user_data)
+{
+	PhotoBoothWebJob *job = g_slice_new0 (PhotoBoothWebJob);
+
+	job->number = number;
+	job->push_time = g_get_monotonic_time ();
+	job->ready_func = func;
+	job->ready_data = user_data;
+	g_thread_pool_push (encoder->pool, job, NULL);
+}
+
+/* deletes the variant of the photo saved as filename once nothing is
+ * going to upload it anymore */
+void photo_booth_web_encoder_remove (PhotoBoothWebEncoder *encoder, const gchar *filename)
+{
+	gchar *basename = g_path_get_basename (filename);
+	gchar *web_filename = g_build_filename (encoder->web_dir, basename, NULL);
+
+	if (g_unlink (web_filename) < 0 && errno != ENOENT)
+		GST_WARNING ("can't remove web variant '%s': %s", web_filename, g_strerror (errno));
+	else
+		GST_DEBUG ("removed web variant '%s'", web_filename);
+	g_free (web_filename);
+	g_free (basename);
+}
@@ -0,0 +1,40 @@
+/*
+ * GStreamer photoboothweb.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_WEB_H__
+#define __PHOTO_BOOTH_WEB_H__
+
+#include <glib.h>
+#include <gst/gst.h>
+
+#define WEB_VARIANT_DIRNAME    ".web"
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothWebEncoder PhotoBoothWebEncoder;
+
+/* on the main thread, jpeg and web_filename are NULL if there's no variant */
+typedef void (*PhotoBoothWebReadyFunc) (GBytes *jpeg, const gchar *web_filename, gpointer user_data);
+
+PhotoBoothWebEncoder   *photo_booth_web_encoder_new     (const gchar *save_dir, gint quality, gboolean progressive);
+void                    photo_booth_web_encoder_free    (PhotoBoothWebEncoder *encoder);
+void                    photo_booth_web_encoder_get_size (gint max_edge, gint width, gint height, gint *web_width, gint *web_height);
+void                    photo_booth_web_encoder_push    (PhotoBoothWebEncoder *encoder, GstSample *sample, const gchar *filename, guint number);
+void                    photo_booth_web_encoder_get_async (PhotoBoothWebEncoder *encoder, guint number, PhotoBoothWebReadyFunc func, gpointer user_data);
+void                    photo_booth_web_encoder_remove  (PhotoBoothWebEncoder *encoder, const gchar *filename);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_WEB_H__ */
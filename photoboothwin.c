@@ -18,6 +18,7 @@
 #include <glib/gstdio.h>
 #include "photobooth.h"
 #include "photoboothwin.h"
+#include "photoboothgallery.h"
 
 typedef struct _PhotoBoothWindowPrivate PhotoBoothWindowPrivate;
 
@@ -25,6 +26,7 @@ struct _PhotoBoothWindowPrivate
 {
 	GtkWidget *overlay;
 	GtkWidget *spinner, *statusbar;
+	GtkWidget *gallery_scroll;
 	GtkLabel *countdown_label;
 	GtkScale *copies;
 	gint countdown;
@@ -42,6 +44,7 @@ static void photo_booth_window_class_init (PhotoBoothWindowClass *klass)
 {
 	GST_DEBUG_CATEGORY_INIT (photo_booth_windows_debug, "photoboothwin", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_BLUE, "PhotoBoothWindow");
 	GError *error = NULL;
+	g_type_ensure (PHOTO_BOOTH_GALLERY_TYPE);
 	if (G_template_filename)
 	{
 		GST_DEBUG ("open template from file '%s'", G_template_filename);
@@ -64,13 +67,17 @@ static void photo_booth_window_class_init (PhotoBoothWindowClass *klass)
 	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, spinner);
 	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, countdown_label);
 	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, copies);
+	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, gallery_scroll);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, image);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, button_cancel);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, button_print);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, button_upload);
+	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, button_gallery);
+	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, gallery);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, switch_flip);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, status_clock);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, status);
+	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, status_upload);
 	gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (klass), PhotoBoothWindow, status_printer);
 }
 
@@ -98,6 +105,7 @@ static void photo_booth_window_init (PhotoBoothWindow *win)
 	gtk_button_set_label (win->button_cancel, _("Cancel"));
 	gtk_button_set_label (win->button_print, _("Print photo"));
 	gtk_button_set_label (win->button_upload, _("Upload photo"));
+	gtk_button_set_label (win->button_gallery, _("Gallery"));
 	g_timeout_add (1000, (GSourceFunc) _pbw_clock_tick, win->status_clock);
 }
 
@@ -229,6 +237,32 @@ gint photo_booth_window_get_copies_hide (PhotoBoothWindow *win)
 	return copies;
 }
 
+void photo_booth_window_show_gallery (PhotoBoothWindow *win, gboolean show)
+{
+	PhotoBoothWindowPrivate *priv;
+	priv = photo_booth_window_get_instance_private (win);
+	GST_DEBUG ("photo_booth_window_show_gallery %i", show);
+	if (show)
+	{
+		gtk_widget_show (priv->gallery_scroll);
+		gtk_widget_hide (GTK_WIDGET (win->switch_flip));
+		gtk_button_set_label (win->button_gallery, _("Back"));
+	}
+	else
+	{
+		gtk_widget_hide (priv->gallery_scroll);
+		gtk_widget_show (GTK_WIDGET (win->switch_flip));
+		gtk_button_set_label (win->button_gallery, _("Gallery"));
+	}
+}
+
+gboolean photo_booth_window_get_gallery_shown (PhotoBoothWindow *win)
+{
+	PhotoBoothWindowPrivate *priv;
+	priv = photo_booth_window_get_instance_private (win);
+	return gtk_widget_get_visible (priv->gallery_scroll);
+}
+
 gchar* photo_booth_window_format_copies_value (GtkScale *scale, gdouble value, gpointer user_data)
 {
 	int intval = (int) value;
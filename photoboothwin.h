@@ -35,9 +35,10 @@ struct _PhotoBoothWindow
 	GtkApplicationWindow parent;
 	GtkWidget *gtkgstwidget;
 	GtkImage *image;
-	GtkButton *button_cancel, *button_print, *button_upload;
+	GtkButton *button_cancel, *button_print, *button_upload, *button_gallery;
 	GtkSwitch *switch_flip;
-	GtkLabel *status_clock, *status, *status_printer;
+	GtkLabel *status_clock, *status, *status_upload, *status_printer;
+	GtkWidget *gallery;
 };
 
 struct _PhotoBoothWindowClass
@@ -54,6 +55,8 @@ void                    photo_booth_window_hide_cursor      (PhotoBoothWindow *w
 void                    photo_booth_window_show_cursor      (PhotoBoothWindow *win);
 void                    photo_booth_window_set_copies_show  (PhotoBoothWindow *win, gint min, gint max, gint def);
 gint                    photo_booth_window_get_copies_hide  (PhotoBoothWindow *win);
+void                    photo_booth_window_show_gallery     (PhotoBoothWindow *win, gboolean show);
+gboolean                photo_booth_window_get_gallery_shown (PhotoBoothWindow *win);
 
 G_END_DECLS
 
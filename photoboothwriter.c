@@ -0,0 +1,327 @@
+/*
+ * photoboothwriter.c
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "photobooth.h"
+#include "photoboothwriter.h"
+#include "photoboothtrace.h"
+
+GST_DEBUG_CATEGORY_STATIC (photo_booth_writer_debug);
+#define GST_CAT_DEFAULT photo_booth_writer_debug
+
+typedef struct
+{
+	GstBuffer *buffer;
+	gchar     *filename;
+	gchar     *tmpname;
+	guint      number;
+	gint       fd;
+	gint64     push_time;
+} PhotoBoothWriterJob;
+
+/* saves encoded photos on its own thread. jobs are written to a temp file
+ * next to their destination, a batch of them is fsync'ed together and
+ * only then renamed into place, so a published file is always complete.
+ * push never blocks, it's called from a streaming thread the main thread
+ * may be waiting for. with max_queue jobs waiting, new ones are refused. */
+struct _PhotoBoothWriter
+{
+	GThread   *thread;
+	GMutex     mutex;
+	GCond      cond;
+	GQueue     queue;
+	guint      max_queue, fsync_batch;
+	guint      in_flight;
+	gboolean   quit;
+	PhotoBoothWriterStats stats;
+	gint64     total_latency;
+	PhotoBoothWriterPublishedFunc published_func;
+	gpointer   published_data;
+};
+
+static void _writer_job_free (PhotoBoothWriterJob *job)
+{
+	gst_buffer_unref (job->buffer);
+	g_free (job->filename);
+	g_free (job->tmpname);
+	g_slice_free (PhotoBoothWriterJob, job);
+}
+
+static gboolean _writer_write_temp (PhotoBoothWriterJob *job)
+{
+	GstMapInfo map;
+	const guint8 *p;
+	gsize len;
+
+	job->tmpname = g_strdup_printf ("%s.tmp", job->filename);
+	job->fd = g_open (job->tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (job->fd < 0)
+	{
+		GST_ERROR ("can't create '%s': %s", job->tmpname, g_strerror (errno));
+		return FALSE;
+	}
+
+	gst_buffer_map (job->buffer, &map, GST_MAP_READ);
+	p = map.data;
+	len = map.size;
+	while (len)
+	{
+		gssize written = write (job->fd, p, len);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			GST_ERROR ("writing '%s' failed: %s", job->tmpname, g_strerror (errno));
+			break;
+		}
+		p += written;
+		len -= written;
+	}
+	gst_buffer_unmap (job->buffer, &map);
+
+	if (len)
+	{
+		close (job->fd);
+		g_unlink (job->tmpname);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void _writer_fsync_dir (const gchar *filename)
+{
+	gchar *dirname = g_path_get_dirname (filename);
+	gint fd = g_open (dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (fd >= 0)
+	{
+		fsync (fd);
+		close (fd);
+	}
+	g_free (dirname);
+}
+
+/* fsyncs all temp files of the batch, renames them into place and
+ * makes the renames durable with one directory fsync per directory */
+static void _writer_publish_batch (PhotoBoothWriter *writer, GPtrArray *batch)
+{
+	gint64 sync_start = g_get_monotonic_time (), now;
+	guint64 trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+	gchar *last_dir = NULL;
+	guint i, published = 0;
+
+	for (i = 0; i < batch->len; i++)
+	{
+		PhotoBoothWriterJob *job = g_ptr_array_index (batch, i);
+		if (fdatasync (job->fd) < 0)
+			GST_WARNING ("fdatasync '%s' failed: %s", job->tmpname, g_strerror (errno));
+		close (job->fd);
+		job->fd = -1;
+		if (g_rename (job->tmpname, job->filename) < 0)
+		{
+			GST_ERROR ("can't publish '%s': %s", job->filename, g_strerror (errno));
+			g_unlink (job->tmpname);
+			g_free (job->filename);
+			job->filename = NULL;
+		}
+	}
+
+	for (i = 0; i < batch->len; i++)
+	{
+		PhotoBoothWriterJob *job = g_ptr_array_index (batch, i);
+		gchar *dir;
+		if (!job->filename)
+			continue;
+		dir = g_path_get_dirname (job->filename);
+		if (g_strcmp0 (dir, last_dir))
+			_writer_fsync_dir (job->filename);
+		g_free (last_dir);
+		last_dir = dir;
+	}
+	g_free (last_dir);
+
+	now = g_get_monotonic_time ();
+	g_mutex_lock (&writer->mutex);
+	for (i = 0; i < batch->len; i++)
+	{
+		PhotoBoothWriterJob *job = g_ptr_array_index (batch, i);
+		if (job->filename)
+		{
+			gint64 latency = now - job->push_time;
+			writer->stats.written++;
+			writer->stats.last_latency = latency;
+			writer->stats.max_latency = MAX (writer->stats.max_latency, latency);
+			writer->total_latency += latency;
+			writer->stats.avg_latency = writer->total_latency / writer->stats.written;
+			published++;
+			GST_INFO ("published '%s' after %" G_GINT64_FORMAT " ms", job->filename, latency / 1000);
+		}
+		else
+			writer->stats.failed++;
+	}
+	writer->in_flight -= batch->len;
+	g_cond_broadcast (&writer->cond);
+	g_mutex_unlock (&writer->mutex);
+
+	GST_DEBUG ("synced batch of %u files (%u published) in %" G_GINT64_FORMAT " ms", batch->len, published, (now - sync_start) / 1000);
+	PHOTO_BOOTH_TRACE_END (trace_start, "fsync", 0);
+
+	for (i = 0; writer->published_func && i < batch->len; i++)
+	{
+		PhotoBoothWriterJob *job = g_ptr_array_index (batch, i);
+		if (job->filename)
+			writer->published_func (job->filename, job->number, writer->published_data);
+	}
+	g_ptr_array_set_size (batch, 0);
+}
+
+static gpointer _writer_thread_func (PhotoBoothWriter *writer)
+{
+	GPtrArray *batch = g_ptr_array_new_with_free_func ((GDestroyNotify) _writer_job_free);
+	PhotoBoothWriterJob *job;
+	guint64 trace_start;
+	gboolean written;
+
+	g_mutex_lock (&writer->mutex);
+	while (TRUE)
+	{
+		while (!writer->queue.length && !writer->quit)
+			g_cond_wait (&writer->cond, &writer->mutex);
+		if (!writer->queue.length)
+			break;
+		job = g_queue_pop_head (&writer->queue);
+		writer->stats.queue_depth = writer->queue.length;
+		g_cond_broadcast (&writer->cond);
+		g_mutex_unlock (&writer->mutex);
+
+		trace_start = PHOTO_BOOTH_TRACE_BEGIN ();
+		written = _writer_write_temp (job);
+		PHOTO_BOOTH_TRACE_END (trace_start, "save", job->number);
+		if (written)
+			g_ptr_array_add (batch, job);
+		else
+		{
+			_writer_job_free (job);
+			g_mutex_lock (&writer->mutex);
+			writer->stats.failed++;
+			writer->in_flight--;
+			g_cond_broadcast (&writer->cond);
+			g_mutex_unlock (&writer->mutex);
+		}
+
+		/* sync when the batch is full or nothing else is waiting */
+		g_mutex_lock (&writer->mutex);
+		if (batch->len && (batch->len >= writer->fsync_batch || !writer->queue.length))
+		{
+			g_mutex_unlock (&writer->mutex);
+			_writer_publish_batch (writer, batch);
+			g_mutex_lock (&writer->mutex);
+		}
+	}
+	g_mutex_unlock (&writer->mutex);
+	g_ptr_array_unref (batch);
+	return NULL;
+}
+
+PhotoBoothWriter *photo_booth_writer_new (guint max_queue, guint fsync_batch)
+{
+	static volatile gsize debug_initialized = 0;
+	PhotoBoothWriter *writer;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (photo_booth_writer_debug, "photoboothwriter", GST_DEBUG_BOLD | GST_DEBUG_FG_WHITE | GST_DEBUG_BG_MAGENTA, "PhotoBoothWriter");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	writer = g_new0 (PhotoBoothWriter, 1);
+	writer->max_queue = MAX (max_queue, 1);
+	writer->fsync_batch = MAX (fsync_batch, 1);
+	g_mutex_init (&writer->mutex);
+	g_cond_init (&writer->cond);
+	g_queue_init (&writer->queue);
+	writer->thread = g_thread_new ("photo-writer", (GThreadFunc) _writer_thread_func, writer);
+	return writer;
+}
+
+/* writes out everything still queued before returning */
+void photo_booth_writer_free (PhotoBoothWriter *writer)
+{
+	g_mutex_lock (&writer->mutex);
+	writer->quit = TRUE;
+	g_cond_broadcast (&writer->cond);
+	g_mutex_unlock (&writer->mutex);
+	g_thread_join (writer->thread);
+	g_mutex_clear (&writer->mutex);
+	g_cond_clear (&writer->cond);
+	g_free (writer);
+}
+
+void photo_booth_writer_set_published_func (PhotoBoothWriter *writer, PhotoBoothWriterPublishedFunc func, gpointer user_data)
+{
+	g_mutex_lock (&writer->mutex);
+	writer->published_func = func;
+	writer->published_data = user_data;
+	g_mutex_unlock (&writer->mutex);
+}
+
+gboolean photo_booth_writer_push (PhotoBoothWriter *writer, GstBuffer *buffer, const gchar *filename, guint number, GError **error)
+{
+	PhotoBoothWriterJob *job;
+	guint depth;
+
+	g_mutex_lock (&writer->mutex);
+	if (writer->queue.length >= writer->max_queue)
+	{
+		writer->stats.refused++;
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY, "writer is falling behind, %u jobs already waiting, refused '%s'", writer->queue.length, filename);
+		g_mutex_unlock (&writer->mutex);
+		return FALSE;
+	}
+	job = g_slice_new0 (PhotoBoothWriterJob);
+	job->buffer = gst_buffer_ref (buffer);
+	job->filename = g_strdup (filename);
+	job->number = number;
+	job->fd = -1;
+	job->push_time = g_get_monotonic_time ();
+	g_queue_push_tail (&writer->queue, job);
+	writer->in_flight++;
+	writer->stats.queue_depth = writer->queue.length;
+	writer->stats.max_queue_depth = MAX (writer->stats.max_queue_depth, writer->stats.queue_depth);
+	depth = writer->stats.queue_depth;
+	g_cond_broadcast (&writer->cond);
+	g_mutex_unlock (&writer->mutex);
+
+	GST_DEBUG ("queued %" G_GSIZE_FORMAT " bytes for '%s', queue depth %u", gst_buffer_get_size (buffer), filename, depth);
+	return TRUE;
+}
+
+/* blocks until everything pushed so far is published (or failed) */
+void photo_booth_writer_flush (PhotoBoothWriter *writer)
+{
+	g_mutex_lock (&writer->mutex);
+	while (writer->in_flight)
+		g_cond_wait (&writer->cond, &writer->mutex);
+	g_mutex_unlock (&writer->mutex);
+}
+
+void photo_booth_writer_get_stats (PhotoBoothWriter *writer, PhotoBoothWriterStats *stats)
+{
+	g_mutex_lock (&writer->mutex);
+	*stats = writer->stats;
+	g_mutex_unlock (&writer->mutex);
+}
@@ -0,0 +1,46 @@
+/*
+ * GStreamer photoboothwriter.h
+ * Copyright 2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __PHOTO_BOOTH_WRITER_H__
+#define __PHOTO_BOOTH_WRITER_H__
+
+#include <glib.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PhotoBoothWriter           PhotoBoothWriter;
+typedef struct _PhotoBoothWriterStats      PhotoBoothWriterStats;
+
+/* called on the writer thread once a photo is durably in place */
+typedef void (*PhotoBoothWriterPublishedFunc) (const gchar *filename, guint number, gpointer user_data);
+
+struct _PhotoBoothWriterStats
+{
+	guint      written, failed, refused;
+	guint      queue_depth, max_queue_depth;
+	gint64     last_latency, max_latency, avg_latency;  /* push to publish, in us */
+};
+
+PhotoBoothWriter   *photo_booth_writer_new          (guint max_queue, guint fsync_batch);
+void                photo_booth_writer_free         (PhotoBoothWriter *writer);
+void                photo_booth_writer_set_published_func (PhotoBoothWriter *writer, PhotoBoothWriterPublishedFunc func, gpointer user_data);
+gboolean            photo_booth_writer_push         (PhotoBoothWriter *writer, GstBuffer *buffer, const gchar *filename, guint number, GError **error);
+void                photo_booth_writer_flush        (PhotoBoothWriter *writer);
+void                photo_booth_writer_get_stats    (PhotoBoothWriter *writer, PhotoBoothWriterStats *stats);
+
+G_END_DECLS
+
+#endif /* __PHOTO_BOOTH_WRITER_H__ */
@@ -0,0 +1,48 @@
+#! /usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# local stand-in for the twitter bridge, prints every link the booth sends.
+# with --ack every line is answered (twitter_bridge_ack = 1 in the booth's
+# ini), --drop-every closes the connection after that many links to
+# exercise the booth's reconnect and resend:
+#   ./bridge-stand-in.py --port 8081 --ack --drop-every 3 --delay 0.5
+
+import argparse
+import socketserver
+import time
+
+args = None
+received = 0
+
+class BridgeHandler(socketserver.StreamRequestHandler):
+  def handle(self):
+    global received
+    print("booth connected from %s:%d" % self.client_address)
+    lines = 0
+    for line in self.rfile:
+      link = line.decode(errors="replace").strip()
+      received += 1
+      lines += 1
+      print("%d: %s" % (received, link))
+      if args.delay:
+        time.sleep(args.delay)
+      if args.drop_every and lines % args.drop_every == 0:
+        print("dropping connection, %s unacknowledged" % link if args.ack else "dropping connection")
+        return
+      if args.ack:
+        self.wfile.write(b"ok\n")
+    print("booth disconnected")
+
+class Server(socketserver.ThreadingTCPServer):
+  allow_reuse_address = True
+  daemon_threads = True
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="photobooth twitter bridge stand-in")
+  parser.add_argument("--port", type=int, default=8081)
+  parser.add_argument("--ack", action="store_true", help="answer every line")
+  parser.add_argument("--delay", type=float, default=0, help="seconds before answering")
+  parser.add_argument("--drop-every", type=int, default=0, help="close the connection after every n lines")
+  args = parser.parse_args()
+  print("listening on port %d" % args.port)
+  Server(("", args.port), BridgeHandler).serve_forever()
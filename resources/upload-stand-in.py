@@ -0,0 +1,114 @@
+#! /usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# local stand-in for the upload servers, to exercise the booth's upload queue
+# without internet. multipart POSTs are answered like imgur (and serve the
+# webhook backend), PUTs like an S3 bucket, checking they're SigV4 signed.
+# requests can fail, stall or be slowed down, and are served concurrently:
+#   ./upload-stand-in.py --fail-rate 0.5 --latency 2 --save-dir /tmp/uploads
+
+import argparse
+import json
+import os
+import random
+import threading
+import time
+from email.parser import BytesParser
+from email.policy import HTTP
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+args = None
+count = 0
+lock = threading.Lock()
+
+class UploadHandler(BaseHTTPRequestHandler):
+  protocol_version = "HTTP/1.1"
+
+  def reply(self, code, body):
+    data = json.dumps(body).encode()
+    self.send_response(code)
+    self.send_header("Content-Type", "application/json")
+    self.send_header("Content-Length", str(len(data)))
+    self.end_headers()
+    self.wfile.write(data)
+
+  def misbehave(self):
+    if args.latency:
+      time.sleep(random.uniform(args.latency / 2, args.latency * 1.5))
+    roll = random.random()
+    if roll < args.drop_rate:
+      self.log_message("dropping connection")
+      self.close_connection = True
+      self.connection.close()
+      return True
+    if roll < args.drop_rate + args.stall_rate:
+      self.log_message("stalling for %d s", args.stall)
+      time.sleep(args.stall)
+      self.close_connection = True
+      return True
+    self.rfile_body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+    if roll < args.drop_rate + args.stall_rate + args.fail_rate:
+      self.reply(args.fail_status, {"success": False, "status": args.fail_status})
+      return True
+    return False
+
+  def received(self, image):
+    global count
+    with lock:
+      count += 1
+      number = count
+    if args.save_dir:
+      with open(os.path.join(args.save_dir, "upload_%04d.jpg" % number), "wb") as f:
+        f.write(image)
+    self.log_message("received photo %d, %d bytes", number, len(image))
+    return number
+
+  def do_POST(self):
+    if self.misbehave():
+      return
+    body = self.rfile_body
+    message = BytesParser(policy=HTTP).parsebytes(b"Content-Type: " + self.headers.get("Content-Type", "").encode() + b"\r\n\r\n" + body)
+    parts = {}
+    if message.is_multipart():
+      for part in message.iter_parts():
+        parts[part.get_param("name", header="content-disposition")] = part.get_payload(decode=True)
+    if not parts.get(args.field):
+      self.reply(400, {"success": False, "status": 400, "error": "no image"})
+      return
+    number = self.received(parts[args.field])
+    self.reply(200, {"success": True, "status": 200,
+                     "data": {"id": "%04d" % number, "link": "http://localhost:%d/%04d.jpg" % (args.port, number)}})
+
+  def do_PUT(self):
+    if self.misbehave():
+      return
+    # curl signs it, checking the signature itself would need the secret
+    if not self.headers.get("Authorization", "").startswith("AWS4-HMAC-SHA256 ") or \
+       self.headers.get("x-amz-content-sha256") != "UNSIGNED-PAYLOAD":
+      self.reply(403, {"error": "not signed"})
+      return
+    if not self.rfile_body:
+      self.reply(400, {"error": "empty object"})
+      return
+    self.received(self.rfile_body)
+    self.send_response(200)
+    self.send_header("ETag", '"%04d"' % count)
+    self.send_header("Content-Length", "0")
+    self.end_headers()
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="photobooth upload stand-in")
+  parser.add_argument("--port", type=int, default=8080)
+  parser.add_argument("--latency", type=float, default=0, help="average seconds before answering")
+  parser.add_argument("--fail-rate", type=float, default=0, help="share of requests answered with --fail-status")
+  parser.add_argument("--fail-status", type=int, default=503)
+  parser.add_argument("--drop-rate", type=float, default=0, help="share of connections closed without an answer")
+  parser.add_argument("--stall-rate", type=float, default=0, help="share of requests never answered for --stall seconds")
+  parser.add_argument("--stall", type=int, default=120)
+  parser.add_argument("--field", default="image", help="form field of posted photos")
+  parser.add_argument("--save-dir", help="keep received photos here")
+  args = parser.parse_args()
+  if args.save_dir and not os.path.isdir(args.save_dir):
+    os.makedirs(args.save_dir)
+  print("listening on port %d" % args.port)
+  ThreadingHTTPServer(("", args.port), UploadHandler).serve_forever()